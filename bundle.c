@@ -0,0 +1,231 @@
+/* bundle.c -- patch bundles
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/io/fcntl.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <string.h>
+#include "bundle.h"
+#include "error.h"
+#include "heap.h"
+#include "module.h"
+#include "patches.h"
+#include "taihen_internal.h"
+
+/**
+ * @brief      Reads a bundle file into a new memory block
+ *
+ * @param[in]  path    The file
+ * @param[out] p_blk   The memory block
+ * @param[out] p_buf   The contents
+ * @param[out] p_size  The size
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int bundle_read(const char *path, SceUID *p_blk, void **p_buf, size_t *p_size) {
+  SceUID fd;
+  SceOff len;
+  SceUID blk;
+  char *buf;
+  int rd, total;
+  int ret;
+
+  fd = sceIoOpenForDriver(path, SCE_O_RDONLY, 0);
+  if (fd < 0) {
+    LOG("failed to open bundle %s: %x", path, fd);
+    return fd;
+  }
+  len = sceIoLseekForDriver(fd, 0, SCE_SEEK_END);
+  if (len < (SceOff)sizeof(tai_bundle_header_t) || len > TAI_BUNDLE_MAX_SIZE) {
+    LOG("bad bundle size: %x", (int)len);
+    sceIoCloseForDriver(fd);
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  sceIoLseekForDriver(fd, 0, SCE_SEEK_SET);
+
+  blk = sceKernelAllocMemBlockForKernel("tai_bundle", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW, (len + 0xfff) & ~0xfff, NULL);
+  LOG("sceKernelAllocMemBlockForKernel(tai_bundle): 0x%08X", blk);
+  if (blk < 0) {
+    sceIoCloseForDriver(fd);
+    return blk;
+  }
+  ret = sceKernelGetMemBlockBaseForKernel(blk, (void **)&buf);
+  if (ret < 0) {
+    sceIoCloseForDriver(fd);
+    sceKernelFreeMemBlockForKernel(blk);
+    return ret;
+  }
+
+  // one sequential read, only short reads loop
+  total = 0;
+  while (total < len) {
+    rd = sceIoReadForDriver(fd, buf + total, len - total);
+    if (rd <= 0) {
+      LOG("failed to read bundle: rd %x, total %x, len %x", rd, total, (int)len);
+      ret = (rd < 0) ? rd : TAI_ERROR_SYSTEM;
+      break;
+    }
+    total += rd;
+  }
+  sceIoCloseForDriver(fd);
+  if (ret < 0) {
+    sceKernelFreeMemBlockForKernel(blk);
+    return ret;
+  }
+  *p_blk = blk;
+  *p_buf = buf;
+  *p_size = len;
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Resolves a location to an address
+ *
+ * @param[in]  pid      The process
+ * @param[in]  modules  The module table
+ * @param[in]  modids   The loaded module for each table entry
+ * @param[in]  loc      The location
+ * @param[out] addr     The address
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int bundle_resolve(SceUID pid, const tai_bundle_module_t *modules, const SceUID *modids, const tai_bundle_loc_t *loc, uintptr_t *addr) {
+  const char *name = modules[loc->module].name;
+  int ret;
+
+  switch (loc->kind) {
+    case TAI_BUNDLE_LOC_EXPORT:
+      ret = module_get_export_func(pid, name, loc->a, loc->b, addr);
+      break;
+    case TAI_BUNDLE_LOC_IMPORT:
+      ret = module_get_import_func(pid, name, loc->a, loc->b, addr);
+      break;
+    default:
+      ret = module_get_offset(pid, modids[loc->module], loc->a, loc->b, addr);
+      if (ret >= 0 && (loc->flags & TAI_BUNDLE_LOC_THUMB)) {
+        *addr |= 1;
+      }
+      break;
+  }
+  if (ret < 0) {
+    LOG("failed to resolve %s kind %d %x:%x: %x", name, loc->kind, loc->a, loc->b, ret);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Applies a bundle file
+ *
+ *             Every module in the bundle must be loaded, with a matching NID
+ *             unless the bundle uses `TAI_BUNDLE_ANY_NID`. Injection data is
+ *             copied into place so the file contents are not kept.
+ *
+ * @param[in]     pid      The process to patch
+ * @param[in]     path     The bundle file
+ * @param[out]    p_hooks  A reference for each hook, in bundle order
+ * @param[in,out] count    In: capacity of `p_hooks`. Out: number of hooks.
+ *
+ * @return     A group reference on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if the bundle is malformed
+ *             - TAI_ERROR_NOT_FOUND if a module or NID is not found
+ *             - TAI_ERROR_MEMORY if the bundle has more hooks than `*count`
+ *             - TAI_ERROR_PATCH_EXISTS if an address is already patched
+ */
+SceUID bundle_apply(SceUID pid, const char *path, tai_hook_ref_t *p_hooks, size_t *count) {
+  const tai_bundle_header_t *hdr;
+  const tai_bundle_module_t *modules;
+  const tai_bundle_entry_t *entries;
+  tai_module_info_t info;
+  tai_batch_op_t *ops;
+  tai_hook_ref_t *refs;
+  SceUID *modids;
+  const char *why;
+  uintptr_t addr;
+  size_t size, hooks;
+  SceUID blk;
+  void *buf;
+  int ret;
+
+  ret = bundle_read(path, &blk, &buf, &size);
+  if (ret < 0) {
+    return ret;
+  }
+  hdr = (const tai_bundle_header_t *)buf;
+  ops = NULL;
+  refs = NULL;
+  modids = NULL;
+  if ((why = bundle_check(buf, size)) != NULL) {
+    LOG("invalid bundle %s: %s", path, why);
+    ret = TAI_ERROR_INVALID_ARGS;
+    goto end;
+  }
+  modules = bundle_modules(hdr);
+  entries = bundle_entries(hdr);
+  hooks = 0;
+  for (uint32_t i = 0; i < hdr->num_entries; i++) {
+    hooks += (entries[i].op == TAI_BUNDLE_HOOK);
+  }
+  if (hooks > *count) {
+    LOG("bundle has %d hooks, room for %d", hooks, *count);
+    ret = TAI_ERROR_MEMORY;
+    goto end;
+  }
+
+  modids = heap_alloc(TAI_HEAP_METADATA, hdr->num_modules * sizeof(SceUID));
+  ops = heap_alloc(TAI_HEAP_METADATA, hdr->num_entries * sizeof(tai_batch_op_t));
+  refs = heap_alloc(TAI_HEAP_METADATA, hdr->num_entries * sizeof(tai_hook_ref_t));
+  if (modids == NULL || ops == NULL || refs == NULL) {
+    ret = TAI_ERROR_MEMORY;
+    goto end;
+  }
+
+  // resolve everything before patching anything
+  for (int i = 0; i < hdr->num_modules; i++) {
+    info.size = sizeof(info);
+    ret = module_get_by_name_nid(pid, modules[i].name, modules[i].nid == TAI_BUNDLE_ANY_NID ? TAI_ANY_LIBRARY : modules[i].nid, &info);
+    if (ret < 0) {
+      LOG("bundle module %s (nid %x) not loaded: %x", modules[i].name, modules[i].nid, ret);
+      goto end;
+    }
+    modids[i] = info.modid;
+  }
+  for (uint32_t i = 0; i < hdr->num_entries; i++) {
+    if ((ret = bundle_resolve(pid, modules, modids, &entries[i].target, &addr)) < 0) {
+      goto end;
+    }
+    ops[i].dest = (void *)addr;
+    if (entries[i].op == TAI_BUNDLE_HOOK) {
+      if ((ret = bundle_resolve(pid, modules, modids, &entries[i].hook, &addr)) < 0) {
+        goto end;
+      }
+      ops[i].src = (const void *)addr;
+      ops[i].size = 0;
+    } else {
+      ops[i].src = bundle_data(hdr) + entries[i].data_offset;
+      ops[i].size = entries[i].data_size;
+    }
+  }
+
+  ret = tai_patch_batch(pid, ops, hdr->num_entries, refs);
+  LOG("applied bundle %s: %x", path, ret);
+  if (ret >= 0) {
+    hooks = 0;
+    for (uint32_t i = 0; i < hdr->num_entries; i++) {
+      if (entries[i].op == TAI_BUNDLE_HOOK) {
+        p_hooks[hooks++] = refs[i];
+      }
+    }
+    *count = hooks;
+  }
+
+end:
+  heap_free(TAI_HEAP_METADATA, refs);
+  heap_free(TAI_HEAP_METADATA, ops);
+  heap_free(TAI_HEAP_METADATA, modids);
+  sceKernelFreeMemBlockForKernel(blk);
+  return ret;
+}
@@ -0,0 +1,25 @@
+/**
+ * @brief      Patch bundles
+ */
+#ifndef TAI_BUNDLE_HEADER
+#define TAI_BUNDLE_HEADER
+
+#include "taihen_internal.h"
+#include "bundle_format.h"
+
+/**
+ * @defgroup   bundle Patch Bundles
+ * @brief      Applies a bundle file as one transaction
+ *
+ * @details    The file is read with one sequential read, checked, and every
+ *             location is resolved before anything is patched. The patches are
+ *             then inserted under one hold of the hooks lock and owned by a
+ *             group, so either the whole bundle is applied or none of it is.
+ */
+/** @{ */
+
+SceUID bundle_apply(SceUID pid, const char *path, tai_hook_ref_t *p_hooks, size_t *count);
+
+/** @} */
+
+#endif // TAI_BUNDLE_HEADER
@@ -0,0 +1,126 @@
+/* bundle_format.c -- patch bundle format checks
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "bundle_format.h"
+
+/**
+ * @brief      Hashes bundle contents (32-bit FNV-1a)
+ *
+ * @param[in]  buf   The data
+ * @param[in]  size  The size
+ *
+ * @return     The hash
+ */
+uint32_t bundle_hash(const void *buf, size_t size) {
+  const uint8_t *p = (const uint8_t *)buf;
+  uint32_t hash;
+
+  hash = 2166136261u;
+  while (size-- > 0) {
+    hash = (hash ^ *p++) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief      Checks a location
+ *
+ * @param[in]  hdr   The bundle
+ * @param[in]  loc   The location
+ *
+ * @return     NULL if valid, otherwise what is wrong
+ */
+static const char *bundle_check_loc(const tai_bundle_header_t *hdr, const tai_bundle_loc_t *loc) {
+  if (loc->module >= hdr->num_modules) {
+    return "module index out of range";
+  }
+  if (loc->kind < TAI_BUNDLE_LOC_EXPORT || loc->kind > TAI_BUNDLE_LOC_OFFSET) {
+    return "unknown location kind";
+  }
+  if ((loc->flags & ~TAI_BUNDLE_LOC_THUMB) != 0) {
+    return "unknown location flags";
+  }
+  if ((loc->flags & TAI_BUNDLE_LOC_THUMB) && loc->kind != TAI_BUNDLE_LOC_OFFSET) {
+    return "thumb flag on a NID location";
+  }
+  return NULL;
+}
+
+/**
+ * @brief      Checks that a bundle is well formed
+ *
+ *             Every table and data range must be inside `size`, which must be
+ *             exactly the size of the bundle. Nothing is resolved against
+ *             loaded modules.
+ *
+ * @param[in]  buf   The bundle, 4 byte aligned
+ * @param[in]  size  The size of the bundle
+ *
+ * @return     NULL if valid, otherwise what is wrong
+ */
+const char *bundle_check(const void *buf, size_t size) {
+  const tai_bundle_header_t *hdr = (const tai_bundle_header_t *)buf;
+  const tai_bundle_module_t *modules;
+  const tai_bundle_entry_t *entries;
+  const tai_bundle_entry_t *entry;
+  const char *why;
+  size_t expected;
+  size_t len;
+
+  if (size < sizeof(*hdr) || size > TAI_BUNDLE_MAX_SIZE) {
+    return "bad size";
+  }
+  if (hdr->magic != TAI_BUNDLE_MAGIC) {
+    return "bad magic";
+  }
+  if (hdr->version != TAI_BUNDLE_VERSION) {
+    return "unsupported version";
+  }
+  if (hdr->num_modules == 0 || hdr->num_entries == 0 || hdr->num_entries > TAI_BUNDLE_MAX_ENTRIES) {
+    return "bad table sizes";
+  }
+  expected = sizeof(*hdr) + hdr->num_modules * sizeof(tai_bundle_module_t) +
+             hdr->num_entries * sizeof(tai_bundle_entry_t);
+  if (hdr->data_size > TAI_BUNDLE_MAX_SIZE || expected + hdr->data_size != size) {
+    return "size does not match tables";
+  }
+  if (bundle_hash(hdr + 1, size - sizeof(*hdr)) != hdr->hash) {
+    return "bad hash";
+  }
+  modules = bundle_modules(hdr);
+  for (int i = 0; i < hdr->num_modules; i++) {
+    for (len = 0; len < sizeof(modules[i].name) && modules[i].name[len] != '\0'; len++);
+    if (len == 0 || len == sizeof(modules[i].name)) {
+      return "bad module name";
+    }
+  }
+  entries = bundle_entries(hdr);
+  for (uint32_t i = 0; i < hdr->num_entries; i++) {
+    entry = &entries[i];
+    if (entry->reserved != 0) {
+      return "reserved field set";
+    }
+    if ((why = bundle_check_loc(hdr, &entry->target)) != NULL) {
+      return why;
+    }
+    if (entry->op == TAI_BUNDLE_HOOK) {
+      if ((why = bundle_check_loc(hdr, &entry->hook)) != NULL) {
+        return why;
+      }
+    } else if (entry->op == TAI_BUNDLE_INJECT) {
+      if (entry->data_size == 0 || entry->data_offset > hdr->data_size ||
+          entry->data_size > hdr->data_size - entry->data_offset) {
+        return "injection data out of range";
+      }
+    } else {
+      return "unknown entry op";
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,136 @@
+/**
+ * @brief      Patch bundle file format
+ */
+#ifndef TAI_BUNDLE_FORMAT_HEADER
+#define TAI_BUNDLE_FORMAT_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup   bundle_format Patch Bundle Format
+ * @brief      Hooks and injections for many modules in one file
+ *
+ * @details    A bundle is a header followed by a table of modules, a table of
+ *             entries and the data injected by the entries, all packed with
+ *             no padding:
+ *
+ *             ```
+ *             tai_bundle_header_t
+ *             tai_bundle_module_t[num_modules]
+ *             tai_bundle_entry_t[num_entries]
+ *             uint8_t data[data_size]
+ *             ```
+ *
+ *             Every address is given relative to a module in the table, by
+ *             export NID, import NID or segment offset. All fields are little
+ *             endian. This header only depends on the C library so host tools
+ *             can build bundles.
+ */
+/** @{ */
+
+/** Identifies a bundle ("TAIB") */
+#define TAI_BUNDLE_MAGIC 0x42494154
+
+/** Bundle format version */
+#define TAI_BUNDLE_VERSION 1
+
+/** Largest bundle taiHEN will read */
+#define TAI_BUNDLE_MAX_SIZE 0x100000
+
+/** Most entries in a bundle */
+#define TAI_BUNDLE_MAX_ENTRIES 256
+
+/** Module NID that matches any version of the module */
+#define TAI_BUNDLE_ANY_NID 0
+
+/**
+ * @brief      What an entry does
+ */
+typedef enum {
+  TAI_BUNDLE_HOOK = 1,          ///< Hook `target` with the function at `hook`
+  TAI_BUNDLE_INJECT = 2         ///< Write data over `target`
+} tai_bundle_op_t;
+
+/**
+ * @brief      How a location is found in its module
+ */
+typedef enum {
+  TAI_BUNDLE_LOC_EXPORT = 1,    ///< `a` is the library NID, `b` the function NID
+  TAI_BUNDLE_LOC_IMPORT = 2,    ///< `a` is the imported library NID, `b` the function NID
+  TAI_BUNDLE_LOC_OFFSET = 3     ///< `a` is the segment index, `b` the offset in it
+} tai_bundle_loc_kind_t;
+
+/** Location flag: the function at an offset is Thumb code */
+#define TAI_BUNDLE_LOC_THUMB 0x1
+
+/**
+ * @brief      A location in a module
+ */
+typedef struct _tai_bundle_loc {
+  uint16_t module;              ///< Index in the module table
+  uint8_t kind;                 ///< A `tai_bundle_loc_kind_t`
+  uint8_t flags;                ///< `TAI_BUNDLE_LOC_*` flags
+  uint32_t a;                   ///< Depends on `kind`
+  uint32_t b;                   ///< Depends on `kind`
+} tai_bundle_loc_t;
+
+/**
+ * @brief      A module the entries refer to
+ */
+typedef struct _tai_bundle_module {
+  char name[28];                ///< Module name, NUL terminated
+  uint32_t nid;                 ///< Module NID or `TAI_BUNDLE_ANY_NID`
+} tai_bundle_module_t;
+
+/**
+ * @brief      A hook or injection
+ */
+typedef struct _tai_bundle_entry {
+  uint16_t op;                  ///< A `tai_bundle_op_t`
+  uint16_t reserved;            ///< Zero
+  tai_bundle_loc_t target;      ///< What to hook or inject
+  tai_bundle_loc_t hook;        ///< Hooks: the hook function
+  uint32_t data_offset;         ///< Injections: offset of the data in the data area
+  uint32_t data_size;           ///< Injections: size of the data
+} tai_bundle_entry_t;
+
+/**
+ * @brief      Start of a bundle
+ */
+typedef struct _tai_bundle_header {
+  uint32_t magic;               ///< `TAI_BUNDLE_MAGIC`
+  uint16_t version;             ///< `TAI_BUNDLE_VERSION`
+  uint16_t num_modules;         ///< Entries in the module table
+  uint32_t num_entries;         ///< Entries in the entry table
+  uint32_t data_size;           ///< Bytes of injection data
+  uint32_t hash;                ///< `bundle_hash` of everything after the header
+} tai_bundle_header_t;
+
+/**
+ * @brief      Gets the module table of a checked bundle
+ */
+static inline const tai_bundle_module_t *bundle_modules(const tai_bundle_header_t *hdr) {
+  return (const tai_bundle_module_t *)(hdr + 1);
+}
+
+/**
+ * @brief      Gets the entry table of a checked bundle
+ */
+static inline const tai_bundle_entry_t *bundle_entries(const tai_bundle_header_t *hdr) {
+  return (const tai_bundle_entry_t *)(bundle_modules(hdr) + hdr->num_modules);
+}
+
+/**
+ * @brief      Gets the data area of a checked bundle
+ */
+static inline const uint8_t *bundle_data(const tai_bundle_header_t *hdr) {
+  return (const uint8_t *)(bundle_entries(hdr) + hdr->num_entries);
+}
+
+uint32_t bundle_hash(const void *buf, size_t size);
+const char *bundle_check(const void *buf, size_t size);
+
+/** @} */
+
+#endif // TAI_BUNDLE_FORMAT_HEADER
@@ -0,0 +1,431 @@
+/* bypass.c -- per-thread hook bypass flags
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+#include "bypass.h"
+#include "error.h"
+#include "taihen_internal.h"
+
+/**
+ * @brief      The user page of a process
+ */
+typedef struct _bypass_process {
+  SceUID pid;                   ///< The process, zero if the entry is free
+  SceUID exe_res;               ///< Read only mapping in the process, < 0 if none
+  SceUID mirror_res;            ///< Kernel writable mirror, < 0 if none
+  bypass_page_t *page;          ///< Kernel writable page
+  uintptr_t user_addr;          ///< Address of the page in the process
+} bypass_process_t;
+
+/** Kernel flags */
+static bypass_page_t g_kernel_page;
+
+/** Process of each slot in `g_kernel_page` */
+static SceUID g_kernel_pids[BYPASS_SLOTS];
+
+/** User pages */
+static bypass_process_t g_processes[BYPASS_MAX_PROCESSES];
+
+/** Lock for `g_processes` */
+static SceUID g_bypass_lock;
+
+#if !defined(__arm__)
+/** Host builds of the tests keep the flag word addresses here */
+__thread const volatile uint32_t *tai_bypass_host_words[BYPASS_MAX];
+#endif
+
+/**
+ * @brief      Gets the address of the calling thread's flag word
+ *
+ * @param[in]  domain  Kernel or user flags
+ *
+ * @return     The address as seen by the domain, zero if there is none
+ */
+static uintptr_t bypass_get_word(bypass_domain_t domain) {
+#if defined(__arm__)
+  uintptr_t tls, word;
+
+  if (domain == BYPASS_KERNEL) {
+    __asm__ volatile ("mrc p15, 0, %0, c13, c0, 4" : "=r" (tls)); // TPIDRPRW
+    return *(uintptr_t *)(tls + TAI_BYPASS_TLS_OFFSET);
+  }
+  __asm__ volatile ("mrc p15, 0, %0, c13, c0, 3" : "=r" (tls)); // TPIDRURO
+  if (sceKernelMemcpyUserToKernel(&word, tls + TAI_BYPASS_TLS_OFFSET, sizeof(word)) < 0) {
+    return 0;
+  }
+  return word;
+#else
+  return (uintptr_t)tai_bypass_host_words[domain];
+#endif
+}
+
+/**
+ * @brief      Sets the address of the calling thread's flag word
+ *
+ * @param[in]  domain  Kernel or user flags
+ * @param[in]  word    The address as seen by the domain, zero for none
+ */
+static void bypass_set_word(bypass_domain_t domain, uintptr_t word) {
+#if defined(__arm__)
+  uintptr_t tls;
+
+  if (domain == BYPASS_KERNEL) {
+    __asm__ volatile ("mrc p15, 0, %0, c13, c0, 4" : "=r" (tls)); // TPIDRPRW
+    *(volatile uintptr_t *)(tls + TAI_BYPASS_TLS_OFFSET) = word;
+    return;
+  }
+  __asm__ volatile ("mrc p15, 0, %0, c13, c0, 3" : "=r" (tls)); // TPIDRURO
+  sceKernelMemcpyKernelToUser(tls + TAI_BYPASS_TLS_OFFSET, &word, sizeof(word));
+#else
+  tai_bypass_host_words[domain] = (const volatile uint32_t *)word;
+#endif
+}
+
+/**
+ * @brief      Finds the user page of a process
+ *
+ *             The caller must hold the bypass lock.
+ *
+ * @param[in]  pid   The process
+ *
+ * @return     The page or NULL if the process has none
+ */
+static bypass_process_t *bypass_find_process(SceUID pid) {
+  for (int i = 0; i < BYPASS_MAX_PROCESSES; i++) {
+    if (g_processes[i].pid == pid) {
+      return &g_processes[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief      Frees the user page of a process
+ *
+ *             The caller must hold the bypass lock.
+ *
+ * @param      proc  The process
+ */
+static void bypass_free_process(bypass_process_t *proc) {
+  if (proc->mirror_res >= 0) {
+    sceKernelFreeMemBlockForKernel(proc->mirror_res);
+  }
+  if (proc->exe_res >= 0) {
+    sceKernelFreeMemBlockForKernel(proc->exe_res);
+  }
+  memset(proc, 0, sizeof(*proc));
+}
+
+/**
+ * @brief      Gets the slot of the calling thread
+ *
+ * @param      page    The page
+ * @param[in]  base    Address of the page as seen by the domain
+ * @param[in]  domain  Kernel or user flags
+ * @param[in]  thid    The thread
+ *
+ * @return     The slot or < 0 if the thread has none
+ */
+static int bypass_find_slot(bypass_page_t *page, uintptr_t base, bypass_domain_t domain, SceUID thid) {
+  uintptr_t word;
+  int slot;
+
+  word = bypass_get_word(domain);
+  if (word < base || word >= base + sizeof(page->flags) || (word - base) % sizeof(uint32_t) != 0) {
+    return -1;
+  }
+  slot = (word - base) / sizeof(uint32_t);
+  if (__atomic_load_n(&page->owners[slot], __ATOMIC_ACQUIRE) != thid) {
+    return -1;
+  }
+  return slot;
+}
+
+/**
+ * @brief      Gives the calling thread a slot
+ *
+ *             Waits for a thread to leave its scope if every slot is taken,
+ *             so entering a scope never fails.
+ *
+ * @param      page    The page
+ * @param[in]  base    Address of the page as seen by the domain
+ * @param[in]  domain  Kernel or user flags
+ * @param[in]  thid    The thread
+ *
+ * @return     The slot
+ */
+static int bypass_claim_slot(bypass_page_t *page, uintptr_t base, bypass_domain_t domain, SceUID thid) {
+  SceUID free;
+
+  while (1) {
+    for (int i = 0; i < BYPASS_SLOTS; i++) {
+      free = 0;
+      if (__atomic_compare_exchange_n(&page->owners[i], &free, thid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (domain == BYPASS_KERNEL) {
+          g_kernel_pids[i] = sceKernelGetProcessId();
+        }
+        bypass_set_word(domain, base + i * sizeof(uint32_t));
+        return i;
+      }
+    }
+    LOG("no bypass slot free for thread %x, waiting", thid);
+    sceKernelDelayThreadForDriver(BYPASS_WAIT_US);
+  }
+}
+
+/**
+ * @brief      Gets the page for the calling thread
+ *
+ * @param[in]  domain  Kernel or user flags
+ * @param[out] base    Address of the page as seen by the domain
+ *
+ * @return     The kernel writable page or NULL if the process has no user page
+ */
+static bypass_page_t *bypass_get_page(bypass_domain_t domain, uintptr_t *base) {
+  bypass_process_t *proc;
+  bypass_page_t *page;
+
+  if (domain == BYPASS_KERNEL) {
+    *base = (uintptr_t)g_kernel_page.flags;
+    return &g_kernel_page;
+  }
+  // the page only goes away once every thread of the process has exited
+  sceKernelLockMutexForKernel(g_bypass_lock, 1, NULL);
+  proc = bypass_find_process(sceKernelGetProcessId());
+  if (proc != NULL) {
+    *base = proc->user_addr;
+    page = proc->page;
+  } else {
+    page = NULL;
+  }
+  sceKernelUnlockMutexForKernel(g_bypass_lock, 1);
+  return page;
+}
+
+/**
+ * @brief      Sets up the bypass flags
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int bypass_init(void) {
+  memset(&g_kernel_page, 0, sizeof(g_kernel_page));
+  memset(g_kernel_pids, 0, sizeof(g_kernel_pids));
+  memset(g_processes, 0, sizeof(g_processes));
+  g_bypass_lock = sceKernelCreateMutexForKernel("tai_bypass_lock", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_bypass_lock): 0x%08X", g_bypass_lock);
+  if (g_bypass_lock < 0) {
+    return g_bypass_lock;
+  }
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Frees the user pages
+ */
+void bypass_deinit(void) {
+  for (int i = 0; i < BYPASS_MAX_PROCESSES; i++) {
+    if (g_processes[i].pid != 0) {
+      bypass_free_process(&g_processes[i]);
+    }
+  }
+  sceKernelDeleteMutexForKernel(g_bypass_lock);
+  g_bypass_lock = 0;
+}
+
+/**
+ * @brief      Makes the user page of a process
+ *
+ *             Done when the first hook is added to the process. Until then
+ *             there is nothing for its threads to bypass.
+ *
+ * @param[in]  pid   The process
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_MEMORY if too many processes have a page
+ */
+int bypass_add_process(SceUID pid) {
+  SceKernelAllocMemBlockKernelOpt opt;
+  bypass_process_t *proc;
+  int ret;
+
+  if (pid == KERNEL_PID || pid == SHARED_PID) {
+    return TAI_SUCCESS;
+  }
+  sceKernelLockMutexForKernel(g_bypass_lock, 1, NULL);
+  if (bypass_find_process(pid) != NULL) {
+    ret = TAI_SUCCESS;
+    goto end;
+  }
+  proc = bypass_find_process(0);
+  if (proc == NULL) {
+    LOG("no bypass page left for pid %x", pid);
+    ret = TAI_ERROR_MEMORY;
+    goto end;
+  }
+
+  proc->pid = pid;
+  proc->exe_res = -1;
+  proc->mirror_res = -1;
+  memset(&opt, 0, sizeof(opt));
+  opt.size = sizeof(opt);
+  opt.attr = 0xA0000000 | 0x400000 | 0x80080;
+  opt.pid = pid;
+  ret = sceKernelAllocMemBlockForKernel("taibypass", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, sizeof(bypass_page_t), &opt);
+  LOG("sceKernelAllocMemBlockForKernel(taibypass): 0x%08X", ret);
+  if (ret < 0) {
+    goto err;
+  }
+  proc->exe_res = ret;
+  if ((ret = sceKernelGetMemBlockBaseForKernel(proc->exe_res, (void **)&proc->user_addr)) < 0) {
+    goto err;
+  }
+  if ((ret = sceKernelMapBlockUserVisible(proc->exe_res)) < 0) {
+    goto err;
+  }
+  memset(&opt, 0, sizeof(opt));
+  opt.size = sizeof(opt);
+  opt.attr = 0x1000040;
+  opt.mirror_blkid = proc->exe_res;
+  ret = sceKernelAllocMemBlockForKernel("taimirror", SCE_KERNEL_MEMBLOCK_TYPE_RW_UNK0, 0, &opt);
+  LOG("sceKernelAllocMemBlockForKernel(taimirror): 0x%08X", ret);
+  if (ret < 0) {
+    goto err;
+  }
+  proc->mirror_res = ret;
+  if ((ret = sceKernelGetMemBlockBaseForKernel(proc->mirror_res, (void **)&proc->page)) < 0) {
+    goto err;
+  }
+  memset(proc->page, 0, sizeof(bypass_page_t));
+  ret = TAI_SUCCESS;
+  goto end;
+
+err:
+  bypass_free_process(proc);
+end:
+  sceKernelUnlockMutexForKernel(g_bypass_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Sets flags for the calling thread
+ *
+ *             Never fails. A user thread of a process without hooks has
+ *             nothing to bypass and is left alone.
+ *
+ * @param[in]  domain  Kernel or user flags
+ * @param[in]  flags   The flags to set
+ *
+ * @return     The flags before, pass them to `bypass_exit`
+ */
+uint32_t bypass_enter(bypass_domain_t domain, uint32_t flags) {
+  bypass_page_t *page;
+  uintptr_t base;
+  uint32_t prev;
+  SceUID thid;
+  int slot;
+
+  page = bypass_get_page(domain, &base);
+  if (page == NULL) {
+    return 0;
+  }
+  thid = sceKernelGetThreadIdForDriver();
+  slot = bypass_find_slot(page, base, domain, thid);
+  if (slot < 0) {
+    slot = bypass_claim_slot(page, base, domain, thid);
+  }
+  prev = page->flags[slot];
+  __atomic_store_n(&page->flags[slot], prev | flags, __ATOMIC_RELEASE);
+  return prev;
+}
+
+/**
+ * @brief      Restores the flags of the calling thread
+ *
+ *             The thread gives its slot back once none of its flags are set.
+ *
+ * @param[in]  domain  Kernel or user flags
+ * @param[in]  prev    The flags from `bypass_enter`
+ */
+void bypass_exit(bypass_domain_t domain, uint32_t prev) {
+  bypass_page_t *page;
+  uintptr_t base;
+  int slot;
+
+  page = bypass_get_page(domain, &base);
+  if (page == NULL) {
+    return;
+  }
+  slot = bypass_find_slot(page, base, domain, sceKernelGetThreadIdForDriver());
+  if (slot < 0) {
+    return;
+  }
+  __atomic_store_n(&page->flags[slot], prev, __ATOMIC_RELEASE);
+  if (prev == 0) {
+    // forget the word before the slot can go to another thread
+    bypass_set_word(domain, 0);
+    if (domain == BYPASS_KERNEL) {
+      g_kernel_pids[slot] = 0;
+    }
+    __atomic_store_n(&page->owners[slot], 0, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief      Tests if any of the flags are set for the calling thread
+ *
+ *             The same check as `TAI_BYPASSED`.
+ *
+ * @param[in]  domain  Kernel or user flags
+ * @param[in]  flags   The flags
+ *
+ * @return     Nonzero if any are set
+ */
+int bypass_test(bypass_domain_t domain, uint32_t flags) {
+  const volatile uint32_t *word;
+
+  word = (const volatile uint32_t *)bypass_get_word(domain);
+  return word != NULL && (*word & flags) != 0;
+}
+
+/**
+ * @brief      Frees the bypass flags of an exiting process
+ *
+ *             Its user page goes away with it. Kernel slots of its threads
+ *             that were killed inside a scope are given back. A slot is only
+ *             freed if it still belongs to the dead thread, so slots that
+ *             live threads claim meanwhile are left alone.
+ *
+ * @param[in]  pid   The exiting process
+ */
+void bypass_cleanup_process(SceUID pid) {
+  bypass_process_t *proc;
+  SceUID thid;
+
+  if (pid == KERNEL_PID) {
+    return;
+  }
+  for (int i = 0; i < BYPASS_SLOTS; i++) {
+    thid = __atomic_load_n(&g_kernel_page.owners[i], __ATOMIC_ACQUIRE);
+    // a claimed slot has its process set after its owner, never a stale one
+    if (thid != 0 && g_kernel_pids[i] == pid) {
+      LOG("freeing kernel bypass slot of thread %x", thid);
+      g_kernel_pids[i] = 0;
+      g_kernel_page.flags[i] = 0;
+      __atomic_compare_exchange_n(&g_kernel_page.owners[i], &thid, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+  }
+  sceKernelLockMutexForKernel(g_bypass_lock, 1, NULL);
+  proc = bypass_find_process(pid);
+  if (proc != NULL) {
+    LOG("freeing bypass page of pid %x", pid);
+    bypass_free_process(proc);
+  }
+  sceKernelUnlockMutexForKernel(g_bypass_lock, 1);
+}
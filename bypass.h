@@ -0,0 +1,63 @@
+/**
+ * @brief      Per-thread hook bypass flags
+ */
+#ifndef TAI_BYPASS_HEADER
+#define TAI_BYPASS_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   bypass Hook Bypass
+ * @brief      Flags a hook sets while it calls functions it has hooked
+ *
+ * @details    Every thread inside a bypass scope owns a flag word in a page
+ *             taiHEN allocates. Kernel flags are in a kernel page. User flags
+ *             are in a page of the thread's process that the process can read
+ *             but not write, made along with the first hook in the process.
+ *             The thread's TLS holds the address of its word so that
+ *             `TAI_BYPASSED` is an inline load. Only entering and leaving a
+ *             scope write the word. A thread gives its slot back when it
+ *             leaves its outermost scope, and slots of threads killed inside
+ *             a scope are freed with their process.
+ */
+/** @{ */
+
+/** Number of threads a page has room for */
+#define BYPASS_SLOTS 512
+
+/** Most processes with a user page */
+#define BYPASS_MAX_PROCESSES 64
+
+/** How long entering waits before it looks for a free slot again in us */
+#define BYPASS_WAIT_US 100
+
+/**
+ * @brief      Who the flags are for
+ */
+typedef enum {
+  BYPASS_KERNEL = 0,            ///< Set by kernel hooks
+  BYPASS_USER,                  ///< Set by user hooks through syscalls
+  BYPASS_MAX
+} bypass_domain_t;
+
+/**
+ * @brief      A page of flag words
+ *
+ *             `flags` is what threads read. Fits one 4KiB page.
+ */
+typedef struct _bypass_page {
+  uint32_t flags[BYPASS_SLOTS]; ///< Flag word of each slot
+  SceUID owners[BYPASS_SLOTS];  ///< Thread of each slot, zero if free
+} bypass_page_t;
+
+int bypass_init(void);
+void bypass_deinit(void);
+int bypass_add_process(SceUID pid);
+uint32_t bypass_enter(bypass_domain_t domain, uint32_t flags);
+void bypass_exit(bypass_domain_t domain, uint32_t prev);
+int bypass_test(bypass_domain_t domain, uint32_t flags);
+void bypass_cleanup_process(SceUID pid);
+
+/** @} */
+
+#endif // TAI_BYPASS_HEADER
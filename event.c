@@ -0,0 +1,409 @@
+/* event.c -- module event bus
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/kernel/modulemgr.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+#include "error.h"
+#include "event.h"
+#include "taihen_internal.h"
+
+/** SceModulemgrForKernel library NID */
+#define NID_MODULEMGR_FOR_KERNEL        0xC445FA63
+
+/** `sceKernelLoadModuleForPid` */
+#define NID_LOAD_MODULE_FOR_PID         0xFA21D8CB
+
+/** `sceKernelLoadStartModuleForPid` */
+#define NID_LOAD_START_MODULE_FOR_PID   0x9D953C22
+
+/** `sceKernelUnloadModuleForPid` */
+#define NID_UNLOAD_MODULE_FOR_PID       0x5972E2CC
+
+/** `sceKernelStopUnloadModuleForPid` */
+#define NID_STOP_UNLOAD_MODULE_FOR_PID  0x414CC813
+
+/** Handle bits holding the slot, the rest hold the slot's generation */
+#define HANDLE_SLOT_BITS 8
+
+/** FNV-1a parameters */
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME        0x01000193
+
+/**
+ * @brief      A registered callback
+ */
+typedef struct _event_handler {
+  tai_module_event_cb_t callback; ///< Callback or NULL if the slot is free
+  void *opaque;                 ///< Passed back to `callback`
+  SceUID pid;                   ///< Process filter or `TAI_ANY_PID`
+  uint32_t name_hash;           ///< Hash of the module name or 0 for any
+  int events;                   ///< Mask of `tai_module_event_type_t`
+  uint32_t gen;                 ///< Bumped each time the slot is taken
+} event_handler_t;
+
+/**
+ * @brief      A callback copied out of the table for dispatch
+ */
+typedef struct _event_call {
+  tai_module_event_cb_t callback;
+  void *opaque;
+} event_call_t;
+
+/** Registered callbacks */
+static event_handler_t g_handlers[EVENT_MAX_HANDLERS];
+
+/** One past the last slot in use so dispatch does not walk the whole table */
+static int g_handlers_end;
+
+/** Lock for the handler table, never held while calling out so it is taken last */
+static SceUID g_event_lock;
+
+/** Hook reference to `sceKernelLoadModuleForPid` */
+static tai_hook_ref_t g_load_module_hook;
+
+/** Hook reference to `sceKernelLoadStartModuleForPid` */
+static tai_hook_ref_t g_load_start_module_hook;
+
+/** Hook reference to `sceKernelUnloadModuleForPid` */
+static tai_hook_ref_t g_unload_module_hook;
+
+/** Hook reference to `sceKernelStopUnloadModuleForPid` */
+static tai_hook_ref_t g_stop_unload_module_hook;
+
+/** References to the hooks */
+static SceUID g_hooks[4];
+
+/**
+ * @brief      Hashes a module name for filtering
+ *
+ *             FNV-1a. Zero is reserved to mean any module.
+ *
+ * @param[in]  name  The module name
+ *
+ * @return     The hash
+ */
+uint32_t event_name_hash(const char *name) {
+  uint32_t hash;
+
+  hash = FNV_OFFSET_BASIS;
+  while (*name) {
+    hash ^= (unsigned char)*name++;
+    hash *= FNV_PRIME;
+  }
+  return hash ? hash : 1;
+}
+
+/**
+ * @brief      Calls every matching callback
+ *
+ *             Matching callbacks are copied out under the lock and called
+ *             without it, so a slow callback does not hold up other module
+ *             loads and callbacks can load modules or register themselves.
+ *
+ * @param[in]  type   The event type
+ * @param[in]  pid    The process
+ * @param[in]  modid  The module
+ * @param[in]  name   The module name
+ */
+static void event_dispatch(tai_module_event_type_t type, SceUID pid, SceUID modid, const char *name) {
+  tai_module_event_t event;
+  event_call_t calls[EVENT_MAX_HANDLERS];
+  event_handler_t *handler;
+  uint32_t hash;
+  int count;
+  int i;
+
+  event.size = sizeof(event);
+  event.type = type;
+  event.pid = pid;
+  event.modid = modid;
+  event.name = name;
+  hash = event_name_hash(name);
+  LOG("module event %d: pid %x, modid %x, %s", type, pid, modid, name);
+
+  count = 0;
+  sceKernelLockMutexForKernel(g_event_lock, 1, NULL);
+  for (i = 0; i < g_handlers_end; i++) {
+    handler = &g_handlers[i];
+    if (handler->callback == NULL || (handler->events & type) == 0) {
+      continue;
+    }
+    if (handler->pid != TAI_ANY_PID && handler->pid != pid) {
+      continue;
+    }
+    if (handler->name_hash != 0 && handler->name_hash != hash) {
+      continue;
+    }
+    calls[count].callback = handler->callback;
+    calls[count].opaque = handler->opaque;
+    count++;
+  }
+  sceKernelUnlockMutexForKernel(g_event_lock, 1);
+
+  for (i = 0; i < count; i++) {
+    calls[i].callback(&event, calls[i].opaque);
+  }
+}
+
+/**
+ * @brief      Gets the name of a module
+ *
+ * @param[in]  pid    The process
+ * @param[in]  modid  The module
+ * @param[out] name   The name (at least 28 bytes)
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int get_module_name(SceUID pid, SceUID modid, char *name) {
+  SceKernelModuleInfo info;
+  int ret;
+
+  info.size = sizeof(info);
+  ret = sceKernelGetModuleInfoForKernel(pid, modid, &info);
+  if (ret < 0) {
+    LOG("sceKernelGetModuleInfoForKernel(%x, %x): 0x%08X", pid, modid, ret);
+    name[0] = '\0';
+    return ret;
+  }
+  memcpy(name, info.module_name, sizeof(info.module_name));
+  name[sizeof(info.module_name) - 1] = '\0';
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Dispatches a load event for a module just loaded
+ *
+ * @param[in]  pid    The process
+ * @param[in]  modid  The module
+ */
+static void module_loaded(SceUID pid, SceUID modid) {
+  char name[28];
+
+  if (g_handlers_end > 0 && get_module_name(pid, modid, name) >= 0) {
+    event_dispatch(TAI_EVENT_MODULE_LOAD, pid, modid, name);
+  }
+}
+
+/**
+ * @brief      Patch for `sceKernelLoadModuleForPid`
+ */
+static SceUID load_module_patched(SceUID pid, const char *path, int flags, SceKernelLMOption *option) {
+  SceUID ret;
+
+  ret = TAI_CONTINUE(SceUID, g_load_module_hook, pid, path, flags, option);
+  if (ret >= 0) {
+    module_loaded(pid, ret);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Patch for `sceKernelLoadStartModuleForPid`
+ */
+static SceUID load_start_module_patched(SceUID pid, const char *path, SceSize args, void *argp, int flags, SceKernelLMOption *option, int *status) {
+  SceUID ret;
+
+  ret = TAI_CONTINUE(SceUID, g_load_start_module_hook, pid, path, args, argp, flags, option, status);
+  if (ret >= 0) {
+    module_loaded(pid, ret);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Patch for `sceKernelUnloadModuleForPid`
+ *
+ *             The name is looked up first since the module is gone after.
+ */
+static int unload_module_patched(SceUID pid, SceUID modid, int flags, SceKernelLMOption *option) {
+  char name[28];
+  int valid;
+  int ret;
+
+  valid = g_handlers_end > 0 && get_module_name(pid, modid, name) >= 0;
+  ret = TAI_CONTINUE(int, g_unload_module_hook, pid, modid, flags, option);
+  if (ret >= 0 && valid) {
+    event_dispatch(TAI_EVENT_MODULE_UNLOAD, pid, modid, name);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Patch for `sceKernelStopUnloadModuleForPid`
+ */
+static int stop_unload_module_patched(SceUID pid, SceUID modid, SceSize args, void *argp, int flags, SceKernelLMOption *option, int *status) {
+  char name[28];
+  int valid;
+  int ret;
+
+  valid = g_handlers_end > 0 && get_module_name(pid, modid, name) >= 0;
+  ret = TAI_CONTINUE(int, g_stop_unload_module_hook, pid, modid, args, argp, flags, option, status);
+  if (ret >= 0 && valid) {
+    event_dispatch(TAI_EVENT_MODULE_UNLOAD, pid, modid, name);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Registers a module event callback
+ *
+ * @param[in]  pid       Process to watch or `TAI_ANY_PID`
+ * @param[in]  module    Module name to watch or NULL for any
+ * @param[in]  events    Mask of `tai_module_event_type_t`
+ * @param[in]  callback  The callback
+ * @param      opaque    Passed back to the callback
+ *
+ * @return     Handle for `event_unregister` on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if there is no callback or event
+ *             - TAI_ERROR_MEMORY if the table is full
+ */
+SceUID event_register(SceUID pid, const char *module, int events, tai_module_event_cb_t callback, void *opaque) {
+  event_handler_t *handler;
+  int i;
+
+  if (callback == NULL || (events & TAI_EVENT_MODULE_ALL) == 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  sceKernelLockMutexForKernel(g_event_lock, 1, NULL);
+  for (i = 0; i < EVENT_MAX_HANDLERS; i++) {
+    if (g_handlers[i].callback == NULL) {
+      break;
+    }
+  }
+  if (i == EVENT_MAX_HANDLERS) {
+    sceKernelUnlockMutexForKernel(g_event_lock, 1);
+    LOG("event table full");
+    return TAI_ERROR_MEMORY;
+  }
+  handler = &g_handlers[i];
+  handler->opaque = opaque;
+  handler->pid = pid;
+  handler->name_hash = module ? event_name_hash(module) : 0;
+  handler->events = events & TAI_EVENT_MODULE_ALL;
+  handler->callback = callback;
+  handler->gen = (handler->gen + 1) & (0x7FFFFFFF >> HANDLE_SLOT_BITS);
+  if (i >= g_handlers_end) {
+    g_handlers_end = i + 1;
+  }
+  sceKernelUnlockMutexForKernel(g_event_lock, 1);
+  LOG("registered event handler %d for pid %x, module %s", i, pid, module ? module : "(any)");
+  return (handler->gen << HANDLE_SLOT_BITS) | (i + 1);
+}
+
+/**
+ * @brief      Removes a module event callback
+ *
+ *             The handle holds the generation of its slot, so a stale handle
+ *             cannot remove a callback registered later in the same slot. A
+ *             dispatch that already copied the callback out may still call it
+ *             once after this returns.
+ *
+ * @param[in]  handle  The handle from `event_register`
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if the handle is not registered
+ */
+int event_unregister(SceUID handle) {
+  event_handler_t *handler;
+  int slot;
+  int ret;
+
+  slot = (handle & ((1 << HANDLE_SLOT_BITS) - 1)) - 1;
+  if (handle < 0 || slot < 0 || slot >= EVENT_MAX_HANDLERS) {
+    return TAI_ERROR_NOT_FOUND;
+  }
+  handler = &g_handlers[slot];
+  sceKernelLockMutexForKernel(g_event_lock, 1, NULL);
+  if (handler->callback == NULL || handler->gen != ((uint32_t)handle >> HANDLE_SLOT_BITS)) {
+    ret = TAI_ERROR_NOT_FOUND;
+  } else {
+    handler->callback = NULL;
+    while (g_handlers_end > 0 && g_handlers[g_handlers_end - 1].callback == NULL) {
+      g_handlers_end--;
+    }
+    ret = TAI_SUCCESS;
+  }
+  sceKernelUnlockMutexForKernel(g_event_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Hooks the module manager
+ *
+ *             Requires `patches_init` to be called first!
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int event_init(void) {
+  memset(g_handlers, 0, sizeof(g_handlers));
+  g_handlers_end = 0;
+  g_event_lock = sceKernelCreateMutexForKernel("tai_event_lock", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_event_lock): 0x%08X", g_event_lock);
+  if (g_event_lock < 0) {
+    return g_event_lock;
+  }
+  memset(g_hooks, 0, sizeof(g_hooks));
+  g_hooks[0] = taiHookFunctionExportForKernel(KERNEL_PID,
+                                              &g_load_module_hook,
+                                              "SceKernelModulemgr",
+                                              NID_MODULEMGR_FOR_KERNEL,
+                                              NID_LOAD_MODULE_FOR_PID,
+                                              load_module_patched);
+  if (g_hooks[0] < 0) goto fail;
+  g_hooks[1] = taiHookFunctionExportForKernel(KERNEL_PID,
+                                              &g_load_start_module_hook,
+                                              "SceKernelModulemgr",
+                                              NID_MODULEMGR_FOR_KERNEL,
+                                              NID_LOAD_START_MODULE_FOR_PID,
+                                              load_start_module_patched);
+  if (g_hooks[1] < 0) goto fail;
+  g_hooks[2] = taiHookFunctionExportForKernel(KERNEL_PID,
+                                              &g_unload_module_hook,
+                                              "SceKernelModulemgr",
+                                              NID_MODULEMGR_FOR_KERNEL,
+                                              NID_UNLOAD_MODULE_FOR_PID,
+                                              unload_module_patched);
+  if (g_hooks[2] < 0) goto fail;
+  g_hooks[3] = taiHookFunctionExportForKernel(KERNEL_PID,
+                                              &g_stop_unload_module_hook,
+                                              "SceKernelModulemgr",
+                                              NID_MODULEMGR_FOR_KERNEL,
+                                              NID_STOP_UNLOAD_MODULE_FOR_PID,
+                                              stop_unload_module_patched);
+  if (g_hooks[3] < 0) goto fail;
+  LOG("module event hooks added");
+  return TAI_SUCCESS;
+fail:
+  LOG("failed to add module event hooks");
+  event_deinit();
+  return TAI_ERROR_SYSTEM;
+}
+
+/**
+ * @brief      Removes the module manager hooks
+ */
+void event_deinit(void) {
+  if (g_hooks[0] > 0) {
+    taiHookReleaseForKernel(g_hooks[0], g_load_module_hook);
+  }
+  if (g_hooks[1] > 0) {
+    taiHookReleaseForKernel(g_hooks[1], g_load_start_module_hook);
+  }
+  if (g_hooks[2] > 0) {
+    taiHookReleaseForKernel(g_hooks[2], g_unload_module_hook);
+  }
+  if (g_hooks[3] > 0) {
+    taiHookReleaseForKernel(g_hooks[3], g_stop_unload_module_hook);
+  }
+  memset(g_hooks, 0, sizeof(g_hooks));
+  if (g_event_lock > 0) {
+    sceKernelDeleteMutexForKernel(g_event_lock);
+  }
+  g_event_lock = 0;
+}
@@ -0,0 +1,32 @@
+/**
+ * @brief      Module event bus
+ */
+#ifndef TAI_EVENT_HEADER
+#define TAI_EVENT_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   event Module Event Bus
+ * @brief      Notifies plugins of module loads and unloads
+ *
+ * @details    taiHEN hooks the module manager once and dispatches each load
+ *             and unload to every registered callback whose process and module
+ *             name filters match. This saves plugins from each adding their
+ *             own hook to the module manager. It is also the invalidation
+ *             signal for taiHEN's own module lookup caches.
+ */
+/** @{ */
+
+/** Maximum number of registered callbacks */
+#define EVENT_MAX_HANDLERS 32
+
+int event_init(void);
+void event_deinit(void);
+uint32_t event_name_hash(const char *name);
+SceUID event_register(SceUID pid, const char *module, int events, tai_module_event_cb_t callback, void *opaque);
+int event_unregister(SceUID handle);
+
+/** @} */
+
+#endif // TAI_EVENT_HEADER
@@ -0,0 +1,228 @@
+/* heap.c -- kernel heaps
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <string.h>
+#include "error.h"
+#include "heap.h"
+#include "taihen_internal.h"
+#include "usage.h"
+
+/** Memory block granularity */
+#define HEAP_BLOCK_ALIGN 0x1000
+
+/**
+ * @brief      Placed before every allocation
+ */
+typedef struct _heap_header {
+  uint32_t size;                ///< Requested size
+  SceUID blkid;                 ///< Memory block if spilled, zero if pooled
+} heap_header_t;
+
+/**
+ * @brief      A heap
+ */
+typedef struct _heap {
+  const char *name;             ///< Pool name
+  size_t default_size;          ///< Pool size without usage history
+  size_t capacity;              ///< Pool size
+  SceUID pool;                  ///< The pool
+  uint32_t in_use;              ///< Bytes allocated from the pool
+  uint32_t peak;                ///< Highest `in_use`
+  uint32_t allocs;              ///< Live allocations from the pool
+  uint32_t failures;            ///< Failed allocations
+  uint32_t fragmented;          ///< Failures that would have fit in the free bytes
+  uint32_t spilled;             ///< Live memory block allocations
+  uint32_t spilled_bytes;       ///< Bytes in memory block allocations
+} heap_t;
+
+/** The heaps, indexed by `tai_heap_t` */
+static heap_t g_heaps[TAI_HEAP_MAX] = {
+  [TAI_HEAP_METADATA] = { "tai_heap_meta", HEAP_METADATA_SIZE },
+  [TAI_HEAP_SCRATCH] = { "tai_heap_scratch", HEAP_SCRATCH_SIZE },
+  [TAI_HEAP_SAVED] = { "tai_heap_saved", HEAP_SAVED_SIZE },
+};
+
+/**
+ * @brief      Creates the heaps
+ *
+ *             Heaps are sized from the usage history, so `usage_init` should
+ *             be called first. On failure no heap is left created.
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int heap_init(void) {
+  SceKernelMemPoolCreateOpt opt;
+  heap_t *heap;
+  int ret;
+
+  for (int i = 0; i < TAI_HEAP_MAX; i++) {
+    heap = &g_heaps[i];
+    heap->capacity = usage_heap_size(i, heap->default_size);
+    memset(&opt, 0, sizeof(opt));
+    opt.size = sizeof(opt);
+    opt.uselock = 1;
+    heap->pool = sceKernelMemPoolCreate(heap->name, heap->capacity, &opt);
+    LOG("sceKernelMemPoolCreate(%s): 0x%08X", heap->name, heap->pool);
+    if (heap->pool < 0) {
+      ret = heap->pool;
+      heap->pool = 0;
+      while (--i >= 0) {
+        sceKernelMemPoolDestroy(g_heaps[i].pool);
+        g_heaps[i].pool = 0;
+      }
+      return ret;
+    }
+    heap->in_use = heap->peak = heap->allocs = 0;
+    heap->failures = heap->fragmented = 0;
+    heap->spilled = heap->spilled_bytes = 0;
+  }
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Destroys the heaps
+ */
+void heap_deinit(void) {
+  for (int i = 0; i < TAI_HEAP_MAX; i++) {
+    sceKernelMemPoolDestroy(g_heaps[i].pool);
+    g_heaps[i].pool = 0;
+  }
+}
+
+/**
+ * @brief      Allocates saved data in its own memory block
+ *
+ * @param      heap  The heap to account it to
+ * @param[in]  size  The size
+ *
+ * @return     The header or NULL
+ */
+static heap_header_t *heap_spill(heap_t *heap, size_t size) {
+  heap_header_t *hdr;
+  SceUID blkid;
+  size_t blksize;
+
+  blksize = (sizeof(heap_header_t) + size + HEAP_BLOCK_ALIGN - 1) & ~(HEAP_BLOCK_ALIGN - 1);
+  blkid = sceKernelAllocMemBlockForKernel("tai_saved", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW, blksize, NULL);
+  LOG("sceKernelAllocMemBlockForKernel(tai_saved, 0x%08X): 0x%08X", blksize, blkid);
+  if (blkid < 0) {
+    return NULL;
+  }
+  if (sceKernelGetMemBlockBaseForKernel(blkid, (void **)&hdr) < 0) {
+    sceKernelFreeMemBlockForKernel(blkid);
+    return NULL;
+  }
+  hdr->blkid = blkid;
+  __atomic_add_fetch(&heap->spilled, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&heap->spilled_bytes, blksize, __ATOMIC_RELAXED);
+  return hdr;
+}
+
+/**
+ * @brief      Allocates memory
+ *
+ * @param[in]  heap  Which heap
+ * @param[in]  size  The size
+ *
+ * @return     The memory or NULL
+ */
+void *heap_alloc(tai_heap_t heap, size_t size) {
+  heap_t *h = &g_heaps[heap];
+  heap_header_t *hdr;
+  uint32_t total, in_use, peak;
+
+  if (heap == TAI_HEAP_SAVED && size >= HEAP_SPILL_THRESHOLD) {
+    hdr = heap_spill(h, size);
+  } else {
+    total = sizeof(heap_header_t) + size;
+    hdr = sceKernelMemPoolAlloc(h->pool, total);
+    if (hdr != NULL) {
+      hdr->blkid = 0;
+      in_use = __atomic_add_fetch(&h->in_use, total, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&h->allocs, 1, __ATOMIC_RELAXED);
+      peak = __atomic_load_n(&h->peak, __ATOMIC_RELAXED);
+      while (in_use > peak && !__atomic_compare_exchange_n(&h->peak, &peak, in_use, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    } else if (__atomic_load_n(&h->in_use, __ATOMIC_RELAXED) + total <= h->capacity) {
+      // there was room, just not in one piece
+      __atomic_add_fetch(&h->fragmented, 1, __ATOMIC_RELAXED);
+    }
+  }
+  if (hdr == NULL) {
+    LOG("%s: failed to allocate 0x%08X bytes", h->name, size);
+    __atomic_add_fetch(&h->failures, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  hdr->size = size;
+  return hdr + 1;
+}
+
+/**
+ * @brief      Frees memory from `heap_alloc`
+ *
+ * @param[in]  heap  The heap it was allocated from
+ * @param      ptr   The memory, can be NULL
+ */
+void heap_free(tai_heap_t heap, void *ptr) {
+  heap_t *h = &g_heaps[heap];
+  heap_header_t *hdr;
+  size_t blksize;
+
+  if (ptr == NULL) {
+    return;
+  }
+  hdr = (heap_header_t *)ptr - 1;
+  if (hdr->blkid != 0) {
+    blksize = (sizeof(heap_header_t) + hdr->size + HEAP_BLOCK_ALIGN - 1) & ~(HEAP_BLOCK_ALIGN - 1);
+    __atomic_sub_fetch(&h->spilled, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&h->spilled_bytes, blksize, __ATOMIC_RELAXED);
+    sceKernelFreeMemBlockForKernel(hdr->blkid);
+  } else {
+    __atomic_sub_fetch(&h->in_use, sizeof(heap_header_t) + hdr->size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&h->allocs, 1, __ATOMIC_RELAXED);
+    sceKernelMemPoolFree(h->pool, hdr);
+  }
+}
+
+/**
+ * @brief      Gets the size an allocation was made with
+ *
+ * @param[in]  ptr   Memory from `heap_alloc`
+ *
+ * @return     The size
+ */
+size_t heap_usable_size(const void *ptr) {
+  return ((const heap_header_t *)ptr - 1)->size;
+}
+
+/**
+ * @brief      Gets usage of a heap
+ *
+ * @param[in]  heap   Which heap
+ * @param[out] stats  The usage
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int heap_get_stats(tai_heap_t heap, tai_heap_stats_t *stats) {
+  heap_t *h;
+
+  if (heap < 0 || heap >= TAI_HEAP_MAX) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  h = &g_heaps[heap];
+  stats->size = sizeof(*stats);
+  stats->capacity = h->capacity;
+  stats->in_use = __atomic_load_n(&h->in_use, __ATOMIC_RELAXED);
+  stats->peak = __atomic_load_n(&h->peak, __ATOMIC_RELAXED);
+  stats->allocs = __atomic_load_n(&h->allocs, __ATOMIC_RELAXED);
+  stats->failures = __atomic_load_n(&h->failures, __ATOMIC_RELAXED);
+  stats->fragmented = __atomic_load_n(&h->fragmented, __ATOMIC_RELAXED);
+  stats->spilled = __atomic_load_n(&h->spilled, __ATOMIC_RELAXED);
+  stats->spilled_bytes = __atomic_load_n(&h->spilled_bytes, __ATOMIC_RELAXED);
+  return TAI_SUCCESS;
+}
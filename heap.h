@@ -0,0 +1,46 @@
+/**
+ * @brief      Kernel heaps
+ */
+#ifndef TAI_HEAP_HEADER
+#define TAI_HEAP_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   heap Heaps
+ * @brief      Separate heaps for each kind of allocation
+ *
+ * @details    Patch metadata, libsubstitute's scratch memory and the data
+ *             saved by injections each get their own pool so one kind of
+ *             allocation cannot fragment the pool another depends on. Saved
+ *             data of at least `HEAP_SPILL_THRESHOLD` bytes gets its own
+ *             memory block instead of taking a large run of its pool.
+ */
+/** @{ */
+
+/** Default size of the metadata heap in bytes */
+#define HEAP_METADATA_SIZE 0x8000
+
+/** Default size of the libsubstitute scratch heap in bytes */
+#define HEAP_SCRATCH_SIZE 0x8000
+
+/** Default size of the saved data heap in bytes */
+#define HEAP_SAVED_SIZE 0x4000
+
+/**
+ * Saved data of at least this size is put in its own memory block. Blocks are
+ * page granular, so anything smaller stays in the pool rather than wasting
+ * most of a page.
+ */
+#define HEAP_SPILL_THRESHOLD 0x1000
+
+int heap_init(void);
+void heap_deinit(void);
+void *heap_alloc(tai_heap_t heap, size_t size);
+void heap_free(tai_heap_t heap, void *ptr);
+size_t heap_usable_size(const void *ptr);
+int heap_get_stats(tai_heap_t heap, tai_heap_stats_t *stats);
+
+/** @} */
+
+#endif // TAI_HEAP_HEADER
@@ -7,14 +7,21 @@
  */
 #include <psp2kern/types.h>
 #include <psp2kern/io/fcntl.h>
+#include <psp2kern/io/stat.h>
 #include <psp2kern/kernel/modulemgr.h>
 #include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
 #include <string.h>
 #include <taihen/parser.h>
 #include "error.h"
+#include "event.h"
+#include "heap.h"
 #include "hen.h"
 #include "module.h"
+#include "patches.h"
+#include "report.h"
 #include "taihen_internal.h"
+#include "usage.h"
 
 /** The Vita supports a max of 8 segments for ET_SCE_RELEXEC type */
 #define MAX_SEGMENTS 8
@@ -22,6 +29,28 @@
 /** Should be same on all current firmware, but this may change. */
 #define OFFSET_PATCH_ARG 168
 
+/** Plugin file does not exist */
+#define ERROR_NO_SUCH_FILE        0x80010002
+
+/** First and last module manager error for a malformed module */
+#define ERROR_MODULEMGR_INVALID_FIRST 0x8002D009
+#define ERROR_MODULEMGR_INVALID_LAST  0x8002D00E
+
+/** Module manager error for a module built against an old library */
+#define ERROR_MODULEMGR_OLD_LIB   0x8002D013
+
+/** Facility of SceSblAuthMgr, which rejects unloadable SELFs */
+#define ERROR_FACILITY_AUTHMGR    0x800F0000
+
+/** Config lines starting with this wait for a module to load */
+#define DEFERRED_PREFIX '@'
+
+/** Stack size of the thread loading deferred plugins */
+#define DEFERRED_THREAD_STACK 0x4000
+
+/** Priority of the thread loading deferred plugins */
+#define DEFERRED_THREAD_PRIORITY 0x40
+
 /*
  *  S/ELF header
  */
@@ -113,14 +142,27 @@ static tai_hook_ref_t g_load_user_libs_hook;
 /** Hook reference to `nid_poison_hook` */
 static tai_hook_ref_t g_nid_poison_hook;
 
+/** Hook reference to `sceKernelUnloadProcessModules` */
+static tai_hook_ref_t g_unload_process_hook;
+
 /** References to the hooks */
-static SceUID g_hooks[10];
+static SceUID g_hooks[11];
 
 /** Memory reference to config read buffer */
 static SceUID g_config_blk;
 
 /** Buffer for the config data */
-const char *g_config;
+static const char *g_config;
+
+/**
+ * Lock for the config (recursive for loads from plugins). Plugins are loaded
+ * with it held, so the module event lock is taken after it. The event lock is
+ * never held while calling out, so that is the only order.
+ */
+static SceUID g_config_lock;
+
+/** Number of config parses in progress */
+static int g_config_busy;
 
 /** Is the current decryption a homebrew? */
 static int g_is_homebrew;
@@ -128,6 +170,56 @@ static int g_is_homebrew;
 /** Cache of segment info entries from SELF header */
 static self_section_info_t g_seg_info[MAX_SEGMENTS];
 
+/**
+ * @brief      A plugin waiting for a module to load
+ */
+typedef struct _deferred_plugin {
+  SceUID pid;                   ///< Process to load the plugin to or 0 if the slot is free
+  uint32_t trigger;             ///< Hash of the module name that triggers the load
+  int ready;                    ///< The trigger loaded, waiting for the loader thread
+  char path[MAX_PLUGIN_PATH];   ///< Path of the plugin
+} deferred_plugin_t;
+
+/** Plugins waiting for a module to load */
+static deferred_plugin_t g_deferred[MAX_DEFERRED_PLUGINS];
+
+/** Number of slots in use in `g_deferred` */
+static int g_deferred_count;
+
+/** Lock for `g_deferred` */
+static SceUID g_deferred_lock;
+
+/** Module event handle for loading deferred plugins */
+static SceUID g_deferred_event;
+
+/** Thread that loads deferred plugins once their trigger loads */
+static SceUID g_deferred_thread;
+
+/** Signalled when a deferred plugin is ready or the thread should exit */
+static SceUID g_deferred_sema;
+
+/** Tells the loader thread to exit */
+static int g_deferred_stop;
+
+/**
+ * @brief      A plugin that failed to load
+ */
+typedef struct _failed_plugin {
+  uint32_t hash;                ///< Hash of the plugin path or 0 if the slot is free
+  int error;                    ///< The load error
+  int has_mtime;                ///< Was the directory's mtime available?
+  SceDateTime dir_mtime;        ///< Modification time of the plugin's directory
+} failed_plugin_t;
+
+/** Plugins that failed to load, skipped until the config is reloaded */
+static failed_plugin_t g_failed[MAX_FAILED_PLUGINS];
+
+/** Next slot in `g_failed` to replace when full */
+static int g_failed_next;
+
+/** Lock for `g_failed`, never held while loading */
+static SceUID g_failed_lock;
+
 /**
  * @brief      Patch for parsing SELF headers
  *
@@ -319,23 +411,11 @@ static int package_check_2_patched(void) {
  * @return     Zero on success, < 0 on error
  */
 static int load_user_libs_patched(SceUID pid, void *args, int flags) {
-  tai_plugin_load_t param;
   int ret;
-  SceUID mod;
-  char titleid[32];
 
   ret = TAI_CONTINUE(int, g_load_user_libs_hook, pid, args, flags);
 
-  sceKernelGetProcessTitleIdForKernel(pid, titleid, 32);
-  LOG("title started: %s", titleid);
-
-  if (g_config) {
-    param.pid = pid;
-    param.flags = 0x8000; // queue for load
-    taihen_config_parse(g_config, titleid, hen_load_plugin, &param);
-  } else {
-    LOG("config not loaded, skipping plugin load");
-  }
+  hen_title_started(pid);
 
   return ret;
 }
@@ -359,19 +439,182 @@ static int nid_poison_patched(uintptr_t dst, int set, size_t len) {
 }
 
 /**
- * @brief      Load tai config file
+ * @brief      Drops the deferred plugins of a process
+ *
+ * @param[in]  pid   The process
+ */
+static void hen_forget_deferred(SceUID pid) {
+  if (g_deferred_count == 0) {
+    return;
+  }
+  sceKernelLockMutexForKernel(g_deferred_lock, 1, NULL);
+  for (int i = 0; i < MAX_DEFERRED_PLUGINS; i++) {
+    if (g_deferred[i].pid == pid) {
+      LOG("dropping deferred %s for exited pid %x", g_deferred[i].path, pid);
+      g_deferred[i].pid = 0;
+      g_deferred_count--;
+    }
+  }
+  sceKernelUnlockMutexForKernel(g_deferred_lock, 1);
+}
+
+/**
+ * @brief      Patch for unloading the modules of an exiting process
+ *
+ *             Frees what taiHEN still holds for the process.
+ *
+ * @param[in]  pid   The process
  *
  * @return     Zero on success, < 0 on error
  */
-static int hen_load_config(void) {
+static int unload_process_patched(SceUID pid) {
+  int ret;
+
+  ret = TAI_CONTINUE(int, g_unload_process_hook, pid);
+  LOG("process %x exited, cleaning up", pid);
+  hen_forget_deferred(pid);
+  tai_try_cleanup_process(pid);
+  return ret;
+}
+
+/**
+ * @brief      Gets the modification time of the directory holding a plugin
+ *
+ *             Adding or replacing a file in the directory changes its time,
+ *             which is how a plugin that failed because it was missing gets
+ *             retried.
+ *
+ * @param[in]  path   The plugin path
+ * @param[out] mtime  The modification time
+ *
+ * @return     Zero on success, < 0 if unavailable
+ */
+static int plugin_dir_mtime(const char *path, SceDateTime *mtime) {
+  char dir[MAX_PLUGIN_PATH];
+  SceIoStat stat;
+  size_t len;
+  int ret;
+
+  for (len = strlen(path); len > 0 && path[len-1] != '/' && path[len-1] != ':'; len--);
+  if (len == 0 || len >= sizeof(dir)) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  memcpy(dir, path, len);
+  if (dir[len-1] == '/') {
+    len--;
+  }
+  dir[len] = '\0';
+  if ((ret = sceIoGetstatForDriver(dir, &stat)) < 0) {
+    return ret;
+  }
+  memcpy(mtime, &stat.st_mtime, sizeof(*mtime));
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Checks if a plugin is known to fail loading
+ *
+ *             An entry is dropped if the plugin's directory changed since the
+ *             failure.
+ *
+ * @param[in]  path   The plugin path
+ * @param[out] error  The error the plugin failed with
+ *
+ * @return     1 if the plugin should be skipped, 0 otherwise
+ */
+static int hen_plugin_known_bad(const char *path, int *error) {
+  failed_plugin_t *entry;
+  SceDateTime mtime;
+  uint32_t hash;
+  int has_mtime;
+  int bad;
+
+  hash = event_name_hash(path);
+  bad = 0;
+  sceKernelLockMutexForKernel(g_failed_lock, 1, NULL);
+  for (int i = 0; i < MAX_FAILED_PLUGINS; i++) {
+    entry = &g_failed[i];
+    if (entry->hash != hash) {
+      continue;
+    }
+    has_mtime = plugin_dir_mtime(path, &mtime) >= 0;
+    if (has_mtime != entry->has_mtime || (has_mtime && memcmp(&mtime, &entry->dir_mtime, sizeof(mtime)) != 0)) {
+      LOG("directory of %s changed, retrying", path);
+      entry->hash = 0;
+    } else {
+      *error = entry->error;
+      bad = 1;
+    }
+    break;
+  }
+  sceKernelUnlockMutexForKernel(g_failed_lock, 1);
+  return bad;
+}
+
+/**
+ * @brief      Checks if a load error is caused by the plugin file itself
+ *
+ *             Only these are remembered. Running out of memory or a failing
+ *             `module_start` may not happen on the next launch.
+ *
+ * @param[in]  error  The load error
+ *
+ * @return     1 if the plugin will keep failing until its file changes
+ */
+static int hen_plugin_invalid(int error) {
+  if (error == ERROR_NO_SUCH_FILE || error == ERROR_MODULEMGR_OLD_LIB) {
+    return 1;
+  }
+  if (error >= ERROR_MODULEMGR_INVALID_FIRST && error <= ERROR_MODULEMGR_INVALID_LAST) {
+    return 1;
+  }
+  return (error & 0xFFFF0000) == ERROR_FACILITY_AUTHMGR;
+}
+
+/**
+ * @brief      Remembers that a plugin failed to load
+ *
+ * @param[in]  path   The plugin path
+ * @param[in]  error  The error
+ */
+static void hen_plugin_failed(const char *path, int error) {
+  failed_plugin_t *entry;
+
+  sceKernelLockMutexForKernel(g_failed_lock, 1, NULL);
+  entry = &g_failed[g_failed_next];
+  g_failed_next = (g_failed_next + 1) % MAX_FAILED_PLUGINS;
+  entry->hash = event_name_hash(path);
+  entry->error = error;
+  entry->has_mtime = plugin_dir_mtime(path, &entry->dir_mtime) >= 0;
+  sceKernelUnlockMutexForKernel(g_failed_lock, 1);
+}
+
+/**
+ * @brief      Forgets every plugin that failed to load
+ */
+static void hen_forget_failed(void) {
+  sceKernelLockMutexForKernel(g_failed_lock, 1, NULL);
+  memset(g_failed, 0, sizeof(g_failed));
+  g_failed_next = 0;
+  sceKernelUnlockMutexForKernel(g_failed_lock, 1);
+}
+
+/**
+ * @brief      Reads the tai config file into a new memory block
+ *
+ * @param[out] p_blk     The memory block holding the config
+ * @param[out] p_config  The config
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int hen_read_config(SceUID *p_blk, const char **p_config) {
   SceUID fd;
   SceOff len;
+  SceUID blk;
   int ret;
   char *config;
   int rd, total;
 
-  g_config = NULL;
-
   LOG("opening config %s", TAIHEN_CONFIG_FILE);
   fd = sceIoOpenForDriver(TAIHEN_CONFIG_FILE, SCE_O_RDONLY, 0);
   if (fd < 0) {
@@ -389,17 +632,18 @@ static int hen_load_config(void) {
   sceIoLseekForDriver(fd, 0, SCE_SEEK_SET);
 
   LOG("allocating %d bytes for config", (len + 0xfff) & ~0xfff);
-  g_config_blk = sceKernelAllocMemBlockForKernel("tai_config", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW, (len + 0xfff) & ~0xfff, NULL);
-  if (g_config_blk < 0) {
-    LOG("failed to allocate memory: %x", g_config_blk);
+  blk = sceKernelAllocMemBlockForKernel("tai_config", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW, (len + 0xfff) & ~0xfff, NULL);
+  if (blk < 0) {
+    LOG("failed to allocate memory: %x", blk);
     sceIoCloseForDriver(fd);
-    return g_config_blk;
+    return blk;
   }
 
-  ret = sceKernelGetMemBlockBaseForKernel(g_config_blk, (void **)&config);
+  ret = sceKernelGetMemBlockBaseForKernel(blk, (void **)&config);
   if (ret < 0) {
-    LOG("failed to get base for %x: %x", g_config_blk, ret);
+    LOG("failed to get base for %x: %x", blk, ret);
     sceIoCloseForDriver(fd);
+    sceKernelFreeMemBlockForKernel(blk);
     return ret;
   }
 
@@ -417,20 +661,330 @@ static int hen_load_config(void) {
 
   sceIoCloseForDriver(fd);
   if (ret < 0) {
-    sceKernelFreeMemBlockForKernel(g_config_blk);
+    sceKernelFreeMemBlockForKernel(blk);
     return ret;
   }
 
   if ((ret = taihen_config_validate(config)) != 0) {
     LOG("config parsing failed: %x", ret);
-    sceKernelFreeMemBlockForKernel(g_config_blk);
+    sceKernelFreeMemBlockForKernel(blk);
     return ret;
   }
 
-  g_config = config;
+  *p_blk = blk;
+  *p_config = config;
   return TAI_SUCCESS;
 }
 
+/**
+ * @brief      Load tai config file
+ *
+ *             Replaces the current config if there is one and forgets which
+ *             plugins failed to load. If the new config cannot be read, the
+ *             current config is kept.
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_ALLOWED if called while plugins are loading from
+ *               the current config (i.e. from a plugin's `module_start`)
+ */
+int hen_load_config(void) {
+  const char *config = NULL;
+  SceUID blk = 0;
+  int ret;
+
+  sceKernelLockMutexForKernel(g_config_lock, 1, NULL);
+  if (g_config_busy > 0) {
+    LOG("config is being parsed, cannot reload");
+    ret = TAI_ERROR_NOT_ALLOWED;
+  } else if ((ret = hen_read_config(&blk, &config)) >= 0) {
+    if (g_config) {
+      sceKernelFreeMemBlockForKernel(g_config_blk);
+    }
+    g_config_blk = blk;
+    g_config = config;
+    hen_forget_failed();
+  }
+  sceKernelUnlockMutexForKernel(g_config_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Loads the plugins in a config section
+ *
+ *             Afterwards the usage history is saved so the pools are sized
+ *             for these plugins on the next boot.
+ *
+ * @param[in]  pid      The process to load the plugins to
+ * @param[in]  titleid  The section name
+ * @param[in]  flags    The load flags
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int hen_load_title_plugins(SceUID pid, const char *titleid, int flags) {
+  tai_plugin_load_t param;
+  int ret;
+
+  sceKernelLockMutexForKernel(g_config_lock, 1, NULL);
+  if (g_config) {
+    g_config_busy++;
+    param.pid = pid;
+    param.titleid = titleid;
+    param.flags = flags;
+    taihen_config_parse(g_config, titleid, hen_load_plugin, &param);
+    g_config_busy--;
+    ret = TAI_SUCCESS;
+  } else {
+    LOG("config not loaded");
+    ret = TAI_ERROR_SYSTEM;
+  }
+  sceKernelUnlockMutexForKernel(g_config_lock, 1);
+  // loading plugins is what grows the usage, write it back now and then
+  usage_save_lazy();
+  return ret;
+}
+
+/**
+ * @brief      Queues the plugins for a title that is starting
+ *
+ *             Called once the default libraries of a process are loaded. The
+ *             plugins are loaded with flag 0x8000 so the process starts them.
+ *
+ * @param[in]  pid   The process being started
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int hen_title_started(SceUID pid) {
+  char titleid[32];
+  int ret;
+
+  if ((ret = sceKernelGetProcessTitleIdForKernel(pid, titleid, sizeof(titleid))) < 0) {
+    LOG("failed to get title id for %x: %x", pid, ret);
+    return ret;
+  }
+  LOG("title started: %s", titleid);
+
+  return hen_load_title_plugins(pid, titleid, 0x8000); // queue for load
+}
+
+/**
+ * @brief      Buffers for `hen_load_plugin_timed`, kept off the loader's stack
+ */
+struct load_scratch {
+  tai_load_report_t report;
+  SceKernelModuleInfo info;
+};
+
+/**
+ * @brief      Loads a plugin and records how long it took
+ *
+ *             Loading and starting are timed separately. Plugins queued with
+ *             flag 0x8000 are started by the process later so only the load
+ *             is timed.
+ *
+ * @param[in]  pid      The process to load the plugin to
+ * @param[in]  titleid  The title the plugin is loaded for
+ * @param[in]  path     The plugin path
+ * @param[in]  flags    The load flags
+ *
+ * @return     The module UID on success, < 0 on error
+ */
+static SceUID hen_load_plugin_timed(SceUID pid, const char *titleid, const char *path, int flags) {
+  struct load_scratch *scratch;
+  tai_load_report_t *report;
+  SceKernelModuleInfo *info;
+  SceInt64 start;
+  SceUID modid;
+  int result;
+  int ret;
+
+  scratch = heap_alloc(TAI_HEAP_METADATA, sizeof(*scratch));
+  if (scratch == NULL) {
+    LOG("no memory to load %s", path);
+    return TAI_ERROR_MEMORY;
+  }
+  report = &scratch->report;
+  info = &scratch->info;
+  memset(report, 0, sizeof(*report));
+  report->size = sizeof(*report);
+  strncpy(report->titleid, titleid, sizeof(report->titleid) - 1);
+  strncpy(report->path, path, sizeof(report->path) - 1);
+  report->pid = pid;
+
+  if (hen_plugin_known_bad(path, &ret)) {
+    LOG("skipping %s, failed before: %x", path, ret);
+    report->modid = ret;
+    report->flags = TAI_REPORT_SKIPPED;
+    report_add(report);
+    heap_free(TAI_HEAP_METADATA, scratch);
+    return ret;
+  }
+
+  start = sceKernelGetSystemTimeWide();
+  modid = sceKernelLoadModuleForPid(pid, path, flags, NULL);
+  report->load_time = sceKernelGetSystemTimeWide() - start;
+  LOG("load result: %x in %d us", modid, report->load_time);
+  if (modid >= 0) {
+    info->size = sizeof(*info);
+    if (sceKernelGetModuleInfoForKernel(pid, modid, info) >= 0) {
+      for (int i = 0; i < sizeof(info->segments) / sizeof(info->segments[0]); i++) {
+        report->mem_size += info->segments[i].memsz;
+      }
+    }
+    if ((flags & 0x8000) != 0x8000) {
+      start = sceKernelGetSystemTimeWide();
+      ret = sceKernelStartModuleForPid(pid, modid, 0, NULL, flags, NULL, &result);
+      report->start_time = sceKernelGetSystemTimeWide() - start;
+      LOG("start result: %x (%x) in %d us", ret, result, report->start_time);
+      if (ret < 0) {
+        sceKernelUnloadModuleForPid(pid, modid, 0, NULL);
+        report->start_result = ret;
+        modid = ret;
+      } else {
+        report->start_result = result;
+      }
+    }
+  }
+  report->modid = modid;
+  report_add(report);
+  heap_free(TAI_HEAP_METADATA, scratch);
+  if (modid < 0 && hen_plugin_invalid(modid)) {
+    hen_plugin_failed(path, modid);
+  }
+  return modid;
+}
+
+/**
+ * @brief      Queues a plugin to load when a module loads
+ *
+ *             The slot is freed once the plugin is loaded or its process
+ *             exits.
+ *
+ * @param[in]  pid   The process to load the plugin to
+ * @param[in]  line  The config line after the `@`: module name, whitespace,
+ *                   plugin path
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int hen_defer_plugin(SceUID pid, const char *line) {
+  deferred_plugin_t *slot;
+  char name[28];
+  const char *path;
+  size_t len;
+  int i;
+
+  for (path = line; *path != '\0' && *path != ' ' && *path != '\t'; path++);
+  len = path - line;
+  while (*path == ' ' || *path == '\t') path++;
+  if (len == 0 || len >= sizeof(name) || *path == '\0' || strlen(path) >= MAX_PLUGIN_PATH) {
+    LOG("invalid deferred plugin: %s", line);
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  memcpy(name, line, len);
+  name[len] = '\0';
+
+  sceKernelLockMutexForKernel(g_deferred_lock, 1, NULL);
+  slot = NULL;
+  for (i = 0; i < MAX_DEFERRED_PLUGINS && slot == NULL; i++) {
+    if (g_deferred[i].pid == 0) {
+      slot = &g_deferred[i];
+    }
+  }
+  if (slot == NULL) {
+    sceKernelUnlockMutexForKernel(g_deferred_lock, 1);
+    LOG("too many deferred plugins, dropping %s", path);
+    return TAI_ERROR_MEMORY;
+  }
+  slot->trigger = event_name_hash(name);
+  slot->ready = 0;
+  strncpy(slot->path, path, MAX_PLUGIN_PATH - 1);
+  slot->path[MAX_PLUGIN_PATH - 1] = '\0';
+  slot->pid = pid;
+  g_deferred_count++;
+  sceKernelUnlockMutexForKernel(g_deferred_lock, 1);
+  LOG("pid:%x deferring %s until %s loads", pid, path, name);
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Module event callback that queues deferred plugins
+ *
+ *             Plugins are not loaded here since this runs on the module
+ *             loader's thread in the middle of a load. The loader thread picks
+ *             them up instead.
+ *
+ * @param[in]  event   The event
+ * @param      opaque  Unused
+ */
+static void deferred_module_loaded(const tai_module_event_t *event, void *opaque) {
+  uint32_t hash;
+  int found;
+
+  if (g_deferred_count == 0) {
+    return;
+  }
+  hash = event_name_hash(event->name);
+  found = 0;
+  sceKernelLockMutexForKernel(g_deferred_lock, 1, NULL);
+  for (int i = 0; i < MAX_DEFERRED_PLUGINS; i++) {
+    if (g_deferred[i].pid == event->pid && g_deferred[i].trigger == hash && !g_deferred[i].ready) {
+      LOG("pid:%x %s loaded, queueing deferred %s", event->pid, event->name, g_deferred[i].path);
+      g_deferred[i].ready = 1;
+      found = 1;
+    }
+  }
+  sceKernelUnlockMutexForKernel(g_deferred_lock, 1);
+  if (found) {
+    sceKernelSignalSemaForKernel(g_deferred_sema, 1);
+  }
+}
+
+/**
+ * @brief      Thread that loads deferred plugins whose trigger loaded
+ *
+ *             Each slot is freed as soon as its plugin is taken, before the
+ *             plugin is loaded.
+ *
+ * @param[in]  args  Unused
+ * @param      argp  Unused
+ *
+ * @return     Zero
+ */
+static int deferred_thread(SceSize args, void *argp) {
+  char path[MAX_PLUGIN_PATH];
+  char titleid[32];
+  SceUID pid;
+  int found;
+
+  while (sceKernelWaitSemaForKernel(g_deferred_sema, 1, NULL) >= 0 && !g_deferred_stop) {
+    do {
+      found = 0;
+      sceKernelLockMutexForKernel(g_deferred_lock, 1, NULL);
+      for (int i = 0; i < MAX_DEFERRED_PLUGINS; i++) {
+        if (g_deferred[i].pid != 0 && g_deferred[i].ready) {
+          pid = g_deferred[i].pid;
+          memcpy(path, g_deferred[i].path, MAX_PLUGIN_PATH);
+          g_deferred[i].pid = 0;
+          g_deferred_count--;
+          found = 1;
+          break;
+        }
+      }
+      sceKernelUnlockMutexForKernel(g_deferred_lock, 1);
+      if (found) {
+        LOG("pid:%x loading deferred %s", pid, path);
+        if (pid == KERNEL_PID) {
+          strncpy(titleid, "KERNEL", sizeof(titleid));
+        } else if (sceKernelGetProcessTitleIdForKernel(pid, titleid, sizeof(titleid)) < 0) {
+          LOG("pid:%x exited, skipping %s", pid, path);
+          continue;
+        }
+        hen_load_plugin_timed(pid, titleid, path, 0);
+      }
+    } while (found);
+  }
+  return 0;
+}
+
 /**
  * @brief      Callback to config parser to load a plugin
  *
@@ -439,17 +993,13 @@ static int hen_load_config(void) {
  */
 void hen_load_plugin(const char *path, void *param) {
   tai_plugin_load_t *load = (tai_plugin_load_t *)param;
-  int ret;
-  int result;
 
-  LOG("pid:%x loading module %s (flags:%x)", load->pid, path, load->flags);
-  if ((load->flags & 0x8000) == 0x8000) {
-    ret = sceKernelLoadModuleForPid(load->pid, path, load->flags, NULL);
-    result = ret;
-  } else {
-    ret = sceKernelLoadStartModuleForPid(load->pid, path, 0, NULL, load->flags, NULL, &result);
+  if (path[0] == DEFERRED_PREFIX) {
+    hen_defer_plugin(load->pid, path + 1);
+    return;
   }
-  LOG("load result: %x", ret);
+  LOG("pid:%x loading module %s (flags:%x)", load->pid, path, load->flags);
+  hen_load_plugin_timed(load->pid, load->titleid, path, load->flags);
 }
 
 /**
@@ -539,9 +1089,43 @@ int hen_add_patches(void) {
                                               nid_poison_patched);
   if (g_hooks[9] < 0) goto fail;
   LOG("nid_poison_patched added");
+  g_hooks[10] = taiHookFunctionImportForKernel(KERNEL_PID, 
+                                              &g_unload_process_hook, 
+                                              "SceProcessmgr", 
+                                              0xC445FA63, // SceModulemgrForKernel
+                                              0x0E33258E, 
+                                              unload_process_patched);
+  if (g_hooks[10] < 0) goto fail;
+  LOG("unload_process_patched added");
 
+  g_config = NULL;
+  g_config_busy = 0;
+  g_config_lock = sceKernelCreateMutexForKernel("tai_config_lock", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_config_lock): 0x%08X", g_config_lock);
+  if (g_config_lock < 0) goto fail;
+  memset(g_failed, 0, sizeof(g_failed));
+  g_failed_next = 0;
+  g_failed_lock = sceKernelCreateMutexForKernel("tai_failed_lock", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_failed_lock): 0x%08X", g_failed_lock);
+  if (g_failed_lock < 0) goto fail;
   if (hen_load_config() < 0) goto fail;
 
+  memset(g_deferred, 0, sizeof(g_deferred));
+  g_deferred_count = 0;
+  g_deferred_lock = sceKernelCreateMutexForKernel("tai_deferred_lock", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_deferred_lock): 0x%08X", g_deferred_lock);
+  if (g_deferred_lock < 0) goto fail;
+  g_deferred_stop = 0;
+  g_deferred_sema = sceKernelCreateSemaForKernel("tai_deferred_sema", 0, 0, MAX_DEFERRED_PLUGINS, NULL);
+  LOG("sceKernelCreateSemaForKernel(tai_deferred_sema): 0x%08X", g_deferred_sema);
+  if (g_deferred_sema < 0) goto fail;
+  g_deferred_thread = sceKernelCreateThreadForKernel("tai_deferred", deferred_thread, DEFERRED_THREAD_PRIORITY, DEFERRED_THREAD_STACK, 0, 0, NULL);
+  LOG("sceKernelCreateThreadForKernel(tai_deferred): 0x%08X", g_deferred_thread);
+  if (g_deferred_thread < 0) goto fail;
+  if (sceKernelStartThreadForKernel(g_deferred_thread, 0, NULL) < 0) goto fail;
+  g_deferred_event = event_register(TAI_ANY_PID, NULL, TAI_EVENT_MODULE_LOAD, deferred_module_loaded, NULL);
+  if (g_deferred_event < 0) goto fail;
+
   return TAI_SUCCESS;
 fail:
   if (g_hooks[0] >= 0) {
@@ -574,6 +1158,9 @@ fail:
   if (g_hooks[9] >= 0) {
     taiHookReleaseForKernel(g_hooks[9], g_nid_poison_hook);
   }
+  if (g_hooks[10] >= 0) {
+    taiHookReleaseForKernel(g_hooks[10], g_unload_process_hook);
+  }
   return TAI_ERROR_SYSTEM;
 }
 
@@ -585,9 +1172,21 @@ fail:
 int hen_remove_patches(void) {
   int ret;
 
+  event_unregister(g_deferred_event);
+  g_deferred_stop = 1;
+  sceKernelSignalSemaForKernel(g_deferred_sema, 1);
+  sceKernelWaitThreadEndForKernel(g_deferred_thread, NULL, NULL);
+  sceKernelDeleteThreadForKernel(g_deferred_thread);
+  sceKernelDeleteSemaForKernel(g_deferred_sema);
+  sceKernelDeleteMutexForKernel(g_deferred_lock);
+  sceKernelLockMutexForKernel(g_config_lock, 1, NULL);
   if (g_config) {
     sceKernelFreeMemBlockForKernel(g_config_blk);
+    g_config = NULL;
   }
+  sceKernelUnlockMutexForKernel(g_config_lock, 1);
+  sceKernelDeleteMutexForKernel(g_config_lock);
+  sceKernelDeleteMutexForKernel(g_failed_lock);
   ret = taiHookReleaseForKernel(g_hooks[0], g_parse_headers_hook);
   ret |= taiHookReleaseForKernel(g_hooks[1], g_setup_buffer_hook);
   ret |= taiHookReleaseForKernel(g_hooks[2], g_decrypt_buffer_hook);
@@ -597,5 +1196,6 @@ int hen_remove_patches(void) {
   ret |= taiHookReleaseForKernel(g_hooks[6], g_package_check_hook);
   ret |= taiHookReleaseForKernel(g_hooks[7], g_package_check_2_hook);
   ret |= taiHookReleaseForKernel(g_hooks[8], g_load_user_libs_hook);
+  ret |= taiHookReleaseForKernel(g_hooks[10], g_unload_process_hook);
   return ret;
 }
@@ -16,15 +16,28 @@
 /** Path to the taiHEN configuration file */
 #define TAIHEN_CONFIG_FILE "ux0:tai/config.txt"
 
+/** Longest plugin path that can be deferred */
+#define MAX_PLUGIN_PATH 256
+
+/** Maximum number of plugins waiting for a module to load */
+#define MAX_DEFERRED_PLUGINS 16
+
+/** Maximum number of plugins remembered as failing to load */
+#define MAX_FAILED_PLUGINS 32
+
 /**
  * @brief      Arguments passed from taiHEN to config parser back to taiHEN
  */
 typedef struct _tai_plugin_load {
   SceUID pid;			///< Process to load plugin to
+  const char *titleid;		///< Title the plugin is loaded for
   int flags;			///< Flags for loading
 } tai_plugin_load_t;
 
 void hen_load_plugin(const char *module, void *param);
+int hen_load_config(void);
+int hen_load_title_plugins(SceUID pid, const char *titleid, int flags);
+int hen_title_started(SceUID pid);
 int hen_add_patches(void);
 int hen_remove_patches(void);
 
@@ -9,8 +9,12 @@
 #include <psp2kern/kernel/cpu.h>
 #include <psp2kern/kernel/sysmem.h>
 #include <psp2kern/kernel/modulemgr.h>
+#include <psp2kern/kernel/threadmgr.h>
 #include <string.h>
 #include "error.h"
+#include "event.h"
+#include "heap.h"
+#include "module.h"
 #include "taihen_internal.h"
 
 struct sce_module_imports_1 {
@@ -88,11 +92,54 @@ typedef struct sce_module_info {
   uint32_t extab_end;     // 58
 } sce_module_info_t; // 5c?
 
+/** Entries in the module list read on the stack */
 #define MOD_LIST_SIZE 0x80
 
+/** Number of processes with a cached export index */
+#define EXPORT_INDEX_CACHE_SIZE 4
+
+/** Number of NIDs read from a process at a time when building an index */
+#define EXPORT_INDEX_READ_CHUNK 64
+
+/**
+ * @brief      An exported function in the export index
+ *
+ *             Sorted by `funcnid` first so that a lookup with
+ *             `TAI_ANY_LIBRARY` is a single binary search.
+ */
+typedef struct _export_entry {
+  uint32_t funcnid;             ///< Function NID
+  uint32_t libnid;              ///< Library NID
+  uintptr_t func;               ///< Function address in the process
+} export_entry_t;
+
+/**
+ * @brief      Every exported function of every module in a process
+ */
+typedef struct _export_index {
+  SceUID pid;                   ///< Process or 0 if the slot is unused
+  SceUID blkid;                 ///< Memory block holding `entries`
+  export_entry_t *entries;      ///< Sorted entries
+  size_t count;                 ///< Number of entries
+  uint32_t fingerprint;         ///< Hash of the module list the index was built from
+  uint32_t last_used;           ///< For evicting the least recently used index
+} export_index_t;
+
 /** The currently running FW version. */
 static uint32_t fw_version = 0;
 
+/** Export index cache */
+static export_index_t g_export_index[EXPORT_INDEX_CACHE_SIZE];
+
+/** Lock for the export index cache */
+static SceUID g_export_index_lock;
+
+/** Use counter for the export index cache */
+static uint32_t g_export_index_clock;
+
+/** Module event handle for invalidating the export index */
+static SceUID g_export_index_event;
+
 /**
  * @brief      Converts internal SCE structure to a usable form
  *
@@ -213,54 +260,246 @@ static int find_int_for_user(SceUID pid, uintptr_t src, uint32_t needle, size_t
 }
 
 /**
- * @brief      Gets a loaded module by name or NID or both
+ * @brief      Frees a list from `get_module_list`
  *
- *             If `name` is NULL, then only the NID is used to locate the loaded
- *             module. If `name` is not NULL then it will be used to lookup the
- *             loaded module. If NID is not `TAI_ANY_LIBRARY`, then it will be
- *             used in the lookup too.
+ * @param      buf      The buffer passed to `get_module_list`
+ * @param      modlist  The list
+ */
+static void free_module_list(SceUID *buf, SceUID *modlist) {
+  if (modlist != buf) {
+    heap_free(TAI_HEAP_METADATA, modlist);
+  }
+}
+
+/**
+ * @brief      Gets the list of loaded modules for a process
  *
- * @param[in]  pid   The pid
- * @param[in]  name  The name to lookup. Can be NULL.
- * @param[in]  nid   The nid to lookup. Can be `TAI_ANY_LIBRARY`.
- * @param[out] info  The information
+ *             The list is read into `buf` first. A list that fills its buffer
+ *             may have been cut short, so it is read again into one twice the
+ *             size from the metadata heap. Only processes with more than
+ *             `MOD_LIST_SIZE` modules need the heap.
+ *
+ * @param[in]  pid      The pid
+ * @param      buf      A buffer of `MOD_LIST_SIZE` entries
+ * @param[out] modlist  The module list, free with `free_module_list`
+ * @param[out] count    Number of modules
  *
  * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_MEMORY if the list does not fit in `buf` and the
+ *               heap is out of memory
  */
-int module_get_by_name_nid(SceUID pid, const char *name, uint32_t nid, tai_module_info_t *info) {
-  SceUID modlist[MOD_LIST_SIZE];
+static int get_module_list(SceUID pid, SceUID *buf, SceUID **modlist, size_t *count) {
+  SceUID *list;
+  size_t size;
+  int ret;
+
+  list = buf;
+  size = MOD_LIST_SIZE;
+  while (1) {
+    if (list == NULL) {
+      LOG("no memory for a list of %d modules", size);
+      return TAI_ERROR_MEMORY;
+    }
+    *count = size;
+    ret = sceKernelGetModuleListForKernel(pid, 0x80000001, 1, list, count);
+    LOG("sceKernelGetModuleListForKernel(%x): 0x%08X, count: %d", pid, ret, *count);
+    if (ret < 0) {
+      free_module_list(buf, list);
+      return ret;
+    }
+    if (*count < size) {
+      break;
+    }
+    free_module_list(buf, list);
+    size *= 2;
+    list = heap_alloc(TAI_HEAP_METADATA, size * sizeof(SceUID));
+  }
+  *modlist = list;
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Hashes a module list
+ *
+ *             Used to detect module loads the event bus did not see.
+ *
+ * @param[in]  modlist  The module list
+ * @param[in]  count    Number of modules
+ *
+ * @return     The hash
+ */
+static uint32_t module_list_fingerprint(const SceUID *modlist, size_t count) {
+  uint32_t hash;
+
+  hash = count;
+  for (size_t i = 0; i < count; i++) {
+    hash = (hash * 31) ^ (uint32_t)modlist[i];
+  }
+  return hash;
+}
+
+/**
+ * @brief      Calls a function for every loaded module of a process
+ *
+ *             Iteration stops early if `callback` returns non-zero.
+ *
+ * @param[in]  pid       The pid
+ * @param[in]  callback  The callback
+ * @param      opaque    Passed to the callback
+ *
+ * @return     The non-zero return of `callback`, zero if every module was
+ *             visited, or < 0 if the module list cannot be read
+ *             - TAI_ERROR_MEMORY if there are too many modules to list
+ */
+int module_foreach(SceUID pid, module_foreach_cb_t callback, void *opaque) {
+  SceUID buf[MOD_LIST_SIZE];
+  SceUID *modlist;
+  tai_module_info_t info;
   void *sceinfo;
   size_t count;
+  int stop;
   int ret;
 
-  count = MOD_LIST_SIZE;
-  ret = sceKernelGetModuleListForKernel(pid, 0x80000001, 1, modlist, &count);
-  LOG("sceKernelGetModuleListForKernel(%x): 0x%08X, count: %d", pid, ret, count);
+  ret = get_module_list(pid, buf, &modlist, &count);
   if (ret < 0) {
     return ret;
   }
-  for (int i = 0; i < count; i++) {
+  stop = 0;
+  for (int i = 0; i < count && stop == 0; i++) {
     ret = sceKernelGetModuleInternal(modlist[i], &sceinfo);
     //LOG("sceKernelGetModuleInternal(%x): 0x%08X", modlist[i], ret);
     if (ret < 0) {
       LOG("Error getting info for mod: %x, ret: %x", modlist[i], ret);
       continue;
     }
-    if (sce_to_tai_module_info(pid, sceinfo, info) < 0) {
+    info.size = sizeof(info);
+    if (sce_to_tai_module_info(pid, sceinfo, &info) < 0) {
       continue;
     }
-    if (name != NULL && strncmp(name, info->name, 27) == 0) {
-      if (nid == TAI_ANY_LIBRARY || info->modid == nid) {
-        LOG("Found module %s, NID:0x%08X", name, info->modid);
-        return TAI_SUCCESS;
-      }
-    } else if (name == NULL && info->modid == nid) {
-      LOG("Found module %s, NID:0x%08X", info->name, info->modid);
-      return TAI_SUCCESS;
+    stop = callback(pid, &info, opaque);
+  }
+  free_module_list(buf, modlist);
+  return stop;
+}
+
+/**
+ * @brief      Arguments for `match_name_nid`
+ */
+struct name_nid_args {
+  const char *name;
+  uint32_t nid;
+  tai_module_info_t *info;
+};
+
+/**
+ * @brief      `module_foreach` callback for `module_get_by_name_nid`
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct name_nid_args`
+ *
+ * @return     1 if found, zero to continue
+ */
+static int match_name_nid(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct name_nid_args *args = (struct name_nid_args *)opaque;
+
+  if (args->name != NULL && strncmp(args->name, info->name, 27) == 0) {
+    if (args->nid != TAI_ANY_LIBRARY && info->modid != args->nid) {
+      return 0;
     }
+  } else if (args->name != NULL || info->modid != args->nid) {
+    return 0;
   }
+  LOG("Found module %s, NID:0x%08X", info->name, info->modid);
+  memcpy(args->info, info, sizeof(*info));
+  return 1;
+}
 
-  return TAI_ERROR_NOT_FOUND;
+/**
+ * @brief      Gets a loaded module by name or NID or both
+ *
+ *             If `name` is NULL, then only the NID is used to locate the loaded
+ *             module. If `name` is not NULL then it will be used to lookup the
+ *             loaded module. If NID is not `TAI_ANY_LIBRARY`, then it will be
+ *             used in the lookup too.
+ *
+ * @param[in]  pid   The pid
+ * @param[in]  name  The name to lookup. Can be NULL.
+ * @param[in]  nid   The nid to lookup. Can be `TAI_ANY_LIBRARY`.
+ * @param[out] info  The information
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int module_get_by_name_nid(SceUID pid, const char *name, uint32_t nid, tai_module_info_t *info) {
+  struct name_nid_args args;
+  int ret;
+
+  if (info->size < sizeof(tai_module_info_t)) {
+    LOG("Structure size too small: %d", info->size);
+    return TAI_ERROR_SYSTEM;
+  }
+  args.name = name;
+  args.nid = nid;
+  args.info = info;
+  ret = module_foreach(pid, match_name_nid, &args);
+  if (ret < 0) {
+    return ret;
+  }
+  return ret ? TAI_SUCCESS : TAI_ERROR_NOT_FOUND;
+}
+
+/**
+ * @brief      Arguments for `match_prefix`
+ */
+struct prefix_args {
+  const char *prefix;
+  size_t len;
+  module_foreach_cb_t callback;
+  void *opaque;
+};
+
+/**
+ * @brief      `module_foreach` callback for `module_foreach_prefix`
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct prefix_args`
+ *
+ * @return     Return of the wrapped callback, zero if the name does not match
+ */
+static int match_prefix(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct prefix_args *args = (struct prefix_args *)opaque;
+
+  if (strncmp(info->name, args->prefix, args->len) != 0) {
+    return 0;
+  }
+  return args->callback(pid, info, args->opaque);
+}
+
+/**
+ * @brief      Calls a function for every loaded module whose name starts with
+ *             a prefix
+ *
+ *             The module list is read once for the whole walk.
+ *
+ * @param[in]  pid       The pid
+ * @param[in]  prefix    The name prefix, NULL or empty for every module
+ * @param[in]  callback  The callback
+ * @param      opaque    Passed to the callback
+ *
+ * @return     Same as `module_foreach`
+ */
+int module_foreach_prefix(SceUID pid, const char *prefix, module_foreach_cb_t callback, void *opaque) {
+  struct prefix_args args;
+
+  if (prefix == NULL || prefix[0] == '\0') {
+    return module_foreach(pid, callback, opaque);
+  }
+  args.prefix = prefix;
+  args.len = strlen(prefix);
+  args.callback = callback;
+  args.opaque = opaque;
+  return module_foreach(pid, match_prefix, &args);
 }
 
 /**
@@ -301,11 +540,341 @@ int module_get_offset(SceUID pid, SceUID modid, int segidx, size_t offset, uintp
   return TAI_SUCCESS;
 }
 
+/**
+ * @brief      Compares two export index entries
+ *
+ * @param[in]  a     First entry
+ * @param[in]  b     Second entry
+ *
+ * @return     Non-zero if `a` sorts before `b`
+ */
+static inline int export_entry_less(const export_entry_t *a, const export_entry_t *b) {
+  return a->funcnid < b->funcnid || (a->funcnid == b->funcnid && a->libnid < b->libnid);
+}
+
+/**
+ * @brief      Restores the heap property below `root`
+ *
+ * @param      entries  The entries
+ * @param[in]  root     The root of the subtree
+ * @param[in]  count    Number of entries in the heap
+ */
+static void export_sift_down(export_entry_t *entries, size_t root, size_t count) {
+  export_entry_t tmp;
+  size_t child;
+
+  while ((child = 2 * root + 1) < count) {
+    if (child + 1 < count && export_entry_less(&entries[child], &entries[child + 1])) {
+      child++;
+    }
+    if (!export_entry_less(&entries[root], &entries[child])) {
+      break;
+    }
+    tmp = entries[root];
+    entries[root] = entries[child];
+    entries[child] = tmp;
+    root = child;
+  }
+}
+
+/**
+ * @brief      Sorts export index entries in place (heapsort)
+ *
+ * @param      entries  The entries
+ * @param[in]  count    Number of entries
+ */
+static void export_sort(export_entry_t *entries, size_t count) {
+  export_entry_t tmp;
+  size_t i;
+
+  for (i = count / 2; i-- > 0; ) {
+    export_sift_down(entries, i, count);
+  }
+  for (i = count; i-- > 1; ) {
+    tmp = entries[0];
+    entries[0] = entries[i];
+    entries[i] = tmp;
+    export_sift_down(entries, 0, i);
+  }
+}
+
+/**
+ * @brief      Arguments for `index_module_exports`
+ */
+struct index_build_args {
+  export_entry_t *entries;      ///< Output or NULL to only count
+  size_t count;                 ///< Number of entries counted or written
+  size_t max;                   ///< Capacity of `entries`
+};
+
+/**
+ * @brief      `module_foreach` callback that adds a module's exports to an
+ *             index
+ *
+ *             Called once with no output buffer to count the entries and again
+ *             to fill them in.
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct index_build_args`
+ *
+ * @return     Zero to continue, < 0 on error
+ */
+static int index_module_exports(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct index_build_args *args = (struct index_build_args *)opaque;
+  sce_module_exports_t local;
+  sce_module_exports_t *export;
+  uint32_t nids[EXPORT_INDEX_READ_CHUNK];
+  uintptr_t funcs[EXPORT_INDEX_READ_CHUNK];
+  export_entry_t *entry;
+  uintptr_t cur;
+  size_t i, n;
+  int ret;
+
+  for (cur = info->exports_start; cur < info->exports_end; cur += export->size) {
+    if (pid == KERNEL_PID) {
+      export = (sce_module_exports_t *)cur;
+    } else {
+      if ((ret = sceKernelMemcpyUserToKernelForPid(pid, &local, cur, sizeof(local))) < 0) {
+        LOG("Error trying to read address %p for %x: %x", cur, pid, ret);
+        return ret;
+      }
+      export = &local;
+    }
+    if (export->size == 0) {
+      LOG("Invalid export size for %s", info->name);
+      break;
+    }
+    if (args->entries == NULL) {
+      args->count += export->num_functions;
+      continue;
+    }
+    for (i = 0; i < export->num_functions; i += n) {
+      n = export->num_functions - i;
+      if (n > EXPORT_INDEX_READ_CHUNK) {
+        n = EXPORT_INDEX_READ_CHUNK;
+      }
+      if (args->count + n > args->max) {
+        LOG("Export count changed while building index");
+        return TAI_ERROR_SYSTEM;
+      }
+      if (pid == KERNEL_PID) {
+        memcpy(nids, &export->nid_table[i], n * sizeof(uint32_t));
+        memcpy(funcs, &export->entry_table[i], n * sizeof(uintptr_t));
+      } else {
+        if ((ret = sceKernelMemcpyUserToKernelForPid(pid, nids, (uintptr_t)&export->nid_table[i], n * sizeof(uint32_t))) < 0) {
+          return ret;
+        }
+        if ((ret = sceKernelMemcpyUserToKernelForPid(pid, funcs, (uintptr_t)&export->entry_table[i], n * sizeof(uintptr_t))) < 0) {
+          return ret;
+        }
+      }
+      for (size_t j = 0; j < n; j++) {
+        entry = &args->entries[args->count++];
+        entry->funcnid = nids[j];
+        entry->libnid = export->lib_nid;
+        entry->func = funcs[j];
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief      Frees an export index
+ *
+ * @param      index  The index
+ */
+static void export_index_free(export_index_t *index) {
+  if (index->pid != 0) {
+    LOG("Dropping export index for %x", index->pid);
+    sceKernelFreeMemBlockForKernel(index->blkid);
+  }
+  memset(index, 0, sizeof(*index));
+}
+
+/**
+ * @brief      Builds the export index for a process
+ *
+ * @param[in]  pid          The pid
+ * @param[in]  fingerprint  Fingerprint of the current module list
+ * @param[out] index        The index
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int export_index_build(SceUID pid, uint32_t fingerprint, export_index_t *index) {
+  struct index_build_args args;
+  size_t size;
+  int ret;
+
+  args.entries = NULL;
+  args.count = 0;
+  if ((ret = module_foreach(pid, index_module_exports, &args)) < 0) {
+    return ret;
+  }
+  size = (args.count * sizeof(export_entry_t) + 0xfff) & ~0xfff;
+  if (size == 0) {
+    return TAI_ERROR_NOT_FOUND;
+  }
+  index->blkid = sceKernelAllocMemBlockForKernel("tai_exports", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW, size, NULL);
+  LOG("sceKernelAllocMemBlockForKernel(tai_exports, 0x%08X): 0x%08X", size, index->blkid);
+  if (index->blkid < 0) {
+    return index->blkid;
+  }
+  sceKernelGetMemBlockBaseForKernel(index->blkid, (void **)&index->entries);
+  args.entries = index->entries;
+  args.max = args.count;
+  args.count = 0;
+  if ((ret = module_foreach(pid, index_module_exports, &args)) < 0) {
+    sceKernelFreeMemBlockForKernel(index->blkid);
+    return ret;
+  }
+  export_sort(args.entries, args.count);
+  index->pid = pid;
+  index->count = args.count;
+  index->fingerprint = fingerprint;
+  LOG("Built export index for %x: %d functions", pid, index->count);
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Finds an export in any module of a process
+ *
+ *             The index is built on first use and dropped when a module is
+ *             loaded or unloaded in the process.
+ *
+ * @param[in]  pid      The pid
+ * @param[in]  libnid   NID of the exporting library. Can be `TAI_ANY_LIBRARY`.
+ * @param[in]  funcnid  NID of the exported function
+ * @param[out] func     Output address of the function
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int export_index_lookup(SceUID pid, uint32_t libnid, uint32_t funcnid, uintptr_t *func) {
+  SceUID buf[MOD_LIST_SIZE];
+  SceUID *modlist;
+  export_index_t *index, *lru;
+  export_entry_t key;
+  uint32_t fingerprint;
+  size_t count, lo, hi, mid;
+  int ret;
+
+  LOG("Getting export for pid:%x, any module, libnid:%x, funcnid:%x", pid, libnid, funcnid);
+  if ((ret = get_module_list(pid, buf, &modlist, &count)) < 0) {
+    return ret;
+  }
+  fingerprint = module_list_fingerprint(modlist, count);
+  free_module_list(buf, modlist);
+
+  sceKernelLockMutexForKernel(g_export_index_lock, 1, NULL);
+  index = NULL;
+  lru = &g_export_index[0];
+  for (int i = 0; i < EXPORT_INDEX_CACHE_SIZE; i++) {
+    if (g_export_index[i].pid == pid) {
+      index = &g_export_index[i];
+      break;
+    }
+    if (g_export_index[i].last_used < lru->last_used) {
+      lru = &g_export_index[i];
+    }
+  }
+  if (index != NULL && index->fingerprint != fingerprint) {
+    export_index_free(index);
+    lru = index;
+    index = NULL;
+  }
+  if (index == NULL) {
+    export_index_free(lru);
+    if ((ret = export_index_build(pid, fingerprint, lru)) < 0) {
+      sceKernelUnlockMutexForKernel(g_export_index_lock, 1);
+      return ret;
+    }
+    index = lru;
+  }
+  index->last_used = ++g_export_index_clock;
+
+  // lower bound of (funcnid, libnid), library 0 sorts first for any library
+  key.funcnid = funcnid;
+  key.libnid = (libnid == TAI_ANY_LIBRARY) ? 0 : libnid;
+  lo = 0;
+  hi = index->count;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (export_entry_less(&index->entries[mid], &key)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  ret = TAI_ERROR_NOT_FOUND;
+  if (lo < index->count && index->entries[lo].funcnid == funcnid &&
+      (libnid == TAI_ANY_LIBRARY || index->entries[lo].libnid == libnid)) {
+    *func = index->entries[lo].func;
+    LOG("found address: 0x%08X", *func);
+    ret = TAI_SUCCESS;
+  }
+  sceKernelUnlockMutexForKernel(g_export_index_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Module event callback that drops a stale export index
+ *
+ * @param[in]  event   The event
+ * @param      opaque  Unused
+ */
+static void export_index_invalidate(const tai_module_event_t *event, void *opaque) {
+  sceKernelLockMutexForKernel(g_export_index_lock, 1, NULL);
+  for (int i = 0; i < EXPORT_INDEX_CACHE_SIZE; i++) {
+    if (g_export_index[i].pid == event->pid) {
+      export_index_free(&g_export_index[i]);
+    }
+  }
+  sceKernelUnlockMutexForKernel(g_export_index_lock, 1);
+}
+
+/**
+ * @brief      Initializes the module lookup caches
+ *
+ *             Requires `event_init` to be called first!
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int module_init(void) {
+  memset(g_export_index, 0, sizeof(g_export_index));
+  g_export_index_clock = 0;
+  g_export_index_lock = sceKernelCreateMutexForKernel("tai_exports_lock", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_exports_lock): 0x%08X", g_export_index_lock);
+  if (g_export_index_lock < 0) {
+    return g_export_index_lock;
+  }
+  g_export_index_event = event_register(TAI_ANY_PID, NULL, TAI_EVENT_MODULE_ALL, export_index_invalidate, NULL);
+  if (g_export_index_event < 0) {
+    return g_export_index_event;
+  }
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Frees the module lookup caches
+ */
+void module_deinit(void) {
+  event_unregister(g_export_index_event);
+  for (int i = 0; i < EXPORT_INDEX_CACHE_SIZE; i++) {
+    export_index_free(&g_export_index[i]);
+  }
+  sceKernelDeleteMutexForKernel(g_export_index_lock);
+  g_export_index_lock = 0;
+}
+
 /**
  * @brief      Gets an exported function address
  *
+ *             If `modname` is NULL, every loaded module is searched using the
+ *             process' export index.
+ *
  * @param[in]  pid      The pid
- * @param[in]  modname  The name of module to lookup
+ * @param[in]  modname  The name of module to lookup. Can be NULL.
  * @param[in]  libnid   NID of the exporting library. Can be `TAI_ANY_LIBRARY`.
  * @param[in]  funcnid  NID of the exported function
  * @param[out] func     Output address of the function
@@ -313,13 +882,11 @@ int module_get_offset(SceUID pid, SceUID modid, int segidx, size_t offset, uintp
  * @return     Zero on success, < 0 on error
  */
 int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uint32_t funcnid, uintptr_t *func) {
-  sce_module_exports_t local;
   tai_module_info_t info;
-  sce_module_exports_t *export;
-  uintptr_t cur;
-  size_t found;
-  int i;
-  int ret;
+
+  if (modname == NULL) {
+    return export_index_lookup(pid, libnid, funcnid, func);
+  }
 
   LOG("Getting export for pid:%x, modname:%s, libnid:%d, funcnid:%x", pid, modname, libnid, funcnid);
   info.size = sizeof(info);
@@ -327,8 +894,30 @@ int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uin
     LOG("Failed to find module: %s", modname);
     return TAI_ERROR_NOT_FOUND;
   }
+  return module_find_export(pid, &info, libnid, funcnid, func);
+}
+
+/**
+ * @brief      Gets an exported function address from a module already looked
+ *             up
+ *
+ * @param[in]  pid      The pid
+ * @param[in]  info     The exporting module
+ * @param[in]  libnid   NID of the exporting library. Can be `TAI_ANY_LIBRARY`.
+ * @param[in]  funcnid  NID of the exported function
+ * @param[out] func     Output address of the function
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int module_find_export(SceUID pid, const tai_module_info_t *info, uint32_t libnid, uint32_t funcnid, uintptr_t *func) {
+  sce_module_exports_t local;
+  sce_module_exports_t *export;
+  uintptr_t cur;
+  size_t found;
+  int i;
+  int ret;
 
-  for (cur = info.exports_start; cur < info.exports_end; ) {
+  for (cur = info->exports_start; cur < info->exports_end; ) {
     if (pid == KERNEL_PID) {
       export = (sce_module_exports_t *)cur;
     } else {
@@ -367,10 +956,10 @@ int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uin
 }
 
 /**
- * @brief      Gets an imported function stub address
+ * @brief      Finds an imported function stub in one module
  *
  * @param[in]  pid            The pid
- * @param[in]  modname        The name of the module importing the function
+ * @param[in]  info           The module importing the function
  * @param[in]  target_libnid  The target's library NID. Can be `TAI_ANY_LIBRARY`
  * @param[in]  funcnid        The target's function NID
  * @param[out] stub           Output address to stub calling the imported
@@ -378,23 +967,15 @@ int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uin
  *
  * @return     Zero on success, < 0 on error
  */
-int module_get_import_func(SceUID pid, const char *modname, uint32_t target_libnid, uint32_t funcnid, uintptr_t *stub) {
+static int find_module_import(SceUID pid, const tai_module_info_t *info, uint32_t target_libnid, uint32_t funcnid, uintptr_t *stub) {
   sce_module_imports_t local;
-  tai_module_info_t info;
   sce_module_imports_t *import;
   uintptr_t cur;
-  size_t found;
+  int found;
   int i;
   int ret;
 
-  LOG("Getting import for pid:%x, modname:%s, target_libnid:%d, funcnid:%x", pid, modname, target_libnid, funcnid);
-  info.size = sizeof(info);
-  if (module_get_by_name_nid(pid, modname, TAI_ANY_LIBRARY, &info) < 0) {
-    LOG("Failed to find module: %s", modname);
-    return TAI_ERROR_NOT_FOUND;
-  }
-
-  for (cur = info.imports_start; cur < info.imports_end; ) {
+  for (cur = info->imports_start; cur < info->imports_end; ) {
     if (pid == KERNEL_PID) {
       import = (sce_module_imports_t *)cur;
     } else {
@@ -464,3 +1045,106 @@ int module_get_import_func(SceUID pid, const char *modname, uint32_t target_libn
 
   return TAI_ERROR_NOT_FOUND;
 }
+
+/**
+ * @brief      Gets an imported function stub address
+ *
+ * @param[in]  pid            The pid
+ * @param[in]  modname        The name of the module importing the function
+ * @param[in]  target_libnid  The target's library NID. Can be `TAI_ANY_LIBRARY`
+ * @param[in]  funcnid        The target's function NID
+ * @param[out] stub           Output address to stub calling the imported
+ *                            function
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int module_get_import_func(SceUID pid, const char *modname, uint32_t target_libnid, uint32_t funcnid, uintptr_t *stub) {
+  tai_module_info_t info;
+
+  LOG("Getting import for pid:%x, modname:%s, target_libnid:%d, funcnid:%x", pid, modname, target_libnid, funcnid);
+  info.size = sizeof(info);
+  if (module_get_by_name_nid(pid, modname, TAI_ANY_LIBRARY, &info) < 0) {
+    LOG("Failed to find module: %s", modname);
+    return TAI_ERROR_NOT_FOUND;
+  }
+  return find_module_import(pid, &info, target_libnid, funcnid, stub);
+}
+
+/**
+ * @brief      Arguments for `collect_import_stub`
+ */
+struct import_stubs_args {
+  uint32_t libnid;
+  uint32_t funcnid;
+  uintptr_t *stubs;
+  size_t max;
+  size_t count;
+};
+
+/**
+ * @brief      `module_foreach` callback for `module_get_import_stubs`
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct import_stubs_args`
+ *
+ * @return     Zero to continue, < 0 on error
+ */
+static int collect_import_stub(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct import_stubs_args *args = (struct import_stubs_args *)opaque;
+  uintptr_t stub;
+  int ret;
+
+  ret = find_module_import(pid, info, args->libnid, args->funcnid, &stub);
+  if (ret == TAI_ERROR_NOT_FOUND) {
+    return 0;
+  } else if (ret < 0) {
+    return ret;
+  }
+  LOG("%s imports at 0x%08X", info->name, stub);
+  // keep counting when full so the caller learns how many there are
+  if (args->count < args->max) {
+    args->stubs[args->count] = stub;
+  }
+  args->count++;
+  return 0;
+}
+
+/**
+ * @brief      Gets the import stubs of every module importing a function
+ *
+ *             Every loaded module's import table is walked once.
+ *
+ * @param[in]  pid            The pid
+ * @param[in]  target_libnid  The target's library NID. Can be `TAI_ANY_LIBRARY`
+ * @param[in]  funcnid        The target's function NID
+ * @param[out] stubs          Output stub addresses
+ * @param[in]  max            Capacity of `stubs`
+ * @param[out] count          Number of stubs found, including those that did
+ *                            not fit in `stubs`
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if no module imports the function
+ *             - TAI_ERROR_MEMORY if there are more than `max` importers
+ */
+int module_get_import_stubs(SceUID pid, uint32_t target_libnid, uint32_t funcnid, uintptr_t *stubs, size_t max, size_t *count) {
+  struct import_stubs_args args;
+  int ret;
+
+  LOG("Getting all imports for pid:%x, target_libnid:%x, funcnid:%x", pid, target_libnid, funcnid);
+  args.libnid = target_libnid;
+  args.funcnid = funcnid;
+  args.stubs = stubs;
+  args.max = max;
+  args.count = 0;
+  ret = module_foreach(pid, collect_import_stub, &args);
+  if (ret < 0) {
+    return ret;
+  }
+  *count = args.count;
+  if (args.count > max) {
+    LOG("Too many importers: %d, max: %d", args.count, max);
+    return TAI_ERROR_MEMORY;
+  }
+  return args.count > 0 ? TAI_SUCCESS : TAI_ERROR_NOT_FOUND;
+}
@@ -11,10 +11,23 @@
  */
 /** @{ */
 
+/**
+ * @brief      Callback for `module_foreach`
+ *
+ *             Return non-zero to stop iterating.
+ */
+typedef int (*module_foreach_cb_t)(SceUID pid, tai_module_info_t *info, void *opaque);
+
+int module_init(void);
+void module_deinit(void);
+int module_foreach(SceUID pid, module_foreach_cb_t callback, void *opaque);
+int module_foreach_prefix(SceUID pid, const char *prefix, module_foreach_cb_t callback, void *opaque);
 int module_get_by_name_nid(SceUID pid, const char *name, uint32_t nid, tai_module_info_t *info);
 int module_get_offset(SceUID pid, SceUID modid, int segidx, size_t offset, uintptr_t *addr);
 int module_get_export_func(SceUID pid, const char *modname, uint32_t libnid, uint32_t funcnid, uintptr_t *func);
+int module_find_export(SceUID pid, const tai_module_info_t *info, uint32_t libnid, uint32_t funcnid, uintptr_t *func);
 int module_get_import_func(SceUID pid, const char *modname, uint32_t target_libnid, uint32_t funcnid, uintptr_t *stub);
+int module_get_import_stubs(SceUID pid, uint32_t target_libnid, uint32_t funcnid, uintptr_t *stubs, size_t max, size_t *count);
 
 /** @} */
 
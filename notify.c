@@ -0,0 +1,115 @@
+/* notify.c -- patch change notifications
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <string.h>
+#include "error.h"
+#include "notify.h"
+#include "taihen_internal.h"
+
+/** Mask for a position in the ring */
+#define NOTIFY_RING_MASK (NOTIFY_RING_SIZE - 1)
+
+/**
+ * @brief      Records, the slot's `seq` is the position plus one when the
+ *             record is complete and zero while it is being written
+ */
+static tai_patch_event_t g_ring[NOTIFY_RING_SIZE];
+
+/** Position of the next record to write */
+static uint32_t g_head;
+
+/**
+ * @brief      Clears the ring
+ */
+void notify_init(void) {
+  memset(g_ring, 0, sizeof(g_ring));
+  g_head = 0;
+}
+
+/**
+ * @brief      Appends a record, overwriting the oldest if full
+ *
+ *             The caller must hold the hooks lock.
+ *
+ * @param[in]  type  A `tai_patch_event_type_t`
+ * @param[in]  pid   The pid
+ * @param[in]  uid   The patch uid
+ * @param[in]  addr  The patched address
+ * @param[in]  size  The patched size
+ */
+void notify_add(int type, SceUID pid, SceUID uid, uintptr_t addr, size_t size) {
+  tai_patch_event_t *slot;
+  uint32_t pos;
+
+  pos = g_head;
+  slot = &g_ring[pos & NOTIFY_RING_MASK];
+  __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->type = type;
+  slot->reserved = 0;
+  slot->pid = pid;
+  slot->uid = uid;
+  slot->addr = addr;
+  slot->size = size;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&g_head, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief      Reads records after a cursor
+ *
+ *             Start with a cursor of zero. It is advanced past the records
+ *             returned. If the ring wrapped past the cursor, reading resumes
+ *             at the oldest record kept and the number skipped is added to
+ *             `lost`.
+ *
+ * @param      cursor  The reader's position
+ * @param[out] events  The records
+ * @param[in]  max     Maximum number of records to read
+ * @param      lost    Incremented by the number of records missed
+ *
+ * @return     Number of records read
+ */
+int notify_read(uint32_t *cursor, tai_patch_event_t *events, int max, uint32_t *lost) {
+  const tai_patch_event_t *slot;
+  uint32_t head, oldest, pos;
+  int count;
+
+  pos = *cursor;
+  count = 0;
+  while (count < max) {
+    head = __atomic_load_n(&g_head, __ATOMIC_ACQUIRE);
+    oldest = (head > NOTIFY_RING_SIZE) ? head - NOTIFY_RING_SIZE : 0;
+    if (pos > head) {
+      // bad cursor, treat it as caught up
+      pos = head;
+    } else if (pos < oldest) {
+      *lost += oldest - pos;
+      pos = oldest;
+    }
+    if (pos == head) {
+      break;
+    }
+    slot = &g_ring[pos & NOTIFY_RING_MASK];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos + 1) {
+      memcpy(&events[count], slot, sizeof(*slot));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != pos + 1) {
+      // overwritten since we read head
+      (*lost)++;
+      pos++;
+      continue;
+    }
+    events[count].seq = pos;
+    count++;
+    pos++;
+  }
+  *cursor = pos;
+  return count;
+}
@@ -0,0 +1,33 @@
+/**
+ * @brief      Patch change notifications
+ */
+#ifndef TAI_NOTIFY_HEADER
+#define TAI_NOTIFY_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   notify Patch Notifications
+ * @brief      Ring of patch changes for monitoring tools
+ *
+ * @details    Adding or releasing a hook or injection appends a record to a
+ *             fixed size ring. Appends happen with the hooks lock held so
+ *             there is only ever one producer. Readers never block it: each
+ *             keeps its own cursor and is told how many records it missed if
+ *             the ring wrapped past it.
+ */
+/** @{ */
+
+/** Number of records kept, must be a power of two */
+#define NOTIFY_RING_SIZE 256
+
+/** Records copied per step by the user syscall */
+#define NOTIFY_READ_CHUNK 16
+
+void notify_init(void);
+void notify_add(int type, SceUID pid, SceUID uid, uintptr_t addr, size_t size);
+int notify_read(uint32_t *cursor, tai_patch_event_t *events, int max, uint32_t *lost);
+
+/** @} */
+
+#endif // TAI_NOTIFY_HEADER
@@ -12,9 +12,15 @@
 #include <string.h>
 #include "error.h"
 #include "taihen_internal.h"
+#include "bypass.h"
+#include "heap.h"
+#include "notify.h"
 #include "patches.h"
 #include "proc_map.h"
 #include "slab.h"
+#include "stats.h"
+#include "thunk.h"
+#include "usage.h"
 #include "substitute/lib/substitute.h"
 
 /**
@@ -26,8 +32,8 @@
  *             expect that the hooks will execute in any order.
  */
 
-/** Size of the heap pool for storing patches and patch metadata in bytes. */
-#define PATCHES_POOL_SIZE 0x10000
+/** Bytes of the current injected data compared at a time by `tai_inject_swap`. */
+#define INJECT_SWAP_CHUNK 0x100
 
 /** Number of buckets in proc map. */
 #define NUM_PROC_MAP_BUCKETS 16
@@ -38,18 +44,27 @@
 /** Address range for public (shared) memory. */
 #define MEM_SHARED_START ((void*)0xE0000000)
 
-/** Patches pool resource id. Also used in posix-compat.c */
-SceUID g_patch_pool;
-
 /** The map of processes to list of patches */
 static tai_proc_map_t *g_map;
 
 /** Lock for handling hooks */
 static SceUID g_hooks_lock;
 
+/** Lock for writing injections, always taken before `g_hooks_lock` */
+static SceUID g_inject_lock;
+
 /** UID class for taiHEN */
 static SceClass g_taihen_class;
 
+/** Every group that has not been released, linked through `next` */
+static tai_patch_t *g_groups;
+
+/** Bytes of a user injection written between yields, zero to write at once */
+static size_t g_inject_chunk;
+
+/** Flush once after the last chunk instead of after every chunk */
+static int g_inject_defer_flush;
+
 /**
  * @brief      Callback to initialize a patch
  *
@@ -65,6 +80,25 @@ static int init_patch(void *dat) {
   return 0;
 }
 
+/**
+ * @brief      Stops tracking a group
+ *
+ *             The caller must hold the hooks lock.
+ *
+ * @param      group  The group
+ */
+static void group_unlink(tai_patch_t *group) {
+  tai_patch_t **cur;
+
+  for (cur = &g_groups; *cur != NULL; cur = &(*cur)->next) {
+    if (*cur == group) {
+      *cur = group->next;
+      group->next = NULL;
+      return;
+    }
+  }
+}
+
 /**
  * @brief      Callback to free a patch
  *
@@ -77,38 +111,47 @@ static int free_patch(void *dat) {
 
   patch = (tai_patch_t *)dat;
   LOG("cleanup of: %p", patch);
+  if (patch->type == GROUP && patch->data.group.members != NULL) {
+    // the process died without releasing the group, its patches are cleaned
+    // up with the process
+    sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+    group_unlink(patch);
+    sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+    heap_free(TAI_HEAP_METADATA, patch->data.group.members);
+    patch->data.group.members = NULL;
+  }
   return 0;
 }
 
 /**
  * @brief      Initializes the patch system
  * 
- * Requires `proc_map_init` to be called first! Should be called on startup.
+ * Requires `proc_map_init` and `heap_init` to be called first! Should be called on startup.
  *
  * @return     Zero on success, < 0 on error
  */
 int patches_init(void) {
-  SceKernelMemPoolCreateOpt opt;
   int ret;
 
-  memset(&opt, 0, sizeof(opt));
-  opt.size = sizeof(opt);
-  opt.uselock = 1;
-  g_patch_pool = sceKernelMemPoolCreate("tai_patches", PATCHES_POOL_SIZE, &opt);
-  LOG("sceKernelMemPoolCreate(tai_patches): 0x%08X", g_patch_pool);
-  if (g_patch_pool < 0) {
-    return g_patch_pool;
-  }
   g_map = proc_map_alloc(NUM_PROC_MAP_BUCKETS);
   if (g_map == NULL) {
     LOG("Failed to create proc map.");
     return TAI_ERROR_SYSTEM;
   }
+  notify_init();
+  if ((ret = bypass_init()) < 0) {
+    return ret;
+  }
   g_hooks_lock = sceKernelCreateMutexForKernel("tai_hooks_lock", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
   LOG("sceKernelCreateMutexForKernel(tai_hooks_lock): 0x%08X", g_hooks_lock);
   if (g_hooks_lock < 0) {
     return g_hooks_lock;
   }
+  g_inject_lock = sceKernelCreateMutexForKernel("tai_inject_lock", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_inject_lock): 0x%08X", g_inject_lock);
+  if (g_inject_lock < 0) {
+    return g_inject_lock;
+  }
   ret = sceKernelCreateClass(&g_taihen_class, "taiHENClass", sceKernelGetUidClass(), sizeof(tai_patch_t), init_patch, free_patch);
   LOG("sceKernelCreateClass(taiHENClass): 0x%08X", ret);
   if (ret < 0) {
@@ -125,12 +168,14 @@ int patches_init(void) {
 void patches_deinit(void) {
   LOG("Cleaning up patches subsystem.");
   // TODO: Find out how to clean up class
+  sceKernelDeleteMutexForKernel(g_inject_lock);
   sceKernelDeleteMutexForKernel(g_hooks_lock);
-  sceKernelMemPoolDestroy(g_patch_pool);
+  bypass_deinit();
   proc_map_free(g_map);
   g_map = NULL;
-  g_patch_pool = 0;
   g_hooks_lock = 0;
+  g_inject_lock = 0;
+  g_groups = NULL;
 }
 
 /**
@@ -156,6 +201,28 @@ static inline void hex_dump(uintptr_t paddr, const char *addr, unsigned int size
 }
 
 #ifdef __arm__
+/**
+ * @brief      Flush L1 and L2 cache for a kernel address
+ *
+ *             The kernel is always mapped so there is no context to switch.
+ *
+ * @param[in]  vma   The vma
+ * @param[in]  len   The length
+ */
+void cache_flush_kernel(uintptr_t vma, size_t len) {
+  uintptr_t vma_align;
+
+  PROFILE_START(flush_start);
+  vma_align = vma & ~0x1F;
+  len = ((vma + len + 0x1F) & ~0x1F) - vma_align;
+  STATS_INC(cache_flushes);
+  STATS_ADD(cache_flush_bytes, len);
+  sceKernelCpuDcacheFlush((void *)vma_align, len);
+  sceKernelCpuIcacheAndL2Flush((void *)vma_align, len);
+  asm volatile ("isb" ::: "memory");
+  PROFILE_END(TAI_STATS_PHASE_FLUSH, flush_start);
+}
+
 /**
  * @brief      Flush L1 and L2 cache for an address
  *
@@ -175,32 +242,36 @@ void cache_flush(SceUID pid, uintptr_t vma, size_t len) {
   int *other_context;
   int dacr;
 
+  if (pid == KERNEL_PID) {
+    cache_flush_kernel(vma, len);
+    return;
+  }
+
+  PROFILE_START(flush_start);
   vma_align = vma & ~0x1F;
   len = ((vma + len + 0x1F) & ~0x1F) - vma_align;
   LOG("cache flush: vma %p, vma_align %p, len %x", vma, vma_align, len);
+  STATS_INC(cache_flushes);
+  STATS_ADD(cache_flush_bytes, len);
 
-  if (pid == KERNEL_PID) {
+  // TODO: Take care of SHARED_PID
+  flags = sceKernelCpuDisableInterrupts();
+  sceKernelCpuSaveContext(my_context);
+  ret = sceKernelGetPidContext(pid, &other_context);
+  if (ret >= 0) {
+    sceKernelCpuRestoreContext(other_context);
+    asm volatile ("mrc p15, 0, %0, c3, c0, 0" : "=r" (dacr));
+    asm volatile ("mcr p15, 0, %0, c3, c0, 0" :: "r" (0x15450FC3));
     sceKernelCpuDcacheFlush((void *)vma_align, len);
     sceKernelCpuIcacheAndL2Flush((void *)vma_align, len);
-  } else {
-    // TODO: Take care of SHARED_PID
-    flags = sceKernelCpuDisableInterrupts();
-    sceKernelCpuSaveContext(my_context);
-    ret = sceKernelGetPidContext(pid, &other_context);
-    if (ret >= 0) {
-      sceKernelCpuRestoreContext(other_context);
-      asm volatile ("mrc p15, 0, %0, c3, c0, 0" : "=r" (dacr));
-      asm volatile ("mcr p15, 0, %0, c3, c0, 0" :: "r" (0x15450FC3));
-      sceKernelCpuDcacheFlush((void *)vma_align, len);
-      sceKernelCpuIcacheAndL2Flush((void *)vma_align, len);
-      hex_dump(vma_align, (char *)vma_align, len);
-      asm volatile ("mcr p15, 0, %0, c3, c0, 0" :: "r" (dacr));
-    }
-    sceKernelCpuRestoreContext(my_context);
-    sceKernelCpuEnableInterrupts(flags);
-    LOG("sceKernelSwitchVmaForPid(%d): 0x%08X\n", pid, ret);
+    hex_dump(vma_align, (char *)vma_align, len);
+    asm volatile ("mcr p15, 0, %0, c3, c0, 0" :: "r" (dacr));
   }
+  sceKernelCpuRestoreContext(my_context);
+  sceKernelCpuEnableInterrupts(flags);
+  LOG("sceKernelSwitchVmaForPid(%d): 0x%08X\n", pid, ret);
   asm volatile ("isb" ::: "memory");
+  PROFILE_END(TAI_STATS_PHASE_FLUSH, flush_start);
 }
 #endif
 
@@ -315,8 +386,8 @@ static int tai_unhook_function(void *saved) {
  * @brief      Memcpy within process without the pesky permissions
  *
  *             This function will write raw data from `src` to `dst` for `size`.
- *             It works even if `dst` is read only. All levels of caches will be
- *             flushed.
+ *             It works even if `dst` is read only. The caller must flush the
+ *             caches.
  *
  * @param[in]  dst_pid  The target process
  * @param      dst      The target address
@@ -325,7 +396,7 @@ static int tai_unhook_function(void *saved) {
  *
  * @return     Zero on success, < 0 on error
  */
-static int tai_force_memcpy(SceUID dst_pid, void *dst, const void *src, size_t size) {
+static int tai_force_write(SceUID dst_pid, void *dst, const void *src, size_t size) {
   int ret;
   if (dst_pid == KERNEL_PID) {
       ret = sceKernelCpuUnrestrictedMemcpy(dst, src, size);
@@ -334,6 +405,94 @@ static int tai_force_memcpy(SceUID dst_pid, void *dst, const void *src, size_t s
       ret = sceKernelRxMemcpyKernelToUserForPid(dst_pid, (uintptr_t)dst, src, size);
       LOG("sceKernelRxMemcpyKernelToUserForPid(%x, %p, %p, 0x%08X): 0x%08X", dst_pid, dst, src, size, ret);
   }
+  return ret;
+}
+
+/**
+ * @brief      Writes to a read only kernel address and flushes the caches
+ *
+ * @param      dst   The target address
+ * @param[in]  src   The source
+ * @param[in]  size  The size
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int tai_force_memcpy_kernel(void *dst, const void *src, size_t size) {
+  int ret;
+  ret = sceKernelCpuUnrestrictedMemcpy(dst, src, size);
+  LOG("sceKernelCpuUnrestrictedMemcpy(%p, %p, 0x%08X): 0x%08X", dst, src, size, ret);
+  cache_flush_kernel((uintptr_t)dst, size);
+  return ret;
+}
+
+/**
+ * @brief      Writes a large range in chunks, yielding in between
+ *
+ *             Writing and flushing a few hundred KB at once stalls everything
+ *             else on the core, so the range is written `g_inject_chunk` bytes
+ *             at a time. Each chunk is flushed as it is written unless
+ *             `g_inject_defer_flush` is set, in which case the whole range is
+ *             flushed once after the last chunk. Deferring only saves flushes,
+ *             the process can still run code from a half written range. The
+ *             caller must hold the inject lock and not the hooks lock.
+ *
+ * @param[in]  dst_pid  The target process
+ * @param      dst      The target address
+ * @param[in]  src      The source kernel address
+ * @param[in]  size     The size
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int tai_force_memcpy_chunked(SceUID dst_pid, char *dst, const char *src, size_t size) {
+  size_t off, len;
+  int ret;
+
+  LOG("Writing 0x%08X bytes to %p in chunks of 0x%08X", size, dst, g_inject_chunk);
+  ret = TAI_SUCCESS;
+  for (off = 0; off < size && ret >= 0; off += len) {
+    len = size - off;
+    if (len > g_inject_chunk) {
+      len = g_inject_chunk;
+    }
+    if (off > 0) {
+      sceKernelDelayThreadForDriver(0);
+    }
+    ret = tai_force_write(dst_pid, dst + off, src + off, len);
+    if (!g_inject_defer_flush) {
+      cache_flush(dst_pid, (uintptr_t)dst + off, len);
+    }
+  }
+  if (g_inject_defer_flush) {
+    cache_flush(dst_pid, (uintptr_t)dst, size);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Writes to a read only address and flushes the caches
+ *
+ *             This function will write raw data from `src` to `dst` for `size`.
+ *             It works even if `dst` is read only. All levels of caches will be
+ *             flushed. Large user writes are split up when chunking is on and
+ *             `may_yield` is set.
+ *
+ * @param[in]  dst_pid    The target process
+ * @param      dst        The target address
+ * @param[in]  src        The source kernel address
+ * @param[in]  size       The size
+ * @param[in]  may_yield  Nonzero if the hooks lock is not held
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int tai_force_memcpy(SceUID dst_pid, void *dst, const void *src, size_t size, int may_yield) {
+  int ret;
+  if (dst_pid == KERNEL_PID) {
+    return tai_force_memcpy_kernel(dst, src, size);
+  }
+  if (may_yield && g_inject_chunk > 0 && size > g_inject_chunk) {
+    return tai_force_memcpy_chunked(dst_pid, dst, src, size);
+  }
+  ret = tai_force_write(dst_pid, dst, src, size);
   cache_flush(dst_pid, (uintptr_t)dst, size);
   return ret;
 }
@@ -353,11 +512,122 @@ static int tai_memcpy_to_kernel(SceUID src_pid, void *dst, const char *src, size
   if (src_pid == KERNEL_PID) {
     memcpy(dst, src, size);
     LOG("memcpy(%p, %p, 0x%08X)", dst, src, size);
+    ret = 0;
   } else {
     ret = sceKernelMemcpyUserToKernelForPid(src_pid, dst, (uintptr_t)src, size);
     LOG("sceKernelMemcpyUserToKernelForPid(%x, %p, %p, 0x%08X): 0x%08X", src_pid, dst, src, size, ret);
   }
-  return 0;
+  return (ret < 0) ? ret : TAI_SUCCESS;
+}
+
+/**
+ * @brief      Copies data to be saved to kernel, yielding between chunks
+ *
+ *             Only large user copies are split up, and only when chunking is
+ *             on and `may_yield` is set.
+ *
+ * @param[in]  src_pid    The source process (can be kernel)
+ * @param      dst        The target address
+ * @param[in]  src        The source
+ * @param[in]  size       The size
+ * @param[in]  may_yield  Nonzero if the hooks lock is not held
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int tai_save_chunked(SceUID src_pid, char *dst, const char *src, size_t size, int may_yield) {
+  size_t off, len;
+  int ret;
+
+  if (src_pid == KERNEL_PID || !may_yield || g_inject_chunk == 0) {
+    return tai_memcpy_to_kernel(src_pid, dst, src, size);
+  }
+  ret = TAI_SUCCESS;
+  for (off = 0; off < size && ret >= 0; off += len) {
+    len = size - off;
+    if (len > g_inject_chunk) {
+      len = g_inject_chunk;
+    }
+    if (off > 0) {
+      sceKernelDelayThreadForDriver(0);
+    }
+    ret = tai_memcpy_to_kernel(src_pid, dst + off, src + off, len);
+  }
+  return ret;
+}
+
+/**
+ * @brief      Flushes the user visible record of a hook
+ *
+ *             Records are line sized and line aligned so this is always exactly
+ *             one cache line.
+ *
+ * @param[in]  hook  The hook
+ */
+static inline void hook_flush(const tai_hook_t *hook) {
+  cache_flush(hook->patch->pid, hook->exe, sizeof(tai_hook_record_t));
+}
+
+/**
+ * @brief      Frees a hook, its record and its thunk
+ *
+ * @param      hook  The hook
+ */
+static void hook_free(tai_hook_t *hook) {
+  if (hook->thunk) {
+    slab_free(hook->patch->thunk_slab, hook->thunk);
+  }
+  slab_free(hook->patch->hook_slab, hook->u);
+  heap_free(TAI_HEAP_METADATA, hook);
+}
+
+/**
+ * @brief      Allocates a hook and its record
+ *
+ *             The record is placed next to the rest of the chain so
+ *             `TAI_CONTINUE` walks stay within as few slabs as possible. If
+ *             there is a guard, the chain enters the hook through a generated
+ *             thunk instead of `hook_func`.
+ *
+ * @param      patch      The patch the hook will belong to
+ * @param[in]  hook_func  The hook function
+ * @param[in]  guard      Optional guard
+ *
+ * @return     The hook or NULL if out of memory
+ */
+static tai_hook_t *hook_alloc(tai_patch_t *patch, const void *hook_func, const tai_hook_guard_t *guard) {
+  tai_hook_t *hook;
+  tai_hook_record_t *record;
+  const void *hint;
+  uintptr_t thunk_exe;
+  size_t size;
+
+  hook = heap_alloc(TAI_HEAP_METADATA, sizeof(tai_hook_t));
+  if (hook == NULL) {
+    return NULL;
+  }
+  hint = patch->data.hooks.head ? patch->data.hooks.head->u : NULL;
+  record = slab_alloc_near(patch->hook_slab, hint, &hook->exe);
+  if (record == NULL) {
+    heap_free(TAI_HEAP_METADATA, hook);
+    return NULL;
+  }
+  memset(record, 0, sizeof(*record));
+  hook->u = &record->u;
+  hook->u->func = (void *)hook_func;
+  hook->thunk = NULL;
+  hook->next = NULL;
+  hook->patch = patch;
+  if (guard) {
+    hook->thunk = slab_alloc(patch->thunk_slab, &thunk_exe);
+    if (hook->thunk == NULL) {
+      hook_free(hook);
+      return NULL;
+    }
+    size = thunk_build(hook->thunk, guard, hook->exe, hook_func);
+    cache_flush(patch->pid, thunk_exe, size);
+    hook->u->func = (void *)thunk_exe;
+  }
+  return hook;
 }
 
 /**
@@ -367,6 +637,8 @@ static int tai_memcpy_to_kernel(SceUID src_pid, void *dst, const char *src, size
  *             be patched. Otherwise, it will be placed into the chain. The
  *             order in the chain is not defined.
  *
+ *             The caller must hold the hooks lock.
+ *
  * @param      hooks  The chain of hooks to add to
  * @param      item   The hook to add
  *
@@ -377,32 +649,32 @@ static int hooks_add_hook(tai_hook_list_t *hooks, tai_hook_t *item) {
   int ret;
 
   LOG("Adding hook %p to chain %p", item, hooks);
-  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
   if (hooks->head == NULL) { // first hook for this list
-    ret = tai_hook_function(item->patch->slab, hooks->func, item->u.func, &hooks->old, &hooks->saved);
+    PROFILE_START(substitute_start);
+    ret = tai_hook_function(item->patch->slab, hooks->func, item->u->func, &hooks->old, &hooks->saved);
+    PROFILE_END(TAI_STATS_PHASE_SUBSTITUTE, substitute_start);
     if (ret >= 0) {
       hooks->head = item;
       item->next = NULL;
-      item->u.next = (uintptr_t)NULL;
-      item->u.old = hooks->old;
-      cache_flush(item->patch->pid, slab_getmirror(item->patch->slab, item), sizeof(tai_hook_t));
+      item->u->next = (uintptr_t)NULL;
+      item->u->old = hooks->old;
+      hook_flush(item);
     } else {
       LOG("Hook failed, do not add to chain");
     }
   } else {
     head = hooks->head;
     item->next = head->next;
-    item->u.next = head->u.next;
-    item->u.old = hooks->old;
+    item->u->next = head->u->next;
+    item->u->old = hooks->old;
+    // item must be visible before head points to it
+    hook_flush(item);
     head->next = item;
-    head->u.next = slab_getmirror(item->patch->slab, item);
+    head->u->next = item->exe;
+    hook_flush(head);
     LOG("Added hook to existing chain %p", head);
-    // flush cache for head + item, which were modified
-    cache_flush(item->patch->pid, slab_getmirror(item->patch->slab, head), sizeof(tai_hook_t));
-    cache_flush(item->patch->pid, head->u.next, sizeof(tai_hook_t));
     ret = 1;
   }
-  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
 
   return ret;
 }
@@ -422,8 +694,7 @@ static int hooks_add_hook(tai_hook_list_t *hooks, tai_hook_t *item) {
  * @return     Zero on success, < 0 on error or if item is not found
  */
 static int hooks_remove_hook(tai_hook_list_t *hooks, tai_hook_t *item) {
-  tai_hook_t **cur;
-  uintptr_t tmp, *cur_user;
+  tai_hook_t *cur;
   int ret;
 
   LOG("Removing hook %p for %p", item, hooks);
@@ -436,34 +707,24 @@ static int hooks_remove_hook(tai_hook_list_t *hooks, tai_hook_t *item) {
     hooks->head = item->next;
     if (hooks->head != NULL) {
       // add a patch to the new head
-      ret = tai_hook_function(item->patch->slab, hooks->func, hooks->head->u.func, &hooks->old, &hooks->saved);
-      // update the old pointers
-      for (cur = &hooks->head; *cur != NULL; cur = &(*cur)->next) {
-        (*cur)->u.old = hooks->old;
+      ret = tai_hook_function(item->patch->slab, hooks->func, hooks->head->u->func, &hooks->old, &hooks->saved);
+      // update the old pointers, every record has changed
+      for (cur = hooks->head; cur != NULL; cur = cur->next) {
+        cur->u->old = hooks->old;
+        hook_flush(cur);
       }
-      // clear cache of mirror for the last item since it uses the old pointer
-      cache_flush(item->patch->pid, (uintptr_t)cur - offsetof(tai_hook_t, next), sizeof(tai_hook_t));
     } else {
       ret = 0;
     }
   } else {
-    cur = &hooks->head;
-    cur_user = &tmp;
     ret = -1;
-    while (1) {
-      if (*cur) {
-        if (*cur == item) {
-          *cur = item->next; // remove from list
-          *cur_user = item->u.next;
-          // clear cache since pointers were changed
-          cache_flush(item->patch->pid, (uintptr_t)cur - offsetof(tai_hook_t, next), sizeof(tai_hook_t));
-          ret = 0;
-          break;
-        } else {
-          cur = &(*cur)->next;
-          cur_user = &(*cur)->u.next;
-        }
-      } else {
+    for (cur = hooks->head; cur != NULL; cur = cur->next) {
+      if (cur->next == item) {
+        cur->next = item->next; // remove from list
+        cur->u->next = item->u->next;
+        // only the previous record was changed
+        hook_flush(cur);
+        ret = 0;
         break;
       }
     }
@@ -473,24 +734,17 @@ static int hooks_remove_hook(tai_hook_list_t *hooks, tai_hook_t *item) {
 }
 
 /**
- * @brief      Inserts a hook given an absolute address and PID of the function
+ * @brief      Checks the arguments of a hook
  *
- * @param[out] p_hook     Outputs a reference object if successful
  * @param[in]  pid        PID of the address space to hook
- * @param      dest_func  The destination function
  * @param[in]  hook_func  The hook function
+ * @param[in]  guard      Optional caller filter
  *
- * @return     UID for the hook on success, < 0 on error
+ * @return     Zero if the hook can be inserted, < 0 on error
  */
-SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, const void *hook_func) {
-  SceCreateUidObjOpt opt;
-  tai_patch_t *patch, *tmp;
-  tai_hook_t *hook;
+static int hook_check(SceUID pid, const void *hook_func, const tai_hook_guard_t *guard) {
   int ret;
-  struct slab_chain *slab;
-  uintptr_t exe_addr;
 
-  LOG("Hooking %p to %p for pid %x", hook_func, dest_func, pid);
   if (hook_func >= MEM_SHARED_START) {
     if (pid == KERNEL_PID) {
       return TAI_ERROR_INVALID_KERNEL_ADDR; // invalid hook address
@@ -498,24 +752,73 @@ SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, co
       return TAI_ERROR_NOT_IMPLEMENTED; // TODO: add support for this
     }
   }
+  if (guard && (ret = thunk_check_guard(pid, guard)) < 0) {
+    LOG("Invalid guard for pid %x: 0x%08X", pid, ret);
+    return ret;
+  }
+  return TAI_SUCCESS;
+}
 
-  hook = NULL;
+/**
+ * @brief      Creates the object of a new hook chain
+ *
+ *             Done before taking the hooks lock. `hook_insert` deletes it
+ *             again if the hook joins an existing chain. A user process gets
+ *             its bypass page along with its first hook.
+ *
+ * @param[in]  pid    PID of the address space to hook
+ * @param[out] patch  The object
+ *
+ * @return     UID of the object on success, < 0 on error
+ */
+static SceUID hook_create(SceUID pid, tai_patch_t **patch) {
+  SceCreateUidObjOpt opt;
+  int ret;
+
+  if ((ret = bypass_add_process(pid)) < 0) {
+    return ret;
+  }
+  PROFILE_START(uid_start);
   if (pid == KERNEL_PID) {
-    ret = sceKernelCreateUidObj(&g_taihen_class, "tai_patch_hook", NULL, (SceObjectBase **)&patch);
+    ret = sceKernelCreateUidObj(&g_taihen_class, "tai_patch_hook", NULL, (SceObjectBase **)patch);
   } else {
     memset(&opt, 0, sizeof(opt));
     opt.flags = 8;
     opt.pid = pid;
-    ret = sceKernelCreateUidObj(&g_taihen_class, "tai_patch_hook_user", &opt, (SceObjectBase **)&patch);
+    ret = sceKernelCreateUidObj(&g_taihen_class, "tai_patch_hook_user", &opt, (SceObjectBase **)patch);
   }
-  LOG("sceKernelCreateUidObj(tai_patch_hook): 0x%08X, %p", ret, patch);
-  if (ret < 0) {
-    return ret;
+  PROFILE_END(TAI_STATS_PHASE_UID, uid_start);
+  LOG("sceKernelCreateUidObj(tai_patch_hook): 0x%08X, %p", ret, *patch);
+  if (ret >= 0) {
+    (*patch)->type = HOOKS; // so `free_patch` is safe if it is never inserted
   }
+  return ret;
+}
 
-  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+/**
+ * @brief      Inserts a hook
+ *
+ *             The caller must hold the hooks lock. `patch` is used up, it is
+ *             either inserted or deleted.
+ *
+ * @param      patch      The object from `hook_create`
+ * @param[in]  uid        Its UID
+ * @param[out] p_hook     Outputs a reference object if successful
+ * @param[in]  pid        PID of the address space to hook
+ * @param      dest_func  The destination function
+ * @param[in]  hook_func  The hook function
+ * @param[in]  guard      Optional caller filter, NULL to always run the hook
+ *
+ * @return     UID for the hook on success, < 0 on error
+ */
+static SceUID hook_insert(tai_patch_t *patch, SceUID uid, tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, const void *hook_func, const tai_hook_guard_t *guard) {
+  tai_patch_t *tmp;
+  tai_hook_t *hook;
+  int ret;
+
+  hook = NULL;
   patch->type = HOOKS;
-  patch->uid = ret;
+  patch->uid = uid;
   patch->pid = pid;
   patch->addr = FUNC_TO_UINTPTR_T(dest_func);
   patch->size = FUNC_SAVE_SIZE;
@@ -523,14 +826,16 @@ SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, co
   patch->data.hooks.func = dest_func;
   patch->data.hooks.saved = NULL;
   patch->data.hooks.head = NULL;
-  if (proc_map_try_insert(g_map, patch, &tmp) < 1) {
+  PROFILE_START(proc_map_start);
+  ret = proc_map_try_insert(g_map, patch, &tmp);
+  PROFILE_END(TAI_STATS_PHASE_PROC_MAP, proc_map_start);
+  if (ret < 1) {
     ret = sceKernelDeleteUid(patch->uid);
     LOG("sceKernelDeleteUid(old): 0x%08X", ret);
     if (tmp == NULL || tmp->type != HOOKS) {
       // error
       LOG("this hook overlaps an existing hook");
-      ret = TAI_ERROR_PATCH_EXISTS;
-      goto err;
+      return TAI_ERROR_PATCH_EXISTS;
     } else {
       // we have an existing patch
       LOG("found existing patch %p, discarding %p", tmp, patch);
@@ -538,35 +843,64 @@ SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, co
     }
   }
 
-  hook = slab_alloc(patch->slab, &exe_addr);
+  PROFILE_START(slab_start);
+  hook = hook_alloc(patch, hook_func, guard);
+  PROFILE_END(TAI_STATS_PHASE_SLAB, slab_start);
   if (hook == NULL) {
-    ret = -1;
-    goto err;
+    ret = TAI_ERROR_MEMORY;
+  } else {
+    ret = hooks_add_hook(&patch->data.hooks, hook);
   }
-  hook->u.func = (void *)hook_func;
-  hook->patch = patch;
-
-  ret = hooks_add_hook(&patch->data.hooks, hook);
-  if (ret < 0 && patch->data.hooks.head == NULL) {
-    LOG("failed to add hook and patch is now empty, freeing hook %p", hook);
-    slab_free(patch->slab, hook);
-    hook = NULL;
-    proc_map_remove(g_map, patch);
-    sceKernelDeleteUid(patch->uid);
-    patch = NULL;
-  } else if (ret >= 0) {
-    ret = patch->uid;
-    *p_hook = slab_getmirror(patch->slab, hook);
+  if (ret < 0) {
+    if (hook != NULL) {
+      LOG("freeing hook %p", hook);
+      hook_free(hook);
+    }
+    if (patch->data.hooks.head == NULL) {
+      LOG("failed to add hook and patch %p is now empty", patch);
+      proc_map_remove(g_map, patch);
+      sceKernelDeleteUid(patch->uid);
+    }
+    return ret;
   }
 
-err:
-  // error and we have allocated a hook
-  if (ret < 0 && patch && hook) {
-    LOG("freeing hook %p", hook);
-    slab_free(patch->slab, hook);
-  }
+  *p_hook = hook->exe;
+  STATS_INC(hooks_added);
+  usage_note_slab(patch->usage_title, USAGE_SLAB_EXEC, patch->slab->peak_pages);
+  usage_note_slab(patch->usage_title, USAGE_SLAB_HOOK, patch->hook_slab->peak_pages);
+  usage_note_slab(patch->usage_title, USAGE_SLAB_THUNK, patch->thunk_slab->peak_pages);
+  notify_add(TAI_PATCH_EVENT_HOOK_ADDED, pid, patch->uid, patch->addr, patch->size);
+  return patch->uid;
+}
 
+/**
+ * @brief      Inserts a hook given an absolute address and PID of the function
+ *
+ * @param[out] p_hook     Outputs a reference object if successful
+ * @param[in]  pid        PID of the address space to hook
+ * @param      dest_func  The destination function
+ * @param[in]  hook_func  The hook function
+ * @param[in]  guard      Optional caller filter, NULL to always run the hook
+ *
+ * @return     UID for the hook on success, < 0 on error
+ */
+SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, const void *hook_func, const tai_hook_guard_t *guard) {
+  tai_patch_t *patch;
+  SceInt64 start;
+  int ret;
+
+  start = sceKernelGetSystemTimeWide();
+  LOG("Hooking %p to %p for pid %x", hook_func, dest_func, pid);
+  if ((ret = hook_check(pid, hook_func, guard)) < 0) {
+    return ret;
+  }
+  if ((ret = hook_create(pid, &patch)) < 0) {
+    return ret;
+  }
+  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+  ret = hook_insert(patch, ret, p_hook, pid, dest_func, hook_func, guard);
   sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  stats_latency(TAI_STATS_HOOK, start);
 
   return ret;
 }
@@ -582,29 +916,34 @@ err:
 int tai_hook_release(SceUID uid, tai_hook_ref_t hook_ref) {
   tai_hook_t **cur, *hook;
   tai_patch_t *patch;
-  struct slab_chain *slab;
+  SceInt64 start;
   int ret;
 
+  start = sceKernelGetSystemTimeWide();
   ret = sceKernelGetObjForUid(uid, &g_taihen_class, (SceObjectBase **)&patch);
   LOG("sceKernelGetObjForUid(%x): 0x%08X", uid, ret);
   if (ret < 0) {
     return ret;
   }
+  if (patch->type != HOOKS) {
+    LOG("uid %x is not a hook", uid);
+    return TAI_ERROR_INVALID_ARGS;
+  }
   sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
-  slab = patch->slab;
   for (cur = &patch->data.hooks.head; *cur != NULL; cur = &(*cur)->next) {
-    if (slab_getmirror(slab, *cur) == hook_ref) {
+    if ((*cur)->exe == hook_ref) {
       hook = *cur;
       LOG("Found hook %p for ref %p", hook, hook_ref);
+      notify_add(TAI_PATCH_EVENT_HOOK_REMOVED, patch->pid, patch->uid, patch->addr, patch->size);
       ret = hooks_remove_hook(&patch->data.hooks, hook);
-      *cur = hook->next;
       LOG("freeing hook");
-      slab_free(slab, hook);
+      hook_free(hook);
       if (patch->data.hooks.head == NULL) {
         LOG("patch is now empty, freeing it");
         proc_map_remove(g_map, patch);
         sceKernelDeleteUid(patch->uid);
       }
+      STATS_INC(hooks_removed);
       ret = TAI_SUCCESS;
       goto end;
     }
@@ -613,28 +952,37 @@ int tai_hook_release(SceUID uid, tai_hook_ref_t hook_ref) {
   ret = TAI_ERROR_NOT_FOUND;
 end:
   sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  stats_latency(TAI_STATS_HOOK_RELEASE, start);
 
   return ret;
 }
 
 /**
- * @brief      Inserts a raw data injection given an absolute address and PID of
- *             the address space
+ * @brief      Inserts an injection
  *
- * @param[in]  pid   The pid of the src and dest pointers address space
- * @param      dest  The destination
- * @param[in]  src   The source
- * @param[in]  size  The size
+ *             The caller must hold the inject lock. With `may_yield` set, the
+ *             hooks lock is only held to reserve the range and the data is
+ *             written after it is dropped, so chunked writes never yield with
+ *             it held. The range stays reserved while it is written so no
+ *             hook can be put in the middle of it.
+ *
+ * @param[in]  pid        The pid of the src and dest pointers address space
+ * @param      dest       The destination
+ * @param[in]  src        The source
+ * @param[in]  size       The size
+ * @param[in]  may_yield  Nonzero if the caller does not hold the hooks lock
  *
  * @return     UID for the injection on success, < 0 on error
  *             - TAI_ERROR_PATCH_EXISTS if a hook or injection is already
  *               inserted
  */
-SceUID tai_inject_abs(SceUID pid, void *dest, const void *src, size_t size) {
+static SceUID inject_abs(SceUID pid, void *dest, const void *src, size_t size, int may_yield) {
   tai_patch_t *patch, *tmp;
+  SceInt64 start;
   void *saved;
   int ret;
 
+  start = sceKernelGetSystemTimeWide();
   // TODO: Check that dest is not inside our slab structure... that could corrupt kernel code
 
   LOG("Injecting %p with %p for size 0x%08X at pid %x", dest, src, size, pid);
@@ -644,18 +992,18 @@ SceUID tai_inject_abs(SceUID pid, void *dest, const void *src, size_t size) {
     return ret;
   }
 
-  saved = sceKernelMemPoolAlloc(g_patch_pool, size);
-  LOG("sceKernelMemPoolAlloc(g_patch_pool, 0x%08X): %p", size, saved);
+  saved = heap_alloc(TAI_HEAP_SAVED, size);
+  LOG("heap_alloc(TAI_HEAP_SAVED, 0x%08X): %p", size, saved);
   if (saved == NULL) {
     sceKernelDeleteUid(ret);
     return TAI_ERROR_MEMORY;
   }
 
   // try to save old data
-  if (tai_memcpy_to_kernel(pid, saved, dest, size) < 0) {
+  if (tai_save_chunked(pid, saved, dest, size, may_yield) < 0) {
     LOG("Invalid address for memcpy");
     sceKernelDeleteUid(ret);
-    sceKernelMemPoolFree(g_patch_pool, saved);
+    heap_free(TAI_HEAP_SAVED, saved);
     return TAI_ERROR_INVALID_ARGS;
   }
 
@@ -672,17 +1020,29 @@ SceUID tai_inject_abs(SceUID pid, void *dest, const void *src, size_t size) {
   if (proc_map_try_insert(g_map, patch, &tmp) < 1) {
     ret = TAI_ERROR_PATCH_EXISTS;
   } else {
-    ret = tai_force_memcpy(pid, dest, src, size);
+    if (may_yield) {
+      sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+    }
+    ret = tai_force_memcpy(pid, dest, src, size, may_yield);
+    if (may_yield) {
+      sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+    }
+    if (ret < 0) {
+      proc_map_remove(g_map, patch);
+    }
   }
 
   if (ret < 0) {
     sceKernelDeleteUid(patch->uid);
-    sceKernelMemPoolFree(g_patch_pool, saved);
+    heap_free(TAI_HEAP_SAVED, saved);
   } else {
     ret = patch->uid;
+    STATS_INC(injections_added);
+    notify_add(TAI_PATCH_EVENT_INJECT_ADDED, pid, patch->uid, patch->addr, patch->size);
   }
 
   sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  stats_latency(TAI_STATS_INJECT, start);
 
   return ret;
 }
@@ -690,19 +1050,22 @@ SceUID tai_inject_abs(SceUID pid, void *dest, const void *src, size_t size) {
 /**
  * @brief      Removes an injection and restores the original data
  *
- * @param      inject  The injection
+ *             The caller must hold the inject lock. The range stays reserved
+ *             until the original data is back, and with `may_yield` set the
+ *             hooks lock is not held while it is written.
+ *
+ * @param[in]  uid        The injection uid
+ * @param[in]  may_yield  Nonzero if the caller does not hold the hooks lock
  *
  * @return     Zero on success, < 0 on error
  */
-int tai_inject_release(SceUID uid) {
+static int inject_release(SceUID uid, int may_yield) {
   tai_inject_t *inject;
   tai_patch_t *patch;
-  void *saved;
-  void *dest;
-  size_t size;
+  SceInt64 start;
   int ret;
-  SceUID pid;
 
+  start = sceKernelGetSystemTimeWide();
   ret = sceKernelGetObjForUid(uid, &g_taihen_class, (SceObjectBase **)&patch);
   LOG("sceKernelGetObjForUid(%x): 0x%08X", uid, ret);
   if (ret < 0) {
@@ -714,24 +1077,521 @@ int tai_inject_release(SceUID uid) {
   }
   inject = &patch->data.inject;
   LOG("Releasing injection %p for patch %p", inject, patch);
+  // only the inject lock holder frees injections, so the patch stays valid
+  ret = tai_force_memcpy(patch->pid, (void *)patch->addr, inject->saved, inject->size, may_yield);
   sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
-  pid = patch->pid;
-  dest = (void *)patch->addr;
-  saved = inject->saved;
-  size = inject->size;
   if (!proc_map_remove(g_map, patch)) {
     LOG("internal error, cannot remove patch from proc_map");
     ret = TAI_ERROR_SYSTEM;
   } else {
-    ret = tai_force_memcpy(pid, dest, saved, size);
-    sceKernelMemPoolFree(g_patch_pool, saved);
+    STATS_INC(injections_removed);
+    notify_add(TAI_PATCH_EVENT_INJECT_REMOVED, patch->pid, uid, patch->addr, inject->size);
+    heap_free(TAI_HEAP_SAVED, inject->saved);
     sceKernelDeleteUid(patch->uid);
   }
   sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  stats_latency(TAI_STATS_INJECT_RELEASE, start);
+
+  return ret;
+}
+
+/**
+ * @brief      Releases the members of a group, last one first
+ *
+ *             The caller must hold the inject lock and the hooks lock.
+ *             Members that went away with their process are skipped.
+ *
+ * @param[in]  members  The members
+ * @param[in]  count    Number of members
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_HOOK_ERROR if a member could not be released
+ */
+static int group_release_members(const tai_group_member_t *members, size_t count) {
+  int ret;
 
+  ret = TAI_SUCCESS;
+  while (count-- > 0) {
+    if (members[count].uid < 0) {
+      LOG("Member %d went away with its process", count);
+    } else if (members[count].ref != 0) {
+      if (tai_hook_release(members[count].uid, members[count].ref) < 0) {
+        LOG("Failed to release hook member %d", count);
+        ret = TAI_ERROR_HOOK_ERROR;
+      }
+    } else if (inject_release(members[count].uid, 0) < 0) {
+      LOG("Failed to release injection member %d", count);
+      ret = TAI_ERROR_HOOK_ERROR;
+    }
+  }
   return ret;
 }
 
+/**
+ * @brief      Creates a group owning patches that were already inserted
+ *
+ *             The group takes ownership of `members` on success and is
+ *             tracked until it is released, so process cleanup can drop
+ *             members of exiting processes. The caller must hold the hooks
+ *             lock.
+ *
+ * @param[in]  pid      PID of the patches
+ * @param      members  The members
+ * @param[in]  count    Number of members
+ *
+ * @return     UID for the group on success, < 0 on error
+ */
+static SceUID group_create(SceUID pid, tai_group_member_t *members, size_t count) {
+  SceCreateUidObjOpt opt;
+  tai_patch_t *group;
+  int ret;
+
+  if (pid == KERNEL_PID) {
+    ret = sceKernelCreateUidObj(&g_taihen_class, "tai_patch_group", NULL, (SceObjectBase **)&group);
+  } else {
+    memset(&opt, 0, sizeof(opt));
+    opt.flags = 8;
+    opt.pid = pid;
+    ret = sceKernelCreateUidObj(&g_taihen_class, "tai_patch_group_user", &opt, (SceObjectBase **)&group);
+  }
+  LOG("sceKernelCreateUidObj(tai_patch_group): 0x%08X, %p", ret, group);
+  if (ret < 0) {
+    return ret;
+  }
+  group->type = GROUP;
+  group->uid = ret;
+  group->pid = pid;
+  group->addr = 0;
+  group->size = 0;
+  group->next = NULL;
+  group->data.group.count = count;
+  group->data.group.members = members;
+  // the members are freed with their processes, track them to skip those
+  group->next = g_groups;
+  g_groups = group;
+  return group->uid;
+}
+
+/**
+ * @brief      Forgets the group members of an exiting process
+ *
+ *             Process cleanup frees the member patches, so releasing the
+ *             group later must skip them. This covers groups owned by the
+ *             process as well as broadcast groups owned by the kernel. The
+ *             caller must hold the hooks lock.
+ *
+ * @param[in]  pid   The exiting process
+ */
+static void group_drop_process(SceUID pid) {
+  tai_group_member_t *members;
+
+  for (tai_patch_t *group = g_groups; group != NULL; group = group->next) {
+    members = group->data.group.members;
+    for (size_t i = 0; i < group->data.group.count; i++) {
+      if (members[i].uid >= 0 && members[i].pid == pid) {
+        LOG("Dropping member %d of group %x", i, group->uid);
+        members[i].uid = -1;
+      }
+    }
+  }
+}
+
+/**
+ * @brief      Inserts the same hook on many functions
+ *
+ *             All hooks are added under one hold of the hooks lock. If any
+ *             hook fails, the ones already added are released and nothing is
+ *             hooked.
+ *
+ * @param[out] p_hooks     Outputs a reference for each function
+ * @param[in]  pid         PID of the address space to hook
+ * @param      dest_funcs  The destination functions
+ * @param[in]  count       Number of functions
+ * @param[in]  hook_func   The hook function
+ * @param[in]  guard       Optional caller filter, NULL to always run the hook
+ *
+ * @return     UID for the group on success, < 0 on error
+ */
+SceUID tai_hook_func_group(tai_hook_ref_t *p_hooks, SceUID pid, void *const *dest_funcs, size_t count, const void *hook_func, const tai_hook_guard_t *guard) {
+  tai_group_member_t *members;
+  size_t i;
+  int ret;
+
+  LOG("Hooking %d functions to %p for pid %x", count, hook_func, pid);
+  if (count == 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  members = heap_alloc(TAI_HEAP_METADATA, count * sizeof(tai_group_member_t));
+  if (members == NULL) {
+    return TAI_ERROR_MEMORY;
+  }
+
+  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+  for (i = 0; i < count; i++) {
+    ret = tai_hook_func_abs(&members[i].ref, pid, dest_funcs[i], hook_func, guard);
+    if (ret < 0) {
+      LOG("Failed to hook %p: 0x%08X", dest_funcs[i], ret);
+      goto err;
+    }
+    members[i].uid = ret;
+    members[i].pid = pid;
+  }
+  ret = group_create(pid, members, count);
+  if (ret < 0) {
+    goto err;
+  }
+  for (i = 0; i < count; i++) {
+    p_hooks[i] = members[i].ref;
+  }
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  return ret;
+
+err:
+  group_release_members(members, i);
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  heap_free(TAI_HEAP_METADATA, members);
+  return ret;
+}
+
+/**
+ * @brief      Inserts one hook in each of several processes
+ *
+ *             The arguments are checked and every hook object is created
+ *             first, then all processes are hooked under one hold of the
+ *             hooks lock. Each process still gets its own trampoline since
+ *             the address spaces differ. If any hook fails, the ones already
+ *             added are released and nothing is hooked. The group belongs to the kernel since its members span
+ *             processes. Members of a process that exits before the group is
+ *             released are cleaned up with the process and skipped on
+ *             release.
+ *
+ * @param[out] p_hooks     Outputs a reference for each process
+ * @param[in]  pids        The processes
+ * @param      dest_funcs  The function to hook in each process
+ * @param      hook_funcs  The hook function in each process
+ * @param[in]  count       Number of processes
+ *
+ * @return     UID for the group on success, < 0 on error
+ */
+SceUID tai_hook_func_broadcast(tai_hook_ref_t *p_hooks, const SceUID *pids, void *const *dest_funcs, const void *const *hook_funcs, size_t count) {
+  tai_group_member_t *members;
+  tai_patch_t **patches;
+  SceInt64 start;
+  size_t i, j;
+  int ret;
+
+  LOG("Hooking %d processes", count);
+  if (count == 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  members = heap_alloc(TAI_HEAP_METADATA, count * sizeof(tai_group_member_t));
+  if (members == NULL) {
+    return TAI_ERROR_MEMORY;
+  }
+  patches = heap_alloc(TAI_HEAP_METADATA, count * sizeof(tai_patch_t *));
+  if (patches == NULL) {
+    heap_free(TAI_HEAP_METADATA, members);
+    return TAI_ERROR_MEMORY;
+  }
+
+  start = sceKernelGetSystemTimeWide();
+  for (i = 0; i < count; i++) {
+    if ((ret = hook_check(pids[i], hook_funcs[i], NULL)) < 0 ||
+        (ret = hook_create(pids[i], &patches[i])) < 0) {
+      LOG("Failed to hook %p for pid %x: 0x%08X", dest_funcs[i], pids[i], ret);
+      while (i-- > 0) {
+        sceKernelDeleteUid(members[i].uid);
+      }
+      goto end;
+    }
+    members[i].uid = ret;
+    members[i].pid = pids[i];
+  }
+
+  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+  for (i = 0; i < count; i++) {
+    ret = hook_insert(patches[i], members[i].uid, &members[i].ref, pids[i], dest_funcs[i], hook_funcs[i], NULL);
+    if (ret < 0) {
+      LOG("Failed to hook %p for pid %x: 0x%08X", dest_funcs[i], pids[i], ret);
+      for (j = i + 1; j < count; j++) {
+        sceKernelDeleteUid(members[j].uid);
+      }
+      goto err;
+    }
+    members[i].uid = ret;
+  }
+  ret = group_create(KERNEL_PID, members, count);
+  if (ret < 0) {
+    goto err;
+  }
+  for (i = 0; i < count; i++) {
+    p_hooks[i] = members[i].ref;
+  }
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  stats_latency(TAI_STATS_HOOK, start);
+  heap_free(TAI_HEAP_METADATA, patches);
+  return ret;
+
+err:
+  group_release_members(members, i);
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+end:
+  heap_free(TAI_HEAP_METADATA, patches);
+  heap_free(TAI_HEAP_METADATA, members);
+  return ret;
+}
+
+/**
+ * @brief      Inserts hooks and injections as one transaction
+ *
+ *             Everything is inserted under one hold of the hooks lock. If any
+ *             patch fails, the ones already inserted are released in reverse
+ *             order and nothing is patched. Like other groups, patches of a
+ *             process that exits first are skipped when the group is released.
+ *
+ * @param[in]  pid      PID of the address space to patch
+ * @param[in]  ops      The patches
+ * @param[in]  count    Number of patches
+ * @param[out] p_hooks  Outputs a reference for each patch, zero for
+ *                      injections
+ *
+ * @return     UID for the group on success, < 0 on error
+ */
+SceUID tai_patch_batch(SceUID pid, const tai_batch_op_t *ops, size_t count, tai_hook_ref_t *p_hooks) {
+  tai_group_member_t *members;
+  size_t i;
+  int ret;
+
+  LOG("Applying %d patches for pid %x", count, pid);
+  if (count == 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  members = heap_alloc(TAI_HEAP_METADATA, count * sizeof(tai_group_member_t));
+  if (members == NULL) {
+    return TAI_ERROR_MEMORY;
+  }
+
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
+  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+  for (i = 0; i < count; i++) {
+    if (ops[i].size == 0) {
+      ret = tai_hook_func_abs(&members[i].ref, pid, ops[i].dest, ops[i].src, NULL);
+    } else {
+      members[i].ref = 0;
+      ret = inject_abs(pid, ops[i].dest, ops[i].src, ops[i].size, 0);
+    }
+    if (ret < 0) {
+      LOG("Failed to patch %p: 0x%08X", ops[i].dest, ret);
+      goto err;
+    }
+    members[i].uid = ret;
+    members[i].pid = pid;
+  }
+  ret = group_create(pid, members, count);
+  if (ret < 0) {
+    goto err;
+  }
+  for (i = 0; i < count; i++) {
+    p_hooks[i] = members[i].ref;
+  }
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+  return ret;
+
+err:
+  group_release_members(members, i);
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+  heap_free(TAI_HEAP_METADATA, members);
+  return ret;
+}
+
+/**
+ * @brief      Removes every patch in a group
+ *
+ * @param[in]  uid   The group uid
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int tai_group_release(SceUID uid) {
+  tai_group_member_t *members;
+  tai_patch_t *group;
+  size_t count;
+  int ret;
+
+  ret = sceKernelGetObjForUid(uid, &g_taihen_class, (SceObjectBase **)&group);
+  LOG("sceKernelGetObjForUid(%x): 0x%08X", uid, ret);
+  if (ret < 0) {
+    return ret;
+  }
+  if (group->type != GROUP) {
+    LOG("uid %x is not a group", uid);
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
+  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+  members = group->data.group.members;
+  count = group->data.group.count;
+  group->data.group.members = NULL;
+  group->data.group.count = 0;
+  group_unlink(group);
+  if (members == NULL) {
+    ret = TAI_ERROR_NOT_FOUND;
+  } else {
+    ret = group_release_members(members, count);
+  }
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+  if (members == NULL) {
+    return ret;
+  }
+  heap_free(TAI_HEAP_METADATA, members);
+  sceKernelDeleteUid(uid);
+  return ret;
+}
+
+/**
+ * @brief      Inserts a raw data injection given an absolute address and PID of
+ *             the address space
+ *
+ * @param[in]  pid   The pid of the src and dest pointers address space
+ * @param      dest  The destination
+ * @param[in]  src   The source
+ * @param[in]  size  The size
+ *
+ * @return     UID for the injection on success, < 0 on error
+ *             - TAI_ERROR_PATCH_EXISTS if a hook or injection is already
+ *               inserted
+ */
+SceUID tai_inject_abs(SceUID pid, void *dest, const void *src, size_t size) {
+  SceUID ret;
+
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
+  ret = inject_abs(pid, dest, src, size, 1);
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Removes an injection and restores the original data
+ *
+ * @param[in]  uid   The injection uid
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int tai_inject_release(SceUID uid) {
+  int ret;
+
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
+  ret = inject_release(uid, 1);
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Replaces the data of an injection in place
+ *
+ *             The new data is copied to kernel once, then compared with what
+ *             is currently injected and only the range that differs is
+ *             written from that copy, with a single cache flush. The original
+ *             data saved by `tai_inject_abs` is kept so releasing the
+ *             injection still restores it.
+ *
+ * @param[in]  uid      The injection uid
+ * @param[in]  src_pid  The address space of `src`
+ * @param[in]  src      The new data, same size as the injection
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int tai_inject_swap(SceUID uid, SceUID src_pid, const void *src) {
+  tai_patch_t *patch;
+  char *data, *cur;
+  char *dest;
+  size_t first, last, len;
+  int ret;
+
+  // releases take the inject lock too, so the patch stays valid while held
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
+  ret = sceKernelGetObjForUid(uid, &g_taihen_class, (SceObjectBase **)&patch);
+  LOG("sceKernelGetObjForUid(%x): 0x%08X", uid, ret);
+  if (ret < 0) {
+    sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+    return ret;
+  }
+  if (patch->type != INJECTION || patch->uid != uid) {
+    LOG("uid %x is not an injection", uid);
+    sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  // a single copy so the caller cannot change the data between compare and write
+  data = heap_alloc(TAI_HEAP_SAVED, patch->size);
+  cur = heap_alloc(TAI_HEAP_METADATA, INJECT_SWAP_CHUNK);
+  if (data == NULL || cur == NULL) {
+    ret = TAI_ERROR_MEMORY;
+    goto end;
+  }
+  ret = tai_memcpy_to_kernel(src_pid, data, src, patch->size);
+  if (ret < 0) {
+    goto end;
+  }
+  sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
+  dest = (char *)patch->addr;
+  first = patch->size;
+  last = 0;
+  for (size_t off = 0; off < patch->size; off += len) {
+    len = patch->size - off;
+    if (len > INJECT_SWAP_CHUNK) {
+      len = INJECT_SWAP_CHUNK;
+    }
+    ret = tai_memcpy_to_kernel(patch->pid, cur, dest + off, len);
+    if (ret < 0) {
+      goto unlock;
+    }
+    for (size_t i = 0; i < len; i++) {
+      if (cur[i] != data[off + i]) {
+        if (first == patch->size) {
+          first = off + i;
+        }
+        last = off + i + 1;
+      }
+    }
+  }
+  if (first < last) {
+    LOG("Swapping bytes 0x%08X-0x%08X of %p", first, last, dest);
+    ret = tai_force_write(patch->pid, dest + first, data + first, last - first);
+    cache_flush(patch->pid, (uintptr_t)dest + first, last - first);
+    notify_add(TAI_PATCH_EVENT_INJECT_SWAPPED, patch->pid, uid, patch->addr + first, last - first);
+  } else {
+    LOG("Injection %x is unchanged", uid);
+  }
+unlock:
+  sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+end:
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+  heap_free(TAI_HEAP_METADATA, cur);
+  heap_free(TAI_HEAP_SAVED, data);
+
+  return ret;
+}
+
+/**
+ * @brief      Sets how injections are written
+ *
+ *             Chunking is off by default. When it is on, user injections and
+ *             restores larger than `chunk` are written in pieces of `chunk`
+ *             bytes and the thread yields between them. Kernel injections and
+ *             injections made by `tai_patch_batch` are always written at once.
+ *
+ * @param[in]  chunk  Bytes written between yields, zero to write at once
+ * @param[in]  defer  Flush once after the last chunk instead of per chunk
+ */
+void tai_inject_set_chunking(size_t chunk, int defer) {
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
+  g_inject_chunk = chunk;
+  g_inject_defer_flush = defer;
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
+}
+
 /**
  * @brief      Called on process exist to force remove private hooks
  *
@@ -753,22 +1613,33 @@ int tai_try_cleanup_process(SceUID pid) {
   tai_patch_t *patch, *next;
   tai_hook_t *hook, *nexthook;
   LOG("Calling patches cleanup for pid %x", pid);
+  stats_unmap(pid);
+  bypass_cleanup_process(pid);
+  sceKernelLockMutexForKernel(g_inject_lock, 1, NULL);
   sceKernelLockMutexForKernel(g_hooks_lock, 1, NULL);
   if (proc_map_remove_all_pid(g_map, pid, &patch) > 0) {
+    notify_add(TAI_PATCH_EVENT_PROCESS_CLEANUP, pid, 0, 0, 0);
     while (patch != NULL) {
       next = patch->next;
       if (patch->type == HOOKS) {
+        // records went away with the process' slab, only free the metadata
         hook = patch->data.hooks.head;
         while (hook != NULL) {
           nexthook = hook->next;
-          slab_free(patch->slab, hook);
+          heap_free(TAI_HEAP_METADATA, hook);
           hook = nexthook;
         }
+      } else if (patch->type == INJECTION) {
+        // nothing to write back to, the process is gone
+        heap_free(TAI_HEAP_SAVED, patch->data.inject.saved);
+        patch->data.inject.saved = NULL;
       }
       sceKernelDeleteUid(patch->uid);
       patch = next;
     }
   }
+  group_drop_process(pid);
   sceKernelUnlockMutexForKernel(g_hooks_lock, 1);
+  sceKernelUnlockMutexForKernel(g_inject_lock, 1);
   return 0;
 }
@@ -22,14 +22,24 @@
  */
 /** @{ */
 
+/** Bytes written between yields that keep stalls short, for `tai_inject_set_chunking` */
+#define INJECT_WRITE_CHUNK 0x8000
+
 int patches_init(void);
 void patches_deinit(void);
 
 void cache_flush(SceUID pid, uintptr_t vma, size_t len);
-SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, const void *hook_func);
+void cache_flush_kernel(uintptr_t vma, size_t len);
+SceUID tai_hook_func_abs(tai_hook_ref_t *p_hook, SceUID pid, void *dest_func, const void *hook_func, const tai_hook_guard_t *guard);
 int tai_hook_release(SceUID uid, tai_hook_ref_t hook_ref);
+SceUID tai_hook_func_group(tai_hook_ref_t *p_hooks, SceUID pid, void *const *dest_funcs, size_t count, const void *hook_func, const tai_hook_guard_t *guard);
+SceUID tai_hook_func_broadcast(tai_hook_ref_t *p_hooks, const SceUID *pids, void *const *dest_funcs, const void *const *hook_funcs, size_t count);
+SceUID tai_patch_batch(SceUID pid, const tai_batch_op_t *ops, size_t count, tai_hook_ref_t *p_hooks);
+int tai_group_release(SceUID uid);
 SceUID tai_inject_abs(SceUID pid, void *dest, const void *src, size_t size);
 int tai_inject_release(SceUID uid);
+int tai_inject_swap(SceUID uid, SceUID src_pid, const void *src);
+void tai_inject_set_chunking(size_t chunk, int defer);
 int tai_try_cleanup_process(SceUID pid);
 
 /** @} */
@@ -9,34 +9,28 @@
 #include <psp2kern/kernel/sysmem.h>
 #include <stdlib.h>
 #include <string.h>
-
-/** From `patches.c`. Assumes it is initialized before first `malloc` call! */
-extern SceUID g_patch_pool;
+#include "heap.h"
 
 /**
- * @brief      Allocates heap memory from default pool
+ * @brief      Allocates heap memory from the scratch heap
+ *
+ *             Assumes `heap_init` is called before the first `malloc` call!
  *
  * @param[in]  size  The size
  *
  * @return     See `malloc()`
  */
 void *malloc(size_t size) {
-  void *ptr;
-  ptr = sceKernelMemPoolAlloc(g_patch_pool, size + sizeof(size_t));
-  if (ptr) {
-    *(size_t *)ptr = size;
-    ptr = (char *)ptr + sizeof(size_t);
-  }
-  return ptr;
+  return heap_alloc(TAI_HEAP_SCRATCH, size);
 }
 
 /**
- * @brief      Frees heap memory from default pool
+ * @brief      Frees heap memory from the scratch heap
  *
  * @param      ptr   The pointer
  */
 void free(void *ptr) {
-  sceKernelMemPoolFree(g_patch_pool, (char *)ptr - sizeof(size_t));
+  heap_free(TAI_HEAP_SCRATCH, ptr);
 }
 
 /**
@@ -52,8 +46,8 @@ void *realloc(void *ptr, size_t size) {
   size_t oldsize;
 
   dup = malloc(size);
-  if (dup) {
-    oldsize = *(size_t *)((char *)ptr - sizeof(size_t));
+  if (dup && ptr) {
+    oldsize = heap_usable_size(ptr);
     if (oldsize > size) {
       oldsize = size;
     }
@@ -12,26 +12,40 @@
 #include "taihen_internal.h"
 #include "proc_map.h"
 #include "slab.h"
+#include "thunk.h"
+#include "usage.h"
 
 /**
  * @brief      Patches are grouped by PID and stored in a linked list ordered by
  *             the address being patched. The groups are stored in a hash map
  *             where the hash function is just the PID.
+ *
+ *             `KERNEL_PID` holds most patches (all of hen.c's hooks and every
+ *             kernel plugin) and never exits, so it has its own `tai_proc_t`
+ *             in the map instead of a bucket entry. Its slabs stay allocated
+ *             while it has no patches.
  */
 
 /** Size of the heap pool for storing the map in bytes. */
 #define MAP_POOL_SIZE 1024
 
+/** Pool bytes per process the usage history asks room for. */
+#define MAP_POOL_PER_PID (sizeof(tai_proc_t) + 0x10)
+
 /** Found in substitute/lib/vita/execmem.c **/
 extern const size_t g_exe_slab_item_size;
 
 /** Resource pointer for the heap pool */
 static SceUID g_map_pool;
 
+/** Number of processes in the map */
+static uint32_t g_map_pids;
+
 /**
  * @brief      Initializes the map system
  *
- *             Must be called on startup.
+ *             Must be called on startup. The pool is sized from the usage
+ *             history, so `usage_init` should be called first.
  *
  * @return     Zero on success or memory allocation error code.
  */
@@ -40,7 +54,8 @@ int proc_map_init(void) {
   memset(&opt, 0, sizeof(opt));
   opt.size = sizeof(opt);
   opt.uselock = 1;
-  g_map_pool = sceKernelMemPoolCreate("tai_maps", MAP_POOL_SIZE, &opt);
+  g_map_pids = 0;
+  g_map_pool = sceKernelMemPoolCreate("tai_maps", MAP_POOL_SIZE + usage_pids() * MAP_POOL_PER_PID, &opt);
   if (g_map_pool < 0) {
     return g_map_pool;
   } else {
@@ -58,6 +73,34 @@ void proc_map_deinit(void) {
   g_map_pool = 0;
 }
 
+/**
+ * @brief      Sets up the slabs of a process
+ *
+ * @param      proc  The process
+ * @param[in]  pid   The pid
+ */
+static void proc_slabs_init(tai_proc_t *proc, SceUID pid) {
+  slab_init(&proc->slab, g_exe_slab_item_size, pid);
+  slab_init(&proc->hook_slab, sizeof(tai_hook_record_t), pid);
+  slab_init(&proc->thunk_slab, THUNK_MAX_SIZE, pid);
+  // reserve what this title used before, best effort as the slabs still grow on demand
+  proc->usage_title = usage_title(pid);
+  slab_reserve(&proc->slab, usage_slab_reserve(proc->usage_title, USAGE_SLAB_EXEC));
+  slab_reserve(&proc->hook_slab, usage_slab_reserve(proc->usage_title, USAGE_SLAB_HOOK));
+  slab_reserve(&proc->thunk_slab, usage_slab_reserve(proc->usage_title, USAGE_SLAB_THUNK));
+}
+
+/**
+ * @brief      Frees the slabs of a process
+ *
+ * @param      proc  The process
+ */
+static void proc_slabs_destroy(tai_proc_t *proc) {
+  slab_destroy(&proc->slab);
+  slab_destroy(&proc->hook_slab);
+  slab_destroy(&proc->thunk_slab);
+}
+
 /**
  * @brief      Allocates a new map
  *
@@ -75,6 +118,10 @@ tai_proc_map_t *proc_map_alloc(int nbuckets) {
   }
   map->nbuckets = nbuckets;
   map->lock = sceKernelCreateMutexForKernel("tai_map", SCE_KERNEL_MUTEX_ATTR_RECURSIVE, 0, NULL);
+  map->kernel.pid = KERNEL_PID;
+  map->kernel.head = NULL;
+  map->kernel.next = NULL;
+  proc_slabs_init(&map->kernel, KERNEL_PID);
   for (int i = 0; i < nbuckets; i++) {
     map->buckets[i] = NULL;
   }
@@ -87,6 +134,7 @@ tai_proc_map_t *proc_map_alloc(int nbuckets) {
  * @param      map   The map
  */
 void proc_map_free(tai_proc_map_t *map) {
+  proc_slabs_destroy(&map->kernel);
   sceKernelDeleteMutexForKernel(map->lock);
   sceKernelMemPoolFree(g_map_pool, map);
 }
@@ -117,26 +165,31 @@ int proc_map_try_insert(tai_proc_map_t *map, tai_patch_t *patch, tai_patch_t **e
   tai_proc_t **item, *proc;
   tai_patch_t **cur, *tmp;
 
-  idx = patch->pid % map->nbuckets;
   *existing = NULL;
 
   // get proc structure if found
   sceKernelLockMutexForKernel(map->lock, 1, NULL);
-  item = &map->buckets[idx];
-  while (*item != NULL && (*item)->pid < patch->pid) {
-    item = &(*item)->next;
-  }
-  if (*item != NULL && (*item)->pid == patch->pid) {
-    // existing block
-    proc = *item;
+  if (patch->pid == KERNEL_PID) {
+    proc = &map->kernel;
   } else {
-    // new block
-    proc = sceKernelMemPoolAlloc(g_map_pool, sizeof(tai_proc_t));
-    proc->pid = patch->pid;
-    proc->head = NULL;
-    proc->next = *item;
-    slab_init(&proc->slab, g_exe_slab_item_size, patch->pid);
-    *item = proc;
+    idx = patch->pid % map->nbuckets;
+    item = &map->buckets[idx];
+    while (*item != NULL && (*item)->pid < patch->pid) {
+      item = &(*item)->next;
+    }
+    if (*item != NULL && (*item)->pid == patch->pid) {
+      // existing block
+      proc = *item;
+    } else {
+      // new block
+      proc = sceKernelMemPoolAlloc(g_map_pool, sizeof(tai_proc_t));
+      proc->pid = patch->pid;
+      proc->head = NULL;
+      proc->next = *item;
+      proc_slabs_init(proc, patch->pid);
+      *item = proc;
+      usage_note_pids(++g_map_pids);
+    }
   }
 
   // now insert into range if needed
@@ -172,6 +225,9 @@ int proc_map_try_insert(tai_proc_map_t *map, tai_patch_t *patch, tai_patch_t **e
   if (!overlap) {
     patch->next = *cur;
     patch->slab = &proc->slab;
+    patch->hook_slab = &proc->hook_slab;
+    patch->thunk_slab = &proc->thunk_slab;
+    patch->usage_title = proc->usage_title;
     *cur = patch;
   }
   sceKernelUnlockMutexForKernel(map->lock, 1);
@@ -203,9 +259,17 @@ int proc_map_remove_all_pid(tai_proc_map_t *map, SceUID pid, tai_patch_t **head)
   int idx;
   tai_proc_t **cur, *tmp;
 
-  idx = pid % map->nbuckets;
   *head = NULL;
   sceKernelLockMutexForKernel(map->lock, 1, NULL);
+  if (pid == KERNEL_PID) {
+    *head = map->kernel.head;
+    map->kernel.head = NULL;
+    proc_slabs_destroy(&map->kernel);
+    proc_slabs_init(&map->kernel, KERNEL_PID);
+    sceKernelUnlockMutexForKernel(map->lock, 1);
+    return *head != NULL;
+  }
+  idx = pid % map->nbuckets;
   cur = &map->buckets[idx];
   while (*cur != NULL && (*cur)->pid < pid) {
     cur = &(*cur)->next;
@@ -214,13 +278,36 @@ int proc_map_remove_all_pid(tai_proc_map_t *map, SceUID pid, tai_patch_t **head)
     tmp = *cur;
     *cur = tmp->next;
     *head = tmp->head;
-    slab_destroy(&tmp->slab);
+    proc_slabs_destroy(tmp);
     sceKernelMemPoolFree(g_map_pool, tmp);
+    g_map_pids--;
   }
   sceKernelUnlockMutexForKernel(map->lock, 1);
   return *head != NULL;
 }
 
+/**
+ * @brief      Unlinks a patch from its process
+ *
+ * @param      proc   The process
+ * @param      patch  The patch
+ *
+ * @return     One if the patch was found
+ */
+static int proc_remove_patch(tai_proc_t *proc, tai_patch_t *patch) {
+  tai_patch_t **cur;
+
+  cur = &proc->head;
+  while (*cur != NULL && *cur != patch) {
+    cur = &(*cur)->next;
+  }
+  if (*cur == NULL) {
+    return 0;
+  }
+  *cur = patch->next;
+  return 1;
+}
+
 /**
  * @brief      Remove a single patch from the map
  *
@@ -234,31 +321,32 @@ int proc_map_remove(tai_proc_map_t *map, tai_patch_t *patch) {
   int idx;
   int found;
   tai_proc_t **proc, *next;
-  tai_patch_t **cur;
 
-  idx = patch->pid % map->nbuckets;
   found = 0;
   sceKernelLockMutexForKernel(map->lock, 1, NULL);
+  if (patch->pid == KERNEL_PID) {
+    // the kernel's slabs outlive its patches
+    found = proc_remove_patch(&map->kernel, patch);
+    sceKernelUnlockMutexForKernel(map->lock, 1);
+    return found;
+  }
+  idx = patch->pid % map->nbuckets;
   proc = &map->buckets[idx];
   while (*proc != NULL && (*proc)->pid < patch->pid) {
     proc = &(*proc)->next;
   }
   if (*proc != NULL && (*proc)->pid == patch->pid) {
-    cur = &(*proc)->head;
-    while (*cur != NULL && *cur != patch) {
-      cur = &(*cur)->next;
-    }
-    if (*cur != NULL) {
-      *cur = patch->next;
-      found = 1;
-    }
+    found = proc_remove_patch(*proc, patch);
   }
   if (*proc != NULL && (*proc)->head == NULL) { // it's now empty
     patch->slab = NULL; // remove reference
+    patch->hook_slab = NULL;
+    patch->thunk_slab = NULL;
     next = (*proc)->next;
-    slab_destroy(&(*proc)->slab);
+    proc_slabs_destroy(*proc);
     sceKernelMemPoolFree(g_map_pool, *proc);
     *proc = next;
+    g_map_pids--;
   }
   sceKernelUnlockMutexForKernel(map->lock, 1);
   return found;
@@ -23,6 +23,7 @@
 typedef struct _tai_proc_map {
   int nbuckets;				///< Number of buckets set by `proc_map_alloc`
   SceUID lock;				///< Mutex for accessing buckets
+  tai_proc_t kernel;		///< `KERNEL_PID`, kept out of the buckets
   tai_proc_t *buckets[];	///< Buckets
 } tai_proc_map_t;
 
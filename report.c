@@ -0,0 +1,176 @@
+/* report.c -- plugin load reports
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+#include "error.h"
+#include "report.h"
+#include "taihen_internal.h"
+
+/**
+ * @brief      Load records of one title
+ */
+typedef struct _report_title {
+  char titleid[32];             ///< The title or empty if the slot is free
+  uint32_t total;               ///< Number of records ever added for the title
+  uint32_t seq[REPORT_TITLE_HISTORY]; ///< When each record was added
+  tai_load_report_t reports[REPORT_TITLE_HISTORY]; ///< Records, oldest overwritten first
+} report_title_t;
+
+/** Titles with load records */
+static report_title_t g_titles[REPORT_MAX_TITLES];
+
+/** Number of records ever added, orders records across titles */
+static uint32_t g_reports_seq;
+
+/** Lock for the records */
+static SceUID g_report_lock;
+
+/**
+ * @brief      Gets the records of a title, taking over the least recently
+ *             used title if it has none
+ *
+ * @param[in]  titleid  The title
+ *
+ * @return     The title's records
+ */
+static report_title_t *report_title(const char *titleid) {
+  report_title_t *title, *oldest;
+  uint32_t age, oldest_age;
+
+  oldest = NULL;
+  oldest_age = 0;
+  for (int i = 0; i < REPORT_MAX_TITLES; i++) {
+    title = &g_titles[i];
+    if (strncmp(title->titleid, titleid, sizeof(title->titleid)) == 0 && title->titleid[0] != '\0') {
+      return title;
+    }
+    // free slots are the oldest
+    age = title->total ? g_reports_seq - title->seq[(title->total - 1) % REPORT_TITLE_HISTORY] : 0xFFFFFFFF;
+    if (oldest == NULL || age > oldest_age) {
+      oldest = title;
+      oldest_age = age;
+    }
+  }
+  LOG("recording loads for %s", titleid);
+  memset(oldest, 0, sizeof(*oldest));
+  snprintf(oldest->titleid, sizeof(oldest->titleid), "%s", titleid);
+  return oldest;
+}
+
+/**
+ * @brief      Adds a record, replacing the title's oldest if full
+ *
+ * @param[in]  report  The record
+ */
+void report_add(const tai_load_report_t *report) {
+  report_title_t *title;
+  uint32_t idx;
+
+  sceKernelLockMutexForKernel(g_report_lock, 1, NULL);
+  title = report_title(report->titleid[0] ? report->titleid : "?");
+  idx = title->total % REPORT_TITLE_HISTORY;
+  memcpy(&title->reports[idx], report, sizeof(*report));
+  title->seq[idx] = g_reports_seq++;
+  title->total++;
+  sceKernelUnlockMutexForKernel(g_report_lock, 1);
+}
+
+/**
+ * @brief      Gets a record
+ *
+ *             Records of all titles are merged by the order they were added.
+ *
+ * @param[in]  titleid  The title to get records for or NULL for all
+ * @param[in]  index    Which matching record, 0 is the most recent
+ * @param[out] report   The record
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if there are not that many records
+ */
+int report_get(const char *titleid, int index, tai_load_report_t *report) {
+  report_title_t *title;
+  tai_load_report_t *cur, *next;
+  uint32_t count, age, next_age, last_age;
+  int ret;
+
+  ret = TAI_ERROR_NOT_FOUND;
+  if (index < 0) {
+    return ret;
+  }
+  sceKernelLockMutexForKernel(g_report_lock, 1, NULL);
+  cur = NULL;
+  if (titleid != NULL) {
+    for (int i = 0; i < REPORT_MAX_TITLES; i++) {
+      title = &g_titles[i];
+      if (title->titleid[0] == '\0' || strncmp(title->titleid, titleid, sizeof(title->titleid)) != 0) {
+        continue;
+      }
+      count = title->total < REPORT_TITLE_HISTORY ? title->total : REPORT_TITLE_HISTORY;
+      if (index < count) {
+        cur = &title->reports[(title->total - 1 - index) % REPORT_TITLE_HISTORY];
+      }
+      break;
+    }
+  } else {
+    // walk back from the newest record one at a time, by age
+    last_age = 0;
+    for (int n = 0; n <= index; n++) {
+      next = NULL;
+      next_age = 0;
+      for (int i = 0; i < REPORT_MAX_TITLES; i++) {
+        title = &g_titles[i];
+        count = title->total < REPORT_TITLE_HISTORY ? title->total : REPORT_TITLE_HISTORY;
+        for (uint32_t j = 0; j < count; j++) {
+          age = g_reports_seq - title->seq[j];
+          if ((n == 0 || age > last_age) && (next == NULL || age < next_age)) {
+            next = &title->reports[j];
+            next_age = age;
+          }
+        }
+      }
+      if (next == NULL) {
+        break;
+      }
+      cur = (n == index) ? next : NULL;
+      last_age = next_age;
+    }
+  }
+  if (cur != NULL) {
+    memcpy(report, cur, sizeof(*report));
+    ret = TAI_SUCCESS;
+  }
+  sceKernelUnlockMutexForKernel(g_report_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Initializes the load records
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int report_init(void) {
+  memset(g_titles, 0, sizeof(g_titles));
+  g_reports_seq = 0;
+  g_report_lock = sceKernelCreateMutexForKernel("tai_report_lock", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_report_lock): 0x%08X", g_report_lock);
+  if (g_report_lock < 0) {
+    return g_report_lock;
+  }
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Frees the load records
+ */
+void report_deinit(void) {
+  if (g_report_lock > 0) {
+    sceKernelDeleteMutexForKernel(g_report_lock);
+  }
+  g_report_lock = 0;
+}
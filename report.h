@@ -0,0 +1,35 @@
+/**
+ * @brief      Plugin load reports
+ */
+#ifndef TAI_REPORT_HEADER
+#define TAI_REPORT_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   report Plugin Load Reports
+ * @brief      Records how long each plugin took to load
+ *
+ * @details    Every plugin loaded from the config is recorded with its load
+ *             and start time, result and memory cost. Each title keeps its
+ *             most recent records in a small ring of its own so a busy title
+ *             cannot push out the history of the others. When there are too
+ *             many titles, the one that loaded a plugin least recently is
+ *             forgotten.
+ */
+/** @{ */
+
+/** Number of titles with load records */
+#define REPORT_MAX_TITLES 16
+
+/** Number of plugin loads remembered per title */
+#define REPORT_TITLE_HISTORY 8
+
+int report_init(void);
+void report_deinit(void);
+void report_add(const tai_load_report_t *report);
+int report_get(const char *titleid, int index, tai_load_report_t *report);
+
+/** @} */
+
+#endif // TAI_REPORT_HEADER
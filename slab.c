@@ -2,6 +2,7 @@
 
 #include "slab.h"
 #include "taihen_internal.h"
+#include "stats.h"
 #include <psp2kern/kernel/sysmem.h>
 
 #include <stdint.h>
@@ -36,6 +37,10 @@
         ) == SLOTS_ALL_ZERO \
     )
 
+#define GROUP_STARTS ((uint64_t) 0x1111111111111111)
+#define FREE_GROUPS(s) \
+    ((s) & ((s) >> 1) & ((s) >> 2) & ((s) >> 3) & GROUP_STARTS)
+
 #define POWEROF2(x) ((x) != 0 && ((x) & ((x) - 1)) == 0)
 
 #define LIKELY(exp) __builtin_expect(exp, 1)
@@ -43,6 +48,79 @@
 
 const size_t slab_pagesize = 0x1000;
 
+/**
+ * @brief      Maps a kernel writable mirror of executable memory
+ *
+ * @param[in]  exe_res   UID of the executable memory
+ * @param      ptr       A kernel writable pointer
+ *
+ * @return     UID of writable memory on success, < 0 on error
+ */
+static SceUID sce_exe_mirror(SceUID exe_res, void **ptr) {
+    SceKernelAllocMemBlockKernelOpt opt;
+    SceUID res, blkid;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.size = sizeof(opt);
+    opt.attr = 0x1000040;
+    opt.mirror_blkid = exe_res;
+    res = sceKernelAllocMemBlockForKernel("taimirror", SCE_KERNEL_MEMBLOCK_TYPE_RW_UNK0, 0, &opt);
+    LOG("sceKernelAllocMemBlockForKernel(taimirror): 0x%08X", res);
+    if (res < 0) {
+        return res;
+    }
+    blkid = res;
+    res = sceKernelGetMemBlockBaseForKernel(blkid, ptr);
+    LOG("sceKernelGetMemBlockBaseForKernel(%x): 0x%08X, addr: 0x%08X", blkid, res, *ptr);
+    if (res < 0) {
+        sceKernelFreeMemBlockForKernel(blkid);
+        return res;
+    }
+    return blkid;
+}
+
+/**
+ * @brief      Allocates a raw chunk of kernel memory
+ *
+ * The kernel's slabs have no owning process and nothing to map user visible.
+ *
+ * @param      ptr       A kernel writable pointer
+ * @param      exe_addr  Executable kernel address
+ * @param      exe_res   UID for the executable mapping
+ * @param[in]  align     Alignment
+ * @param[in]  size      Size
+ *
+ * @return     UID of writable memory on success, < 0 on error
+ */
+static SceUID sce_exe_alloc_kernel(void **ptr, uintptr_t *exe_addr, SceUID *exe_res, size_t align, size_t size) {
+    SceKernelAllocMemBlockKernelOpt opt;
+    SceUID res;
+
+    LOG("Allocating kernel exec slab size 0x%08X", size);
+    memset(&opt, 0, sizeof(opt));
+    opt.size = sizeof(opt);
+    opt.attr = 0xA0000000 | 0x400000;
+    opt.alignment = align;
+    if (align) {
+        opt.attr |= SCE_KERNEL_ALLOC_MEMBLOCK_ATTR_HAS_ALIGNMENT;
+    }
+    *exe_res = sceKernelAllocMemBlockForKernel("taislab", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RX, size, &opt);
+    LOG("sceKernelAllocMemBlockForKernel(taislab): 0x%08X", *exe_res);
+    if (*exe_res < 0) {
+        return *exe_res;
+    }
+    res = sceKernelGetMemBlockBaseForKernel(*exe_res, (void **)exe_addr);
+    if (res >= 0) {
+        res = sce_exe_mirror(*exe_res, ptr);
+    }
+    if (res < 0) {
+        sceKernelFreeMemBlockForKernel(*exe_res);
+        return res;
+    }
+    STATS_INC(slabs_allocated);
+    return res;
+}
+
 /**
  * @brief      Allocates a raw chunk of memory
  * 
@@ -60,7 +138,11 @@ const size_t slab_pagesize = 0x1000;
 static SceUID sce_exe_alloc(SceUID pid, void **ptr, uintptr_t *exe_addr, SceUID *exe_res, size_t align, size_t size) {
     SceKernelAllocMemBlockKernelOpt opt;
     SceKernelMemBlockType type;
-    SceUID res, blkid;
+    SceUID res;
+
+    if (pid == KERNEL_PID) {
+        return sce_exe_alloc_kernel(ptr, exe_addr, exe_res, align, size);
+    }
 
     LOG("Allocating exec slab for %x size 0x%08X", pid, size);
     // allocate exe mem
@@ -71,9 +153,7 @@ static SceUID sce_exe_alloc(SceUID pid, void **ptr, uintptr_t *exe_addr, SceUID
     if (align) {
         opt.attr |= SCE_KERNEL_ALLOC_MEMBLOCK_ATTR_HAS_ALIGNMENT;
     }
-    if (pid == KERNEL_PID) {
-        type = SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RX;
-    } else if (pid == SHARED_PID) {
+    if (pid == SHARED_PID) {
         type = SCE_KERNEL_MEMBLOCK_TYPE_SHARED_RX;
     } else {
         type = SCE_KERNEL_MEMBLOCK_TYPE_USER_RX;
@@ -88,16 +168,14 @@ static SceUID sce_exe_alloc(SceUID pid, void **ptr, uintptr_t *exe_addr, SceUID
     res = sceKernelGetMemBlockBaseForKernel(*exe_res, (void **)exe_addr);
     LOG("sceKernelGetMemBlockBaseForKernel(%x): 0x%08X, addr: 0x%08X", *exe_res, res, *exe_addr);
     if (res < 0) {
-        goto err2;
+        goto err;
     }
 
     // TODO: Perhaps move this to execmem seal?
-    if (pid != KERNEL_PID) {
-        res = sceKernelMapBlockUserVisible(*exe_res);
-        LOG("sceKernelMapBlockUserVisible: %x", res);
-        if (res < 0) {
-            goto err2;
-        }
+    res = sceKernelMapBlockUserVisible(*exe_res);
+    LOG("sceKernelMapBlockUserVisible: %x", res);
+    if (res < 0) {
+        goto err;
     }
 
     // map in every process if needed
@@ -105,28 +183,15 @@ static SceUID sce_exe_alloc(SceUID pid, void **ptr, uintptr_t *exe_addr, SceUID
         // FIXME: implement this
     }
 
-    // allocate mirror
-    memset(&opt, 0, sizeof(opt));
-    opt.size = sizeof(opt);
-    opt.attr = 0x1000040;
-    opt.mirror_blkid = *exe_res;
-    res = sceKernelAllocMemBlockForKernel("taimirror", SCE_KERNEL_MEMBLOCK_TYPE_RW_UNK0, 0, &opt);
-    LOG("sceKernelAllocMemBlockForKernel(taimirror): 0x%08X", res);
-    if (res < 0) {
-        goto err2;
-    }
-    blkid = res;
-    res = sceKernelGetMemBlockBaseForKernel(blkid, ptr);
-    LOG("sceKernelGetMemBlockBaseForKernel(%x): 0x%08X, addr: 0x%08X", blkid, res, *ptr);
+    res = sce_exe_mirror(*exe_res, ptr);
     if (res < 0) {
-        goto err1;
+        goto err;
     }
 
-    return blkid;
+    STATS_INC(slabs_allocated);
+    return res;
 
-err1:
-    sceKernelFreeMemBlockForKernel(blkid);
-err2:
+err:
     sceKernelFreeMemBlockForKernel(*exe_res);
     return res;
 }
@@ -143,9 +208,33 @@ static int sce_exe_free(SceUID write_res, SceUID exe_res) {
     LOG("freeing slab %x, mirror %x", exe_res, write_res);
     sceKernelFreeMemBlockForKernel(write_res);
     sceKernelFreeMemBlockForKernel(exe_res);
+    STATS_INC(slabs_freed);
     return 0;
 }
 
+/**
+ * @brief      Find the free slot closest to a given slot
+ *
+ * @param[in]  slots  Free slot mask of a slab (must not be all zero)
+ * @param[in]  slot   The slot to search around
+ *
+ * @return     Index of the nearest free slot
+ */
+static inline size_t nearest_free_slot(uint64_t slots, size_t slot) {
+    const uint64_t above = slots >> slot;
+    const uint64_t below = slots & ((SLOTS_FIRST << slot) - 1);
+
+    if (above == SLOTS_ALL_ZERO)
+        return 63 - (size_t) __builtin_clzll(below);
+    if (below == SLOTS_ALL_ZERO)
+        return slot + FIRST_FREE_SLOT(above);
+
+    const size_t up = FIRST_FREE_SLOT(above);
+    const size_t down = slot - (63 - (size_t) __builtin_clzll(below));
+
+    return up <= down ? slot + up : slot - down;
+}
+
 /**
  * @brief      Compute the next largest power of two. Limit 32 bits.
  *
@@ -197,6 +286,7 @@ void slab_init(struct slab_chain *const sch, const size_t itemsize, SceUID pid)
     sch->initial_slotmask = sch->empty_slotmask ^ SLOTS_FIRST;
     sch->alignment_mask = ~(sch->slabsize - 1);
     sch->partial = sch->empty = sch->full = NULL;
+    sch->pages = sch->peak_pages = 0;
 
     assert(slab_is_valid(sch));
 }
@@ -223,9 +313,11 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
                 sch->full->prev = tmp;
 
             sch->full = tmp;
+            STATS_INC(slab_items_allocated);
             *exe_addr = sch->full->exe_data + slot * sch->itemsize;
             return sch->full->data + slot * sch->itemsize;
         } else {
+            STATS_INC(slab_items_allocated);
             *exe_addr = sch->partial->exe_data + slot * sch->itemsize;
             return sch->partial->data + slot * sch->itemsize;
         }
@@ -241,6 +333,7 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
             sch->partial->refcount++ : sch->partial->page->refcount++;
 
         sch->partial->slots = sch->initial_slotmask;
+        STATS_INC(slab_items_allocated);
         *exe_addr = sch->partial->exe_data;
         return sch->partial->data;
     } else {
@@ -252,6 +345,8 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
             *exe_addr = 0;
             return sch->partial = NULL;
         }
+        if (++sch->pages > sch->peak_pages)
+            sch->peak_pages = sch->pages;
         sch->partial->write_res = write_res;
         sch->partial->exe_res = exe_res;
         sch->partial->exe_data = exe_data + offsetof(struct slab_header, data);
@@ -281,7 +376,7 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
             curr.s->page = sch->partial;
             curr.s->write_res = write_res;
             curr.s->exe_res = exe_res;
-            curr.s->exe_data = exe_data;
+            curr.s->exe_data = exe_data + offsetof(struct slab_header, data);
             exe_data += sch->slabsize;
             curr.s->slots = sch->empty_slotmask;
             sch->empty = prev = curr.s;
@@ -293,7 +388,7 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
                 curr.s->page = sch->partial;
                 curr.s->write_res = write_res;
                 curr.s->exe_res = exe_res;
-                curr.s->exe_data = exe_data;
+                curr.s->exe_data = exe_data + offsetof(struct slab_header, data);
                 exe_data += sch->slabsize;
                 curr.s->slots = sch->empty_slotmask;
                 prev = curr.s;
@@ -302,6 +397,7 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
             prev->next = NULL;
         }
 
+        STATS_INC(slab_items_allocated);
         *exe_addr = sch->partial->exe_data;
         return sch->partial->data;
     }
@@ -309,6 +405,167 @@ void *slab_alloc(struct slab_chain *const sch, uintptr_t *exe_addr)
     /* unreachable */
 }
 
+/**
+ * @brief      Takes a free slot from a partial slab
+ *
+ * @param      sch       The slab chain
+ * @param      slab      A slab on the partial list
+ * @param[in]  slot      A free slot in `slab`
+ * @param[out] exe_addr  Executable address of the returned item
+ *
+ * @return     Writable pointer to the item
+ */
+static void *slab_take(struct slab_chain *const sch, struct slab_header *const slab,
+                       const size_t slot, uintptr_t *exe_addr)
+{
+    slab->slots ^= SLOTS_FIRST << slot;
+
+    if (UNLIKELY(slab->slots == SLOTS_ALL_ZERO)) {
+        /* slab has become full, unlink it from anywhere in the partial list */
+        if (LIKELY(slab != sch->partial)) {
+            if (LIKELY((slab->prev->next = slab->next) != NULL))
+                slab->next->prev = slab->prev;
+        } else if (LIKELY((sch->partial = sch->partial->next) != NULL)) {
+            sch->partial->prev = NULL;
+        }
+
+        slab->prev = NULL;
+
+        if (LIKELY((slab->next = sch->full) != NULL))
+            sch->full->prev = slab;
+
+        sch->full = slab;
+    }
+
+    STATS_INC(slab_items_allocated);
+    *exe_addr = slab->exe_data + slot * sch->itemsize;
+    return slab->data + slot * sch->itemsize;
+}
+
+/**
+ * @brief      Allocates an item as close as possible to an existing item
+ *
+ *             If the slab containing `hint` has a free slot, the slot nearest
+ *             to `hint` is returned so related items share a slab (and cache
+ *             lines when the item size allows). If `hint` is NULL, the item
+ *             starts a new group: it is placed at the start of a run of four
+ *             free slots so later items hinted with it can be placed right
+ *             after it. An already mapped empty slab is used
+ *             if no partial slab has such a run. Otherwise this falls back to
+ *             `slab_alloc`.
+ *
+ * @param      sch       The slab chain
+ * @param[in]  hint      An item allocated from `sch` or NULL
+ * @param[out] exe_addr  Executable address of the returned item
+ *
+ * @return     Writable pointer to the item or NULL on failure
+ */
+void *slab_alloc_near(struct slab_chain *const sch, const void *const hint,
+                      uintptr_t *exe_addr)
+{
+    assert(sch != NULL);
+    assert(slab_is_valid(sch));
+
+    struct slab_header *slab;
+
+    if (hint != NULL) {
+        slab = (void *) ((uintptr_t) hint & sch->alignment_mask);
+
+        /* a full slab is not on the partial list */
+        if (slab->slots == SLOTS_ALL_ZERO)
+            return slab_alloc(sch, exe_addr);
+
+        const size_t hint_slot = ((char *) hint - (char *) slab -
+            offsetof(struct slab_header, data)) / sch->itemsize;
+
+        return slab_take(sch, slab, nearest_free_slot(slab->slots, hint_slot),
+                         exe_addr);
+    }
+
+    for (slab = sch->partial; slab != NULL; slab = slab->next) {
+        const uint64_t groups = FREE_GROUPS(slab->slots);
+
+        if (groups != SLOTS_ALL_ZERO)
+            return slab_take(sch, slab, FIRST_FREE_SLOT(groups), exe_addr);
+    }
+
+    if (sch->empty != NULL) {
+        /* hide the partial list so `slab_alloc` starts the empty slab */
+        struct slab_header *const partial = sch->partial;
+        void *item;
+
+        sch->partial = NULL;
+        item = slab_alloc(sch, exe_addr);
+        if (LIKELY((sch->partial->next = partial) != NULL))
+            partial->prev = sch->partial;
+
+        return item;
+    }
+
+    return slab_alloc(sch, exe_addr);
+}
+
+/**
+ * @brief      Maps pages ahead of time
+ *
+ *             The slabs of each page go on the empty list. Reserved pages are
+ *             pinned with an extra reference on the page's first slab so they
+ *             stay mapped when their items are freed, until `slab_destroy`.
+ *
+ * @param      sch    The slab chain
+ * @param[in]  pages  Number of pages to map
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int slab_reserve(struct slab_chain *const sch, size_t pages)
+{
+    assert(sch != NULL);
+    assert(slab_is_valid(sch));
+
+    while (pages-- > 0) {
+        struct slab_header *page;
+        SceUID write_res, exe_res;
+        uintptr_t exe_data;
+
+        if ((write_res = sce_exe_alloc(sch->pid, (void **)&page, &exe_data,
+                          &exe_res, sch->slabsize, sch->pages_per_alloc)) < 0)
+            return write_res;
+
+        if (++sch->pages > sch->peak_pages)
+            sch->peak_pages = sch->pages;
+
+        const char *const page_end = (char *) page + sch->pages_per_alloc;
+
+        union {
+            const char *c;
+            struct slab_header *const s;
+        } curr = {
+            .c = (const char *) page
+        };
+
+        do {
+            curr.s->prev = NULL;
+            curr.s->refcount = 0;
+            curr.s->page = page;
+            curr.s->write_res = write_res;
+            curr.s->exe_res = exe_res;
+            curr.s->exe_data = exe_data + offsetof(struct slab_header, data);
+            exe_data += sch->slabsize;
+            curr.s->slots = sch->empty_slotmask;
+
+            if (LIKELY((curr.s->next = sch->empty) != NULL))
+                sch->empty->prev = curr.s;
+
+            sch->empty = curr.s;
+        } while (LIKELY((curr.c += sch->slabsize) != page_end));
+
+        /* the pin */
+        page->refcount = 1;
+    }
+
+    return 0;
+}
+
 void slab_free(struct slab_chain *const sch, const void *const addr)
 {
     assert(sch != NULL);
@@ -321,6 +578,8 @@ void slab_free(struct slab_chain *const sch, const void *const addr)
     register const int slot = ((char *) addr - (char *) slab -
         offsetof(struct slab_header, data)) / sch->itemsize;
 
+    STATS_INC(slab_items_freed);
+
     if (UNLIKELY(slab->slots == SLOTS_ALL_ZERO)) {
         /* target slab is full, change state to partial */
         slab->slots = SLOTS_FIRST << slot;
@@ -375,6 +634,7 @@ void slab_free(struct slab_chain *const sch, const void *const addr)
                 sch->empty->prev = NULL;
 
             sce_exe_free(slab->write_res, slab->exe_res);
+            sch->pages--;
         } else {
             slab->slots = sch->empty_slotmask;
 
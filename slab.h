@@ -12,6 +12,10 @@
 
 extern const size_t slab_pagesize;
 
+/* items are laid out from a cache line boundary so that line sized items
+ * never straddle two lines */
+#define SLAB_LINE_SIZE 32
+
 struct slab_header {
     struct slab_header *prev, *next;
     uint64_t slots;
@@ -20,7 +24,7 @@ struct slab_header {
     SceUID write_res;
     SceUID exe_res;
     uintptr_t exe_data;
-    uint8_t data[] __attribute__((aligned(sizeof(void *))));
+    uint8_t data[] __attribute__((aligned(SLAB_LINE_SIZE)));
 };
 
 struct slab_chain {
@@ -29,11 +33,14 @@ struct slab_chain {
     uint64_t initial_slotmask, empty_slotmask;
     uintptr_t alignment_mask;
     struct slab_header *partial, *empty, *full;
+    size_t pages, peak_pages;
     SceUID pid;
 };
 
 void slab_init(struct slab_chain *, size_t, SceUID);
 void *slab_alloc(struct slab_chain *, uintptr_t *);
+void *slab_alloc_near(struct slab_chain *, const void *, uintptr_t *);
+int slab_reserve(struct slab_chain *, size_t);
 void slab_free(struct slab_chain *, const void *);
 uintptr_t slab_getmirror(struct slab_chain *, const void *);
 void slab_traverse(const struct slab_chain *, void (*)(const void *));
@@ -0,0 +1,291 @@
+/* stats.c -- shared statistics page
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/kernel/cpu.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+#include "error.h"
+#include "stats.h"
+#include "taihen_internal.h"
+
+/** Size of the stats page */
+#define STATS_PAGE_SIZE 0x1000
+
+/** Copies `stats_snapshot` makes before giving up on an untouched one */
+#define STATS_SNAPSHOT_RETRIES 16
+
+/**
+ * @brief      The stats page mapped into a process
+ */
+typedef struct _stats_mapping {
+  SceUID pid;                   ///< Process or 0 if the slot is unused
+  SceUID blkid;                 ///< The user mapping
+  uintptr_t addr;               ///< Address of the mapping in the process
+} stats_mapping_t;
+
+/** Memory block holding the stats */
+static SceUID g_stats_blk;
+
+/** The stats or NULL if not initialized */
+static tai_stats_t *g_stats;
+
+/** Processes with the page mapped */
+static stats_mapping_t g_mappings[STATS_MAX_MAPPINGS];
+
+/** Lock for `g_mappings` */
+static SceUID g_mappings_lock;
+
+/**
+ * @brief      Adds to a counter and publishes the update
+ *
+ *             Each counter is updated atomically on its own. `seq` is bumped
+ *             by two after every update so it stays even and readers can tell
+ *             whether anything changed while they copied.
+ *
+ * @param      counter  The counter in the stats page
+ * @param[in]  n        Amount to add
+ */
+static inline void stats_update(uint32_t *counter, uint32_t n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&g_stats->seq, 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief      Adds to a counter
+ *
+ *             Use `STATS_INC` and `STATS_ADD` instead.
+ *
+ * @param[in]  offset  Offset of the counter in `tai_stats_t`
+ * @param[in]  n       Amount to add
+ */
+void stats_add(size_t offset, uint32_t n) {
+  if (g_stats == NULL) {
+    return;
+  }
+  stats_update((uint32_t *)((char *)g_stats + offset), n);
+}
+
+/**
+ * @brief      Gets the histogram bucket for the time since `start`
+ *
+ * @param[in]  start  `sceKernelGetSystemTimeWide` at the start
+ *
+ * @return     The bucket
+ */
+static inline int stats_bucket(SceInt64 start) {
+  uint32_t us;
+  int bucket;
+
+  us = sceKernelGetSystemTimeWide() - start;
+  bucket = (us > 1) ? 31 - __builtin_clz(us) : 0;
+  if (bucket >= TAI_STATS_LATENCY_BUCKETS) {
+    bucket = TAI_STATS_LATENCY_BUCKETS - 1;
+  }
+  return bucket;
+}
+
+/**
+ * @brief      Records how long a call took
+ *
+ * @param[in]  api    The API
+ * @param[in]  start  `sceKernelGetSystemTimeWide` at the start of the call
+ */
+void stats_latency(tai_stats_api_t api, SceInt64 start) {
+  if (g_stats == NULL) {
+    return;
+  }
+  stats_update(&g_stats->latency[api][stats_bucket(start)], 1);
+}
+
+/**
+ * @brief      Records how long a phase of adding a hook took
+ *
+ *             Use `PROFILE_START` and `PROFILE_END` instead so it compiles
+ *             out without `ENABLE_PROFILING`.
+ *
+ * @param[in]  phase  The phase
+ * @param[in]  start  `sceKernelGetSystemTimeWide` at the start of the phase
+ */
+void stats_phase(tai_stats_phase_t phase, SceInt64 start) {
+  if (g_stats == NULL) {
+    return;
+  }
+  stats_update(&g_stats->phase[phase][stats_bucket(start)], 1);
+}
+
+/**
+ * @brief      Gets a copy of the stats
+ *
+ *             Copies until no update happened during the copy, at most
+ *             `STATS_SNAPSHOT_RETRIES` times. Under constant updates the last
+ *             copy is kept, where each counter is still a value it had
+ *             during the copy.
+ *
+ * @param[out] out   The copy
+ *
+ * @return     1 if no update happened during the copy, 0 otherwise
+ */
+int stats_snapshot(tai_stats_t *out) {
+  uint32_t seq;
+
+  if (g_stats == NULL) {
+    memset(out, 0, sizeof(*out));
+    return 1;
+  }
+  for (int i = 0; i < STATS_SNAPSHOT_RETRIES; i++) {
+    seq = __atomic_load_n(&g_stats->seq, __ATOMIC_ACQUIRE);
+    memcpy(out, g_stats, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&g_stats->seq, __ATOMIC_RELAXED) == seq) {
+      out->seq = seq;
+      return 1;
+    }
+  }
+  out->seq = seq;
+  return 0;
+}
+
+/**
+ * @brief      Maps the stats page read only into a process
+ *
+ *             The mapping is reused if the process already has one. It is
+ *             freed by `stats_unmap` when the process exits.
+ *
+ * @param[in]  pid   The process
+ * @param[out] addr  Address of the page in the process
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_MEMORY if `STATS_MAX_MAPPINGS` processes have it
+ *               mapped
+ */
+int stats_map(SceUID pid, uintptr_t *addr) {
+  SceKernelAllocMemBlockKernelOpt opt;
+  stats_mapping_t *mapping;
+  SceUID blkid;
+  int ret;
+
+  if (g_stats == NULL) {
+    return TAI_ERROR_SYSTEM;
+  }
+  sceKernelLockMutexForKernel(g_mappings_lock, 1, NULL);
+  mapping = NULL;
+  for (int i = 0; i < STATS_MAX_MAPPINGS; i++) {
+    if (g_mappings[i].pid == pid) {
+      *addr = g_mappings[i].addr;
+      sceKernelUnlockMutexForKernel(g_mappings_lock, 1);
+      return TAI_SUCCESS;
+    } else if (g_mappings[i].pid == 0 && mapping == NULL) {
+      mapping = &g_mappings[i];
+    }
+  }
+  if (mapping == NULL) {
+    LOG("too many processes with the stats page");
+    ret = TAI_ERROR_MEMORY;
+    goto end;
+  }
+
+  // a user read only view of the kernel page
+  memset(&opt, 0, sizeof(opt));
+  opt.size = sizeof(opt);
+  opt.attr = 0x1000040 | 0x80080;
+  opt.mirror_blkid = g_stats_blk;
+  opt.pid = pid;
+  blkid = sceKernelAllocMemBlockForKernel("tai_stats_user", SCE_KERNEL_MEMBLOCK_TYPE_USER_R, 0, &opt);
+  LOG("sceKernelAllocMemBlockForKernel(tai_stats_user): 0x%08X", blkid);
+  if (blkid < 0) {
+    ret = blkid;
+    goto end;
+  }
+  ret = sceKernelGetMemBlockBaseForKernel(blkid, (void **)addr);
+  if (ret >= 0) {
+    ret = sceKernelMapBlockUserVisible(blkid);
+    LOG("sceKernelMapBlockUserVisible: %x", ret);
+  }
+  if (ret < 0) {
+    sceKernelFreeMemBlockForKernel(blkid);
+    goto end;
+  }
+
+  mapping->pid = pid;
+  mapping->blkid = blkid;
+  mapping->addr = *addr;
+  ret = TAI_SUCCESS;
+end:
+  sceKernelUnlockMutexForKernel(g_mappings_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Frees the stats page mapping of an exiting process
+ *
+ * @param[in]  pid   The process
+ */
+void stats_unmap(SceUID pid) {
+  if (g_stats == NULL) {
+    return;
+  }
+  sceKernelLockMutexForKernel(g_mappings_lock, 1, NULL);
+  for (int i = 0; i < STATS_MAX_MAPPINGS; i++) {
+    if (g_mappings[i].pid == pid) {
+      LOG("freeing stats page of pid %x", pid);
+      sceKernelFreeMemBlockForKernel(g_mappings[i].blkid);
+      g_mappings[i].pid = 0;
+      break;
+    }
+  }
+  sceKernelUnlockMutexForKernel(g_mappings_lock, 1);
+}
+
+/**
+ * @brief      Allocates the stats page
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int stats_init(void) {
+  tai_stats_t *stats;
+  int ret;
+
+  memset(g_mappings, 0, sizeof(g_mappings));
+  g_mappings_lock = sceKernelCreateMutexForKernel("tai_stats_lock", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_stats_lock): 0x%08X", g_mappings_lock);
+  if (g_mappings_lock < 0) {
+    return g_mappings_lock;
+  }
+  g_stats_blk = sceKernelAllocMemBlockForKernel("tai_stats", SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW, STATS_PAGE_SIZE, NULL);
+  LOG("sceKernelAllocMemBlockForKernel(tai_stats): 0x%08X", g_stats_blk);
+  if (g_stats_blk < 0) {
+    return g_stats_blk;
+  }
+  ret = sceKernelGetMemBlockBaseForKernel(g_stats_blk, (void **)&stats);
+  if (ret < 0) {
+    sceKernelFreeMemBlockForKernel(g_stats_blk);
+    return ret;
+  }
+  memset(stats, 0, STATS_PAGE_SIZE);
+  stats->size = sizeof(tai_stats_t);
+#ifdef ENABLE_PROFILING
+  stats->profiling = 1;
+#endif
+  g_stats = stats;
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Frees the stats page
+ */
+void stats_deinit(void) {
+  g_stats = NULL;
+  for (int i = 0; i < STATS_MAX_MAPPINGS; i++) {
+    if (g_mappings[i].pid != 0) {
+      sceKernelFreeMemBlockForKernel(g_mappings[i].blkid);
+    }
+  }
+  sceKernelFreeMemBlockForKernel(g_stats_blk);
+  sceKernelDeleteMutexForKernel(g_mappings_lock);
+}
@@ -0,0 +1,53 @@
+/**
+ * @brief      Shared statistics page
+ */
+#ifndef TAI_STATS_HEADER
+#define TAI_STATS_HEADER
+
+#include <stddef.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   stats Statistics
+ * @brief      Counters published in a page readable by user processes
+ *
+ * @details    The counters live in one kernel page. Processes that ask for it
+ *             get a read only mapping of the same physical page so they can
+ *             read the counters without making syscalls. Each counter is
+ *             updated with an atomic add. A sequence number bumped after each
+ *             update lets readers tell if a copy raced with an update.
+ */
+/** @{ */
+
+/** Maximum number of processes with the page mapped */
+#define STATS_MAX_MAPPINGS 16
+
+/** Increments a `tai_stats_t` counter */
+#define STATS_INC(field) stats_add(offsetof(tai_stats_t, field), 1)
+
+/** Adds to a `tai_stats_t` counter */
+#define STATS_ADD(field, n) stats_add(offsetof(tai_stats_t, field), (n))
+
+#ifdef ENABLE_PROFILING
+/** Starts timing a phase */
+#define PROFILE_START(var) SceInt64 var = sceKernelGetSystemTimeWide()
+/** Records the time since `PROFILE_START` in a phase histogram */
+#define PROFILE_END(phase, var) stats_phase((phase), (var))
+#else
+#define PROFILE_START(var)
+#define PROFILE_END(phase, var)
+#endif
+
+int stats_init(void);
+void stats_deinit(void);
+void stats_add(size_t offset, uint32_t n);
+void stats_latency(tai_stats_api_t api, SceInt64 start);
+void stats_phase(tai_stats_phase_t phase, SceInt64 start);
+int stats_snapshot(tai_stats_t *out);
+int stats_map(SceUID pid, uintptr_t *addr);
+void stats_unmap(SceUID pid);
+
+/** @} */
+
+#endif // TAI_STATS_HEADER
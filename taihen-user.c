@@ -12,9 +12,14 @@
 #include <psp2kern/kernel/sysmem.h>
 #include <psp2kern/kernel/threadmgr.h>
 #include <psp2/kernel/error.h>
+#include <string.h>
+#include "bypass.h"
 #include "error.h"
+#include "heap.h"
 #include "module.h"
+#include "notify.h"
 #include "patches.h"
+#include "stats.h"
 #include "taihen_internal.h"
 
 /** Limit for strings passed to kernel */
@@ -57,7 +62,9 @@ SceUID taiHookFunctionExportForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *arg
       kid = taiHookFunctionExportForKernel(pid, &k_ref, k_module, kargs.library_nid, kargs.func_nid, kargs.hook_func);
       if (kid >= 0) {
         sceKernelMemcpyKernelToUser((uintptr_t)p_hook, &k_ref, sizeof(*p_hook));
+        PROFILE_START(uid_start);
         ret = sceKernelCreateUserUid(pid, kid);
+        PROFILE_END(TAI_STATS_PHASE_USER_UID, uid_start);
         LOG("kernel uid: %x, user uid: %x", kid, ret);
       } else {
         ret = kid;
@@ -104,7 +111,9 @@ SceUID taiHookFunctionImportForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *arg
       kid = taiHookFunctionImportForKernel(pid, &k_ref, k_module, kargs.library_nid, kargs.func_nid, kargs.hook_func);
       if (kid >= 0) {
         sceKernelMemcpyKernelToUser((uintptr_t)p_hook, &k_ref, sizeof(*p_hook));
+        PROFILE_START(uid_start);
         ret = sceKernelCreateUserUid(pid, kid);
+        PROFILE_END(TAI_STATS_PHASE_USER_UID, uid_start);
         LOG("kernel uid: %x, user uid: %x", kid, ret);
       } else {
         ret = kid;
@@ -120,6 +129,110 @@ SceUID taiHookFunctionImportForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *arg
   return ret;
 }
 
+/** Kernel function behind a guarded user hook */
+typedef SceUID (*guarded_hook_t)(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func, const tai_hook_guard_t *guard);
+
+/**
+ * @brief      Copies in the arguments of a guarded hook and adds it for the
+ *             calling process
+ *
+ * @param[in]  add     The kernel function that adds the hook
+ * @param[out] p_hook  A reference that can be used by the hook function
+ * @param[in]  args    Call arguments in user memory
+ * @param[in]  guard   Argument predicates in user memory
+ *
+ * @return     A user tai patch reference on success, < 0 on error
+ */
+static SceUID add_guarded_hook_for_user(guarded_hook_t add, tai_hook_ref_t *p_hook, tai_hook_args_t *args, const tai_hook_guard_t *guard) {
+  tai_hook_args_t kargs;
+  tai_hook_guard_t kguard;
+  char k_module[MAX_NAME_LEN];
+  tai_hook_ref_t k_ref;
+  SceUID kid, ret;
+  SceUID pid;
+
+  kargs.size = 0;
+  kguard.size = 0;
+  sceKernelMemcpyUserToKernel(&kargs, (uintptr_t)args, sizeof(kargs));
+  sceKernelMemcpyUserToKernel(&kguard, (uintptr_t)guard, sizeof(kguard));
+  if (kargs.size != sizeof(kargs) || kguard.size != sizeof(kguard)) {
+    LOG("invalid args size: %x, guard size: %x", kargs.size, kguard.size);
+    return TAI_ERROR_USER_MEMORY;
+  }
+  if (sceKernelStrncpyUserToKernel(k_module, (uintptr_t)kargs.module, MAX_NAME_LEN) >= MAX_NAME_LEN) {
+    return TAI_ERROR_USER_MEMORY;
+  }
+  pid = sceKernelGetProcessId();
+  kid = add(pid, &k_ref, k_module, kargs.library_nid, kargs.func_nid, kargs.hook_func, &kguard);
+  if (kid < 0) {
+    return kid;
+  }
+  sceKernelMemcpyKernelToUser((uintptr_t)p_hook, &k_ref, sizeof(*p_hook));
+  PROFILE_START(uid_start);
+  ret = sceKernelCreateUserUid(pid, kid);
+  PROFILE_END(TAI_STATS_PHASE_USER_UID, uid_start);
+  LOG("kernel uid: %x, user uid: %x", kid, ret);
+  return ret;
+}
+
+/**
+ * @brief      Add a hook with argument predicates to a module function export
+ *             for the calling process
+ *
+ * @see        taiHookFunctionExportGuardedForKernel
+ *
+ * @param[out] p_hook  A reference that can be used by the hook function
+ * @param[in]  args    Call arguments
+ * @param[in]  guard   Argument predicates (`type` must be `TAI_GUARD_NONE`)
+ *
+ * @return     A tai patch reference on success, < 0 on error
+ *             - TAI_ERROR_PATCH_EXISTS if the address is already patched
+ *             - TAI_ERROR_HOOK_ERROR if an internal error occurred trying to
+ *               hook
+ *             - TAI_ERROR_NOT_IMPLEMENTED if address is in shared memory region
+ *               or the guard filters by process or thread
+ *             - TAI_ERROR_INVALID_ARGS if the guard is malformed
+ *             - TAI_ERROR_USER_MEMORY if pointers are incorrect
+ */
+SceUID taiHookFunctionExportGuardedForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *args, const tai_hook_guard_t *guard) {
+  uint32_t state;
+  SceUID ret;
+
+  ENTER_SYSCALL(state);
+  ret = add_guarded_hook_for_user(taiHookFunctionExportGuardedForKernel, p_hook, args, guard);
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Add a hook with argument predicates to a module function import
+ *             for the calling process
+ *
+ * @see        taiHookFunctionImportGuardedForKernel
+ *
+ * @param[out] p_hook  A reference that can be used by the hook function
+ * @param[in]  args    Call arguments
+ * @param[in]  guard   Argument predicates (`type` must be `TAI_GUARD_NONE`)
+ *
+ * @return     A tai patch reference on success, < 0 on error
+ *             - TAI_ERROR_PATCH_EXISTS if the address is already patched
+ *             - TAI_ERROR_HOOK_ERROR if an internal error occurred trying to
+ *               hook
+ *             - TAI_ERROR_NOT_IMPLEMENTED if address is in shared memory region
+ *               or the guard filters by process or thread
+ *             - TAI_ERROR_INVALID_ARGS if the guard is malformed
+ *             - TAI_ERROR_USER_MEMORY if pointers are incorrect
+ */
+SceUID taiHookFunctionImportGuardedForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *args, const tai_hook_guard_t *guard) {
+  uint32_t state;
+  SceUID ret;
+
+  ENTER_SYSCALL(state);
+  ret = add_guarded_hook_for_user(taiHookFunctionImportGuardedForKernel, p_hook, args, guard);
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
 /**
  * @brief      Add a hook to a module manually with an offset for the calling
  *             process
@@ -154,7 +267,9 @@ SceUID taiHookFunctionOffsetForUser(tai_hook_ref_t *p_hook, tai_offset_args_t *a
       ret = taiHookFunctionOffsetForKernel(pid, &k_ref, kid, kargs.segidx, kargs.offset, kargs.thumb, kargs.source);
       if (ret >= 0) {
         sceKernelMemcpyKernelToUser((uintptr_t)p_hook, &k_ref, sizeof(*p_hook));
+        PROFILE_START(uid_start);
         ret = sceKernelCreateUserUid(pid, ret);
+        PROFILE_END(TAI_STATS_PHASE_USER_UID, uid_start);
         LOG("user uid: %x", ret);
       }
     } else {
@@ -205,6 +320,285 @@ int taiGetModuleInfo(const char *module, tai_module_info_t *info) {
   return ret;
 }
 
+/**
+ * @brief      Arguments for `copy_module_info_to_user`
+ */
+struct user_module_info_list_args {
+  tai_module_info_t *infos;
+  size_t max;
+  size_t count;
+};
+
+/**
+ * @brief      `module_foreach` callback for `taiGetModuleInfoList`
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct user_module_info_list_args`
+ *
+ * @return     Zero to visit every module
+ */
+static int copy_module_info_to_user(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct user_module_info_list_args *args = (struct user_module_info_list_args *)opaque;
+
+  if (args->count < args->max) {
+    sceKernelMemcpyKernelToUser((uintptr_t)&args->infos[args->count], info, sizeof(*info));
+  }
+  args->count++;
+  return 0;
+}
+
+/**
+ * @brief      Gets information on many modules loaded in the calling process
+ *
+ * @see        taiGetModuleInfoListForKernel
+ *
+ * @param[in]  prefix  Module name prefix or NULL for every module
+ * @param[out] infos   The information to fill
+ * @param      count   Number of entries in `infos`. Outputs the number of
+ *                     matching modules, which may be larger.
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_USER_MEMORY if `count` or `infos` cannot be read,
+ *               `infos[0].size` is wrong or `prefix` is invalid
+ */
+int taiGetModuleInfoList(const char *prefix, tai_module_info_t *infos, size_t *count) {
+  struct user_module_info_list_args args;
+  char k_prefix[MAX_NAME_LEN];
+  uint32_t state;
+  size_t k_size;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  k_size = 0;
+  if (sceKernelMemcpyUserToKernel(&args.max, (uintptr_t)count, sizeof(args.max)) < 0) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else if (args.max > 0 && sceKernelMemcpyUserToKernel(&k_size, (uintptr_t)infos, sizeof(k_size)) < 0) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else if (args.max > 0 && k_size != sizeof(tai_module_info_t)) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else if (prefix != NULL && sceKernelStrncpyUserToKernel(k_prefix, (uintptr_t)prefix, MAX_NAME_LEN) >= MAX_NAME_LEN) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else {
+    args.infos = infos;
+    args.count = 0;
+    ret = module_foreach_prefix(sceKernelGetProcessId(), prefix ? k_prefix : NULL, copy_module_info_to_user, &args);
+    if (ret >= 0) {
+      sceKernelMemcpyKernelToUser((uintptr_t)count, &args.count, sizeof(args.count));
+      ret = TAI_SUCCESS;
+    }
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Gets the address of an exported function in the calling process
+ *
+ * @see        taiGetModuleExportFuncForKernel
+ *
+ * @param[in]  module       Name of the exporting module or NULL for any
+ * @param[in]  library_nid  Optional. The library NID or `TAI_ANY_LIBRARY`
+ * @param[in]  func_nid     The function NID
+ * @param[out] func         The function address
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_USER_MEMORY if `module` is invalid
+ */
+int taiGetModuleExportFunc(const char *module, uint32_t library_nid, uint32_t func_nid, uintptr_t *func) {
+  char k_module[MAX_NAME_LEN];
+  uint32_t state;
+  SceUID pid;
+  uintptr_t k_func;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  pid = sceKernelGetProcessId();
+  if (module == NULL || sceKernelStrncpyUserToKernel(k_module, (uintptr_t)module, MAX_NAME_LEN) < MAX_NAME_LEN) {
+    ret = taiGetModuleExportFuncForKernel(pid, module ? k_module : NULL, library_nid, func_nid, &k_func);
+    if (ret >= 0) {
+      sceKernelMemcpyKernelToUser((uintptr_t)func, &k_func, sizeof(k_func));
+    }
+  } else {
+    ret = TAI_ERROR_USER_MEMORY;
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Gets a record of a plugin loaded by taiHEN
+ *
+ *             Only the shell can read the records of other titles.
+ *
+ * @see        taiGetLoadReportForKernel
+ *
+ * @param[in]  titleid  The title to get records for or NULL for all titles
+ * @param[in]  index    Which record, 0 is the most recent load
+ * @param[out] report   The record
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_USER_MEMORY if `report->size` is wrong or `titleid`
+ *               is invalid
+ *             - TAI_ERROR_NOT_ALLOWED if `titleid` is not the caller's title
+ *               and the caller is not the shell
+ *             - TAI_ERROR_NOT_FOUND if there are no more records
+ */
+int taiGetLoadReport(const char *titleid, int index, tai_load_report_t *report) {
+  char k_titleid[32];
+  char own_titleid[32];
+  uint32_t state;
+  tai_load_report_t k_report;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  sceKernelMemcpyUserToKernel(&k_report, (uintptr_t)report, sizeof(size_t));
+  if (k_report.size != sizeof(k_report)) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else if (titleid != NULL && sceKernelStrncpyUserToKernel(k_titleid, (uintptr_t)titleid, sizeof(k_titleid)) >= sizeof(k_titleid)) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else if (!sceSblACMgrIsShell(0) && (titleid == NULL ||
+             sceKernelGetProcessTitleIdForKernel(sceKernelGetProcessId(), own_titleid, sizeof(own_titleid)) < 0 ||
+             strncmp(k_titleid, own_titleid, sizeof(k_titleid)) != 0)) {
+    ret = TAI_ERROR_NOT_ALLOWED;
+  } else {
+    ret = taiGetLoadReportForKernel(titleid ? k_titleid : NULL, index, &k_report);
+    if (ret >= 0) {
+      sceKernelMemcpyKernelToUser((uintptr_t)report, &k_report, sizeof(k_report));
+    }
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Maps the taiHEN statistics page into the calling process
+ *
+ *             The page is read only. taiHEN frees the mapping when the
+ *             process exits. Read it with `taiReadStats`.
+ *
+ * @param[out] page  Address of the page
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_MEMORY if too many processes have the page mapped
+ */
+int taiGetStatsPage(const tai_stats_t **page) {
+  uint32_t state;
+  uintptr_t addr;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  ret = stats_map(sceKernelGetProcessId(), &addr);
+  if (ret >= 0) {
+    sceKernelMemcpyKernelToUser((uintptr_t)page, &addr, sizeof(addr));
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Gets usage of one of taiHEN's heaps
+ *
+ * @see        taiGetHeapStatsForKernel
+ *
+ * @param[in]  heap   Which heap
+ * @param[out] stats  The usage
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_USER_MEMORY if `stats->size` is invalid
+ */
+int taiGetHeapStats(tai_heap_t heap, tai_heap_stats_t *stats) {
+  tai_heap_stats_t k_stats;
+  uint32_t state;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  sceKernelMemcpyUserToKernel(&k_stats, (uintptr_t)stats, sizeof(size_t));
+  if (k_stats.size != sizeof(k_stats)) {
+    ret = TAI_ERROR_USER_MEMORY;
+  } else {
+    ret = taiGetHeapStatsForKernel(heap, &k_stats);
+    if (ret >= 0) {
+      sceKernelMemcpyKernelToUser((uintptr_t)stats, &k_stats, sizeof(k_stats));
+    }
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Reads hook and injection changes
+ *
+ *             The records include kernel addresses, so only the shell may
+ *             read them.
+ *
+ * @see        taiReadPatchEventsForKernel
+ *
+ * @param      cursor  The reader's position
+ * @param[out] events  The records
+ * @param[in]  max     Maximum number of records to read
+ * @param[out] lost    Number of records missed since the cursor
+ *
+ * @return     Number of records read, < 0 on error
+ *             - TAI_ERROR_NOT_ALLOWED if caller does not have permission
+ */
+int taiReadPatchEvents(uint32_t *cursor, tai_patch_event_t *events, int max, uint32_t *lost) {
+  tai_patch_event_t k_events[NOTIFY_READ_CHUNK];
+  uint32_t state;
+  uint32_t k_cursor;
+  uint32_t k_lost;
+  int count;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  if (!sceSblACMgrIsShell(0)) {
+    ret = TAI_ERROR_NOT_ALLOWED;
+    goto end;
+  }
+  if (max < 0) {
+    ret = TAI_ERROR_INVALID_ARGS;
+    goto end;
+  }
+  sceKernelMemcpyUserToKernel(&k_cursor, (uintptr_t)cursor, sizeof(k_cursor));
+  k_lost = 0;
+  ret = 0;
+  while (ret < max) {
+    count = notify_read(&k_cursor, k_events, (max - ret < NOTIFY_READ_CHUNK) ? max - ret : NOTIFY_READ_CHUNK, &k_lost);
+    if (count == 0) {
+      break;
+    }
+    sceKernelMemcpyKernelToUser((uintptr_t)&events[ret], k_events, count * sizeof(tai_patch_event_t));
+    ret += count;
+  }
+  sceKernelMemcpyKernelToUser((uintptr_t)cursor, &k_cursor, sizeof(k_cursor));
+  sceKernelMemcpyKernelToUser((uintptr_t)lost, &k_lost, sizeof(k_lost));
+end:
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Reloads the taiHEN config file
+ *
+ * @see        taiReloadConfigForKernel
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_ALLOWED if caller does not have permission
+ */
+int taiReloadConfig(void) {
+  uint32_t state;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  if (sceSblACMgrIsShell(0)) {
+    ret = taiReloadConfigForKernel();
+  } else {
+    ret = TAI_ERROR_NOT_ALLOWED;
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
 /**
  * @brief      Release a hook for the calling process
  *
@@ -332,6 +726,74 @@ int taiInjectRelease(SceUID tai_uid) {
   return ret;
 }
 
+/**
+ * @brief      Replaces the data of an injection in the current process
+ *
+ * @see        taiInjectSwapForKernel
+ *
+ * @param[in]  tai_uid  The tai patch reference
+ * @param[in]  src      The new data, the same size as the injection
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int taiInjectSwap(SceUID tai_uid, const void *src) {
+  uint32_t state;
+  SceUID pid, kid;
+  int ret;
+
+  ENTER_SYSCALL(state);
+  pid = sceKernelGetProcessId();
+  kid = sceKernelKernelUidForUserUid(pid, tai_uid);
+  if (kid >= 0) {
+    ret = tai_inject_swap(kid, pid, src);
+  } else {
+    ret = kid;
+  }
+  EXIT_SYSCALL(state);
+  return ret;
+}
+
+/**
+ * @brief      Sets hook bypass flags for the calling thread
+ *
+ *             These are separate from the flags kernel hooks see. The thread's
+ *             flag word is read only to the process, so only this and
+ *             `taiBypassExit` change it.
+ *
+ * @see        taiBypassEnterForKernel
+ *
+ * @param[in]  flags  The flags to set
+ *
+ * @return     The flags before, pass them to `taiBypassExit`
+ */
+uint32_t taiBypassEnter(uint32_t flags) {
+  uint32_t state;
+  uint32_t prev;
+
+  ENTER_SYSCALL(state);
+  prev = bypass_enter(BYPASS_USER, flags);
+  EXIT_SYSCALL(state);
+  return prev;
+}
+
+/**
+ * @brief      Restores the hook bypass flags of the calling thread
+ *
+ * @see        taiBypassExitForKernel
+ *
+ * @param[in]  prev  The flags from `taiBypassEnter`
+ *
+ * @return     Zero always
+ */
+int taiBypassExit(uint32_t prev) {
+  uint32_t state;
+
+  ENTER_SYSCALL(state);
+  bypass_exit(BYPASS_USER, prev);
+  EXIT_SYSCALL(state);
+  return TAI_SUCCESS;
+}
+
 /**
  * @brief      Loads a kernel module
  *
@@ -8,18 +8,41 @@
 #include <psp2kern/types.h>
 #include <psp2kern/kernel/modulemgr.h>
 #include <taihen/parser.h>
+#include <string.h>
+#include "bundle.h"
+#include "bypass.h"
 #include "error.h"
+#include "event.h"
+#include "heap.h"
 #include "hen.h"
 #include "module.h"
+#include "notify.h"
 #include "patches.h"
 #include "proc_map.h"
+#include "report.h"
+#include "stats.h"
+#include "usage.h"
 #include "taihen_internal.h"
 
 /** For ordering log entries */
 unsigned char log_ctr = 0;
 
-/** From `hen.c` **/
-extern const char *g_config;
+/** Most module builds `taiHookFunctionBroadcastForKernel` remembers */
+#define MAX_BROADCAST_BUILDS 8
+
+/**
+ * @brief      Where a broadcast hook goes in one build of its modules
+ *
+ *             Functions are kept as offsets from their module's export table,
+ *             which is at the same place in the module image in every process
+ *             that loaded the same build.
+ */
+struct broadcast_build {
+  uint32_t module_nid;          ///< Build of the target module
+  uint32_t hook_module_nid;     ///< Build of the hook module, zero without one
+  uintptr_t func_off;           ///< Target function from the target's exports
+  uintptr_t hook_off;           ///< Hook function from the hook module's exports
+};
 
 /**
  * @brief      Add a hook given an absolute address
@@ -39,7 +62,7 @@ extern const char *g_config;
  *             - TAI_ERROR_INVALID_KERNEL_ADDR if `pid` is kernel and address is in shared memory region
  */
 SceUID taiHookFunctionAbs(SceUID pid, tai_hook_ref_t *p_hook, void *dest_func, const void *hook_func) {
-  return tai_hook_func_abs(p_hook, pid, dest_func, hook_func);
+  return tai_hook_func_abs(p_hook, pid, dest_func, hook_func, NULL);
 }
 
 /**
@@ -65,15 +88,7 @@ SceUID taiHookFunctionAbs(SceUID pid, tai_hook_ref_t *p_hook, void *dest_func, c
  *             - TAI_ERROR_INVALID_KERNEL_ADDR if `pid` is kernel and address is in shared memory region
  */
 SceUID taiHookFunctionExportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func) {
-  int ret;
-  uintptr_t func;
-
-  ret = module_get_export_func(pid, module, library_nid, func_nid, &func);
-  if (ret < 0) {
-    LOG("Failed to find export for %s, NID:0x%08X: 0x%08X", module, func_nid, ret);
-    return ret;
-  }
-  return taiHookFunctionAbs(pid, p_hook, (void *)func, hook_func);
+  return taiHookFunctionExportGuardedForKernel(pid, p_hook, module, library_nid, func_nid, hook_func, NULL);
 }
 
 /**
@@ -98,15 +113,158 @@ SceUID taiHookFunctionExportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const
  *             - TAI_ERROR_INVALID_KERNEL_ADDR if `pid` is kernel and address is in shared memory region
  */
 SceUID taiHookFunctionImportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func) {
+  return taiHookFunctionImportGuardedForKernel(pid, p_hook, module, import_library_nid, import_func_nid, hook_func, NULL);
+}
+
+/**
+ * @brief      Add a hook given an absolute address that only runs for some
+ *             callers
+ *
+ *             The guard is checked by a small generated thunk before
+ *             `hook_func` is entered. Calls that do not match skip straight
+ *             to the next hook in the chain, so `hook_func` does not need to
+ *             check the caller or its arguments and call `TAI_CONTINUE`
+ *             itself. Argument predicates work for any process but process
+ *             and thread filters are only supported on kernel hooks.
+ *
+ * @param[in]  pid        The pid of the target
+ * @param[out] p_hook     A reference that can be used by the hook function
+ * @param      dest_func  The function to patch
+ * @param[in]  hook_func  The hook function
+ * @param[in]  guard      The callers to run `hook_func` for. NULL to always
+ *                        run it.
+ *
+ * @return     A tai patch reference on success, < 0 on error
+ *             - TAI_ERROR_PATCH_EXISTS if the address is already patched
+ *             - TAI_ERROR_HOOK_ERROR if an internal error occurred trying to hook
+ *             - TAI_ERROR_INVALID_KERNEL_ADDR if `pid` is kernel and address is in shared memory region
+ *             - TAI_ERROR_INVALID_ARGS if the guard is malformed
+ *             - TAI_ERROR_NOT_IMPLEMENTED if `pid` is not kernel and the guard
+ *               filters by process or thread
+ */
+SceUID taiHookFunctionAbsGuarded(SceUID pid, tai_hook_ref_t *p_hook, void *dest_func, const void *hook_func, const tai_hook_guard_t *guard) {
+  return tai_hook_func_abs(p_hook, pid, dest_func, hook_func, guard);
+}
+
+/**
+ * @brief      Add a hook to a module function export that only runs for some
+ *             callers
+ *
+ * @see        taiHookFunctionExportForKernel
+ * @see        taiHookFunctionAbsGuarded
+ *
+ * @param[in]  pid          The pid of the target
+ * @param[out] p_hook       A reference that can be used by the hook function
+ * @param[in]  module       Name of the target module.
+ * @param[in]  library_nid  Optional. NID of the target library.
+ * @param[in]  func_nid     The function NID
+ * @param[in]  hook_func    The hook function
+ * @param[in]  guard        The callers to run `hook_func` for
+ *
+ * @return     A tai patch reference on success, < 0 on error
+ */
+SceUID taiHookFunctionExportGuardedForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func, const tai_hook_guard_t *guard) {
+  int ret;
+  uintptr_t func;
+
+  PROFILE_START(lookup_start);
+  ret = module_get_export_func(pid, module, library_nid, func_nid, &func);
+  PROFILE_END(TAI_STATS_PHASE_LOOKUP, lookup_start);
+  if (ret < 0) {
+    LOG("Failed to find export for %s, NID:0x%08X: 0x%08X", module, func_nid, ret);
+    return ret;
+  }
+  return taiHookFunctionAbsGuarded(pid, p_hook, (void *)func, hook_func, guard);
+}
+
+/**
+ * @brief      Add a hook to a module function import that only runs for some
+ *             callers
+ *
+ * @see        taiHookFunctionImportForKernel
+ * @see        taiHookFunctionAbsGuarded
+ *
+ * @param[in]  pid                 The pid of the target
+ * @param[out] p_hook              A reference that can be used by the hook
+ *                                 function
+ * @param[in]  module              Name of the target module.
+ * @param[in]  import_library_nid  The imported library from the target module
+ * @param[in]  import_func_nid     The function NID of the import
+ * @param[in]  hook_func           The hook function
+ * @param[in]  guard               The callers to run `hook_func` for
+ *
+ * @return     A tai patch reference on success, < 0 on error
+ */
+SceUID taiHookFunctionImportGuardedForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func, const tai_hook_guard_t *guard) {
   int ret;
   uintptr_t stub;
 
+  PROFILE_START(lookup_start);
   ret = module_get_import_func(pid, module, import_library_nid, import_func_nid, &stub);
+  PROFILE_END(TAI_STATS_PHASE_LOOKUP, lookup_start);
   if (ret < 0) {
     LOG("Failed to find stub for %s, NID:0x%08X: 0x%08X", module, import_func_nid, ret);
     return ret;
   }
-  return taiHookFunctionAbs(pid, p_hook, (void *)stub, hook_func);
+  return taiHookFunctionAbsGuarded(pid, p_hook, (void *)stub, hook_func, guard);
+}
+
+/**
+ * @brief      Add a hook to the import stub of every module importing a
+ *             function
+ *
+ *             The import tables of all loaded modules are walked once and
+ *             every stub found is hooked in one batch. Either all of them are
+ *             hooked or none are. `p_hooks[i]` is the reference for the i-th
+ *             stub. Every stub leads to the same imported function, so the
+ *             hook function may continue through any of the references, but
+ *             only the matching one also runs other hooks on that stub.
+ *             Modules loaded afterwards are not hooked.
+ *
+ * @param[in]     pid                 The pid of the target
+ * @param[out]    p_hooks             References for the hooks
+ * @param[in,out] count               In: capacity of `p_hooks`. Out: number
+ *                                    of stubs hooked, or the number of stubs
+ *                                    found if there are more than fit.
+ * @param[in]     import_library_nid  The imported library NID or
+ *                                    `TAI_ANY_LIBRARY`
+ * @param[in]     import_func_nid     The function NID of the import
+ * @param[in]     hook_func           The hook function
+ *
+ * @return     A group reference on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if no loaded module imports the function
+ *             - TAI_ERROR_INVALID_ARGS if `*count` is zero
+ *             - TAI_ERROR_MEMORY if there are more importers than `*count`,
+ *               `*count` is set to the number needed
+ *             - TAI_ERROR_PATCH_EXISTS if a stub is already patched
+ */
+SceUID taiHookFunctionImportAllForKernel(SceUID pid, tai_hook_ref_t *p_hooks, size_t *count, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func) {
+  uintptr_t *stubs;
+  size_t found;
+  int ret;
+
+  if (*count == 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  stubs = heap_alloc(TAI_HEAP_METADATA, *count * sizeof(uintptr_t));
+  if (stubs == NULL) {
+    return TAI_ERROR_MEMORY;
+  }
+  ret = module_get_import_stubs(pid, import_library_nid, import_func_nid, stubs, *count, &found);
+  if (ret == TAI_ERROR_MEMORY) {
+    *count = found;
+  }
+  if (ret < 0) {
+    LOG("Failed to find importers of NID:0x%08X: 0x%08X", import_func_nid, ret);
+    goto end;
+  }
+  ret = tai_hook_func_group(p_hooks, pid, (void *const *)stubs, found, hook_func, NULL);
+  if (ret >= 0) {
+    *count = found;
+  }
+end:
+  heap_free(TAI_HEAP_METADATA, stubs);
+  return ret;
 }
 
 /**
@@ -164,6 +322,212 @@ int taiGetModuleInfoForKernel(SceUID pid, const char *module, tai_module_info_t
   return module_get_by_name_nid(pid, module, TAI_ANY_LIBRARY, info);
 }
 
+/**
+ * @brief      Arguments for `copy_module_info`
+ */
+struct module_info_list_args {
+  tai_module_info_t *infos;
+  size_t max;
+  size_t count;
+};
+
+/**
+ * @brief      `module_foreach` callback for `taiGetModuleInfoListForKernel`
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct module_info_list_args`
+ *
+ * @return     Zero to visit every module
+ */
+static int copy_module_info(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct module_info_list_args *args = (struct module_info_list_args *)opaque;
+
+  if (args->count < args->max) {
+    memcpy(&args->infos[args->count], info, sizeof(*info));
+  }
+  args->count++;
+  return 0;
+}
+
+/**
+ * @brief      Gets information on many loaded modules at once
+ *
+ *             Fills `infos` with every module whose name starts with
+ *             `prefix` from a single walk of the module list. This is much
+ *             cheaper than calling `taiGetModuleInfoForKernel` for each
+ *             module. Set `infos[0].size` to `sizeof(tai_module_info_t)`.
+ *
+ * @param[in]  pid     The pid of the _caller_ (kernel should set to KERNEL_PID)
+ * @param[in]  prefix  Module name prefix or NULL for every module
+ * @param[out] infos   The information to fill
+ * @param      count   Number of entries in `infos`. Outputs the number of
+ *                     matching modules, which may be larger.
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int taiGetModuleInfoListForKernel(SceUID pid, const char *prefix, tai_module_info_t *infos, size_t *count) {
+  struct module_info_list_args args;
+  int ret;
+
+  if (*count > 0 && infos[0].size != sizeof(tai_module_info_t)) {
+    LOG("Structure size mismatch: %d", infos[0].size);
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  args.infos = infos;
+  args.max = *count;
+  args.count = 0;
+  ret = module_foreach_prefix(pid, prefix, copy_module_info, &args);
+  if (ret < 0) {
+    return ret;
+  }
+  *count = args.count;
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Gets the address of an exported function
+ *
+ *             If `module` is NULL, every module loaded in the process is
+ *             searched. The first search builds an index of the process'
+ *             exports so later searches are a single lookup.
+ *
+ * @param[in]  pid          The pid of the _caller_ (kernel should set to KERNEL_PID)
+ * @param[in]  module       Name of the exporting module or NULL for any
+ * @param[in]  library_nid  Optional. The library NID or `TAI_ANY_LIBRARY`
+ * @param[in]  func_nid     The function NID
+ * @param[out] func         The function address
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if no loaded module exports the function
+ */
+int taiGetModuleExportFuncForKernel(SceUID pid, const char *module, uint32_t library_nid, uint32_t func_nid, uintptr_t *func) {
+  return module_get_export_func(pid, module, library_nid, func_nid, func);
+}
+
+/**
+ * @brief      Gets a record of a plugin loaded by taiHEN
+ *
+ *             taiHEN remembers the most recent plugin loads of each of the
+ *             most recently launched titles. Call with increasing `index`
+ *             until `TAI_ERROR_NOT_FOUND` to get every record for a title.
+ *
+ * @param[in]  titleid  The title to get records for or NULL for all titles
+ * @param[in]  index    Which record, 0 is the most recent load
+ * @param[out] report   The record
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if there are no more records
+ */
+int taiGetLoadReportForKernel(const char *titleid, int index, tai_load_report_t *report) {
+  return report_get(titleid, index, report);
+}
+
+/**
+ * @brief      Gets a copy of the taiHEN statistics
+ *
+ *             User processes should use `taiGetStatsPage` instead, which maps
+ *             the counters so they can be read without a syscall.
+ *
+ * @param[out] stats  The stats
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int taiGetStatsForKernel(tai_stats_t *stats) {
+  if (stats == NULL) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  stats_snapshot(stats);
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Gets usage of one of taiHEN's heaps
+ *
+ *             Hook metadata, libsubstitute and injection saves each have their
+ *             own heap. A growing `fragmented` count means allocations are
+ *             failing even though the heap has enough free space in total.
+ *
+ * @param[in]  heap   Which heap
+ * @param[out] stats  The usage
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int taiGetHeapStatsForKernel(tai_heap_t heap, tai_heap_stats_t *stats) {
+  return heap_get_stats(heap, stats);
+}
+
+/**
+ * @brief      Reads hook and injection changes
+ *
+ *             taiHEN keeps the most recent patch changes in a ring. Each
+ *             reader keeps its own cursor, starting at zero, which is moved
+ *             past the records read. Readers never slow down patching: if a
+ *             reader falls too far behind, the records it missed are counted
+ *             in `lost` and reading resumes at the oldest record kept.
+ *
+ * @param      cursor  The reader's position
+ * @param[out] events  The records
+ * @param[in]  max     Maximum number of records to read
+ * @param[out] lost    Number of records missed since the cursor
+ *
+ * @return     Number of records read, < 0 on error
+ */
+int taiReadPatchEventsForKernel(uint32_t *cursor, tai_patch_event_t *events, int max, uint32_t *lost) {
+  if (cursor == NULL || events == NULL || lost == NULL || max < 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  *lost = 0;
+  return notify_read(cursor, events, max, lost);
+}
+
+/**
+ * @brief      Reloads the taiHEN config file
+ *
+ *             Plugins that failed to load before are tried again on their
+ *             next launch. Plugins already loaded are not affected.
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_ALLOWED if called while taiHEN is loading
+ *               plugins (e.g. from a plugin's `module_start`)
+ */
+int taiReloadConfigForKernel(void) {
+  return hen_load_config();
+}
+
+/**
+ * @brief      Registers a callback for module loads and unloads
+ *
+ *             This is cheaper than hooking the module manager yourself since
+ *             taiHEN only hooks it once and walks a table of callbacks. The
+ *             module name is matched by hash.
+ *
+ * @param[in]  pid       Process to watch or `TAI_ANY_PID`
+ * @param[in]  module    Name of the module to watch or NULL for any
+ * @param[in]  events    Mask of `tai_module_event_type_t`
+ * @param[in]  callback  The callback
+ * @param      opaque    Passed back to the callback
+ *
+ * @return     A handle on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if there is no callback or event
+ *             - TAI_ERROR_MEMORY if too many callbacks are registered
+ */
+SceUID taiRegisterModuleEventForKernel(SceUID pid, const char *module, int events, tai_module_event_cb_t callback, void *opaque) {
+  return event_register(pid, module, events, callback, opaque);
+}
+
+/**
+ * @brief      Removes a module event callback
+ *
+ * @param[in]  handle  The handle from `taiRegisterModuleEventForKernel`
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_NOT_FOUND if the handle is invalid
+ */
+int taiUnregisterModuleEventForKernel(SceUID handle) {
+  return event_unregister(handle);
+}
+
 /**
  * @brief      Release a hook
  *
@@ -177,6 +541,21 @@ int taiHookReleaseForKernel(SceUID tai_uid, tai_hook_ref_t hook) {
   return tai_hook_release(tai_uid, hook);
 }
 
+/**
+ * @brief      Release every hook and injection in a group
+ *
+ * @param[in]  group_uid  The group reference from
+ *                        `taiHookFunctionImportAllForKernel` or
+ *                        `taiApplyBundleForKernel`
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if `group_uid` is not a group
+ *             - TAI_ERROR_HOOK_ERROR if a hook could not be removed
+ */
+int taiHookGroupReleaseForKernel(SceUID group_uid) {
+  return tai_group_release(group_uid);
+}
+
 /**
  * @brief      Injects data into a process bypassing MMU flags
  *
@@ -228,6 +607,250 @@ int taiInjectReleaseForKernel(SceUID tai_uid) {
   return tai_inject_release(tai_uid);
 }
 
+/**
+ * @brief      Replaces the data of an injection
+ *
+ *             Use this to switch between variants of a patch without
+ *             releasing and injecting again. Only the bytes that differ from
+ *             what is currently injected are written. Releasing the injection
+ *             still restores the original data.
+ *
+ * @param[in]  tai_uid  The tai patch reference
+ * @param[in]  src      The new data in kernel address space, the same size as
+ *                      the injection
+ *
+ * @return     Zero on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if `tai_uid` is not an injection
+ */
+int taiInjectSwapForKernel(SceUID tai_uid, const void *src) {
+  return tai_inject_swap(tai_uid, KERNEL_PID, src);
+}
+
+/**
+ * @brief      Writes large user injections in chunks
+ *
+ *             Off by default. When on, user injections and restores larger
+ *             than `chunk` bytes are written `chunk` bytes at a time and the
+ *             calling thread yields in between, so other threads on the core
+ *             are not stalled by a write of a few hundred KB. The process can
+ *             run code from a partly written range in the meantime, so only
+ *             turn this on for data the process is not using yet. Kernel
+ *             injections are always written at once. 0x8000 is a good size.
+ *
+ * @param[in]  chunk  Bytes written between yields, zero to turn chunking off
+ * @param[in]  defer  Nonzero to flush the caches once after the last chunk
+ *                    instead of after every chunk
+ *
+ * @return     Zero always
+ */
+int taiInjectSetChunkingForKernel(size_t chunk, int defer) {
+  tai_inject_set_chunking(chunk, defer);
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Sets hook bypass flags for the calling thread
+ *
+ *             The flags stay set until `taiBypassExitForKernel`. Kernel flags
+ *             are separate from the flags set by user hooks. Test them with
+ *             `TAI_BYPASSED`.
+ *
+ * @param[in]  flags  The flags to set
+ *
+ * @return     The flags before, pass them to `taiBypassExitForKernel`
+ */
+uint32_t taiBypassEnterForKernel(uint32_t flags) {
+  return bypass_enter(BYPASS_KERNEL, flags);
+}
+
+/**
+ * @brief      Restores the hook bypass flags of the calling thread
+ *
+ * @param[in]  prev  The flags from `taiBypassEnterForKernel`
+ *
+ * @return     Zero always
+ */
+int taiBypassExitForKernel(uint32_t prev) {
+  bypass_exit(BYPASS_KERNEL, prev);
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Applies a patch bundle file as one transaction
+ *
+ *             The bundle lists hooks and injections by module (see
+ *             `bundle_format.h`). Every location is resolved before anything
+ *             is patched and either all patches are applied or none are.
+ *             Release them together with `taiHookGroupReleaseForKernel`.
+ *
+ * @param[in]     pid      The pid of the target
+ * @param[in]     path     Path of the bundle file
+ * @param[out]    p_hooks  References for the hooks, in bundle order
+ * @param[in,out] count    In: capacity of `p_hooks`. Out: number of hooks.
+ *
+ * @return     A group reference on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if the bundle is malformed
+ *             - TAI_ERROR_NOT_FOUND if a module or NID is not found
+ *             - TAI_ERROR_MEMORY if the bundle has more hooks than `*count`
+ *             - TAI_ERROR_PATCH_EXISTS if an address is already patched
+ */
+SceUID taiApplyBundleForKernel(SceUID pid, const char *path, tai_hook_ref_t *p_hooks, size_t *count) {
+  return bundle_apply(pid, path, p_hooks, count);
+}
+
+/**
+ * @brief      Modules of a broadcast hook in one process
+ */
+struct broadcast_modules {
+  const tai_broadcast_args_t *args; ///< The hook
+  tai_module_info_t info;           ///< Module exporting the function
+  tai_module_info_t hook_info;      ///< Module exporting the hook function
+  int has_info;                     ///< Set once `info` is found
+  int has_hook_info;                ///< Set once `hook_info` is found
+};
+
+/**
+ * @brief      `module_foreach` callback that finds both modules of a
+ *             broadcast hook in one pass
+ *
+ * @param[in]  pid     The pid
+ * @param[in]  info    The module
+ * @param      opaque  The `struct broadcast_modules`
+ *
+ * @return     1 once both are found, zero to continue
+ */
+static int match_broadcast_modules(SceUID pid, tai_module_info_t *info, void *opaque) {
+  struct broadcast_modules *mods = (struct broadcast_modules *)opaque;
+
+  if (!mods->has_info && strncmp(mods->args->module, info->name, 27) == 0) {
+    memcpy(&mods->info, info, sizeof(*info));
+    mods->has_info = 1;
+  }
+  if (mods->args->hook_module != NULL && !mods->has_hook_info && strncmp(mods->args->hook_module, info->name, 27) == 0) {
+    memcpy(&mods->hook_info, info, sizeof(*info));
+    mods->has_hook_info = 1;
+  }
+  return mods->has_info && (mods->args->hook_module == NULL || mods->has_hook_info);
+}
+
+/**
+ * @brief      Finds where a broadcast hook goes in a process
+ *
+ *             Both modules are found with a single pass over the process'
+ *             module list. Their export tables are only searched for the
+ *             first process with a given build of the modules, later
+ *             processes with that build add the offsets to their own module
+ *             addresses.
+ *
+ * @param[in]     pid      The process
+ * @param[in]     args     The hook
+ * @param         builds   Builds resolved so far
+ * @param[in,out] nbuilds  Number of entries in `builds`
+ * @param[out]    func     The function to hook
+ * @param[out]    hook     The hook function
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int broadcast_resolve(SceUID pid, const tai_broadcast_args_t *args, struct broadcast_build *builds, size_t *nbuilds, void **func, const void **hook) {
+  struct broadcast_modules mods;
+  struct broadcast_build *build;
+  uintptr_t addr, hook_addr;
+  int ret;
+
+  memset(&mods, 0, sizeof(mods));
+  mods.args = args;
+  if ((ret = module_foreach(pid, match_broadcast_modules, &mods)) < 0) {
+    return ret;
+  }
+  if (ret == 0) {
+    LOG("Modules of broadcast hook not loaded in pid %x", pid);
+    return TAI_ERROR_NOT_FOUND;
+  }
+  for (size_t i = 0; i < *nbuilds; i++) {
+    build = &builds[i];
+    if (build->module_nid == mods.info.module_nid && build->hook_module_nid == mods.hook_info.module_nid) {
+      *func = (void *)(mods.info.exports_start + build->func_off);
+      *hook = args->hook_module ? (const void *)(mods.hook_info.exports_start + build->hook_off) : args->hook_func;
+      return TAI_SUCCESS;
+    }
+  }
+
+  LOG("Resolving broadcast hook for module build %08X in pid %x", mods.info.module_nid, pid);
+  if ((ret = module_find_export(pid, &mods.info, args->library_nid, args->func_nid, &addr)) < 0) {
+    return ret;
+  }
+  if (args->hook_module != NULL) {
+    if ((ret = module_find_export(pid, &mods.hook_info, args->hook_library_nid, args->hook_func_nid, &hook_addr)) < 0) {
+      return ret;
+    }
+  } else {
+    hook_addr = (uintptr_t)args->hook_func;
+  }
+  if (*nbuilds < MAX_BROADCAST_BUILDS) {
+    build = &builds[(*nbuilds)++];
+    build->module_nid = mods.info.module_nid;
+    build->hook_module_nid = mods.hook_info.module_nid;
+    build->func_off = addr - mods.info.exports_start;
+    build->hook_off = hook_addr - mods.hook_info.exports_start;
+  }
+  *func = (void *)addr;
+  *hook = (const void *)hook_addr;
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Hooks the same function in several processes
+ *
+ *             For tools that hook every running instance of a program. The
+ *             modules are found with one pass over each process' module list
+ *             and the export tables are only searched once for each build of
+ *             the modules. Every process is then hooked under one hold of the
+ *             hooks lock and either all processes are hooked or none are.
+ *             Each process still gets its own trampoline since the address
+ *             spaces differ. A process that exits first takes its hook with
+ *             it. Release the rest together
+ *             with `taiHookGroupReleaseForKernel`.
+ *
+ * @param[in]  pids     The processes, each listed once
+ * @param[in]  count    Number of processes
+ * @param[out] p_hooks  A reference for each process, in `pids` order
+ * @param[in]  args     The hook
+ *
+ * @return     A group reference on success, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if `args` is invalid
+ *             - TAI_ERROR_NOT_FOUND if a module or NID is not found
+ *             - TAI_ERROR_PATCH_EXISTS if an address is already patched
+ */
+SceUID taiHookFunctionBroadcastForKernel(const SceUID *pids, size_t count, tai_hook_ref_t *p_hooks, const tai_broadcast_args_t *args) {
+  struct broadcast_build builds[MAX_BROADCAST_BUILDS];
+  size_t nbuilds;
+  void **funcs;
+  const void **hooks;
+  int ret;
+
+  if (args == NULL || args->size != sizeof(*args) || args->module == NULL || count == 0) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  funcs = heap_alloc(TAI_HEAP_METADATA, count * (sizeof(void *) + sizeof(const void *)));
+  if (funcs == NULL) {
+    return TAI_ERROR_MEMORY;
+  }
+  hooks = (const void **)(funcs + count);
+  nbuilds = 0;
+  for (size_t i = 0; i < count; i++) {
+    ret = broadcast_resolve(pids[i], args, builds, &nbuilds, &funcs[i], &hooks[i]);
+    if (ret < 0) {
+      LOG("Failed to resolve broadcast hook for pid %x: 0x%08X", pids[i], ret);
+      goto end;
+    }
+  }
+  LOG("Resolved %d processes from %d module builds", count, nbuilds);
+  ret = tai_hook_func_broadcast(p_hooks, pids, (void *const *)funcs, hooks, count);
+end:
+  heap_free(TAI_HEAP_METADATA, funcs);
+  return ret;
+}
+
 /**
  * @brief      Parses the taiHEN config and loads all plugins for a titleid to a
  *             process
@@ -240,16 +863,7 @@ int taiInjectReleaseForKernel(SceUID tai_uid) {
  *             - TAI_ERROR_SYSTEM if the config file is invalid
  */
 int taiLoadPluginsForTitleForKernel(SceUID pid, const char *titleid, int flags) {
-  tai_plugin_load_t param;
-  if (g_config) {
-    param.pid = pid;
-    param.flags = flags;
-    taihen_config_parse(g_config, titleid, hen_load_plugin, &param);
-    return TAI_SUCCESS;
-  } else {
-    LOG("config not loaded");
-    return TAI_ERROR_SYSTEM;
-  }
+  return hen_load_title_plugins(pid, titleid, flags);
 }
 
 /**
@@ -267,16 +881,46 @@ int taiLoadPluginsForTitleForKernel(SceUID pid, const char *titleid, int flags)
 int module_start(SceSize argc, const void *args) {
   int ret;
   LOG("starting taihen...");
+  ret = usage_init();
+  if (ret < 0) {
+    LOG("usage init failed: %x", ret);
+    return SCE_KERNEL_START_FAILED;
+  }
   ret = proc_map_init();
   if (ret < 0) {
     LOG("proc map init failed: %x", ret);
     return SCE_KERNEL_START_FAILED;
   }
+  ret = stats_init();
+  if (ret < 0) {
+    LOG("stats init failed: %x", ret);
+    return SCE_KERNEL_START_FAILED;
+  }
+  ret = heap_init();
+  if (ret < 0) {
+    LOG("heap init failed: %x", ret);
+    return SCE_KERNEL_START_FAILED;
+  }
   ret = patches_init();
   if (ret < 0) {
     LOG("patches init failed: %x", ret);
     return SCE_KERNEL_START_FAILED;
   }
+  ret = event_init();
+  if (ret < 0) {
+    LOG("event init failed: %x", ret);
+    return SCE_KERNEL_START_FAILED;
+  }
+  ret = module_init();
+  if (ret < 0) {
+    LOG("module init failed: %x", ret);
+    return SCE_KERNEL_START_FAILED;
+  }
+  ret = report_init();
+  if (ret < 0) {
+    LOG("report init failed: %x", ret);
+    return SCE_KERNEL_START_FAILED;
+  }
   ret = hen_add_patches();
   if (ret < 0) {
     LOG("HEN patches failed: %x", ret);
@@ -308,8 +952,15 @@ void _start() __attribute__ ((weak, alias ("module_start")));
 int module_stop(SceSize argc, const void *args) {
   // TODO: release everything
   hen_remove_patches();
+  usage_save();
+  report_deinit();
+  module_deinit();
+  event_deinit();
   patches_deinit();
+  heap_deinit();
+  stats_deinit();
   proc_map_deinit();
+  usage_deinit();
   return SCE_KERNEL_STOP_SUCCESS;
 }
 
@@ -36,6 +36,9 @@ extern "C" {
 /** Fake library NID indicating that any library NID would match. */
 #define TAI_ANY_LIBRARY 0xFFFFFFFF
 
+/** Fake PID indicating that any process would match. */
+#define TAI_ANY_PID ((SceUID)0xFFFFFFFF)
+
 /** Functions for calling the syscalls with arguments */
 #define HELPER inline static __attribute__((unused))
 
@@ -66,6 +69,25 @@ typedef struct _tai_hook_args {
   const void *hook_func;
 } tai_hook_args_t;
 
+/**
+ * @brief      Hook installed in many processes by
+ *             `taiHookFunctionBroadcastForKernel`
+ *
+ *             The hook function is either an export of a module loaded in
+ *             every process (`hook_module`) or the same address everywhere
+ *             (`hook_func`).
+ */
+typedef struct _tai_broadcast_args {
+  size_t size;                  ///< Structure size, set to sizeof(tai_broadcast_args_t)
+  const char *module;           ///< Module exporting the function to hook
+  uint32_t library_nid;         ///< Library of the function, can be `TAI_ANY_LIBRARY`
+  uint32_t func_nid;            ///< The function to hook
+  const char *hook_module;      ///< Module exporting the hook function, NULL to use `hook_func`
+  uint32_t hook_library_nid;    ///< Library of the hook function, can be `TAI_ANY_LIBRARY`
+  uint32_t hook_func_nid;       ///< The hook function
+  const void *hook_func;        ///< Hook function address if `hook_module` is NULL
+} tai_broadcast_args_t;
+
 /**
  * @brief      Pass offset arguments to kernel
  */
@@ -89,6 +111,262 @@ typedef struct _tai_module_args {
   int flags;
 } tai_module_args_t;
 
+/**
+ * @brief      Module events
+ */
+typedef enum {
+  TAI_EVENT_MODULE_LOAD = 1,    ///< A module was loaded
+  TAI_EVENT_MODULE_UNLOAD = 2,  ///< A module was unloaded
+  TAI_EVENT_MODULE_ALL = 3      ///< Mask of all module events
+} tai_module_event_type_t;
+
+/**
+ * @brief      Module event passed to callbacks
+ */
+typedef struct _tai_module_event {
+  size_t size;                  ///< Structure size
+  int type;                     ///< A `tai_module_event_type_t`
+  SceUID pid;                   ///< Process of the module
+  SceUID modid;                 ///< Module UID (no longer valid on unload)
+  const char *name;             ///< Module name (only valid during the callback)
+} tai_module_event_t;
+
+/**
+ * @brief      Module event callback
+ *
+ *             Called in the context of the thread loading or unloading the
+ *             module. Keep it short, it runs on the module manager's path.
+ */
+typedef void (*tai_module_event_cb_t)(const tai_module_event_t *event, void *opaque);
+
+/** Number of latency buckets per API in `tai_stats_t` */
+#define TAI_STATS_LATENCY_BUCKETS 16
+
+/**
+ * @brief      APIs with latency histograms in `tai_stats_t`
+ */
+typedef enum {
+  TAI_STATS_HOOK = 0,           ///< Adding a hook
+  TAI_STATS_HOOK_RELEASE,       ///< Releasing a hook
+  TAI_STATS_INJECT,             ///< Adding an injection
+  TAI_STATS_INJECT_RELEASE,     ///< Releasing an injection
+  TAI_STATS_API_MAX
+} tai_stats_api_t;
+
+/**
+ * @brief      Phases of adding a hook with histograms in `tai_stats_t`
+ *
+ *             Only recorded when taiHEN is built with `ENABLE_PROFILING`.
+ */
+typedef enum {
+  TAI_STATS_PHASE_LOOKUP = 0,   ///< Finding the export or import in the module
+  TAI_STATS_PHASE_UID,          ///< Creating the patch UID
+  TAI_STATS_PHASE_USER_UID,     ///< Creating the user UID of a hook added from user
+  TAI_STATS_PHASE_PROC_MAP,     ///< Inserting the patch in the proc map
+  TAI_STATS_PHASE_SLAB,         ///< Allocating the hook record and thunk
+  TAI_STATS_PHASE_SUBSTITUTE,   ///< Patching the function with libsubstitute
+  TAI_STATS_PHASE_FLUSH,        ///< Each cache flush, also counted in its phase
+  TAI_STATS_PHASE_MAX
+} tai_stats_phase_t;
+
+/**
+ * @brief      taiHEN counters
+ *
+ *             Published in a read only page that can be mapped into a process
+ *             with `taiGetStatsPage`. Each counter is updated atomically and
+ *             `seq` changes after every update. Use `taiReadStats` to get a
+ *             copy no update raced with.
+ */
+typedef struct _tai_stats {
+  volatile uint32_t seq;        ///< Sequence number, bumped by two per update
+  uint32_t size;                ///< Structure size
+  uint32_t hooks_added;         ///< Hooks added
+  uint32_t hooks_removed;       ///< Hooks released
+  uint32_t injections_added;    ///< Injections added
+  uint32_t injections_removed;  ///< Injections released
+  uint32_t cache_flushes;       ///< Cache flushes
+  uint32_t cache_flush_bytes;   ///< Bytes flushed
+  uint32_t slabs_allocated;     ///< Slabs allocated
+  uint32_t slabs_freed;         ///< Slabs freed
+  uint32_t slab_items_allocated;///< Slab items allocated
+  uint32_t slab_items_freed;    ///< Slab items freed
+  /** Calls taking [2^i, 2^(i+1)) microseconds per API, the last bucket is open ended */
+  uint32_t latency[TAI_STATS_API_MAX][TAI_STATS_LATENCY_BUCKETS];
+  uint32_t profiling;           ///< Nonzero if `phase` is recorded
+  /** Time spent per phase of adding a hook, bucketed like `latency` */
+  uint32_t phase[TAI_STATS_PHASE_MAX][TAI_STATS_LATENCY_BUCKETS];
+} tai_stats_t;
+
+/** Copies `taiReadStats` makes before giving up on an untouched one */
+#define TAI_STATS_READ_RETRIES 16
+
+/**
+ * @brief      Copies the stats page without a syscall
+ *
+ *             Copies until no update happened during the copy, at most
+ *             `TAI_STATS_READ_RETRIES` times. Each counter in the copy is
+ *             always a value it had, even when giving up.
+ *
+ * @param[in]  page  The page from `taiGetStatsPage`
+ * @param[out] out   The copy
+ *
+ * @return     1 if no update happened during the copy, 0 otherwise
+ */
+HELPER int taiReadStats(const tai_stats_t *page, tai_stats_t *out) {
+  const volatile uint32_t *src = (const volatile uint32_t *)page;
+  uint32_t *dst = (uint32_t *)out;
+  uint32_t seq;
+
+  for (int n = 0; n < TAI_STATS_READ_RETRIES; n++) {
+    seq = page->seq;
+    __sync_synchronize();
+    for (int i = 1; i < sizeof(tai_stats_t) / sizeof(uint32_t); i++) {
+      dst[i] = src[i];
+    }
+    __sync_synchronize();
+    out->seq = seq;
+    if (page->seq == seq) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief      taiHEN's kernel heaps
+ */
+typedef enum {
+  TAI_HEAP_METADATA = 0,        ///< Hook and patch bookkeeping
+  TAI_HEAP_SCRATCH,             ///< libsubstitute's working memory
+  TAI_HEAP_SAVED,               ///< Original data saved by injections
+  TAI_HEAP_MAX
+} tai_heap_t;
+
+/**
+ * @brief      Usage of a heap
+ *
+ *             Byte counts include a small header per allocation. `fragmented`
+ *             counts failed allocations that would have fit in the total free
+ *             space, a sign the heap is fragmented.
+ */
+typedef struct _tai_heap_stats {
+  size_t size;                  ///< Structure size, set to sizeof(tai_heap_stats_t)
+  uint32_t capacity;            ///< Heap size in bytes
+  uint32_t in_use;              ///< Bytes allocated
+  uint32_t peak;                ///< Most bytes ever allocated at once
+  uint32_t allocs;              ///< Live allocations
+  uint32_t failures;            ///< Failed allocations
+  uint32_t fragmented;          ///< Failed allocations smaller than the free space
+  uint32_t spilled;             ///< Live allocations in their own memory block
+  uint32_t spilled_bytes;       ///< Bytes in their own memory blocks
+} tai_heap_stats_t;
+
+/**
+ * @brief      Patch events
+ */
+typedef enum {
+  TAI_PATCH_EVENT_HOOK_ADDED = 1,     ///< A hook was added
+  TAI_PATCH_EVENT_HOOK_REMOVED,       ///< A hook was released
+  TAI_PATCH_EVENT_INJECT_ADDED,       ///< An injection was added
+  TAI_PATCH_EVENT_INJECT_REMOVED,     ///< An injection was released
+  TAI_PATCH_EVENT_PROCESS_CLEANUP,    ///< All patches of an exited process were dropped
+  TAI_PATCH_EVENT_INJECT_SWAPPED      ///< An injection's data was replaced, `addr` and `size` are the bytes that changed
+} tai_patch_event_type_t;
+
+/**
+ * @brief      Record of a patch change
+ *
+ *             Read with `taiReadPatchEvents`. For process cleanup only `pid`
+ *             is set.
+ */
+typedef struct _tai_patch_event {
+  uint32_t seq;                 ///< Position of the event in the stream
+  uint16_t type;                ///< A `tai_patch_event_type_t`
+  uint16_t reserved;
+  SceUID pid;                   ///< Process of the patch
+  SceUID uid;                   ///< Patch UID
+  uintptr_t addr;               ///< Patched address
+  uint32_t size;                ///< Patched size
+} tai_patch_event_t;
+
+/** Longest plugin path kept in a load report */
+#define TAI_REPORT_PATH_LEN 128
+
+/** Load report flag: the plugin was skipped because it failed to load before */
+#define TAI_REPORT_SKIPPED 1
+
+/**
+ * @brief      Record of a plugin loaded by taiHEN
+ *
+ *             Times are in microseconds. Plugins queued to start with the
+ *             application have a `start_time` and `start_result` of zero.
+ */
+typedef struct _tai_load_report {
+  size_t size;                  ///< Structure size, set to sizeof(tai_load_report_t)
+  char titleid[32];             ///< Title the plugin was loaded for
+  char path[TAI_REPORT_PATH_LEN]; ///< Plugin path (may be truncated)
+  SceUID pid;                   ///< Process the plugin was loaded to
+  SceUID modid;                 ///< Module UID or < 0 if the load failed
+  int start_result;             ///< Return of the plugin's `module_start`
+  uint32_t load_time;           ///< Time taken to load
+  uint32_t start_time;          ///< Time taken to start
+  size_t mem_size;              ///< Memory taken by the plugin's segments
+  int flags;                    ///< `TAI_REPORT_*` flags
+} tai_load_report_t;
+
+/** Maximum number of IDs in a `tai_hook_guard_t` */
+#define TAI_GUARD_MAX_IDS 8
+
+/** Maximum number of argument predicates in a `tai_hook_guard_t` */
+#define TAI_GUARD_MAX_ARGS 4
+
+/**
+ * @brief      Kind of ID matched by a hook guard
+ */
+typedef enum {
+  TAI_GUARD_NONE = 0,           ///< No ID filter, only check the arguments
+  TAI_GUARD_PID = 1,            ///< Match the calling process
+  TAI_GUARD_THREAD = 2          ///< Match the calling thread
+} tai_guard_type_t;
+
+/**
+ * @brief      Test applied to an argument register
+ *
+ *             Comparisons are unsigned.
+ */
+typedef enum {
+  TAI_ARG_EQ = 1,               ///< `arg == a`
+  TAI_ARG_MASK = 2,             ///< `(arg & a) == b`
+  TAI_ARG_RANGE = 3             ///< `a <= arg && arg <= b`
+} tai_arg_op_t;
+
+/**
+ * @brief      Predicate on one of the first four arguments of a hooked call
+ */
+typedef struct _tai_arg_predicate {
+  int op;                       ///< A `tai_arg_op_t`
+  int reg;                      ///< Argument index (0-3 for r0-r3)
+  uint32_t a;                   ///< Value, mask or lower bound
+  uint32_t b;                   ///< Expected masked value or upper bound
+} tai_arg_predicate_t;
+
+/**
+ * @brief      Caller filter for a hook
+ *
+ *             The guard is checked before the hook function is entered. If
+ *             the caller does not match any of `ids` or any of `args` fails,
+ *             the hook function is skipped and the chain continues as if it
+ *             called `TAI_CONTINUE`.
+ */
+typedef struct _tai_hook_guard {
+  size_t size;                  ///< Structure size, set to sizeof(tai_hook_guard_t)
+  int type;                     ///< A `tai_guard_type_t`
+  int count;                    ///< Number of entries in `ids`
+  SceUID ids[TAI_GUARD_MAX_IDS];///< Callers that run the hook function
+  int nargs;                    ///< Number of entries in `args`
+  tai_arg_predicate_t args[TAI_GUARD_MAX_ARGS]; ///< Predicates that must all hold
+} tai_hook_guard_t;
+
 /**
  * @defgroup   hook Hooks Interface
  * @brief      Patches functions.
@@ -194,6 +472,7 @@ typedef struct _tai_module_args {
  *  back to `recurse_open_hook` so it is _very important_ to avoid an
  *  infinite recursion. In this case, we check that the parameter is
  *  not the same, but more complex checks may be needed for other 
+ *  function. The bypass flags (see `TAI_BYPASS_ENTER`) do this for any
  *  function.
  */
 /** @{ */
@@ -226,7 +505,23 @@ SceUID taiHookFunctionExportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const
 SceUID taiHookFunctionImportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func);
 SceUID taiHookFunctionOffsetForKernel(SceUID pid, tai_hook_ref_t *p_hook, SceUID modid, int segidx, uint32_t offset, int thumb, const void *hook_func);
 int taiGetModuleInfoForKernel(SceUID pid, const char *module, tai_module_info_t *info);
+int taiGetModuleInfoListForKernel(SceUID pid, const char *prefix, tai_module_info_t *infos, size_t *count);
+int taiGetModuleExportFuncForKernel(SceUID pid, const char *module, uint32_t library_nid, uint32_t func_nid, uintptr_t *func);
+int taiGetLoadReportForKernel(const char *titleid, int index, tai_load_report_t *report);
+int taiReloadConfigForKernel(void);
+int taiGetStatsForKernel(tai_stats_t *stats);
+int taiGetHeapStatsForKernel(tai_heap_t heap, tai_heap_stats_t *stats);
+int taiReadPatchEventsForKernel(uint32_t *cursor, tai_patch_event_t *events, int max, uint32_t *lost);
 int taiHookReleaseForKernel(SceUID tai_uid, tai_hook_ref_t hook);
+SceUID taiHookFunctionImportAllForKernel(SceUID pid, tai_hook_ref_t *p_hooks, size_t *count, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func);
+int taiHookGroupReleaseForKernel(SceUID group_uid);
+SceUID taiApplyBundleForKernel(SceUID pid, const char *path, tai_hook_ref_t *p_hooks, size_t *count);
+SceUID taiHookFunctionBroadcastForKernel(const SceUID *pids, size_t count, tai_hook_ref_t *p_hooks, const tai_broadcast_args_t *args);
+SceUID taiHookFunctionAbsGuarded(SceUID pid, tai_hook_ref_t *p_hook, void *dest_func, const void *hook_func, const tai_hook_guard_t *guard);
+SceUID taiHookFunctionExportGuardedForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func, const tai_hook_guard_t *guard);
+SceUID taiHookFunctionImportGuardedForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func, const tai_hook_guard_t *guard);
+SceUID taiRegisterModuleEventForKernel(SceUID pid, const char *module, int events, tai_module_event_cb_t callback, void *opaque);
+int taiUnregisterModuleEventForKernel(SceUID handle);
 /** @} */
 #endif // __VITA_KERNEL__
 
@@ -239,7 +534,16 @@ SceUID taiHookFunctionExportForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *arg
 SceUID taiHookFunctionImportForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *args);
 SceUID taiHookFunctionOffsetForUser(tai_hook_ref_t *p_hook, tai_offset_args_t *args);
 int taiGetModuleInfo(const char *module, tai_module_info_t *info);
+int taiGetModuleInfoList(const char *prefix, tai_module_info_t *infos, size_t *count);
+int taiGetModuleExportFunc(const char *module, uint32_t library_nid, uint32_t func_nid, uintptr_t *func);
+int taiGetLoadReport(const char *titleid, int index, tai_load_report_t *report);
+int taiReloadConfig(void);
+int taiGetStatsPage(const tai_stats_t **page);
+int taiGetHeapStats(tai_heap_t heap, tai_heap_stats_t *stats);
+int taiReadPatchEvents(uint32_t *cursor, tai_patch_event_t *events, int max, uint32_t *lost);
 int taiHookRelease(SceUID tai_uid, tai_hook_ref_t hook);
+SceUID taiHookFunctionExportGuardedForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *args, const tai_hook_guard_t *guard);
+SceUID taiHookFunctionImportGuardedForUser(tai_hook_ref_t *p_hook, tai_hook_args_t *args, const tai_hook_guard_t *guard);
 
 /**
  * @brief      Helper function for #taiHookFunctionExportForUser
@@ -285,6 +589,53 @@ HELPER SceUID taiHookFunctionImport(tai_hook_ref_t *p_hook, const char *module,
   return taiHookFunctionImportForUser(p_hook, &args);
 }
 
+/**
+ * @brief      Helper function for #taiHookFunctionExportGuardedForUser
+ *
+ * @see        taiHookFunctionExportGuardedForUser
+ *
+ * @param[out] p_hook       A reference that can be used by the hook function
+ * @param[in]  module       Name of the target module.
+ * @param[in]  library_nid  Optional. NID of the target library.
+ * @param[in]  func_nid     The function NID. If `library_nid` is 0, then the
+ *                          first export with the NID will be hooked.
+ * @param[in]  hook_func    The hook function
+ * @param[in]  guard        Argument predicates. `type` must be `TAI_GUARD_NONE`.
+ */
+HELPER SceUID taiHookFunctionExportGuarded(tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func, const tai_hook_guard_t *guard) {
+  tai_hook_args_t args;
+  args.size = sizeof(args);
+  args.module = module;
+  args.library_nid = library_nid;
+  args.func_nid = func_nid;
+  args.hook_func = hook_func;
+  return taiHookFunctionExportGuardedForUser(p_hook, &args, guard);
+}
+
+/**
+ * @brief      Helper function for #taiHookFunctionImportGuardedForUser
+ *
+ * @see        taiHookFunctionImportGuardedForUser
+ *
+ * @param[out] p_hook              A reference that can be used by the hook
+ *                                 function
+ * @param[in]  module              Name of the target module.
+ * @param[in]  import_library_nid  The imported library from the target module
+ * @param[in]  import_func_nid     The function NID of the import
+ * @param[in]  hook_func           The hook function
+ * @param[in]  guard               Argument predicates. `type` must be
+ *                                 `TAI_GUARD_NONE`.
+ */
+HELPER SceUID taiHookFunctionImportGuarded(tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func, const tai_hook_guard_t *guard) {
+  tai_hook_args_t args;
+  args.size = sizeof(args);
+  args.module = module;
+  args.library_nid = import_library_nid;
+  args.func_nid = import_func_nid;
+  args.hook_func = hook_func;
+  return taiHookFunctionImportGuardedForUser(p_hook, &args, guard);
+}
+
 /**
  * @brief      Helper function for #taiHookFunctionOffsetForUser
  *
@@ -329,6 +680,106 @@ HELPER SceUID taiHookFunctionOffset(tai_hook_ref_t *p_hook, SceUID modid, int se
     ((type(*)())next->func)(__VA_ARGS__) \
   ; \
 })
+
+/** @name Hook bypass
+ * Per-thread flags for hooks that call what they hook
+ *
+ * A hook that calls functions it (or another hook of the same plugin) has
+ * hooked sets a bit around those calls, and the hook functions skip their own
+ * work while the bit is set. The flags start out zero. Each thread inside a
+ * scope owns a flag word in a page taiHEN allocates, which user code can read
+ * but not write, and its TLS holds the address of the word. Testing the flags
+ * is an inline load, only entering and leaving a scope call into taiHEN.
+ * Entering never fails. Bits below `TAI_BYPASS_USER` are shared categories,
+ * the rest are free for plugins to pick. Kernel and user hooks have separate
+ * flags so user code cannot set the bits that kernel hooks see.
+ *
+ * ```c
+ * SceUID open_hook(const char *path, int flags, SceMode mode) {
+ *   SceUID ret = TAI_CONTINUE(SceUID, open_ref, path, flags, mode);
+ *   uint32_t prev;
+ *   if (!TAI_BYPASSED(TAI_BYPASS_IO)) {
+ *     prev = TAI_BYPASS_ENTER(TAI_BYPASS_IO);
+ *     log_open(path); // calls sceIoOpenForDriver
+ *     TAI_BYPASS_EXIT(prev);
+ *   }
+ *   return ret;
+ * }
+ * ```
+ */
+/** @{ */
+#define TAI_BYPASS_IO       (1u << 0)   ///< File and device I/O
+#define TAI_BYPASS_MEMORY   (1u << 1)   ///< Memory allocation and mapping
+#define TAI_BYPASS_MODULE   (1u << 2)   ///< Module loading
+#define TAI_BYPASS_USER     (1u << 8)   ///< First bit free for plugins
+#define TAI_BYPASS_ALL      0xFFFFFFFFu ///< Every bit
+
+/** Offset from the thread's TLS base of the address of its flag word */
+#define TAI_BYPASS_TLS_OFFSET 0x7FC
+
+#ifdef __VITA_KERNEL__
+uint32_t taiBypassEnterForKernel(uint32_t flags);
+int taiBypassExitForKernel(uint32_t prev);
+#endif
+uint32_t taiBypassEnter(uint32_t flags);
+int taiBypassExit(uint32_t prev);
+
+/**
+ * @brief      Gets the calling thread's bypass flag word
+ *
+ * @return     The flag word or NULL if the thread is not inside a scope
+ */
+static inline const volatile uint32_t *tai_bypass_word(void) {
+#if defined(__arm__)
+  uintptr_t tls;
+#ifdef __VITA_KERNEL__
+  __asm__ ("mrc p15, 0, %0, c13, c0, 4" : "=r" (tls)); // TPIDRPRW
+#else
+  __asm__ ("mrc p15, 0, %0, c13, c0, 3" : "=r" (tls)); // TPIDRURO
+#endif
+  return *(const volatile uint32_t *volatile *)(tls + TAI_BYPASS_TLS_OFFSET);
+#else
+  // host builds of the tests
+  extern __thread const volatile uint32_t *tai_bypass_host_words[];
+#ifdef __VITA_KERNEL__
+  return tai_bypass_host_words[0];
+#else
+  return tai_bypass_host_words[1];
+#endif
+#endif
+}
+
+/**
+ * @brief      Tests if any of the flags are set for this thread
+ *
+ * @param      flags  The flags
+ */
+#define TAI_BYPASSED(flags) ({ \
+  const volatile uint32_t *word = tai_bypass_word(); \
+  word != NULL && (*word & (flags)) != 0; \
+})
+
+#ifdef __VITA_KERNEL__
+/**
+ * @brief      Sets flags for this thread until `TAI_BYPASS_EXIT`
+ *
+ * @param      flags  The flags
+ *
+ * @return     The previous flags, pass them to `TAI_BYPASS_EXIT`
+ */
+#define TAI_BYPASS_ENTER(flags) taiBypassEnterForKernel(flags)
+
+/**
+ * @brief      Restores the flags saved by `TAI_BYPASS_ENTER`
+ *
+ * @param      prev  The previous flags from `TAI_BYPASS_ENTER`
+ */
+#define TAI_BYPASS_EXIT(prev) taiBypassExitForKernel(prev)
+#else // __VITA_KERNEL__
+#define TAI_BYPASS_ENTER(flags) taiBypassEnter(flags)
+#define TAI_BYPASS_EXIT(prev) taiBypassExit(prev)
+#endif // __VITA_KERNEL__
+/** @} */
 #else // __GNUC__
 #error Non-GCC compatible compilers are currently unsupported
 #endif // __GNUC__
@@ -355,6 +806,8 @@ HELPER SceUID taiHookFunctionOffset(tai_hook_ref_t *p_hook, SceUID modid, int se
 SceUID taiInjectAbsForKernel(SceUID pid, void *dest, const void *src, size_t size);
 SceUID taiInjectDataForKernel(SceUID pid, SceUID modid, int segidx, uint32_t offset, const void *data, size_t size);
 int taiInjectReleaseForKernel(SceUID tai_uid);
+int taiInjectSwapForKernel(SceUID tai_uid, const void *src);
+int taiInjectSetChunkingForKernel(size_t chunk, int defer);
 /** @} */
 #endif // !__VITA_KERNEL__
 
@@ -366,6 +819,7 @@ int taiInjectReleaseForKernel(SceUID tai_uid);
 SceUID taiInjectAbs(void *dest, const void *src, size_t size);
 SceUID taiInjectDataForUser(tai_offset_args_t *args);
 int taiInjectRelease(SceUID tai_uid);
+int taiInjectSwap(SceUID tai_uid, const void *src);
 
 /**
  * @brief      Helper function for #taiInjectDataForUser
@@ -39,16 +39,29 @@ extern unsigned char log_ctr;
  */
 typedef enum {
   HOOKS,
-  INJECTION
+  INJECTION,
+  GROUP
 } tai_patch_type_t;
 
 /**
- * @brief      Hook data stored in address space of process to patch
+ * @brief      User visible part of a hook stored in the process' exec slab
+ *
+ *             Padded to exactly one cache line so a chain update only has to
+ *             flush the line of the record that changed. Nothing but the
+ *             fields `TAI_CONTINUE` reads is ever mapped into the process.
  */
-typedef struct _tai_hook {
+typedef union _tai_hook_record {
   struct _tai_hook_user u;      ///< Used by `TAI_CONTINUE` to find next hook to run
-  // TODO: obfuscate these two kernel pointers as they might be stored in userland
-  // also put a MAC over them
+  uint8_t line[SLAB_LINE_SIZE]; ///< Padding to a full cache line
+} tai_hook_record_t;
+
+/**
+ * @brief      Kernel only hook data
+ */
+typedef struct _tai_hook {
+  struct _tai_hook_user *u;     ///< Writable view of the record in the exec slab
+  uintptr_t exe;                ///< Address of the record in the process (the hook reference)
+  void *thunk;                  ///< Writable view of the guard thunk or NULL if unguarded
   struct _tai_hook *next;       ///< Next hook for this process + address
   struct _tai_patch *patch;     ///< The patch containing this hook
 } tai_hook_t;
@@ -73,21 +86,55 @@ typedef struct _tai_hook_list {
 } tai_hook_list_t;
 
 /**
- * @brief      A patch containing either a hook chain or an injection
+ * @brief      A hook or injection owned by a group
+ */
+typedef struct _tai_group_member {
+  SceUID uid;                   ///< The member's patch, < 0 once its process exited
+  SceUID pid;                   ///< Process of the member's patch
+  tai_hook_ref_t ref;           ///< The hook reference, zero for an injection
+} tai_group_member_t;
+
+/**
+ * @brief      Hooks and injections that are released together
+ *
+ *             Groups are never inserted into the proc map, the member patches
+ *             are.
+ */
+typedef struct _tai_group {
+  size_t count;                 ///< Number of members
+  struct _tai_group_member *members; ///< The members (allocated from the patch pool)
+} tai_group_t;
+
+/**
+ * @brief      One patch of `tai_patch_batch`
+ */
+typedef struct _tai_batch_op {
+  void *dest;                   ///< Function to hook or address to inject
+  const void *src;              ///< Hook function or kernel data to inject
+  size_t size;                  ///< Bytes to inject, zero for a hook
+} tai_batch_op_t;
+
+/**
+ * @brief      A patch containing either a hook chain, an injection or a group
+ *             of patches
  */
 typedef struct _tai_patch {
   uint32_t sce_reserved[2];     ///< used by SCE object system
   union {
     struct _tai_inject inject;  ///< Inject data
     struct _tai_hook_list hooks;///< Hook chain data
+    struct _tai_group group;    ///< Hook group data
   } data;
-  tai_patch_type_t type;        ///< Type of patch (hook chain or injection)
+  tai_patch_type_t type;        ///< Type of patch (hook chain, injection or group)
   SceUID uid;                   ///< Kernel object id of this object
   SceUID pid;                   ///< Process owning this object
   uintptr_t addr;               ///< Address being patched
   size_t size;                  ///< Size of the patch
   struct _tai_patch *next;      ///< Next patch in the linked list for this process
   struct slab_chain *slab;      ///< Slab chain for this process (copied from the owner `tai_proc_t`)
+  struct slab_chain *hook_slab; ///< Hook record slab for this process (copied from the owner `tai_proc_t`)
+  struct slab_chain *thunk_slab;///< Thunk slab for this process (copied from the owner `tai_proc_t`)
+  int usage_title;              ///< Usage history slot for this process (copied from the owner `tai_proc_t`)
 } tai_patch_t;
 
 /** @} */
@@ -104,6 +151,9 @@ typedef struct _tai_proc {
   SceUID pid;                   ///< Process ID (the key in the map)
   tai_patch_t *head;            ///< Linked list of patches for this process
   struct slab_chain slab;       ///< A slab allocator associated with this process
+  struct slab_chain hook_slab;  ///< Exec slab of `tai_hook_record_t` for this process
+  struct slab_chain thunk_slab; ///< Exec slab of guard thunks for this process
+  int usage_title;              ///< Usage history slot of the process' title, < 0 if untracked
   struct _tai_proc *next;       ///< Next process in this map bucket
 } tai_proc_t;
 
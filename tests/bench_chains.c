@@ -0,0 +1,162 @@
+/* bench_chains.c -- cache locality benchmark for hook chains
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../taihen.h"
+#include "../taihen_internal.h"
+#include "../slab.h"
+
+/** Macro for printing test messages with an identifier */
+#ifndef NO_TEST_OUTPUT
+#define TEST_MSG(fmt, ...) printf("[%s] " fmt "\n", name, ##__VA_ARGS__)
+#else
+#define TEST_MSG(fmt, ...)
+#endif
+
+/** Size of a cache line on the target */
+#define LINE_SIZE 32
+
+/** Size of a hook record */
+#define RECORD_SIZE sizeof(tai_hook_record_t)
+
+/** Number of hooked functions */
+#define NUM_TARGETS 24
+
+/** Number of hooks on each function */
+#define HOOKS_PER_TARGET 6
+
+/** Number of release/re-add rounds to scatter the slabs */
+#define CHURN_ROUNDS 200
+
+/**
+ * @brief      A simulated hook chain
+ *
+ *             `items[0]` is the head. Like `hooks_add_hook`, new records are
+ *             linked in right after the head.
+ */
+struct chain {
+  void *items[HOOKS_PER_TARGET];
+  int count;
+};
+
+/**
+ * @brief      Adds a record to a chain
+ *
+ * @param      slab  The slab
+ * @param      c     The chain
+ * @param[in]  near  Use placement hints
+ */
+static void chain_add(struct slab_chain *slab, struct chain *c, int near) {
+  void *item;
+  uintptr_t exe;
+
+  item = near ? slab_alloc_near(slab, c->items[0], &exe) : slab_alloc(slab, &exe);
+  assert(item != NULL);
+  if (c->count == 0) {
+    c->items[0] = item;
+  } else {
+    memmove(&c->items[2], &c->items[1], (c->count - 1) * sizeof(void *));
+    c->items[1] = item;
+  }
+  c->count++;
+}
+
+/**
+ * @brief      Removes the oldest record of a chain
+ *
+ * @param      slab  The slab
+ * @param      c     The chain
+ */
+static void chain_remove_last(struct slab_chain *slab, struct chain *c) {
+  slab_free(slab, c->items[--c->count]);
+  c->items[c->count] = NULL;
+}
+
+/**
+ * @brief      Counts distinct cache lines and slabs touched walking a chain
+ *
+ * @param[in]  slab   The slab
+ * @param[in]  c      The chain
+ * @param[out] slabs  Number of distinct slabs
+ *
+ * @return     Number of distinct cache lines
+ */
+static int chain_walk(const struct slab_chain *slab, const struct chain *c, int *slabs) {
+  uintptr_t lines[HOOKS_PER_TARGET * 2];
+  uintptr_t bases[HOOKS_PER_TARGET];
+  int nlines, nbases, i;
+
+  nlines = nbases = 0;
+  for (int k = 0; k < c->count; k++) {
+    uintptr_t addr = (uintptr_t)c->items[k];
+    uintptr_t base = addr & slab->alignment_mask;
+    for (i = 0; i < nbases && bases[i] != base; i++);
+    if (i == nbases) bases[nbases++] = base;
+    for (uintptr_t l = addr / LINE_SIZE; l <= (addr + RECORD_SIZE - 1) / LINE_SIZE; l++) {
+      for (i = 0; i < nlines && lines[i] != l; i++);
+      if (i == nlines) lines[nlines++] = l;
+    }
+  }
+  *slabs = nbases;
+  return nlines;
+}
+
+/**
+ * @brief      Builds interleaved chains with churn and reports locality
+ *
+ * @param[in]  name  The name of the run
+ * @param[in]  near  Use placement hints
+ */
+static void run(const char *name, int near) {
+  struct slab_chain slab;
+  struct chain chains[NUM_TARGETS];
+  int lines, slabs, total_lines, total_slabs;
+
+  srand(0);
+  memset(chains, 0, sizeof(chains));
+  slab_init(&slab, RECORD_SIZE, KERNEL_PID);
+
+  // install round robin so consecutive allocations belong to different chains
+  for (int h = 0; h < HOOKS_PER_TARGET; h++) {
+    for (int t = 0; t < NUM_TARGETS; t++) {
+      chain_add(&slab, &chains[t], near);
+    }
+  }
+  // plugins come and go
+  for (int r = 0; r < CHURN_ROUNDS; r++) {
+    struct chain *c = &chains[rand() % NUM_TARGETS];
+    chain_remove_last(&slab, c);
+    chain_add(&slab, c, near);
+  }
+
+  total_lines = total_slabs = 0;
+  for (int t = 0; t < NUM_TARGETS; t++) {
+    lines = chain_walk(&slab, &chains[t], &slabs);
+    total_lines += lines;
+    total_slabs += slabs;
+  }
+  TEST_MSG("%d chains x %d hooks, %zu byte records", NUM_TARGETS, HOOKS_PER_TARGET, RECORD_SIZE);
+  TEST_MSG("avg distinct lines per chain walk: %.2f", (double)total_lines / NUM_TARGETS);
+  TEST_MSG("avg distinct slabs per chain walk: %.2f", (double)total_slabs / NUM_TARGETS);
+
+  for (int t = 0; t < NUM_TARGETS; t++) {
+    while (chains[t].count > 0) {
+      chain_remove_last(&slab, &chains[t]);
+    }
+  }
+  slab_destroy(&slab);
+}
+
+int main(int argc, const char *argv[]) {
+  run("slab_alloc", 0);
+  run("slab_alloc_near", 1);
+  return 0;
+}
@@ -0,0 +1,221 @@
+/* bench_config.c -- config size benchmark
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <taihen/parser.h>
+
+#include "../taihen.h"
+#include "../taihen_internal.h"
+#include "../event.h"
+#include "../hen.h"
+#include "../report.h"
+#include "../usage.h"
+#include "compat.h"
+
+/** Macro for printing test messages with an identifier */
+#ifndef NO_TEST_OUTPUT
+#define TEST_MSG(fmt, ...) printf("[%s] " fmt "\n", name, ##__VA_ARGS__)
+#else
+#define TEST_MSG(fmt, ...)
+#endif
+
+/** Times each measurement is repeated */
+#define ROUNDS 200
+
+/** Bytes reserved per config line when sizing the buffer */
+#define LINE_BYTES 64
+
+/**
+ * @brief      Shape of a generated config
+ */
+struct shape {
+  const char *name;             ///< Name of the run
+  int sections;                 ///< Title sections
+  int plugins;                  ///< Plugins per title section
+  int all_plugins;              ///< Plugins in `*ALL`
+};
+
+/** Shapes run when none is given on the command line */
+static const struct shape g_shapes[] = {
+  { "small", 10, 2, 2 },
+  { "medium", 100, 3, 5 },
+  { "large", 500, 3, 10 },
+  { "huge", 1000, 4, 40 },
+};
+
+/**
+ * @brief      Makes a title id
+ *
+ * @param[out] titleid  The title id, at least 10 bytes
+ * @param[in]  index    The title
+ */
+static void make_titleid(char *titleid, int index) {
+  sprintf(titleid, "PCSE%05d", index);
+}
+
+/**
+ * @brief      Generates a config
+ *
+ * @param[in]  s     The shape
+ * @param[out] len   The length
+ *
+ * @return     The config, free with `free`
+ */
+static char *make_config(const struct shape *s, size_t *len) {
+  char titleid[16];
+  char *config;
+  size_t cap, n;
+
+  cap = (size_t)(s->sections * (s->plugins + 1) + s->all_plugins + 4) * LINE_BYTES;
+  config = malloc(cap);
+  assert(config != NULL);
+  n = sprintf(config, "# generated by bench_config\n*KERNEL\nux0:tai/kernel.skprx\n*ALL\n");
+  for (int i = 0; i < s->all_plugins; i++) {
+    n += sprintf(config + n, "ux0:tai/all/plugin_%d.suprx\n", i);
+  }
+  for (int t = 0; t < s->sections; t++) {
+    make_titleid(titleid, t);
+    n += sprintf(config + n, "*%s\n", titleid);
+    for (int p = 0; p < s->plugins; p++) {
+      n += sprintf(config + n, "ux0:tai/%s/plugin_%d.suprx\n", titleid, p);
+    }
+  }
+  assert(n < cap);
+  *len = n;
+  return config;
+}
+
+/**
+ * @brief      Config parser callback that counts plugins
+ *
+ * @param[in]  path   The plugin path
+ * @param      param  The count
+ */
+static void count_plugin(const char *path, void *param) {
+  (*(int *)param)++;
+}
+
+/**
+ * @brief      Times looking up one title
+ *
+ * @param[in]  config   The config
+ * @param[in]  titleid  The title
+ * @param[out] found    Number of plugins for the title
+ *
+ * @return     Average time in us
+ */
+static double time_lookup(const char *config, const char *titleid, int *found) {
+  SceInt64 start;
+  int count;
+
+  start = sceKernelGetSystemTimeWide();
+  for (int r = 0; r < ROUNDS; r++) {
+    count = 0;
+    taihen_config_parse(config, titleid, count_plugin, &count);
+  }
+  *found = count;
+  return (double)(sceKernelGetSystemTimeWide() - start) / ROUNDS;
+}
+
+/**
+ * @brief      Measures loading a config and looking up titles in it
+ *
+ * @param[in]  s     The shape
+ */
+static void run(const struct shape *s) {
+  const char *name = s->name;
+  char titleid[16];
+  SceInt64 start;
+  double load, validate, lookup;
+  size_t len;
+  char *config;
+  int found;
+  int ret;
+
+  config = make_config(s, &len);
+  compat_add_file(TAIHEN_CONFIG_FILE, config, len);
+  TEST_MSG("%d sections x %d plugins, %d in *ALL: %zu bytes",
+           s->sections, s->plugins, s->all_plugins, len);
+
+  ret = 0;
+  start = sceKernelGetSystemTimeWide();
+  for (int r = 0; r < ROUNDS; r++) {
+    ret |= hen_load_config();
+  }
+  load = (double)(sceKernelGetSystemTimeWide() - start) / ROUNDS;
+  assert(ret == 0);
+
+  start = sceKernelGetSystemTimeWide();
+  for (int r = 0; r < ROUNDS; r++) {
+    ret |= taihen_config_validate(config);
+  }
+  validate = (double)(sceKernelGetSystemTimeWide() - start) / ROUNDS;
+  assert(ret == 0);
+  TEST_MSG("load: %.2f us, of which validate: %.2f us", load, validate);
+
+  make_titleid(titleid, 0);
+  lookup = time_lookup(config, titleid, &found);
+  assert(found == s->all_plugins + s->plugins);
+  TEST_MSG("lookup first section: %.2f us", lookup);
+  make_titleid(titleid, s->sections / 2);
+  lookup = time_lookup(config, titleid, &found);
+  assert(found == s->all_plugins + s->plugins);
+  TEST_MSG("lookup middle section: %.2f us", lookup);
+  make_titleid(titleid, s->sections - 1);
+  lookup = time_lookup(config, titleid, &found);
+  assert(found == s->all_plugins + s->plugins);
+  TEST_MSG("lookup last section: %.2f us", lookup);
+  make_titleid(titleid, s->sections);
+  lookup = time_lookup(config, titleid, &found);
+  assert(found == s->all_plugins);
+  TEST_MSG("lookup title without section: %.2f us", lookup);
+
+  free(config);
+}
+
+/**
+ * @brief      Runs the default shapes or the one given
+ *
+ *             Usage: `bench_config [sections plugins all_plugins]`
+ */
+int main(int argc, const char *argv[]) {
+  struct shape custom;
+  int ret;
+
+  ret = usage_init();
+  assert(ret == 0);
+  ret = event_init();
+  assert(ret == 0);
+  ret = report_init();
+  assert(ret == 0);
+  // hen needs a config to start
+  compat_add_file(TAIHEN_CONFIG_FILE, "*KERNEL\n", 8);
+  ret = hen_add_patches();
+  assert(ret == 0);
+  if (argc == 4) {
+    custom.name = "custom";
+    custom.sections = atoi(argv[1]);
+    custom.plugins = atoi(argv[2]);
+    custom.all_plugins = atoi(argv[3]);
+    assert(custom.sections > 0 && custom.plugins >= 0 && custom.all_plugins >= 0);
+    run(&custom);
+  } else {
+    for (int i = 0; i < sizeof(g_shapes) / sizeof(g_shapes[0]); i++) {
+      run(&g_shapes[i]);
+    }
+  }
+  ret = hen_remove_patches();
+  assert(ret == 0);
+  report_deinit();
+  event_deinit();
+  usage_deinit();
+  return 0;
+}
@@ -0,0 +1,159 @@
+/* bench_hen.c -- title launch benchmark for plugin loading
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <psp2kern/kernel/threadmgr.h>
+
+#include "../taihen.h"
+#include "../taihen_internal.h"
+#include "../event.h"
+#include "../heap.h"
+#include "../hen.h"
+#include "../report.h"
+#include "../usage.h"
+#include "compat.h"
+
+/** Macro for printing test messages with an identifier */
+#ifndef NO_TEST_OUTPUT
+#define TEST_MSG(fmt, ...) printf("[%s] " fmt "\n", name, ##__VA_ARGS__)
+#else
+#define TEST_MSG(fmt, ...)
+#endif
+
+/** Number of titles with their own section */
+#define NUM_TITLES 40
+
+/** Number of plugins in each title section */
+#define PLUGINS_PER_TITLE 3
+
+/** Every this many titles has a plugin that is missing */
+#define MISSING_EVERY 8
+
+/** Number of simulated launches */
+#define NUM_LAUNCHES 5000
+
+/** First pid handed out */
+#define FIRST_PID 0x10010
+
+/** Size of the generated config */
+#define CONFIG_SIZE 0x4000
+
+/**
+ * @brief      Makes a title id
+ *
+ * @param[out] titleid  The title id, at least 10 bytes
+ * @param[in]  index    The title
+ */
+static void make_titleid(char *titleid, int index) {
+  sprintf(titleid, "PCSE%05d", index);
+}
+
+/**
+ * @brief      Writes a config like a well used setup and its plugins
+ *
+ *             Global plugins in `*ALL`, several plugins per title and some
+ *             entries whose file does not exist.
+ *
+ * @param[in]  name  The name of the run
+ */
+static void make_config(const char *name) {
+  static char config[CONFIG_SIZE];
+  char titleid[16];
+  char path[64];
+  size_t len;
+
+  len = 0;
+  len += sprintf(config + len, "# generated by bench_hen\n*KERNEL\nux0:tai/kernel.skprx\n");
+  compat_add_file("ux0:tai/kernel.skprx", "", 0);
+  len += sprintf(config + len, "*ALL\n");
+  for (int i = 0; i < 3; i++) {
+    sprintf(path, "ux0:tai/all_%d.suprx", i);
+    len += sprintf(config + len, "%s\n", path);
+    compat_add_file(path, "", 0);
+  }
+  for (int t = 0; t < NUM_TITLES; t++) {
+    make_titleid(titleid, t);
+    len += sprintf(config + len, "*%s\n", titleid);
+    for (int p = 0; p < PLUGINS_PER_TITLE; p++) {
+      sprintf(path, "ux0:tai/%s/plugin_%d.suprx", titleid, p);
+      len += sprintf(config + len, "%s\n", path);
+      if (p > 0 || t % MISSING_EVERY != 0) {
+        compat_add_file(path, "", 0);
+      }
+    }
+    assert(len < CONFIG_SIZE - 256);
+  }
+  compat_add_file(TAIHEN_CONFIG_FILE, config, len);
+  TEST_MSG("config: %zu bytes, %d title sections", len, NUM_TITLES);
+}
+
+/**
+ * @brief      Launches titles and reports the time spent loading plugins
+ *
+ *             One in four launches is a title without a section of its own.
+ *
+ * @param[in]  name  The name of the run
+ */
+static void run(const char *name) {
+  tai_load_report_t report;
+  char titleid[16];
+  SceInt64 start, elapsed, total, min, max;
+  SceUID pid;
+  int ret;
+
+  total = max = 0;
+  min = -1;
+  for (int i = 0; i < NUM_LAUNCHES; i++) {
+    pid = FIRST_PID + i;
+    make_titleid(titleid, (i % 4 == 3) ? NUM_TITLES + i % NUM_TITLES : i % NUM_TITLES);
+    ret = compat_add_process(pid, titleid);
+    assert(ret == 0);
+    start = sceKernelGetSystemTimeWide();
+    ret = hen_title_started(pid);
+    elapsed = sceKernelGetSystemTimeWide() - start;
+    assert(ret == 0);
+    compat_remove_process(pid);
+    total += elapsed;
+    if (min < 0 || elapsed < min) min = elapsed;
+    if (elapsed > max) max = elapsed;
+  }
+  // the last launch's plugins are the most recent reports
+  report.size = sizeof(report);
+  ret = report_get(titleid, 0, &report);
+  assert(ret == 0 && report.modid >= 0);
+  TEST_MSG("%d launches in %lld us", NUM_LAUNCHES, (long long)total);
+  TEST_MSG("per launch: avg %.2f us, min %lld us, max %lld us",
+           (double)total / NUM_LAUNCHES, (long long)min, (long long)max);
+}
+
+int main(int argc, const char *argv[]) {
+  const char *name = "bench_hen";
+  int ret;
+
+  ret = usage_init();
+  assert(ret == 0);
+  ret = heap_init();
+  assert(ret == 0);
+  ret = event_init();
+  assert(ret == 0);
+  ret = report_init();
+  assert(ret == 0);
+  make_config(name);
+  ret = hen_add_patches();
+  assert(ret == 0);
+  run("title_launch");
+  ret = hen_remove_patches();
+  assert(ret == 0);
+  report_deinit();
+  event_deinit();
+  heap_deinit();
+  usage_deinit();
+  return 0;
+}
@@ -0,0 +1,124 @@
+/* bench_inject.c -- latency benchmark for large injections
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <psp2kern/kernel/threadmgr.h>
+
+#include "../taihen.h"
+#include "../taihen_internal.h"
+#include "../heap.h"
+#include "../patches.h"
+#include "../stats.h"
+#include "../usage.h"
+#include "compat.h"
+
+/** Macro for printing test messages with an identifier */
+#ifndef NO_TEST_OUTPUT
+#define TEST_MSG(fmt, ...) printf("[%s] " fmt "\n", name, ##__VA_ARGS__)
+#else
+#define TEST_MSG(fmt, ...)
+#endif
+
+/** Times each injection is added and released */
+#define ROUNDS 20
+
+/** Process the injections are written to, only user injections are chunked */
+#define BENCH_PID 0x4444
+
+/** Injection sizes measured */
+static const size_t g_sizes[] = { 0x10000, 0x40000, 0x100000 };
+
+/**
+ * @brief      How injections are written
+ */
+struct mode {
+  const char *name;             ///< Name of the run
+  size_t chunk;                 ///< Chunk size, zero for one write
+  int defer;                    ///< Flush after the last chunk only
+};
+
+/** Modes measured */
+static const struct mode g_modes[] = {
+  { "whole", 0, 0 },
+  { "chunk_64k", 0x10000, 0 },
+  { "chunk_16k", 0x4000, 0 },
+  { "chunk_16k_deferred", 0x4000, 1 },
+};
+
+/**
+ * @brief      Measures adding and releasing an injection
+ *
+ * @param[in]  m     The mode
+ * @param[in]  size  The injection size
+ */
+static void run(const struct mode *m, size_t size) {
+  const char *name = m->name;
+  SceInt64 start, total, stall, worst;
+  char *target, *data;
+  SceUID uid;
+  int ret;
+
+  target = malloc(size);
+  data = malloc(size);
+  assert(target != NULL && data != NULL);
+  memset(target, 0xAA, size);
+  memset(data, 0x55, size);
+  tai_inject_set_chunking(m->chunk, m->defer);
+
+  total = worst = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    start = sceKernelGetSystemTimeWide();
+    compat_stall_reset();
+    uid = tai_inject_abs(BENCH_PID, target, data, size);
+    assert(uid >= 0);
+    stall = compat_stall_max();
+    compat_stall_reset();
+    ret = tai_inject_release(uid);
+    assert(ret == 0);
+    if (compat_stall_max() > stall) {
+      stall = compat_stall_max();
+    }
+    total += sceKernelGetSystemTimeWide() - start;
+    if (stall > worst) {
+      worst = stall;
+    }
+  }
+  assert(memcmp(target, data, size) != 0 && target[0] == (char)0xAA && target[size-1] == (char)0xAA);
+  TEST_MSG("0x%06zx bytes: avg %.1f us per inject and release, worst stall %lld us",
+           size, (double)total / ROUNDS, (long long)worst);
+  free(target);
+  free(data);
+}
+
+int main(int argc, const char *argv[]) {
+  int ret;
+
+  ret = usage_init();
+  assert(ret == 0);
+  ret = stats_init();
+  assert(ret == 0);
+  ret = heap_init();
+  assert(ret == 0);
+  ret = patches_init();
+  assert(ret == 0);
+  ret = compat_add_process(BENCH_PID, "BENCH0001");
+  assert(ret == 0);
+  for (int i = 0; i < sizeof(g_modes) / sizeof(g_modes[0]); i++) {
+    for (int j = 0; j < sizeof(g_sizes) / sizeof(g_sizes[0]); j++) {
+      run(&g_modes[i], g_sizes[j]);
+    }
+  }
+  compat_remove_process(BENCH_PID);
+  patches_deinit();
+  heap_deinit();
+  stats_deinit();
+  usage_deinit();
+  return 0;
+}
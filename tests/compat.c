@@ -6,6 +6,9 @@
  * of the MIT license.  See the LICENSE file for details.
  */
 #include <psp2kern/types.h>
+#include <psp2kern/io/fcntl.h>
+#include <psp2kern/io/stat.h>
+#include <psp2kern/kernel/modulemgr.h>
 #include <psp2kern/kernel/sysmem.h>
 #include <psp2kern/kernel/threadmgr.h>
 #include <assert.h>
@@ -13,12 +16,21 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
 #include "../substitute/lib/substitute.h"
 #include "../taihen_internal.h"
+#include "compat.h"
 
 #define MAX_LOCKS 128
 #define MAX_BLOCKS 128
 #define MAX_TAI 128
+#define MAX_FILES 256
+#define MAX_FDS 16
+#define MAX_PROCS 64
+#define MAX_THREADS 16
+#define MAX_SEMAS 16
 
 #define MIRROR_FLAG 0x40000
 
@@ -30,6 +42,49 @@ pthread_mutex_t lock_lock = PTHREAD_MUTEX_INITIALIZER;
 
 const size_t g_exe_slab_item_size = sizeof(tai_hook_t);
 
+unsigned char log_ctr = 0;
+
+struct file {
+  char path[256];
+  char *data;
+  size_t size;
+  SceDateTime mtime;
+};
+
+struct fd {
+  struct file *file;
+  size_t pos;
+};
+
+struct proc {
+  SceUID pid;
+  char titleid[32];
+};
+
+struct thread {
+  int used;
+  pthread_t thread;
+  int (*entry)(SceSize, void *);
+  SceSize arglen;
+  void *argp;
+  int ret;
+};
+
+struct sema {
+  int used;
+  int count;
+  int max;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct file files[MAX_FILES] = {0};
+struct fd fds[MAX_FDS] = {0};
+struct proc procs[MAX_PROCS] = {0};
+struct thread threads[MAX_THREADS] = {0};
+struct sema semas[MAX_SEMAS] = {0};
+SceUID next_modid = 1;
+
 SceUID sceKernelMemPoolCreate(const char *name, SceSize size, void *opt) {
   return 1;
 }
@@ -88,7 +143,15 @@ int sceKernelDeleteMutexForKernel(SceUID mutexid) {
   return 0;
 }
 
+/** Number of mutex locks the calling thread holds */
+static __thread int locks_held;
+
+/** Number of mutex locks the calling thread took */
+static __thread int locks_taken;
+
 int sceKernelLockMutexForKernel(SceUID mutexid, int lockCount, unsigned int *timeout) {
+  int ret;
+
   if (lockCount != 1) {
     fprintf(stderr, "sceKernelLockMutexForKernel not implemented for lockCount != 1\n");
     return -1;
@@ -97,7 +160,12 @@ int sceKernelLockMutexForKernel(SceUID mutexid, int lockCount, unsigned int *tim
     fprintf(stderr, "sceKernelLockMutexForKernel not implemented for timeout != NULL\n");
     return -1;
   }
-  return pthread_mutex_lock(&mutex[mutexid]);
+  ret = pthread_mutex_lock(&mutex[mutexid]);
+  if (ret == 0) {
+    locks_held++;
+    locks_taken++;
+  }
+  return ret;
 }
 
 int sceKernelUnlockMutexForKernel(SceUID mutexid, int unlockCount) {
@@ -105,6 +173,7 @@ int sceKernelUnlockMutexForKernel(SceUID mutexid, int unlockCount) {
     fprintf(stderr, "sceKernelLockMutexForKernel not implemented for unlockCount != 1\n");
     return -1;
   }
+  locks_held--;
   return pthread_mutex_unlock(&mutex[mutexid]);
 }
 
@@ -152,6 +221,11 @@ int sceKernelGetMemBlockBaseForKernel(SceUID uid, void **ptr) {
   return 0;
 }
 
+int sceKernelMapBlockUserVisible(SceUID uid) {
+  fprintf(stderr, "sceKernelMapBlockUserVisible(%x)\n", uid);
+  return 0;
+}
+
 int sceKernelFreeMemBlockForKernel(SceUID uid) {
   pthread_mutex_lock(&lock_lock);
   if (uid & MIRROR_FLAG) {
@@ -169,6 +243,10 @@ void cache_flush(SceUID pid, uintptr_t vma, size_t len) {
   fprintf(stderr, "called flush for pid %x, vma %lx, len %zx\n", pid, vma, len);
 }
 
+void cache_flush_kernel(uintptr_t vma, size_t len) {
+  fprintf(stderr, "called kernel flush for vma %lx, len %zx\n", vma, len);
+}
+
 int sceKernelCpuUnrestrictedMemcpy(void *dst, const void *src, size_t len) {
   fprintf(stderr, "sceKernelCpuUnrestrictedMemcpy(%p, %p, %zx)\n", dst, src, len);
   memcpy(dst, src, len);
@@ -223,7 +301,7 @@ SceUID sceKernelCreateUidObj(SceClass *cls, const char *name, void *opt, SceObje
 }
 int sceKernelGetObjForUid(SceUID uid, SceClass *cls, SceObjectBase **obj) {
   *obj = (SceObjectBase *)tai_used[uid];
-  return 0;
+  return (*obj == NULL) ? -1 : 0;
 }
 
 SceClass *sceKernelGetUidClass(void) {
@@ -240,16 +318,474 @@ int sceKernelDeleteUid(SceUID uid) {
   return 0;
 }
 
+/**
+ * @brief      Checks if a process was started with `compat_add_process`
+ *
+ *             Such processes share the host address space, so copies to and
+ *             from them are real.
+ *
+ * @param[in]  pid   The pid
+ *
+ * @return     Nonzero if it was
+ */
+static int is_process(SceUID pid) {
+  int found;
+
+  pthread_mutex_lock(&lock_lock);
+  found = 0;
+  for (int i = 0; i < MAX_PROCS && pid != 0; i++) {
+    if (procs[i].pid == pid) {
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return found;
+}
+
 int sceKernelMemcpyUserToKernelForPid(SceUID pid, void *dst, uintptr_t src, size_t len) {
+  if (is_process(pid)) {
+    memcpy(dst, (const void *)src, len);
+    return 0;
+  }
   fprintf(stderr, "stubbed out sceKernelMemcpyUserToKernelForPid(%x, %p, %p, %zx)\n", pid, dst, (void *)src, len);
   return 0;
 }
 
 int sceKernelRxMemcpyKernelToUserForPid(SceUID pid, uintptr_t dst, const void *src, size_t len) {
+  if (is_process(pid)) {
+    memcpy((void *)dst, src, len);
+    return 0;
+  }
   fprintf(stderr, "stubbed out sceKernelRxMemcpyKernelToUserForPid(%x, %p, %p, %zx)\n", pid, (void *)dst, src, len);
   return 0;
 }
 
+int sceKernelCpuDisableInterrupts(void) {
+  return 0;
+}
+
+int sceKernelCpuEnableInterrupts(int flags) {
+  return 0;
+}
+
+int sceKernelCpuSaveContext(int context[3]) {
+  return 0;
+}
+
+int sceKernelCpuRestoreContext(int context[3]) {
+  return 0;
+}
+
+int sceKernelGetPidContext(SceUID pid, int **context) {
+  static int dummy[3];
+  *context = dummy;
+  return 0;
+}
+
+/** Process the calling thread runs in, zero for the kernel */
+static __thread SceUID current_pid;
+
+SceUID sceKernelGetProcessId(void) {
+  return current_pid ? current_pid : KERNEL_PID;
+}
+
+void compat_set_process(SceUID pid) {
+  current_pid = pid;
+}
+
+SceUID sceKernelGetThreadIdForDriver(void) {
+  return (SceUID)(uintptr_t)pthread_self();
+}
+
+SceInt64 sceKernelGetSystemTimeWide(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (SceInt64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Time of the calling thread's last yield */
+static __thread SceInt64 last_yield;
+
+/** Longest time the calling thread ran without yielding */
+static __thread SceInt64 max_stall;
+
+/** Number of times the calling thread yielded */
+static __thread int yields;
+
+/** Most mutex locks the calling thread held while yielding */
+static __thread int max_yield_locks;
+
+int sceKernelDelayThreadForDriver(SceUInt delay) {
+  SceInt64 now = sceKernelGetSystemTimeWide();
+  if (now - last_yield > max_stall) {
+    max_stall = now - last_yield;
+  }
+  yields++;
+  if (locks_held > max_yield_locks) {
+    max_yield_locks = locks_held;
+  }
+  if (delay > 0) {
+    usleep(delay);
+  } else {
+    sched_yield();
+  }
+  last_yield = sceKernelGetSystemTimeWide();
+  return 0;
+}
+
+void compat_stall_reset(void) {
+  last_yield = sceKernelGetSystemTimeWide();
+  max_stall = 0;
+  yields = 0;
+  max_yield_locks = 0;
+  locks_taken = 0;
+}
+
+SceInt64 compat_stall_max(void) {
+  SceInt64 now = sceKernelGetSystemTimeWide();
+  return (now - last_yield > max_stall) ? now - last_yield : max_stall;
+}
+
+int compat_yields(int *max_locks) {
+  *max_locks = max_yield_locks;
+  return yields;
+}
+
+int compat_locks_taken(void) {
+  return locks_taken;
+}
+
+static void *thread_start(void *arg) {
+  struct thread *t = (struct thread *)arg;
+  t->ret = t->entry(t->arglen, t->argp);
+  return NULL;
+}
+
+SceUID sceKernelCreateThreadForKernel(const char *name, int (*entry)(SceSize, void *), int prio, int stack, SceUInt attr, int cpu, const void *opt) {
+  int id;
+
+  pthread_mutex_lock(&lock_lock);
+  id = -1;
+  for (int i = 0; i < MAX_THREADS; i++) {
+    if (!threads[i].used) {
+      memset(&threads[i], 0, sizeof(threads[i]));
+      threads[i].used = 1;
+      threads[i].entry = entry;
+      id = i;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return id;
+}
+
+int sceKernelStartThreadForKernel(SceUID thid, SceSize arglen, void *argp) {
+  threads[thid].arglen = arglen;
+  threads[thid].argp = argp;
+  return pthread_create(&threads[thid].thread, NULL, thread_start, &threads[thid]) == 0 ? 0 : -1;
+}
+
+int sceKernelWaitThreadEndForKernel(SceUID thid, int *stat, SceUInt *timeout) {
+  pthread_join(threads[thid].thread, NULL);
+  if (stat) {
+    *stat = threads[thid].ret;
+  }
+  return 0;
+}
+
+int sceKernelDeleteThreadForKernel(SceUID thid) {
+  pthread_mutex_lock(&lock_lock);
+  threads[thid].used = 0;
+  pthread_mutex_unlock(&lock_lock);
+  return 0;
+}
+
+SceUID sceKernelCreateSemaForKernel(const char *name, SceUInt attr, int initVal, int maxVal, void *option) {
+  int id;
+
+  pthread_mutex_lock(&lock_lock);
+  id = -1;
+  for (int i = 0; i < MAX_SEMAS; i++) {
+    if (!semas[i].used) {
+      semas[i].used = 1;
+      semas[i].count = initVal;
+      semas[i].max = maxVal;
+      pthread_mutex_init(&semas[i].lock, NULL);
+      pthread_cond_init(&semas[i].cond, NULL);
+      id = i;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return id;
+}
+
+int sceKernelDeleteSemaForKernel(SceUID semaid) {
+  pthread_mutex_lock(&lock_lock);
+  pthread_cond_destroy(&semas[semaid].cond);
+  pthread_mutex_destroy(&semas[semaid].lock);
+  semas[semaid].used = 0;
+  pthread_mutex_unlock(&lock_lock);
+  return 0;
+}
+
+int sceKernelSignalSemaForKernel(SceUID semaid, int signal) {
+  struct sema *s = &semas[semaid];
+  int ret;
+
+  pthread_mutex_lock(&s->lock);
+  if (s->count + signal > s->max) {
+    ret = -1;
+  } else {
+    s->count += signal;
+    pthread_cond_broadcast(&s->cond);
+    ret = 0;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return ret;
+}
+
+int sceKernelWaitSemaForKernel(SceUID semaid, int signal, SceUInt *timeout) {
+  struct sema *s = &semas[semaid];
+
+  pthread_mutex_lock(&s->lock);
+  while (s->count < signal) {
+    pthread_cond_wait(&s->cond, &s->lock);
+  }
+  s->count -= signal;
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
+
+static struct file *find_file(const char *path) {
+  for (int i = 0; i < MAX_FILES; i++) {
+    if (files[i].data != NULL && strcmp(files[i].path, path) == 0) {
+      return &files[i];
+    }
+  }
+  return NULL;
+}
+
+int compat_add_file(const char *path, const void *data, size_t size) {
+  struct file *file;
+
+  pthread_mutex_lock(&lock_lock);
+  if ((file = find_file(path)) == NULL) {
+    for (int i = 0; i < MAX_FILES; i++) {
+      if (files[i].data == NULL) {
+        file = &files[i];
+        break;
+      }
+    }
+  }
+  assert(file != NULL && strlen(path) < sizeof(file->path));
+  strcpy(file->path, path);
+  free(file->data);
+  // never NULL so an empty file still exists
+  file->data = malloc(size + 1);
+  memcpy(file->data, data, size);
+  file->size = size;
+  file->mtime.second++;
+  pthread_mutex_unlock(&lock_lock);
+  return 0;
+}
+
+void compat_remove_file(const char *path) {
+  struct file *file;
+
+  pthread_mutex_lock(&lock_lock);
+  if ((file = find_file(path)) != NULL) {
+    free(file->data);
+    memset(file, 0, sizeof(*file));
+  }
+  pthread_mutex_unlock(&lock_lock);
+}
+
+SceUID sceIoOpenForDriver(const char *file, int flags, SceMode mode) {
+  struct file *f;
+  int id;
+
+  if ((f = find_file(file)) == NULL) {
+    if ((flags & SCE_O_CREAT) == 0) {
+      return -1;
+    }
+    compat_add_file(file, "", 0);
+    f = find_file(file);
+  } else if (flags & SCE_O_TRUNC) {
+    f->size = 0;
+  }
+  pthread_mutex_lock(&lock_lock);
+  id = -1;
+  for (int i = 0; i < MAX_FDS; i++) {
+    if (fds[i].file == NULL) {
+      fds[i].file = f;
+      fds[i].pos = 0;
+      id = i;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return id;
+}
+
+int sceIoCloseForDriver(SceUID fd) {
+  if (fd < 0 || fd >= MAX_FDS || fds[fd].file == NULL) {
+    return -1;
+  }
+  fds[fd].file = NULL;
+  return 0;
+}
+
+int sceIoReadForDriver(SceUID fd, void *data, SceSize size) {
+  struct fd *f;
+
+  if (fd < 0 || fd >= MAX_FDS || (f = &fds[fd])->file == NULL) {
+    return -1;
+  }
+  if (size > f->file->size - f->pos) {
+    size = f->file->size - f->pos;
+  }
+  memcpy(data, f->file->data + f->pos, size);
+  f->pos += size;
+  return size;
+}
+
+int sceIoWriteForDriver(SceUID fd, const void *data, SceSize size) {
+  struct fd *f;
+
+  if (fd < 0 || fd >= MAX_FDS || (f = &fds[fd])->file == NULL) {
+    return -1;
+  }
+  if (f->pos + size > f->file->size) {
+    f->file->data = realloc(f->file->data, f->pos + size + 1);
+    f->file->size = f->pos + size;
+  }
+  memcpy(f->file->data + f->pos, data, size);
+  f->pos += size;
+  return size;
+}
+
+SceOff sceIoLseekForDriver(SceUID fd, SceOff offset, int whence) {
+  struct fd *f;
+
+  if (fd < 0 || fd >= MAX_FDS || (f = &fds[fd])->file == NULL) {
+    return -1;
+  }
+  if (whence == SCE_SEEK_END) {
+    offset += f->file->size;
+  } else if (whence == SCE_SEEK_CUR) {
+    offset += f->pos;
+  }
+  if (offset < 0 || offset > f->file->size) {
+    return -1;
+  }
+  f->pos = offset;
+  return offset;
+}
+
+int sceIoGetstatForDriver(const char *file, SceIoStat *stat) {
+  size_t len;
+  int found;
+
+  // a directory exists if a file is in it
+  len = strlen(file);
+  found = 0;
+  memset(stat, 0, sizeof(*stat));
+  pthread_mutex_lock(&lock_lock);
+  for (int i = 0; i < MAX_FILES; i++) {
+    if (files[i].data == NULL) {
+      continue;
+    }
+    if (strcmp(files[i].path, file) == 0) {
+      stat->st_size = files[i].size;
+      stat->st_mtime = files[i].mtime;
+      found = 1;
+    } else if (strncmp(files[i].path, file, len) == 0 && files[i].path[len] == '/') {
+      if (files[i].mtime.second > stat->st_mtime.second) {
+        stat->st_mtime = files[i].mtime;
+      }
+      found = 1;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return found ? 0 : -1;
+}
+
+int compat_add_process(SceUID pid, const char *titleid) {
+  int ret;
+
+  pthread_mutex_lock(&lock_lock);
+  ret = -1;
+  for (int i = 0; i < MAX_PROCS; i++) {
+    if (procs[i].pid == 0) {
+      procs[i].pid = pid;
+      strncpy(procs[i].titleid, titleid, sizeof(procs[i].titleid) - 1);
+      ret = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return ret;
+}
+
+void compat_remove_process(SceUID pid) {
+  pthread_mutex_lock(&lock_lock);
+  for (int i = 0; i < MAX_PROCS; i++) {
+    if (procs[i].pid == pid) {
+      memset(&procs[i], 0, sizeof(procs[i]));
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+}
+
+int sceKernelGetProcessTitleIdForKernel(SceUID pid, char *titleid, size_t len) {
+  int ret;
+
+  pthread_mutex_lock(&lock_lock);
+  ret = -1;
+  for (int i = 0; i < MAX_PROCS; i++) {
+    if (procs[i].pid == pid) {
+      strncpy(titleid, procs[i].titleid, len);
+      titleid[len - 1] = '\0';
+      ret = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock_lock);
+  return ret;
+}
+
+SceUID sceKernelLoadModuleForPid(SceUID pid, const char *path, int flags, SceKernelLMOption *option) {
+  if (find_file(path) == NULL) {
+    return 0x80010002; // SCE_ERROR_ERRNO_ENOENT
+  }
+  return __atomic_fetch_add(&next_modid, 1, __ATOMIC_RELAXED);
+}
+
+int sceKernelStartModuleForPid(SceUID pid, SceUID modid, SceSize args, void *argp, int flags, SceKernelLMOption *option, int *status) {
+  *status = 0;
+  return 0;
+}
+
+int sceKernelUnloadModuleForPid(SceUID pid, SceUID modid, int flags, SceKernelLMOption *option) {
+  return 0;
+}
+
+int sceKernelGetModuleInfoForKernel(SceUID pid, SceUID modid, SceKernelModuleInfo *info) {
+  memset(info, 0, sizeof(*info));
+  info->size = sizeof(*info);
+  info->modid = modid;
+  snprintf(info->module_name, sizeof(info->module_name), "module_%x", modid);
+  info->segments[0].memsz = 0x4000;
+  info->segments[1].memsz = 0x1000;
+  return 0;
+}
+
+int sceKernelRunWithStack(int stack_size, int (*to_call)(void *), void *args) {
+  return to_call(args);
+}
+
 int substitute_hook_functions(const struct substitute_function_hook *hooks,
                               size_t nhooks,
                               struct substitute_function_hook_record **recordp,
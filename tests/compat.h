@@ -0,0 +1,93 @@
+/* compat.h -- Vita compatibility layer for POSIX unit tests
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#ifndef TAI_TESTS_COMPAT_HEADER
+#define TAI_TESTS_COMPAT_HEADER
+
+#include <psp2kern/types.h>
+
+/**
+ * @brief      Creates or replaces a file seen by the `sceIo*ForDriver` calls
+ *
+ *             Loading a module succeeds only if its path is a file. Each call
+ *             bumps the file's modification time.
+ *
+ * @param[in]  path  The path
+ * @param[in]  data  The contents
+ * @param[in]  size  The size
+ *
+ * @return     Zero
+ */
+int compat_add_file(const char *path, const void *data, size_t size);
+
+/**
+ * @brief      Removes a file
+ *
+ * @param[in]  path  The path
+ */
+void compat_remove_file(const char *path);
+
+/**
+ * @brief      Starts a process
+ *
+ *             The process shares the host address space, copies to and from
+ *             it are real.
+ *
+ * @param[in]  pid      The pid
+ * @param[in]  titleid  Its title id
+ *
+ * @return     Zero on success, < 0 if there are too many processes
+ */
+int compat_add_process(SceUID pid, const char *titleid);
+
+/**
+ * @brief      Makes the calling thread run in a process
+ *
+ * @param[in]  pid   The pid, zero for the kernel
+ */
+void compat_set_process(SceUID pid);
+
+/**
+ * @brief      Exits a process
+ *
+ * @param[in]  pid   The pid
+ */
+void compat_remove_process(SceUID pid);
+
+/**
+ * @brief      Starts measuring how long the calling thread runs between
+ *             `sceKernelDelayThreadForDriver` calls
+ */
+void compat_stall_reset(void);
+
+/**
+ * @brief      Gets the longest time the calling thread ran without yielding
+ *             since `compat_stall_reset`
+ *
+ * @return     The time in us
+ */
+SceInt64 compat_stall_max(void);
+
+/**
+ * @brief      Gets how often the calling thread yielded since
+ *             `compat_stall_reset`
+ *
+ * @param[out] max_locks  The most mutex locks it held while yielding
+ *
+ * @return     The number of yields
+ */
+int compat_yields(int *max_locks);
+
+/**
+ * @brief      Gets how many mutex locks the calling thread took since
+ *             `compat_stall_reset`
+ *
+ * @return     The number of locks
+ */
+int compat_locks_taken(void);
+
+#endif // TAI_TESTS_COMPAT_HEADER
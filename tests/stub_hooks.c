@@ -0,0 +1,38 @@
+/* stub_hooks.c -- hook stand-ins for benchmarks of code that adds hooks
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include "../taihen.h"
+
+/*
+ * `hen_add_patches` and `event_init` hook the kernel before anything else
+ * works. The benchmarks measure what happens after, so the hooks only
+ * pretend to succeed.
+ */
+
+SceUID taiHookFunctionExportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func) {
+  *p_hook = 0;
+  return 1;
+}
+
+SceUID taiHookFunctionImportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func) {
+  *p_hook = 0;
+  return 1;
+}
+
+int taiHookReleaseForKernel(SceUID tai_uid, tai_hook_ref_t hook) {
+  return 0;
+}
+
+/*
+ * Exiting processes are cleaned up by `hen_add_patches`'s hook, which the
+ * stand-ins above never call.
+ */
+
+int tai_try_cleanup_process(SceUID pid) {
+  return 0;
+}
@@ -8,11 +8,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 #include "../taihen.h"
 #include "../taihen_internal.h"
+#include "../bypass.h"
+#include "../error.h"
+#include "../heap.h"
+#include "../notify.h"
 #include "../patches.h"
+#include "../stats.h"
+#include "../usage.h"
+#include "compat.h"
 
 /** Macro for printing test messages with an identifier */
 #ifndef NO_TEST_OUTPUT
@@ -65,7 +74,7 @@ int test_scenario_1(const char *name, int flavor) {
       addr = start[i] * 16;
     }
     TEST_MSG("Attempting to add hook at addr:%lx", addr);
-    if ((uids[i] = tai_hook_func_abs(&hooks[i], 0, (void *)addr, NULL)) < 0) {
+    if ((uids[i] = tai_hook_func_abs(&hooks[i], 0, (void *)addr, NULL, NULL)) < 0) {
       TEST_MSG("Failed to hook addr:%lx", addr);
       hooks[i] = 0;
       uids[i] = 0;
@@ -115,14 +124,14 @@ int test_scenario_2(const char *name, int flavor) {
     TEST_MSG("Attempting to add injection at addr:%lx, size:%zx", addr, size);
     if ((uid[i] = tai_inject_abs(0, (void *)addr, NULL, size)) < 0) {
       TEST_MSG("Failed to inject addr:%lx, size:%zx", addr, size);
-      uid[i] = 0;
+      uid[i] = -1;
     } else {
       TEST_MSG("Successfully injected addr:%lx", addr);
     }
   }
   TEST_MSG("Cleanup");
   for (int i = 0; i < TEST_2_NUM_INJECT; i++) {
-    if (uid[i] != 0) {
+    if (uid[i] >= 0) {
       ret = tai_inject_release(uid[i]);
       assert(ret == 0);
     }
@@ -150,6 +159,603 @@ int test_scenario_3(const char *name, int flavor) {
   }
 }
 
+/**
+ * @brief      Test guarded hooks
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  Unused
+ *
+ * @return     Success
+ */
+int test_scenario_4(const char *name, int flavor) {
+  tai_hook_guard_t guard;
+  tai_hook_ref_t hook;
+  struct _tai_hook_user *record;
+  const void *hook_func = (const void *)0x1000;
+  SceUID uid;
+  int ret;
+
+  memset(&guard, 0, sizeof(guard));
+  guard.size = sizeof(guard);
+  guard.type = TAI_GUARD_PID;
+  guard.count = 0;
+  guard.nargs = 0;
+  TEST_MSG("Empty guard is rejected");
+  ret = tai_hook_func_abs(&hook, KERNEL_PID, (void *)0x4000, hook_func, &guard);
+  assert(ret == TAI_ERROR_INVALID_ARGS);
+  guard.count = TAI_GUARD_MAX_IDS + 1;
+  TEST_MSG("Oversized guard is rejected");
+  ret = tai_hook_func_abs(&hook, KERNEL_PID, (void *)0x4000, hook_func, &guard);
+  assert(ret == TAI_ERROR_INVALID_ARGS);
+  guard.count = 2;
+  guard.ids[0] = 0x1234;
+  guard.ids[1] = 0x5678;
+  TEST_MSG("User guard is not supported");
+  ret = tai_hook_func_abs(&hook, 0, (void *)0x4000, hook_func, &guard);
+  assert(ret == TAI_ERROR_NOT_IMPLEMENTED);
+
+  TEST_MSG("Adding guarded hook");
+  uid = tai_hook_func_abs(&hook, KERNEL_PID, (void *)0x4000, hook_func, &guard);
+  assert(uid >= 0);
+  record = (struct _tai_hook_user *)hook;
+  TEST_MSG("Chain enters through thunk at %p", record->func);
+  assert(record->func != hook_func);
+  assert(((uintptr_t)record->func & 1) == 0);
+  ret = tai_hook_release(uid, hook);
+  assert(ret == 0);
+
+  TEST_MSG("Bad argument register is rejected");
+  memset(&guard, 0, sizeof(guard));
+  guard.size = sizeof(guard);
+  guard.type = TAI_GUARD_NONE;
+  guard.nargs = 1;
+  guard.args[0].op = TAI_ARG_EQ;
+  guard.args[0].reg = 4;
+  ret = tai_hook_func_abs(&hook, 0, (void *)0x4000, hook_func, &guard);
+  assert(ret == TAI_ERROR_INVALID_ARGS);
+
+  TEST_MSG("Adding largest possible guard for user");
+  guard.nargs = TAI_GUARD_MAX_ARGS;
+  for (int i = 0; i < TAI_GUARD_MAX_ARGS; i++) {
+    guard.args[i].op = TAI_ARG_RANGE;
+    guard.args[i].reg = i;
+    guard.args[i].a = 0x10;
+    guard.args[i].b = 0x20;
+  }
+  uid = tai_hook_func_abs(&hook, 0, (void *)0x4000, hook_func, &guard);
+  assert(uid >= 0);
+  ret = tai_hook_release(uid, hook);
+  assert(ret == 0);
+  return 0;
+}
+
+/** Number of functions hooked as a group */
+#define TEST_5_NUM_HOOKS      4
+
+/** Process that exits before releasing its group */
+#define TEST_5_EXIT_PID       0x10041
+
+/**
+ * @brief      Test hook groups
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  One to have a process exit before releasing its group
+ *
+ * @return     Success
+ */
+int test_scenario_5(const char *name, int flavor) {
+  tai_hook_ref_t hooks[TEST_5_NUM_HOOKS];
+  void *funcs[TEST_5_NUM_HOOKS];
+  SceUID group, inject, uid;
+  tai_hook_ref_t ref;
+  int ret;
+
+  for (int i = 0; i < TEST_5_NUM_HOOKS; i++) {
+    funcs[i] = (void *)(uintptr_t)(0x8000 + i * 0x100);
+  }
+  TEST_MSG("Adding group");
+  group = tai_hook_func_group(hooks, 0, funcs, TEST_5_NUM_HOOKS, NULL, NULL);
+  assert(group >= 0);
+  for (int i = 0; i < TEST_5_NUM_HOOKS; i++) {
+    assert(hooks[i] != 0);
+  }
+  TEST_MSG("Group is not a hook");
+  ret = tai_hook_release(group, hooks[0]);
+  assert(ret == TAI_ERROR_INVALID_ARGS);
+  TEST_MSG("Releasing group");
+  ret = tai_group_release(group);
+  assert(ret == 0);
+
+  TEST_MSG("Failed group hooks nothing");
+  inject = tai_inject_abs(0, (char *)funcs[TEST_5_NUM_HOOKS-1] + 4, NULL, 4);
+  assert(inject >= 0);
+  group = tai_hook_func_group(hooks, 0, funcs, TEST_5_NUM_HOOKS, NULL, NULL);
+  assert(group == TAI_ERROR_PATCH_EXISTS);
+  ret = tai_inject_release(inject);
+  assert(ret == 0);
+  group = tai_hook_func_group(hooks, 0, funcs, TEST_5_NUM_HOOKS, NULL, NULL);
+  assert(group >= 0);
+  ret = tai_group_release(group);
+  assert(ret == 0);
+
+  if (flavor) {
+    TEST_MSG("Process exits and a new hook takes a member's place");
+    group = tai_hook_func_group(hooks, TEST_5_EXIT_PID, funcs, TEST_5_NUM_HOOKS, (void *)0xD000, NULL);
+    assert(group >= 0);
+    tai_try_cleanup_process(TEST_5_EXIT_PID);
+    uid = tai_hook_func_abs(&ref, TEST_5_EXIT_PID, funcs[0], (void *)0xD100, NULL);
+    assert(uid >= 0);
+    ret = tai_group_release(group);
+    assert(ret == 0);
+    TEST_MSG("The new hook was left alone");
+    ret = tai_hook_release(uid, ref);
+    assert(ret == 0);
+  }
+  return 0;
+}
+
+/** Size of the injection swapped between variants */
+#define TEST_6_SIZE           0x300
+
+/**
+ * @brief      Test swapping the data of an injection
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  Unused
+ *
+ * @return     Success
+ */
+int test_scenario_6(const char *name, int flavor) {
+  static char target[TEST_6_SIZE], original[TEST_6_SIZE];
+  static char variant_a[TEST_6_SIZE], variant_b[TEST_6_SIZE];
+  tai_patch_event_t event;
+  uint32_t cursor, lost;
+  SceUID inject;
+  int ret;
+
+  for (int i = 0; i < TEST_6_SIZE; i++) {
+    original[i] = target[i] = i;
+    variant_a[i] = variant_b[i] = ~i;
+  }
+  memset(variant_b + 0x120, 0x5A, 0x40);
+
+  TEST_MSG("Injecting variant a");
+  inject = tai_inject_abs(KERNEL_PID, target, variant_a, TEST_6_SIZE);
+  assert(inject >= 0);
+  assert(memcmp(target, variant_a, TEST_6_SIZE) == 0);
+
+  TEST_MSG("Swapping to variant b");
+  cursor = lost = 0;
+  while (notify_read(&cursor, &event, 1, &lost) > 0);
+  ret = tai_inject_swap(inject, KERNEL_PID, variant_b);
+  assert(ret == 0);
+  assert(memcmp(target, variant_b, TEST_6_SIZE) == 0);
+  ret = notify_read(&cursor, &event, 1, &lost);
+  assert(ret == 1);
+  assert(event.type == TAI_PATCH_EVENT_INJECT_SWAPPED);
+  assert(event.addr == (uintptr_t)target + 0x120 && event.size == 0x40);
+
+  TEST_MSG("Swapping to the same data");
+  ret = tai_inject_swap(inject, KERNEL_PID, variant_b);
+  assert(ret == 0);
+  ret = notify_read(&cursor, &event, 1, &lost);
+  assert(ret == 0);
+
+  TEST_MSG("Release restores the original");
+  ret = tai_inject_release(inject);
+  assert(ret == 0);
+  assert(memcmp(target, original, TEST_6_SIZE) == 0);
+  ret = tai_inject_swap(inject, KERNEL_PID, variant_a);
+  assert(ret < 0);
+  return 0;
+}
+
+/** Size of each injection in the batch */
+#define TEST_7_SIZE           0x10
+
+/** Process that exits before releasing its batch */
+#define TEST_7_EXIT_PID       0x10051
+
+/**
+ * @brief      Test applying hooks and injections in one batch
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  One to have a process exit before releasing its batch
+ *
+ * @return     Success
+ */
+int test_scenario_7(const char *name, int flavor) {
+  static char target[2][TEST_7_SIZE], original[TEST_7_SIZE], data[TEST_7_SIZE];
+  tai_hook_ref_t hooks[4];
+  tai_batch_op_t ops[4];
+  SceUID group, inject, uid;
+  tai_hook_ref_t ref;
+  int ret;
+
+  for (int i = 0; i < TEST_7_SIZE; i++) {
+    original[i] = target[0][i] = target[1][i] = i;
+    data[i] = ~i;
+  }
+  ops[0] = (tai_batch_op_t){ (void *)0xA000, (void *)0xB000, 0 };
+  ops[1] = (tai_batch_op_t){ target[0], data, TEST_7_SIZE };
+  ops[2] = (tai_batch_op_t){ (void *)0xA100, (void *)0xB100, 0 };
+  ops[3] = (tai_batch_op_t){ target[1], data, TEST_7_SIZE };
+
+  TEST_MSG("Failed batch patches nothing");
+  inject = tai_inject_abs(KERNEL_PID, target[1] + 4, data, 4);
+  assert(inject >= 0);
+  group = tai_patch_batch(KERNEL_PID, ops, 4, hooks);
+  assert(group == TAI_ERROR_PATCH_EXISTS);
+  assert(memcmp(target[0], original, TEST_7_SIZE) == 0);
+  ret = tai_inject_release(inject);
+  assert(ret == 0);
+
+  TEST_MSG("Applying batch");
+  group = tai_patch_batch(KERNEL_PID, ops, 4, hooks);
+  assert(group >= 0);
+  assert(hooks[0] != 0 && hooks[2] != 0);
+  assert(memcmp(target[0], data, TEST_7_SIZE) == 0);
+  assert(memcmp(target[1], data, TEST_7_SIZE) == 0);
+
+  TEST_MSG("Releasing batch restores everything");
+  ret = tai_group_release(group);
+  assert(ret == 0);
+  assert(memcmp(target[0], original, TEST_7_SIZE) == 0);
+  assert(memcmp(target[1], original, TEST_7_SIZE) == 0);
+
+  if (flavor) {
+    TEST_MSG("Process exits and new patches take the members' places");
+    group = tai_patch_batch(TEST_7_EXIT_PID, ops, 4, hooks);
+    assert(group >= 0);
+    tai_try_cleanup_process(TEST_7_EXIT_PID);
+    uid = tai_hook_func_abs(&ref, TEST_7_EXIT_PID, ops[0].dest, (void *)0xB200, NULL);
+    assert(uid >= 0);
+    inject = tai_inject_abs(TEST_7_EXIT_PID, ops[1].dest, data, TEST_7_SIZE);
+    assert(inject >= 0);
+    ret = tai_group_release(group);
+    assert(ret == 0);
+    TEST_MSG("The new patches were left alone");
+    ret = tai_inject_release(inject);
+    assert(ret == 0);
+    ret = tai_hook_release(uid, ref);
+    assert(ret == 0);
+  }
+  return 0;
+}
+
+/** Process of the threads in the bypass test */
+#define TEST_8_PID            0x10061
+
+/**
+ * @brief      Reads the bypass flags of a new thread
+ *
+ * @param      arg   Set to whether the thread is bypassed
+ *
+ * @return     NULL
+ */
+static void *read_bypass(void *arg) {
+  *(int *)arg = bypass_test(BYPASS_KERNEL, TAI_BYPASS_ALL);
+  return NULL;
+}
+
+/** Held by the threads of `leak_bypass` until all of them entered */
+static pthread_barrier_t leak_barrier;
+
+/**
+ * @brief      Enters a bypass scope in `TEST_8_PID` and exits the thread
+ *             inside it
+ *
+ * @param      arg   Set to the flags before entering
+ *
+ * @return     NULL
+ */
+static void *leak_bypass(void *arg) {
+  compat_set_process(TEST_8_PID);
+  *(uint32_t *)arg = bypass_enter(BYPASS_KERNEL, TAI_BYPASS_IO);
+  pthread_barrier_wait(&leak_barrier);
+  pthread_barrier_wait(&leak_barrier);
+  return NULL;
+}
+
+/** Set once `wait_bypass` entered its scope */
+static int wait_entered;
+
+/**
+ * @brief      Enters and leaves a bypass scope
+ *
+ * @param      arg   Unused
+ *
+ * @return     NULL
+ */
+static void *wait_bypass(void *arg) {
+  uint32_t prev;
+
+  prev = bypass_enter(BYPASS_KERNEL, TAI_BYPASS_IO);
+  __atomic_store_n(&wait_entered, 1, __ATOMIC_RELEASE);
+  bypass_exit(BYPASS_KERNEL, prev);
+  return NULL;
+}
+
+/**
+ * @brief      Test the per-thread hook bypass flags
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  Unused
+ *
+ * @return     Success
+ */
+int test_scenario_8(const char *name, int flavor) {
+  static pthread_t leaked[BYPASS_SLOTS];
+  static uint32_t results[BYPASS_SLOTS];
+  pthread_t thread;
+  uint32_t outer, inner;
+  int other, ret;
+
+  TEST_MSG("Nesting bypass scopes");
+  assert(!bypass_test(BYPASS_KERNEL, TAI_BYPASS_ALL));
+  outer = bypass_enter(BYPASS_KERNEL, TAI_BYPASS_IO);
+  assert(outer == 0);
+  assert(bypass_test(BYPASS_KERNEL, TAI_BYPASS_IO) && !bypass_test(BYPASS_KERNEL, TAI_BYPASS_MEMORY));
+  inner = bypass_enter(BYPASS_KERNEL, TAI_BYPASS_IO | TAI_BYPASS_USER);
+  assert(inner == TAI_BYPASS_IO);
+  assert(bypass_test(BYPASS_KERNEL, TAI_BYPASS_USER));
+
+  TEST_MSG("User flags are separate");
+  assert(!TAI_BYPASSED(TAI_BYPASS_ALL));
+
+  TEST_MSG("Other threads are not bypassed");
+  other = 1;
+  pthread_create(&thread, NULL, read_bypass, &other);
+  pthread_join(thread, NULL);
+  assert(other == 0);
+
+  bypass_exit(BYPASS_KERNEL, inner);
+  assert(bypass_test(BYPASS_KERNEL, TAI_BYPASS_IO) && !bypass_test(BYPASS_KERNEL, TAI_BYPASS_USER));
+  bypass_exit(BYPASS_KERNEL, outer);
+  assert(!bypass_test(BYPASS_KERNEL, TAI_BYPASS_ALL));
+
+  TEST_MSG("User flags are read inline from the process page");
+  compat_set_process(TEST_8_PID);
+  outer = bypass_enter(BYPASS_USER, TAI_BYPASS_IO);
+  assert(outer == 0 && !TAI_BYPASSED(TAI_BYPASS_ALL));
+  ret = bypass_add_process(TEST_8_PID);
+  assert(ret == 0);
+  outer = bypass_enter(BYPASS_USER, TAI_BYPASS_IO);
+  assert(outer == 0 && TAI_BYPASSED(TAI_BYPASS_IO) && !TAI_BYPASSED(TAI_BYPASS_MEMORY));
+  assert(!bypass_test(BYPASS_KERNEL, TAI_BYPASS_ALL));
+  inner = bypass_enter(BYPASS_USER, TAI_BYPASS_MEMORY);
+  assert(inner == TAI_BYPASS_IO && TAI_BYPASSED(TAI_BYPASS_MEMORY));
+  bypass_exit(BYPASS_USER, inner);
+  assert(TAI_BYPASSED(TAI_BYPASS_IO) && !TAI_BYPASSED(TAI_BYPASS_MEMORY));
+  bypass_exit(BYPASS_USER, outer);
+  assert(!TAI_BYPASSED(TAI_BYPASS_ALL) && tai_bypass_word() == NULL);
+  compat_set_process(0);
+
+  TEST_MSG("Entering waits while every slot is taken");
+  pthread_barrier_init(&leak_barrier, NULL, BYPASS_SLOTS + 1);
+  for (int i = 0; i < BYPASS_SLOTS; i++) {
+    results[i] = 1;
+    pthread_create(&leaked[i], NULL, leak_bypass, &results[i]);
+  }
+  pthread_barrier_wait(&leak_barrier);
+  for (int i = 0; i < BYPASS_SLOTS; i++) {
+    assert(results[i] == 0);
+  }
+  wait_entered = 0;
+  pthread_create(&thread, NULL, wait_bypass, NULL);
+  usleep(10000);
+  assert(__atomic_load_n(&wait_entered, __ATOMIC_ACQUIRE) == 0);
+
+  TEST_MSG("Slots of threads that exit in a scope are freed with the process");
+  pthread_barrier_wait(&leak_barrier);
+  for (int i = 0; i < BYPASS_SLOTS; i++) {
+    pthread_join(leaked[i], NULL);
+  }
+  pthread_barrier_destroy(&leak_barrier);
+  bypass_cleanup_process(TEST_8_PID);
+  pthread_join(thread, NULL);
+  assert(wait_entered == 1);
+  outer = bypass_enter(BYPASS_KERNEL, TAI_BYPASS_IO);
+  assert(outer == 0);
+  bypass_exit(BYPASS_KERNEL, outer);
+  assert(!bypass_test(BYPASS_KERNEL, TAI_BYPASS_ALL));
+  return 0;
+}
+
+/** Size of the injection written in chunks */
+#define TEST_9_SIZE           0x1000
+
+/** Process the chunked injection is written to */
+#define TEST_9_PID            0x4343
+
+/**
+ * @brief      Test writing and restoring an injection in chunks
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  One to flush after the last chunk only
+ *
+ * @return     Success
+ */
+int test_scenario_9(const char *name, int flavor) {
+  static char target[TEST_9_SIZE], original[TEST_9_SIZE], data[TEST_9_SIZE];
+  tai_batch_op_t op;
+  tai_hook_ref_t ref;
+  SceUID inject, group;
+  int ret, yields, locks;
+
+  for (int i = 0; i < TEST_9_SIZE; i++) {
+    original[i] = target[i] = i;
+    data[i] = i * 7 + 3;
+  }
+  ret = compat_add_process(TEST_9_PID, "TEST00009");
+  assert(ret == 0);
+
+  TEST_MSG("Chunking is off by default");
+  compat_stall_reset();
+  inject = tai_inject_abs(TEST_9_PID, target, data, TEST_9_SIZE);
+  assert(inject >= 0);
+  assert(memcmp(target, data, TEST_9_SIZE) == 0);
+  ret = tai_inject_release(inject);
+  assert(ret == 0);
+  assert(memcmp(target, original, TEST_9_SIZE) == 0);
+  yields = compat_yields(&locks);
+  assert(yields == 0);
+
+  tai_inject_set_chunking(0x300, flavor);
+
+  TEST_MSG("Injecting in chunks");
+  compat_stall_reset();
+  inject = tai_inject_abs(TEST_9_PID, target, data, TEST_9_SIZE);
+  assert(inject >= 0);
+  assert(memcmp(target, data, TEST_9_SIZE) == 0);
+
+  TEST_MSG("Restoring in chunks");
+  ret = tai_inject_release(inject);
+  assert(ret == 0);
+  assert(memcmp(target, original, TEST_9_SIZE) == 0);
+
+  TEST_MSG("Only the inject lock is held between chunks");
+  yields = compat_yields(&locks);
+  assert(yields > 0);
+  assert(locks == 1);
+
+  TEST_MSG("Kernel injections are written at once");
+  compat_stall_reset();
+  inject = tai_inject_abs(KERNEL_PID, target, data, TEST_9_SIZE);
+  assert(inject >= 0);
+  assert(memcmp(target, data, TEST_9_SIZE) == 0);
+  ret = tai_inject_release(inject);
+  assert(ret == 0);
+  assert(memcmp(target, original, TEST_9_SIZE) == 0);
+  yields = compat_yields(&locks);
+  assert(yields == 0);
+
+  TEST_MSG("Batches are written at once");
+  op.dest = target;
+  op.src = data;
+  op.size = TEST_9_SIZE;
+  compat_stall_reset();
+  group = tai_patch_batch(TEST_9_PID, &op, 1, &ref);
+  assert(group >= 0);
+  assert(memcmp(target, data, TEST_9_SIZE) == 0);
+  ret = tai_group_release(group);
+  assert(ret == 0);
+  assert(memcmp(target, original, TEST_9_SIZE) == 0);
+  yields = compat_yields(&locks);
+  assert(yields == 0);
+
+  tai_inject_set_chunking(0, 0);
+  compat_remove_process(TEST_9_PID);
+  return 0;
+}
+
+/** Number of processes for the broadcast test */
+#define TEST_10_NUM_PIDS 3
+
+/**
+ * @brief      Test hooking the same function in several processes
+ *
+ * @param[in]  name    The name of the test
+ * @param[in]  flavor  One to have a member process exit before the release
+ *
+ * @return     Success
+ */
+int test_scenario_10(const char *name, int flavor) {
+  static const SceUID pids[TEST_10_NUM_PIDS] = { 0x10011, 0x10021, 0x10031 };
+  void *dest[TEST_10_NUM_PIDS];
+  const void *hook[TEST_10_NUM_PIDS];
+  tai_hook_ref_t hooks[TEST_10_NUM_PIDS];
+  SceUID group, blocker, uid;
+  tai_hook_ref_t ref, new_ref;
+  int ret;
+
+  for (int i = 0; i < TEST_10_NUM_PIDS; i++) {
+    dest[i] = (void *)0xC000;
+    hook[i] = (void *)0xD000;
+  }
+
+  TEST_MSG("Failed broadcast hooks nothing");
+  blocker = tai_inject_abs(pids[2], (void *)0xBFFC, "\0\0\0\0\0\0\0\0", 8);
+  assert(blocker >= 0);
+  group = tai_hook_func_broadcast(hooks, pids, dest, hook, TEST_10_NUM_PIDS);
+  assert(group == TAI_ERROR_PATCH_EXISTS);
+  ret = tai_inject_release(blocker);
+  assert(ret == 0);
+
+  TEST_MSG("Broadcasting hook");
+  compat_stall_reset();
+  group = tai_hook_func_broadcast(hooks, pids, dest, hook, TEST_10_NUM_PIDS);
+  assert(group >= 0);
+  // the hooks lock once for all processes, the bypass pages' and the map's own
+  // locks once for each
+  ret = compat_locks_taken();
+  assert(ret == 1 + 2 * TEST_10_NUM_PIDS);
+  for (int i = 0; i < TEST_10_NUM_PIDS; i++) {
+    assert(hooks[i] != 0);
+  }
+
+  TEST_MSG("Each process is hooked");
+  uid = tai_hook_func_abs(&ref, pids[1], dest[1], (void *)0xD100, NULL);
+  assert(uid >= 0);
+  ret = tai_hook_release(uid, ref);
+  assert(ret == 0);
+
+  if (flavor) {
+    TEST_MSG("Member process exits and a new hook takes its place");
+    tai_try_cleanup_process(pids[1]);
+    uid = tai_hook_func_abs(&new_ref, pids[1], dest[1], (void *)0xD100, NULL);
+    assert(uid >= 0);
+  }
+
+  TEST_MSG("Releasing broadcast");
+  ret = tai_group_release(group);
+  assert(ret == 0);
+
+  TEST_MSG("Every process is released");
+  ret = tai_hook_func_abs(&ref, pids[0], dest[0], (void *)0xD100, NULL);
+  assert(ret >= 0);
+  ret = tai_hook_release(ret, ref);
+  assert(ret == 0);
+  if (flavor) {
+    TEST_MSG("The new hook was left alone");
+    ret = tai_hook_release(uid, new_ref);
+    assert(ret == 0);
+  }
+  return 0;
+}
+
+/**
+ * @brief      Prints the hook phase histograms
+ *
+ *             Every added hook creates a UID and inserts into the proc map
+ *             whether or not it joins an existing chain.
+ *
+ * @param[in]  name   The name of the test
+ * @param[in]  stats  The stats
+ */
+static void dump_phases(const char *name, const tai_stats_t *stats) {
+  static const char *phases[TAI_STATS_PHASE_MAX] = {
+    "lookup", "uid", "user_uid", "proc_map", "slab", "substitute", "flush"
+  };
+  char line[TAI_STATS_LATENCY_BUCKETS * 8];
+  uint32_t total;
+  int len;
+
+  TEST_MSG("phase      calls   <2us  <4us  <8us ...");
+  for (int p = 0; p < TAI_STATS_PHASE_MAX; p++) {
+    total = 0;
+    len = 0;
+    for (int b = 0; b < TAI_STATS_LATENCY_BUCKETS; b++) {
+      total += stats->phase[p][b];
+      len += sprintf(line + len, " %5u", stats->phase[p][b]);
+    }
+    TEST_MSG("%-10s %5u %s", phases[p], total, line);
+    if (p == TAI_STATS_PHASE_UID || p == TAI_STATS_PHASE_PROC_MAP) {
+      assert(total >= stats->hooks_added);
+    }
+  }
+}
+
 /**
  * @brief      Arguments for test thread
  */
@@ -177,10 +783,21 @@ void *start_test(void *arg) {
 /** Number of threads for tests. */
 #define TEST_NUM_THREADS 32
 
+/** Process that exits without releasing its patches. */
+#define TEST_CLEANUP_PID 0x4242
+
 int main(int argc, const char *argv[]) {
   const char *name = "INIT";
   pthread_t threads[TEST_NUM_THREADS];
   struct thread_args args[TEST_NUM_THREADS];
+  tai_stats_t stats;
+  tai_heap_stats_t heap_stats;
+  void *spill;
+  tai_patch_event_t events[NOTIFY_RING_SIZE];
+  uint32_t cursor, lost;
+  int count, balance, swaps;
+  SceUID inject;
+  int ret;
   
   int seed = 0;
 
@@ -191,12 +808,88 @@ int main(int argc, const char *argv[]) {
   srand(seed);
 
   TEST_MSG("Setup patches");
+  usage_init();
+  stats_init();
+  heap_init();
   patches_init();
 
   TEST_MSG("Phase 1: Single threaded");
   test_scenario_1("hooks_test_1", 0);
   test_scenario_1("hooks_test_2", 1);
   test_scenario_2("injection_test", 0);
+  test_scenario_4("guard_test", 0);
+  test_scenario_5("group_test", 0);
+  test_scenario_6("swap_test", 0);
+  test_scenario_7("batch_test", 0);
+  test_scenario_8("bypass_test", 0);
+  test_scenario_9("chunked_inject_test", 0);
+  test_scenario_9("chunked_deferred_inject_test", 1);
+  test_scenario_10("broadcast_test", 0);
+
+  TEST_MSG("Checking stats");
+  stats_snapshot(&stats);
+  TEST_MSG("hooks: %u added, %u removed", stats.hooks_added, stats.hooks_removed);
+  TEST_MSG("injections: %u added, %u removed", stats.injections_added, stats.injections_removed);
+  assert((stats.seq & 1) == 0);
+  assert(stats.hooks_added > 0 && stats.hooks_added == stats.hooks_removed);
+  assert(stats.injections_added > 0 && stats.injections_added == stats.injections_removed);
+  assert(stats.profiling);
+  dump_phases(name, &stats);
+
+  TEST_MSG("Checking patch events");
+  cursor = 0;
+  lost = 0;
+  count = notify_read(&cursor, events, NOTIFY_RING_SIZE, &lost);
+  TEST_MSG("%d events, %u lost", count, lost);
+  balance = 0;
+  swaps = 0;
+  for (int i = 0; i < count; i++) {
+    assert(events[i].seq == lost + i);
+    if (events[i].type == TAI_PATCH_EVENT_INJECT_SWAPPED) {
+      swaps++;
+    } else if (events[i].type == TAI_PATCH_EVENT_HOOK_ADDED || events[i].type == TAI_PATCH_EVENT_INJECT_ADDED) {
+      balance++;
+    } else if (events[i].type == TAI_PATCH_EVENT_HOOK_REMOVED || events[i].type == TAI_PATCH_EVENT_INJECT_REMOVED) {
+      balance--;
+    }
+  }
+  assert(lost == 0 && count == stats.hooks_added * 2 + stats.injections_added * 2 + swaps);
+  assert(swaps == 1);
+  assert(balance == 0);
+  count = notify_read(&cursor, events, NOTIFY_RING_SIZE, &lost);
+  assert(count == 0);
+
+  TEST_MSG("Checking heaps");
+  for (int i = 0; i < TAI_HEAP_MAX; i++) {
+    ret = heap_get_stats(i, &heap_stats);
+    assert(ret == 0);
+    TEST_MSG("heap %d: %u in use, %u peak, %u allocs", i, heap_stats.in_use, heap_stats.peak, heap_stats.allocs);
+    if (i != TAI_HEAP_SCRATCH) {
+      assert(heap_stats.in_use == 0 && heap_stats.allocs == 0 && heap_stats.peak > 0);
+    }
+  }
+  spill = heap_alloc(TAI_HEAP_SAVED, HEAP_SPILL_THRESHOLD - 1);
+  assert(spill != NULL);
+  heap_get_stats(TAI_HEAP_SAVED, &heap_stats);
+  assert(heap_stats.spilled == 0 && heap_stats.allocs == 1);
+  heap_free(TAI_HEAP_SAVED, spill);
+  spill = heap_alloc(TAI_HEAP_SAVED, HEAP_SPILL_THRESHOLD + 1);
+  assert(spill != NULL && heap_usable_size(spill) == HEAP_SPILL_THRESHOLD + 1);
+  heap_get_stats(TAI_HEAP_SAVED, &heap_stats);
+  assert(heap_stats.spilled == 1 && heap_stats.in_use == 0);
+  heap_free(TAI_HEAP_SAVED, spill);
+  heap_get_stats(TAI_HEAP_SAVED, &heap_stats);
+  assert(heap_stats.spilled == 0 && heap_stats.spilled_bytes == 0);
+
+  TEST_MSG("Process cleanup frees saved data");
+  inject = tai_inject_abs(TEST_CLEANUP_PID, (void *)0xC000, "\0\0\0\0", 4);
+  assert(inject >= 0);
+  tai_try_cleanup_process(TEST_CLEANUP_PID);
+  heap_get_stats(TAI_HEAP_SAVED, &heap_stats);
+  assert(heap_stats.in_use == 0 && heap_stats.allocs == 0);
+  test_scenario_10("broadcast_exit_test", 1);
+  test_scenario_5("group_exit_test", 1);
+  test_scenario_7("batch_exit_test", 1);
 
   TEST_MSG("Phase 2: Multi threaded");
   TEST_MSG("scenario 1");
@@ -235,5 +928,8 @@ int main(int argc, const char *argv[]) {
 
   TEST_MSG("Cleanup patches");
   patches_deinit();
+  heap_deinit();
+  stats_deinit();
+  usage_deinit();
   return 0;
 }
@@ -14,6 +14,9 @@
 #include "../taihen.h"
 #include "../taihen_internal.h"
 #include "../proc_map.h"
+#include "../slab.h"
+#include "../usage.h"
+#include "compat.h"
 
 /** Set to 1 to print the status of the map after each operation */
 #define VERBOSE 0
@@ -74,6 +77,9 @@ void proc_map_dump(const char *name, tai_proc_map_t *map, int lock) {
 
   TEST_MSG("Dumping map...");
   if (lock) sceKernelLockMutexForKernel(map->lock, 1, NULL);
+  for (patch = map->kernel.head; patch != NULL; patch = patch->next) {
+    TEST_MSG("    Kernel patch: addr = %lx, size = %zx", patch->addr, patch->size);
+  }
   for (int i = 0; i < map->nbuckets; i++) {
     for (proc = map->buckets[i]; proc != NULL; proc = proc->next) {
       TEST_MSG("Proc Item: pid = %d", proc->pid);
@@ -224,6 +230,81 @@ int test_scenario_2(const char *name, tai_proc_map_t *map, SceUID pid) {
   return 0;
 }
 
+/**
+ * @brief      Reserved slab pages are used before growing and stay mapped
+ *
+ * @param[in]  name  The name of the test
+ *
+ * @return     Success
+ */
+int test_slab_reserve(const char *name) {
+  struct slab_chain sch;
+  void **items;
+  uintptr_t exe;
+  size_t capacity;
+  int ret;
+
+  slab_init(&sch, sizeof(tai_hook_record_t), 0);
+  TEST_MSG("Reserving 2 pages");
+  ret = slab_reserve(&sch, 2);
+  assert(ret == 0);
+  assert(sch.pages == 2 && sch.peak_pages == 2);
+  capacity = 2 * (sch.pages_per_alloc / sch.slabsize) * sch.itemcount;
+  items = malloc(capacity * sizeof(void *));
+  TEST_MSG("Filling %zu items", capacity);
+  for (size_t i = 0; i < capacity; i++) {
+    items[i] = (i & 1) ? slab_alloc_near(&sch, items[i-1], &exe) : slab_alloc(&sch, &exe);
+    assert(items[i] != NULL);
+    assert(slab_getmirror(&sch, items[i]) == exe);
+  }
+  assert(sch.pages == 2);
+  TEST_MSG("Freeing all items");
+  for (size_t i = 0; i < capacity; i++) {
+    slab_free(&sch, items[i]);
+  }
+  assert(sch.pages == 2);
+  items[0] = slab_alloc(&sch, &exe);
+  assert(items[0] != NULL && sch.pages == 2);
+  slab_free(&sch, items[0]);
+  slab_destroy(&sch);
+  free(items);
+  return 0;
+}
+
+/**
+ * @brief      Processes of one title share a usage slot
+ *
+ * @param[in]  name  The name of the test
+ *
+ * @return     Success
+ */
+int test_usage_title(const char *name) {
+  int a, b, c;
+  int ret;
+
+  ret = compat_add_process(0x100, "PCSA00001");
+  ret |= compat_add_process(0x101, "PCSA00001");
+  ret |= compat_add_process(0x102, "PCSB00002");
+  assert(ret == 0);
+  a = usage_title(0x100);
+  b = usage_title(0x101);
+  c = usage_title(0x102);
+  TEST_MSG("slots: %d %d %d", a, b, c);
+  assert(a >= 0 && a == b);
+  assert(c >= 0 && c != a);
+  ret = usage_title(KERNEL_PID);
+  assert(ret >= 0);
+  TEST_MSG("Unknown process is untracked");
+  ret = usage_title(0x103);
+  assert(ret < 0);
+  assert(usage_slab_reserve(-1, USAGE_SLAB_HOOK) == 0);
+  usage_note_slab(-1, USAGE_SLAB_HOOK, 1);
+  compat_remove_process(0x100);
+  compat_remove_process(0x101);
+  compat_remove_process(0x102);
+  return 0;
+}
+
 /**
  * @brief      Arguments for test thread
  */
@@ -270,6 +351,7 @@ int main(int argc, const char *argv[]) {
   srand(seed);
 
   TEST_MSG("Setup maps");
+  usage_init();
   proc_map_init();
   map = proc_map_alloc(TEST_NUM_BUCKETS);
 
@@ -278,13 +360,16 @@ int main(int argc, const char *argv[]) {
   proc_map_dump("single_thread", map, 1);
   test_scenario_2("single_thread", map, 0);
   proc_map_dump("single_thread", map, 1);
+  test_scenario_1("single_thread_kernel", map, KERNEL_PID);
+  test_scenario_2("single_thread_kernel", map, KERNEL_PID);
+  proc_map_dump("single_thread_kernel", map, 1);
 
   TEST_MSG("Phase 2: Multi threaded");
   TEST_MSG("scenario 1");
   for (int i = 0; i < TEST_NUM_THREADS; i++) {
     args[i].test = test_scenario_1;
     args[i].map = map;
-    args[i].pid = i / 4;
+    args[i].pid = (i < 4) ? KERNEL_PID : i / 4;
     args[i].index = i;
     pthread_create(&threads[i], NULL, start_test, &args[i]);
   }
@@ -297,7 +382,7 @@ int main(int argc, const char *argv[]) {
   for (int i = 0; i < TEST_NUM_THREADS; i++) {
     args[i].test = test_scenario_2;
     args[i].map = map;
-    args[i].pid = i / 4;
+    args[i].pid = (i < 4) ? KERNEL_PID : i / 4;
     args[i].index = i;
     pthread_create(&threads[i], NULL, start_test, &args[i]);
   }
@@ -307,8 +392,13 @@ int main(int argc, const char *argv[]) {
   }
   proc_map_dump("multi-threads-2", map, 1);
 
+  TEST_MSG("Phase 3: Slab reserve");
+  test_slab_reserve("slab_reserve");
+  test_usage_title("usage_title");
+
   TEST_MSG("Cleanup maps");
   proc_map_free(map);
   proc_map_deinit();
+  usage_deinit();
   return 0;
 }
@@ -0,0 +1,318 @@
+/* thunk.c -- generated hook entry code
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <stddef.h>
+#include "error.h"
+#include "taihen_internal.h"
+#include "thunk.h"
+
+/**
+ * @brief      The generated code (ARM mode)
+ *
+ *             ```
+ *                 push   {r0-r6, lr}
+ *                 ldr    r1, [sp, #4*reg]    @ for each argument predicate
+ *                 ldr    r2, =a
+ *                 cmp    r1, r2              @ EQ: bne skip
+ *                 ...                        @ MASK: and, cmp b, bne skip
+ *                 ...                        @ RANGE: blo skip, cmp b, bhi skip
+ *                 ldr    r4, =getter         @ if there is an ID filter
+ *                 blx    r4
+ *                 ldr    r2, =id0            @ repeated for each id
+ *                 cmp    r0, r2
+ *                 beq    match
+ *                 ...
+ *                 b      match               @ only without ID filter
+ *             skip:
+ *                 ldr    r1, =record         @ continue chain
+ *                 ldr    r2, [r1, #next]
+ *                 cmp    r2, #0
+ *                 ldrne  r12, [r2, #func]
+ *                 ldreq  r12, [r1, #old]
+ *                 pop    {r0-r6, lr}
+ *                 bx     r12
+ *             match:
+ *                 pop    {r0-r6, lr}
+ *                 ldr    pc, =hook_func
+ *                 <literal pool>
+ *             ```
+ *
+ *             Arguments are checked first since they are cheap. Eight
+ *             registers are saved to keep the stack 8 byte aligned for the
+ *             getter call and to give the predicates their saved copy of
+ *             r0-r3.
+ */
+
+/** Max number of literals in a thunk */
+#define THUNK_MAX_LITERALS (TAI_GUARD_MAX_IDS + 2 * TAI_GUARD_MAX_ARGS + 3)
+
+/** Max number of branches to one label */
+#define THUNK_MAX_BRANCHES (TAI_GUARD_MAX_IDS + 2 * TAI_GUARD_MAX_ARGS + 1)
+
+/** ARM condition codes */
+#define COND_EQ 0x0u
+#define COND_NE 0x1u
+#define COND_LO 0x3u
+#define COND_HI 0x8u
+#define COND_AL 0xEu
+
+/** Register numbers */
+#define R0  0
+#define R1  1
+#define R2  2
+#define R4  4
+#define R12 12
+#define SP  13
+#define PC  15
+
+/** Instruction encodings */
+#define ARM_PUSH_R0_R6_LR   0xE92D407F
+#define ARM_POP_R0_R6_LR    0xE8BD407F
+#define ARM_BLX(rm)         (0xE12FFF30 | (rm))
+#define ARM_BX(rm)          (0xE12FFF10 | (rm))
+#define ARM_AND(rd, rn, rm) (0xE0000000 | ((rn) << 16) | ((rd) << 12) | (rm))
+#define ARM_CMP(rn, rm)     (0xE1500000 | ((rn) << 16) | (rm))
+#define ARM_CMP_IMM(rn, i)  (0xE3500000 | ((rn) << 16) | (i))
+#define ARM_LDR_IMM(c, rt, rn, i) \
+  (((c) << 28) | 0x05900000 | ((rn) << 16) | ((rt) << 12) | (uint32_t)(i))
+#define ARM_B(c, words)     (((c) << 28) | 0x0A000000 | ((words) & 0xFFFFFF))
+
+/**
+ * @brief      Forward branches to a label
+ */
+struct thunk_label {
+  size_t branches[THUNK_MAX_BRANCHES];      ///< Branch instructions to fix up
+  size_t count;                             ///< Number of branches
+};
+
+/**
+ * @brief      Code generation state
+ */
+struct thunk_builder {
+  uint32_t *code;                           ///< Output buffer
+  size_t pos;                               ///< Next instruction index
+  uint32_t literals[THUNK_MAX_LITERALS];    ///< Literal pool
+  size_t fixups[THUNK_MAX_LITERALS];        ///< Instruction loading each literal
+  size_t nliterals;                         ///< Number of literals
+};
+
+/**
+ * @brief      Emits one instruction
+ *
+ * @param      b     The builder
+ * @param[in]  insn  The instruction
+ *
+ * @return     Index of the instruction
+ */
+static inline size_t emit(struct thunk_builder *b, uint32_t insn) {
+  b->code[b->pos] = insn;
+  return b->pos++;
+}
+
+/**
+ * @brief      Emits a PC relative load of a literal
+ *
+ *             The offset is filled in by `place_literals`.
+ *
+ * @param      b      The builder
+ * @param[in]  rt     The destination register
+ * @param[in]  value  The value to load
+ */
+static void emit_ldr_literal(struct thunk_builder *b, int rt, uint32_t value) {
+  b->literals[b->nliterals] = value;
+  b->fixups[b->nliterals] = emit(b, ARM_LDR_IMM(COND_AL, rt, PC, 0));
+  b->nliterals++;
+}
+
+/**
+ * @brief      Emits a forward branch to a label
+ *
+ *             The offset is filled in by `bind_label`.
+ *
+ * @param      b      The builder
+ * @param      label  The label
+ * @param[in]  cond   The condition code
+ */
+static void emit_branch(struct thunk_builder *b, struct thunk_label *label, uint32_t cond) {
+  label->branches[label->count++] = emit(b, ARM_B(cond, 0));
+}
+
+/**
+ * @brief      Points all branches to a label at the next instruction
+ *
+ * @param      b      The builder
+ * @param      label  The label
+ */
+static void bind_label(struct thunk_builder *b, struct thunk_label *label) {
+  size_t i;
+
+  for (i = 0; i < label->count; i++) {
+    // PC reads as the branch's address + 8
+    b->code[label->branches[i]] |= (b->pos - (label->branches[i] + 2)) & 0xFFFFFF;
+  }
+}
+
+/**
+ * @brief      Emits the check of one argument predicate
+ *
+ * @param      b     The builder
+ * @param[in]  pred  The predicate
+ * @param      skip  Label to branch to if the predicate fails
+ */
+static void emit_predicate(struct thunk_builder *b, const tai_arg_predicate_t *pred, struct thunk_label *skip) {
+  emit(b, ARM_LDR_IMM(COND_AL, R1, SP, pred->reg * 4));
+  emit_ldr_literal(b, R2, pred->a);
+  switch (pred->op) {
+    case TAI_ARG_EQ:
+      emit(b, ARM_CMP(R1, R2));
+      emit_branch(b, skip, COND_NE);
+      break;
+    case TAI_ARG_MASK:
+      emit(b, ARM_AND(R1, R1, R2));
+      emit_ldr_literal(b, R2, pred->b);
+      emit(b, ARM_CMP(R1, R2));
+      emit_branch(b, skip, COND_NE);
+      break;
+    case TAI_ARG_RANGE:
+      emit(b, ARM_CMP(R1, R2));
+      emit_branch(b, skip, COND_LO);
+      emit_ldr_literal(b, R2, pred->b);
+      emit(b, ARM_CMP(R1, R2));
+      emit_branch(b, skip, COND_HI);
+      break;
+  }
+}
+
+/**
+ * @brief      Appends the literal pool after the code and fixes up the loads
+ *
+ * @param      b     The builder
+ */
+static void place_literals(struct thunk_builder *b) {
+  size_t base, i;
+
+  base = b->pos;
+  for (i = 0; i < b->nliterals; i++) {
+    // PC reads as the load's address + 8
+    b->code[b->fixups[i]] |= ((base + i) - (b->fixups[i] + 2)) * 4;
+    emit(b, b->literals[i]);
+  }
+}
+
+/**
+ * @brief      Checks that a guard can be compiled for a process
+ *
+ *             The ID getters called by the thunk are kernel functions, so ID
+ *             filters are only supported on kernel hooks. Argument predicates
+ *             work for any process.
+ *
+ * @param[in]  pid    The pid of the hook
+ * @param[in]  guard  The guard
+ *
+ * @return     Zero if valid, < 0 on error
+ *             - TAI_ERROR_INVALID_ARGS if the guard is malformed or empty
+ *             - TAI_ERROR_NOT_IMPLEMENTED if there is an ID filter and `pid`
+ *               is not the kernel
+ */
+int thunk_check_guard(SceUID pid, const tai_hook_guard_t *guard) {
+  int i;
+
+  if (guard->size != sizeof(tai_hook_guard_t)) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  if (guard->nargs < 0 || guard->nargs > TAI_GUARD_MAX_ARGS) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  for (i = 0; i < guard->nargs; i++) {
+    if (guard->args[i].reg < 0 || guard->args[i].reg > 3) {
+      return TAI_ERROR_INVALID_ARGS;
+    }
+    if (guard->args[i].op != TAI_ARG_EQ && guard->args[i].op != TAI_ARG_MASK && guard->args[i].op != TAI_ARG_RANGE) {
+      return TAI_ERROR_INVALID_ARGS;
+    }
+  }
+  if (guard->type == TAI_GUARD_NONE) {
+    return guard->nargs > 0 ? TAI_SUCCESS : TAI_ERROR_INVALID_ARGS;
+  }
+  if (guard->type != TAI_GUARD_PID && guard->type != TAI_GUARD_THREAD) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  if (guard->count < 1 || guard->count > TAI_GUARD_MAX_IDS) {
+    return TAI_ERROR_INVALID_ARGS;
+  }
+  if (pid != KERNEL_PID) {
+    return TAI_ERROR_NOT_IMPLEMENTED;
+  }
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Generates the thunk for a guarded hook
+ *
+ *             `code` must have room for `THUNK_MAX_SIZE` bytes and the guard
+ *             must have passed `thunk_check_guard`.
+ *
+ * @param[out] code       Output buffer (kernel writable view of the thunk)
+ * @param[in]  guard      The guard
+ * @param[in]  record     Address of the hook's `struct _tai_hook_user`
+ * @param[in]  hook_func  The hook function
+ *
+ * @return     Size of the thunk in bytes
+ */
+size_t thunk_build(uint32_t *code, const tai_hook_guard_t *guard, uintptr_t record, const void *hook_func) {
+  struct thunk_builder b;
+  struct thunk_label skip, match;
+  uintptr_t getter;
+  int i;
+
+  b.code = code;
+  b.pos = 0;
+  b.nliterals = 0;
+  skip.count = 0;
+  match.count = 0;
+
+  emit(&b, ARM_PUSH_R0_R6_LR);
+  for (i = 0; i < guard->nargs; i++) {
+    emit_predicate(&b, &guard->args[i], &skip);
+  }
+  if (guard->type != TAI_GUARD_NONE) {
+    if (guard->type == TAI_GUARD_THREAD) {
+      getter = (uintptr_t)sceKernelGetThreadIdForDriver;
+    } else {
+      getter = (uintptr_t)sceKernelGetProcessId;
+    }
+    emit_ldr_literal(&b, R4, getter);
+    emit(&b, ARM_BLX(R4));
+    for (i = 0; i < guard->count; i++) {
+      emit_ldr_literal(&b, R2, guard->ids[i]);
+      emit(&b, ARM_CMP(R0, R2));
+      emit_branch(&b, &match, COND_EQ);
+    }
+  } else {
+    emit_branch(&b, &match, COND_AL);
+  }
+
+  // no match: same as `TAI_CONTINUE`
+  bind_label(&b, &skip);
+  emit_ldr_literal(&b, R1, record);
+  emit(&b, ARM_LDR_IMM(COND_AL, R2, R1, offsetof(struct _tai_hook_user, next)));
+  emit(&b, ARM_CMP_IMM(R2, 0));
+  emit(&b, ARM_LDR_IMM(COND_NE, R12, R2, offsetof(struct _tai_hook_user, func)));
+  emit(&b, ARM_LDR_IMM(COND_EQ, R12, R1, offsetof(struct _tai_hook_user, old)));
+  emit(&b, ARM_POP_R0_R6_LR);
+  emit(&b, ARM_BX(R12));
+
+  bind_label(&b, &match);
+  emit(&b, ARM_POP_R0_R6_LR);
+  emit_ldr_literal(&b, PC, (uintptr_t)hook_func);
+
+  place_literals(&b);
+  LOG("Built thunk at %p: %d words", code, b.pos);
+  return b.pos * sizeof(uint32_t);
+}
@@ -0,0 +1,30 @@
+/**
+ * @brief      Generated hook entry code
+ */
+#ifndef TAI_THUNK_HEADER
+#define TAI_THUNK_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   thunk Hook Thunks
+ * @brief      Small ARM stubs placed in front of a hook function
+ *
+ * @details    A guarded hook does not enter the hook function directly.
+ *             Instead, the chain points to a thunk generated for that hook
+ *             which checks the caller against the hook's guard. If it matches,
+ *             the thunk tail calls the hook function. Otherwise, it continues
+ *             the chain exactly like `TAI_CONTINUE` would without ever setting
+ *             up a C frame for the hook function.
+ */
+/** @{ */
+
+/** Size of a thunk slot in bytes. Must fit the largest possible guard. */
+#define THUNK_MAX_SIZE 384
+
+int thunk_check_guard(SceUID pid, const tai_hook_guard_t *guard);
+size_t thunk_build(uint32_t *code, const tai_hook_guard_t *guard, uintptr_t record, const void *hook_func);
+
+/** @} */
+
+#endif // TAI_THUNK_HEADER
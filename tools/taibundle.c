@@ -0,0 +1,334 @@
+/* taibundle.c -- builds and checks taiHEN patch bundles
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ *
+ * Usage:
+ *   taibundle build <spec.txt> <out.bin>
+ *   taibundle check <bundle.bin>
+ *
+ * A spec has one statement per line, `#` starts a comment:
+ *
+ *   module <name> [module nid]
+ *   hook <target> <hook function>
+ *   inject <target> <hex bytes>
+ *
+ * A location is `<module>:export:<library nid>:<function nid>`,
+ * `<module>:import:<library nid>:<function nid>` or
+ * `<module>:offset:<segment>:<offset>[:thumb]`. Modules must be declared
+ * before they are used. Bundles are written in host byte order, so build them
+ * on a little endian host.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../bundle_format.h"
+
+/** Longest spec line */
+#define MAX_LINE 4096
+
+/** Most modules in a bundle built by this tool */
+#define MAX_MODULES 64
+
+/** Most injection data in a bundle built by this tool */
+#define MAX_DATA 0x40000
+
+static tai_bundle_module_t g_modules[MAX_MODULES];
+static tai_bundle_entry_t g_entries[TAI_BUNDLE_MAX_ENTRIES];
+static uint8_t g_data[MAX_DATA];
+static int g_num_modules;
+static int g_num_entries;
+static size_t g_data_size;
+
+/**
+ * @brief      Prints an error for a spec line
+ */
+static int spec_error(const char *file, int line, const char *what) {
+  fprintf(stderr, "%s:%d: %s\n", file, line, what);
+  return -1;
+}
+
+/**
+ * @brief      Parses a number in any C base
+ *
+ * @return     Zero on success, < 0 if not a number
+ */
+static int parse_u32(const char *str, uint32_t *out) {
+  char *end;
+
+  if (*str == '\0') {
+    return -1;
+  }
+  *out = strtoul(str, &end, 0);
+  return (*end == '\0') ? 0 : -1;
+}
+
+/**
+ * @brief      Parses a location
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int parse_loc(char *str, tai_bundle_loc_t *loc) {
+  char *parts[5];
+  int n;
+  int i;
+
+  n = 0;
+  for (char *tok = strtok(str, ":"); tok != NULL && n < 5; tok = strtok(NULL, ":")) {
+    parts[n++] = tok;
+  }
+  if (n < 4) {
+    return -1;
+  }
+  for (i = 0; i < g_num_modules && strcmp(g_modules[i].name, parts[0]) != 0; i++);
+  if (i == g_num_modules) {
+    return -1;
+  }
+  memset(loc, 0, sizeof(*loc));
+  loc->module = i;
+  if (strcmp(parts[1], "export") == 0 && n == 4) {
+    loc->kind = TAI_BUNDLE_LOC_EXPORT;
+  } else if (strcmp(parts[1], "import") == 0 && n == 4) {
+    loc->kind = TAI_BUNDLE_LOC_IMPORT;
+  } else if (strcmp(parts[1], "offset") == 0) {
+    loc->kind = TAI_BUNDLE_LOC_OFFSET;
+    if (n == 5) {
+      if (strcmp(parts[4], "thumb") != 0) {
+        return -1;
+      }
+      loc->flags = TAI_BUNDLE_LOC_THUMB;
+    }
+  } else {
+    return -1;
+  }
+  if (parse_u32(parts[2], &loc->a) < 0 || parse_u32(parts[3], &loc->b) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief      Appends hex bytes to the data area
+ *
+ * @return     Number of bytes, < 0 on error
+ */
+static int parse_hex(const char *str) {
+  size_t start = g_data_size;
+  unsigned int byte;
+
+  while (*str) {
+    if (isspace((unsigned char)*str)) {
+      str++;
+      continue;
+    }
+    if (!isxdigit((unsigned char)str[0]) || !isxdigit((unsigned char)str[1]) || g_data_size == MAX_DATA) {
+      return -1;
+    }
+    sscanf(str, "%2x", &byte);
+    g_data[g_data_size++] = byte;
+    str += 2;
+  }
+  return g_data_size - start;
+}
+
+/**
+ * @brief      Reads a spec into the tables
+ *
+ * @return     Zero on success, < 0 on error
+ */
+static int read_spec(const char *file) {
+  char buf[MAX_LINE];
+  char *cmd, *arg1, *arg2, *rest;
+  tai_bundle_entry_t *entry;
+  uint32_t nid;
+  int line;
+  int size;
+  FILE *fp;
+
+  if ((fp = fopen(file, "r")) == NULL) {
+    perror(file);
+    return -1;
+  }
+  line = 0;
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    line++;
+    buf[strcspn(buf, "#\r\n")] = '\0';
+    if ((cmd = strtok(buf, " \t")) == NULL) {
+      continue;
+    }
+    arg1 = strtok(NULL, " \t");
+    arg2 = strtok(NULL, " \t");
+    rest = strtok(NULL, "");
+    if (strcmp(cmd, "module") == 0) {
+      if (arg1 == NULL || rest != NULL || strlen(arg1) >= sizeof(g_modules[0].name) || g_num_modules == MAX_MODULES) {
+        return spec_error(file, line, "bad module");
+      }
+      nid = TAI_BUNDLE_ANY_NID;
+      if (arg2 != NULL && parse_u32(arg2, &nid) < 0) {
+        return spec_error(file, line, "bad module nid");
+      }
+      strcpy(g_modules[g_num_modules].name, arg1);
+      g_modules[g_num_modules].nid = nid;
+      g_num_modules++;
+      continue;
+    }
+    if (g_num_entries == TAI_BUNDLE_MAX_ENTRIES) {
+      return spec_error(file, line, "too many entries");
+    }
+    entry = &g_entries[g_num_entries];
+    memset(entry, 0, sizeof(*entry));
+    if (arg1 == NULL || arg2 == NULL || parse_loc(arg1, &entry->target) < 0) {
+      return spec_error(file, line, "bad target");
+    }
+    if (strcmp(cmd, "hook") == 0) {
+      entry->op = TAI_BUNDLE_HOOK;
+      if (rest != NULL || parse_loc(arg2, &entry->hook) < 0) {
+        return spec_error(file, line, "bad hook function");
+      }
+    } else if (strcmp(cmd, "inject") == 0) {
+      entry->op = TAI_BUNDLE_INJECT;
+      entry->data_offset = g_data_size;
+      size = parse_hex(arg2);
+      if (size > 0 && rest != NULL) {
+        size = parse_hex(rest) < 0 ? -1 : (int)(g_data_size - entry->data_offset);
+      }
+      if (size <= 0) {
+        return spec_error(file, line, "bad injection data");
+      }
+      entry->data_size = size;
+    } else {
+      return spec_error(file, line, "unknown statement");
+    }
+    g_num_entries++;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/**
+ * @brief      Builds a bundle from a spec
+ */
+static int build(const char *spec, const char *out) {
+  tai_bundle_header_t hdr;
+  uint8_t *buf;
+  size_t size, pos;
+  const char *why;
+  FILE *fp;
+
+  if (read_spec(spec) < 0) {
+    return 1;
+  }
+  size = sizeof(hdr) + g_num_modules * sizeof(tai_bundle_module_t) +
+         g_num_entries * sizeof(tai_bundle_entry_t) + g_data_size;
+  if ((buf = malloc(size)) == NULL) {
+    return 1;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = TAI_BUNDLE_MAGIC;
+  hdr.version = TAI_BUNDLE_VERSION;
+  hdr.num_modules = g_num_modules;
+  hdr.num_entries = g_num_entries;
+  hdr.data_size = g_data_size;
+  pos = sizeof(hdr);
+  memcpy(buf + pos, g_modules, g_num_modules * sizeof(tai_bundle_module_t));
+  pos += g_num_modules * sizeof(tai_bundle_module_t);
+  memcpy(buf + pos, g_entries, g_num_entries * sizeof(tai_bundle_entry_t));
+  pos += g_num_entries * sizeof(tai_bundle_entry_t);
+  memcpy(buf + pos, g_data, g_data_size);
+  hdr.hash = bundle_hash(buf + sizeof(hdr), size - sizeof(hdr));
+  memcpy(buf, &hdr, sizeof(hdr));
+
+  if ((why = bundle_check(buf, size)) != NULL) {
+    fprintf(stderr, "%s: %s\n", spec, why);
+    free(buf);
+    return 1;
+  }
+  if ((fp = fopen(out, "wb")) == NULL || fwrite(buf, 1, size, fp) != size) {
+    perror(out);
+    free(buf);
+    return 1;
+  }
+  fclose(fp);
+  free(buf);
+  printf("%s: %d modules, %d entries, %zu data bytes, %zu bytes\n", out, g_num_modules, g_num_entries, g_data_size, size);
+  return 0;
+}
+
+/**
+ * @brief      Prints a location
+ */
+static void print_loc(const tai_bundle_module_t *modules, const tai_bundle_loc_t *loc) {
+  static const char *kinds[] = { "?", "export", "import", "offset" };
+
+  printf("%s:%s:0x%08X:0x%08X%s", modules[loc->module].name, kinds[loc->kind], loc->a, loc->b,
+         (loc->flags & TAI_BUNDLE_LOC_THUMB) ? ":thumb" : "");
+}
+
+/**
+ * @brief      Checks a bundle and prints its contents
+ */
+static int check(const char *file) {
+  const tai_bundle_header_t *hdr;
+  const tai_bundle_module_t *modules;
+  const tai_bundle_entry_t *entries;
+  const char *why;
+  uint32_t *buf;
+  long size;
+  FILE *fp;
+
+  if ((fp = fopen(file, "rb")) == NULL) {
+    perror(file);
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  // uint32_t keeps the tables aligned
+  buf = malloc(size + sizeof(uint32_t));
+  if (buf == NULL || fread(buf, 1, size, fp) != (size_t)size) {
+    perror(file);
+    return 1;
+  }
+  fclose(fp);
+  if ((why = bundle_check(buf, size)) != NULL) {
+    fprintf(stderr, "%s: invalid: %s\n", file, why);
+    free(buf);
+    return 1;
+  }
+  hdr = (const tai_bundle_header_t *)buf;
+  modules = bundle_modules(hdr);
+  entries = bundle_entries(hdr);
+  for (int i = 0; i < hdr->num_modules; i++) {
+    printf("module %s 0x%08X\n", modules[i].name, modules[i].nid);
+  }
+  for (uint32_t i = 0; i < hdr->num_entries; i++) {
+    if (entries[i].op == TAI_BUNDLE_HOOK) {
+      printf("hook ");
+      print_loc(modules, &entries[i].target);
+      printf(" ");
+      print_loc(modules, &entries[i].hook);
+      printf("\n");
+    } else {
+      printf("inject ");
+      print_loc(modules, &entries[i].target);
+      printf(" %u bytes at 0x%X\n", entries[i].data_size, entries[i].data_offset);
+    }
+  }
+  printf("%s: valid, %ld bytes\n", file, size);
+  free(buf);
+  return 0;
+}
+
+int main(int argc, const char *argv[]) {
+  if (argc == 4 && strcmp(argv[1], "build") == 0) {
+    return build(argv[2], argv[3]);
+  } else if (argc == 3 && strcmp(argv[1], "check") == 0) {
+    return check(argv[2]);
+  }
+  fprintf(stderr, "usage: %s build <spec.txt> <out.bin>\n"
+                  "       %s check <bundle.bin>\n", argv[0], argv[0]);
+  return 2;
+}
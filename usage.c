@@ -0,0 +1,319 @@
+/* usage.c -- persisted usage history
+ *
+ * Copyright (C) 2016 Yifan Lu
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include <psp2kern/types.h>
+#include <psp2kern/io/fcntl.h>
+#include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <string.h>
+#include "error.h"
+#include "heap.h"
+#include "taihen_internal.h"
+#include "usage.h"
+
+/** Usage loaded from the file, zero if there was none */
+static usage_record_t g_history;
+
+/** Usage of this boot */
+static usage_record_t g_current;
+
+/** What was last written to the file */
+static usage_record_t g_saved;
+
+/** Lock for saving */
+static SceUID g_usage_lock;
+
+/** Lock for the title slots */
+static SceUID g_titles_lock;
+
+/** Title slots handed out this boot, one bit per slot */
+static uint32_t g_titles_claimed;
+
+/** When the usage file was last written */
+static SceInt64 g_last_save;
+
+/**
+ * @brief      Raises a mark
+ *
+ * @param      mark   The mark
+ * @param[in]  value  The new value
+ */
+static inline void usage_raise(uint32_t *mark, uint32_t value) {
+  uint32_t old;
+
+  old = __atomic_load_n(mark, __ATOMIC_RELAXED);
+  while (value > old && !__atomic_compare_exchange_n(mark, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief      Loads the usage history
+ *
+ *             Must be called before the heaps and the proc map are created.
+ *             A missing or bad file is not an error, the defaults are used.
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int usage_init(void) {
+  SceUID fd;
+  int ret;
+
+  memset(&g_history, 0, sizeof(g_history));
+  memset(&g_current, 0, sizeof(g_current));
+  memset(&g_saved, 0, sizeof(g_saved));
+  g_usage_lock = sceKernelCreateMutexForKernel("tai_usage", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_usage): 0x%08X", g_usage_lock);
+  if (g_usage_lock < 0) {
+    return g_usage_lock;
+  }
+  g_titles_lock = sceKernelCreateMutexForKernel("tai_usage_titles", 0, 0, NULL);
+  LOG("sceKernelCreateMutexForKernel(tai_usage_titles): 0x%08X", g_titles_lock);
+  if (g_titles_lock < 0) {
+    sceKernelDeleteMutexForKernel(g_usage_lock);
+    return g_titles_lock;
+  }
+  g_titles_claimed = 0;
+  g_last_save = sceKernelGetSystemTimeWide() - USAGE_SAVE_INTERVAL;
+  fd = sceIoOpenForDriver(USAGE_FILE, SCE_O_RDONLY, 0);
+  if (fd < 0) {
+    LOG("no usage history: %x", fd);
+    return TAI_SUCCESS;
+  }
+  ret = sceIoReadForDriver(fd, &g_history, sizeof(g_history));
+  sceIoCloseForDriver(fd);
+  if (ret != sizeof(g_history) || g_history.magic != USAGE_MAGIC || g_history.version != USAGE_VERSION) {
+    LOG("ignoring invalid usage history: %x", ret);
+    memset(&g_history, 0, sizeof(g_history));
+  }
+  // titles keep their slots so this boot's usage lines up with the history
+  for (int i = 0; i < USAGE_MAX_TITLES; i++) {
+    g_history.titles[i].titleid[sizeof(g_history.titles[i].titleid) - 1] = '\0';
+    memcpy(g_current.titles[i].titleid, g_history.titles[i].titleid, sizeof(g_current.titles[i].titleid));
+  }
+  return TAI_SUCCESS;
+}
+
+/**
+ * @brief      Frees the locks
+ */
+void usage_deinit(void) {
+  sceKernelDeleteMutexForKernel(g_titles_lock);
+  g_titles_lock = 0;
+  sceKernelDeleteMutexForKernel(g_usage_lock);
+  g_usage_lock = 0;
+}
+
+/**
+ * @brief      Writes the usage history if this boot changed it
+ *
+ *             Each mark is the larger of this boot's usage and three quarters
+ *             of the previous mark.
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int usage_save(void) {
+  tai_heap_stats_t stats;
+  usage_record_t record;
+  SceUID fd;
+  int ret;
+
+  sceKernelLockMutexForKernel(g_usage_lock, 1, NULL);
+  __atomic_store_n(&g_last_save, sceKernelGetSystemTimeWide(), __ATOMIC_RELAXED);
+  for (int i = 0; i < TAI_HEAP_MAX; i++) {
+    stats.size = sizeof(stats);
+    if (heap_get_stats(i, &stats) >= 0) {
+      usage_raise(&g_current.heap_peak[i], stats.peak);
+    }
+  }
+  record.magic = USAGE_MAGIC;
+  record.version = USAGE_VERSION;
+  for (int i = 0; i < TAI_HEAP_MAX; i++) {
+    record.heap_peak[i] = g_history.heap_peak[i] - g_history.heap_peak[i] / 4;
+    usage_raise(&record.heap_peak[i], g_current.heap_peak[i]);
+  }
+  record.pids = g_history.pids - g_history.pids / 4;
+  usage_raise(&record.pids, g_current.pids);
+  sceKernelLockMutexForKernel(g_titles_lock, 1, NULL);
+  for (int i = 0; i < USAGE_MAX_TITLES; i++) {
+    memcpy(record.titles[i].titleid, g_current.titles[i].titleid, sizeof(record.titles[i].titleid));
+    for (int j = 0; j < USAGE_SLAB_MAX; j++) {
+      record.titles[i].slab_pages[j] = g_history.titles[i].slab_pages[j] - g_history.titles[i].slab_pages[j] / 4;
+      usage_raise(&record.titles[i].slab_pages[j], g_current.titles[i].slab_pages[j]);
+    }
+  }
+  sceKernelUnlockMutexForKernel(g_titles_lock, 1);
+  if (memcmp(&record, &g_saved, sizeof(record)) == 0) {
+    ret = TAI_SUCCESS;
+    goto end;
+  }
+  fd = sceIoOpenForDriver(USAGE_FILE, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 6);
+  if (fd < 0) {
+    LOG("failed to open %s: %x", USAGE_FILE, fd);
+    ret = fd;
+    goto end;
+  }
+  ret = sceIoWriteForDriver(fd, &record, sizeof(record));
+  sceIoCloseForDriver(fd);
+  if (ret != sizeof(record)) {
+    LOG("failed to write usage history: %x", ret);
+    ret = (ret < 0) ? ret : TAI_ERROR_SYSTEM;
+    goto end;
+  }
+  memcpy(&g_saved, &record, sizeof(record));
+  ret = TAI_SUCCESS;
+end:
+  sceKernelUnlockMutexForKernel(g_usage_lock, 1);
+  return ret;
+}
+
+/**
+ * @brief      Writes the usage history unless it was written recently
+ *
+ *             For callers that run often, like every title launch. The file
+ *             is written at most once every `USAGE_SAVE_INTERVAL`, marks
+ *             raised in between are written by a later call or by
+ *             `usage_save` at module stop.
+ *
+ * @return     Zero on success, < 0 on error
+ */
+int usage_save_lazy(void) {
+  if (sceKernelGetSystemTimeWide() - __atomic_load_n(&g_last_save, __ATOMIC_RELAXED) < USAGE_SAVE_INTERVAL) {
+    return TAI_SUCCESS;
+  }
+  return usage_save();
+}
+
+/**
+ * @brief      Gets the size to create a heap with
+ *
+ *             A quarter more than the recorded peak, but never less than the
+ *             default.
+ *
+ * @param[in]  heap  The heap
+ * @param[in]  def   The default size
+ *
+ * @return     The size
+ */
+size_t usage_heap_size(tai_heap_t heap, size_t def) {
+  size_t size;
+
+  size = g_history.heap_peak[heap];
+  size = (size + size / 4 + 0xFFF) & ~0xFFF;
+  if (size > USAGE_MAX_HEAP_SIZE) {
+    size = USAGE_MAX_HEAP_SIZE;
+  }
+  return (size > def) ? size : def;
+}
+
+/**
+ * @brief      Gets the number of processes to size the proc map pool for
+ *
+ * @return     Recorded number of processes, zero if unknown
+ */
+size_t usage_pids(void) {
+  return (g_history.pids > USAGE_MAX_PIDS) ? USAGE_MAX_PIDS : g_history.pids;
+}
+
+/**
+ * @brief      Gets the history slot of a process' title
+ *
+ *             A title without a slot takes the slot with the least history
+ *             that no process claimed this boot. Slots stay claimed until
+ *             taiHEN stops, so only `USAGE_MAX_TITLES` titles are tracked per
+ *             boot.
+ *
+ * @param[in]  pid   The process
+ *
+ * @return     The slot, < 0 if the title is not tracked
+ */
+int usage_title(SceUID pid) {
+  char titleid[sizeof(g_current.titles[0].titleid)];
+  uint32_t pages, least;
+  int slot;
+
+  if (pid == KERNEL_PID) {
+    strncpy(titleid, USAGE_KERNEL_TITLE, sizeof(titleid));
+  } else if (sceKernelGetProcessTitleIdForKernel(pid, titleid, sizeof(titleid)) < 0) {
+    return TAI_ERROR_NOT_FOUND;
+  }
+  titleid[sizeof(titleid) - 1] = '\0';
+  sceKernelLockMutexForKernel(g_titles_lock, 1, NULL);
+  slot = -1;
+  for (int i = 0; i < USAGE_MAX_TITLES; i++) {
+    if (strncmp(g_current.titles[i].titleid, titleid, sizeof(titleid)) == 0) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    least = 0xFFFFFFFF;
+    for (int i = 0; i < USAGE_MAX_TITLES; i++) {
+      if (g_titles_claimed & (1 << i)) {
+        continue;
+      }
+      pages = 0;
+      for (int j = 0; j < USAGE_SLAB_MAX; j++) {
+        pages += g_history.titles[i].slab_pages[j];
+      }
+      if (pages < least) {
+        least = pages;
+        slot = i;
+      }
+    }
+    if (slot >= 0) {
+      LOG("usage slot %d is now %s", slot, titleid);
+      memset(&g_history.titles[slot], 0, sizeof(g_history.titles[slot]));
+      memset(&g_current.titles[slot], 0, sizeof(g_current.titles[slot]));
+      memcpy(g_current.titles[slot].titleid, titleid, sizeof(titleid));
+    }
+  }
+  if (slot >= 0) {
+    g_titles_claimed |= 1 << slot;
+  }
+  sceKernelUnlockMutexForKernel(g_titles_lock, 1);
+  return (slot >= 0) ? slot : TAI_ERROR_MEMORY;
+}
+
+/**
+ * @brief      Gets the number of pages to reserve for a new process' slab
+ *
+ * @param[in]  title  Slot of the process' title from `usage_title`
+ * @param[in]  kind   The slab chain
+ *
+ * @return     Number of pages
+ */
+size_t usage_slab_reserve(int title, usage_slab_t kind) {
+  uint32_t pages;
+
+  if (title < 0) {
+    return 0;
+  }
+  pages = g_history.titles[title].slab_pages[kind];
+  return (pages > USAGE_MAX_SLAB_RESERVE) ? USAGE_MAX_SLAB_RESERVE : pages;
+}
+
+/**
+ * @brief      Records the number of processes with patches
+ *
+ * @param[in]  count  The current count
+ */
+void usage_note_pids(uint32_t count) {
+  usage_raise(&g_current.pids, count);
+}
+
+/**
+ * @brief      Records the pages used by a process' slab chain
+ *
+ * @param[in]  title  Slot of the process' title from `usage_title`
+ * @param[in]  kind   The slab chain
+ * @param[in]  pages  Most pages the chain has had
+ */
+void usage_note_slab(int title, usage_slab_t kind, uint32_t pages) {
+  if (title < 0) {
+    return;
+  }
+  usage_raise(&g_current.titles[title].slab_pages[kind], pages);
+}
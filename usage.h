@@ -0,0 +1,92 @@
+/**
+ * @brief      Persisted usage history
+ */
+#ifndef TAI_USAGE_HEADER
+#define TAI_USAGE_HEADER
+
+#include "taihen_internal.h"
+
+/**
+ * @defgroup   usage Usage History
+ * @brief      Sizes pools and slabs from what earlier boots used
+ *
+ * @details    The high-water marks of the heaps, the number of processes
+ *             with patches and the slab pages used by each title are saved to
+ *             a small file. On the next start the heaps and the map pool are
+ *             created large enough for that usage and a new process gets the
+ *             slab pages its title used reserved up front. Marks decay by a
+ *             quarter each boot they are not reached again so a lighter setup
+ *             gives memory back.
+ */
+/** @{ */
+
+/** File the usage history is kept in */
+#define USAGE_FILE "ux0:tai/usage.bin"
+
+/** Identifies a usage file ("TAIU") */
+#define USAGE_MAGIC 0x55494154
+
+/** Usage file format version */
+#define USAGE_VERSION 2
+
+/** Minimum time between writes of the usage file after a title launch in microseconds */
+#define USAGE_SAVE_INTERVAL (60 * 1000 * 1000)
+
+/** Largest heap the history can ask for */
+#define USAGE_MAX_HEAP_SIZE 0x40000
+
+/** Most processes the map pool is sized for */
+#define USAGE_MAX_PIDS 64
+
+/** Most slab pages reserved per process per chain */
+#define USAGE_MAX_SLAB_RESERVE 4
+
+/** Number of titles with a slab history */
+#define USAGE_MAX_TITLES 16
+
+/** Title slab usage of `KERNEL_PID` is recorded under */
+#define USAGE_KERNEL_TITLE "kernel"
+
+/**
+ * @brief      Slab chains of a process
+ */
+typedef enum {
+  USAGE_SLAB_EXEC = 0,          ///< libsubstitute trampolines
+  USAGE_SLAB_HOOK,              ///< Hook records
+  USAGE_SLAB_THUNK,             ///< Guard thunks
+  USAGE_SLAB_MAX
+} usage_slab_t;
+
+/**
+ * @brief      Slab usage of a title
+ */
+typedef struct _usage_title {
+  char titleid[32];             ///< The title, empty if the slot is unused
+  uint32_t slab_pages[USAGE_SLAB_MAX]; ///< Most slab pages of one process per chain
+} usage_title_t;
+
+/**
+ * @brief      Contents of the usage file
+ */
+typedef struct _usage_record {
+  uint32_t magic;               ///< `USAGE_MAGIC`
+  uint32_t version;             ///< `USAGE_VERSION`
+  uint32_t heap_peak[TAI_HEAP_MAX]; ///< Most bytes used per heap
+  uint32_t pids;                ///< Most processes with patches at once
+  usage_title_t titles[USAGE_MAX_TITLES]; ///< Slab usage per title
+} usage_record_t;
+
+int usage_init(void);
+void usage_deinit(void);
+int usage_save(void);
+int usage_save_lazy(void);
+size_t usage_heap_size(tai_heap_t heap, size_t def);
+size_t usage_pids(void);
+int usage_title(SceUID pid);
+size_t usage_slab_reserve(int title, usage_slab_t kind);
+void usage_note_pids(uint32_t count);
+void usage_note_slab(int title, usage_slab_t kind, uint32_t pages);
+
+/** @} */
+
+#endif // TAI_USAGE_HEADER